@@ -32,8 +32,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "avl.h"
+#include "avl_internal.h"
 
 avl_node *
 avl_new_avl_node (void *            key,
@@ -48,6 +50,7 @@ avl_new_avl_node (void *            key,
     node->key = key;
     node->left = NULL;
     node->right = NULL;
+    node->rank_and_balance = 0;
     AVL_SET_BALANCE (node, 0);
     AVL_SET_RANK (node, 1);
     return node;
@@ -65,36 +68,426 @@ avl_new_avl_tree (avl_key_compare_fun_type compare_fun,
   } else {
     avl_node * root = avl_new_avl_node((void *)NULL, (avl_node *) NULL);
     if (!root) {
+      free (t);
       return NULL;
     } else {
       t->root = root;
       t->length = 0;
       t->compare_fun = compare_fun;
       t->compare_arg = compare_arg;
+      t->arena = NULL;
+      t->monoid = NULL;
+      t->value_offset = 0;
+      t->free_value_fun = NULL;
       return t;
     }
   }
 }
 
+/* node arenas */
+
+#define AVL_DEFAULT_SLAB_NODES 1024
+#define AVL_FIRST_SLAB_NODES 16
+
+static
+void *
+avl_default_alloc (void * alloc_arg, size_t size)
+{
+  return malloc (size);
+}
+
+static
+void
+avl_default_dealloc (void * alloc_arg, void * block)
+{
+  free (block);
+}
+
+avl_node_arena *
+avl_new_node_arena (unsigned int slab_nodes,
+                    avl_alloc_fun_type alloc_fun,
+                    avl_dealloc_fun_type dealloc_fun,
+                    void * alloc_arg)
+{
+  avl_node_arena * arena;
+
+  if (!alloc_fun != !dealloc_fun) {
+    /* one without the other could never give the slabs back */
+    return NULL;
+  } else if (!alloc_fun) {
+    alloc_fun = avl_default_alloc;
+    dealloc_fun = avl_default_dealloc;
+  }
+  arena = (avl_node_arena *) alloc_fun (alloc_arg, sizeof (avl_node_arena));
+  if (!arena) {
+    return NULL;
+  } else {
+    arena->slabs = NULL;
+    arena->free_list = NULL;
+    arena->bump = arena->bump_end = NULL;
+    arena->slab_nodes = slab_nodes ? slab_nodes : AVL_DEFAULT_SLAB_NODES;
+    arena->next_slab_nodes = AVL_FIRST_SLAB_NODES;
+    if (arena->next_slab_nodes > arena->slab_nodes) {
+      arena->next_slab_nodes = arena->slab_nodes;
+    }
+    arena->node_size = sizeof (avl_node);
+    arena->refcount = 1;
+    arena->alloc_fun = alloc_fun;
+    arena->dealloc_fun = dealloc_fun;
+    arena->alloc_arg = alloc_arg;
+    return arena;
+  }
+}
+
+void
+avl_release_node_arena (avl_node_arena * arena)
+{
+  avl_arena_slab * slab, * next;
+
+  arena->refcount = arena->refcount - 1;
+  if (arena->refcount) {
+    return;
+  }
+  for (slab = arena->slabs; slab; slab = next) {
+    next = slab->next;
+    arena->dealloc_fun (arena->alloc_arg, slab);
+  }
+  arena->dealloc_fun (arena->alloc_arg, arena);
+}
+
+/*
+ * A node is laid out as the avl_node, then the aggregate if there is a
+ * <monoid>, then the value if there are <values>, aligned for a pointer.
+ */
+
+#define AVL_ALIGN_POINTER(n)    (((n) + sizeof (void *) - 1) & ~(sizeof (void *) - 1))
+
+static
+size_t
+avl_value_offset (avl_monoid * monoid)
+{
+  return AVL_ALIGN_POINTER (sizeof (avl_node) + (monoid ? monoid->size : 0));
+}
+
+/* the bytes of a node that mean anything */
+
+static
+size_t
+avl_node_size (avl_monoid * monoid, int values)
+{
+  if (values) {
+    return avl_value_offset (monoid) + sizeof (void *);
+  } else {
+    return sizeof (avl_node) + (monoid ? monoid->size : 0);
+  }
+}
+
+static
+size_t
+avl_tree_node_size (avl_tree * tree)
+{
+  return avl_node_size (tree->monoid, tree->value_offset != 0);
+}
+
+/*
+ * Make sure <arena> hands out nodes of at least <size> bytes.  Its node
+ * size can only change before its first slab.
+ */
+
+static
+int
+avl_arena_fit (avl_node_arena * arena, size_t size)
+{
+  unsigned int node_size = AVL_ALIGN_POINTER (size);
+
+  if (node_size <= arena->node_size) {
+    return 0;
+  } else if (arena->slabs) {
+    return -1;
+  }
+  arena->node_size = node_size;
+  return 0;
+}
+
+int
+avl_tree_use_arena (avl_tree * tree, avl_node_arena * arena)
+{
+  if (tree->length || tree->arena || (avl_arena_fit (arena, avl_tree_node_size (tree)) != 0)) {
+    return -1;
+  }
+  arena->refcount = arena->refcount + 1;
+  tree->arena = arena;
+  return 0;
+}
+
+/*
+ * Copy the nodes under <node> into <to>, parented by <parent>.  On
+ * failure whatever was copied is given back and NULL returned.
+ */
+
+static void avl_drop_nodes (avl_tree * tree, avl_node * node);
+
+static
+avl_node *
+avl_copy_nodes (avl_tree * to, avl_node * node, avl_node * parent)
+{
+  avl_node * copy = avl_new_tree_node (to, node->key, parent);
+
+  if (!copy) {
+    return NULL;
+  }
+  memcpy (copy, node, avl_tree_node_size (to));
+  copy->parent = parent;
+  copy->left = copy->right = NULL;
+  if ((node->left && !(copy->left = avl_copy_nodes (to, node->left, copy)))
+      || (node->right && !(copy->right = avl_copy_nodes (to, node->right, copy)))) {
+    avl_drop_nodes (to, copy);
+    return NULL;
+  }
+  return copy;
+}
+
+/* free the nodes under <node>, leaving their keys and values alone */
+
+static
+void
+avl_drop_nodes (avl_tree * tree, avl_node * node)
+{
+  if (node->left) {
+    avl_drop_nodes (tree, node->left);
+  }
+  if (node->right) {
+    avl_drop_nodes (tree, node->right);
+  }
+  avl_free_tree_node (tree, node);
+}
+
+int
+avl_tree_move_to_arena (avl_tree * tree, avl_node_arena * arena)
+{
+  avl_tree moved = *tree;
+  avl_node * top = NULL;
+
+  if (arena == tree->arena) {
+    return 0;
+  } else if (arena && (avl_arena_fit (arena, avl_tree_node_size (tree)) != 0)) {
+    return -1;
+  }
+  moved.arena = arena;
+  if (tree->length) {
+    top = avl_copy_nodes (&moved, tree->root->right, tree->root);
+    if (!top) {
+      return -1;
+    }
+    /* slabs the tree held the last reference to go away wholesale */
+    if (!(tree->arena && tree->arena->refcount == 1)) {
+      avl_drop_nodes (tree, tree->root->right);
+    }
+  }
+  if (tree->arena) {
+    avl_release_node_arena (tree->arena);
+  }
+  if (arena) {
+    arena->refcount = arena->refcount + 1;
+  }
+  tree->arena = arena;
+  tree->root->right = top;
+  return 0;
+}
+
+/*
+ * The slab header is padded out to a full node, which keeps every
+ * node in the slab aligned like the header itself.
+ */
+
+static
+avl_node *
+avl_arena_alloc_node (avl_node_arena * arena)
+{
+  avl_node * node = arena->free_list;
+
+  if (node) {
+    arena->free_list = node->right;
+    return node;
+  }
+  if (arena->bump == arena->bump_end) {
+    size_t slab_size = (size_t) arena->node_size * (arena->next_slab_nodes + 1);
+    avl_arena_slab * slab =
+      (avl_arena_slab *) arena->alloc_fun (arena->alloc_arg, slab_size);
+    if (!slab) {
+      return NULL;
+    }
+    /* slabs start small and double, so that small trees stay small */
+    if (arena->next_slab_nodes < arena->slab_nodes / 2) {
+      arena->next_slab_nodes = arena->next_slab_nodes * 2;
+    } else {
+      arena->next_slab_nodes = arena->slab_nodes;
+    }
+    slab->next = arena->slabs;
+    arena->slabs = slab;
+    arena->bump = ((char *) slab) + arena->node_size;
+    arena->bump_end = ((char *) slab) + slab_size;
+  }
+  node = (avl_node *) arena->bump;
+  arena->bump = arena->bump + arena->node_size;
+  return node;
+}
+
+avl_node *
+avl_new_tree_node (avl_tree * tree,
+                   void * key,
+                   avl_node * parent)
+{
+  avl_node * node;
+
+  if (tree->arena) {
+    node = avl_arena_alloc_node (tree->arena);
+  } else if (tree->monoid || tree->value_offset) {
+    node = (avl_node *) malloc (avl_tree_node_size (tree));
+  } else {
+    return avl_new_avl_node (key, parent);
+  }
+  if (!node) {
+    return NULL;
+  } else {
+    node->parent = parent;
+    node->key = key;
+    node->left = NULL;
+    node->right = NULL;
+    node->rank_and_balance = 0;
+    if (tree->value_offset) {
+      AVL_NODE_VALUE (tree, node) = NULL;
+    }
+    AVL_SET_BALANCE (node, 0);
+    AVL_SET_RANK (node, 1);
+    return node;
+  }
+}
+
+void
+avl_free_tree_node (avl_tree * tree, avl_node * node)
+{
+  if (tree->arena) {
+    node->right = tree->arena->free_list;
+    tree->arena->free_list = node;
+  } else {
+    free (node);
+  }
+}
+
+/* aggregates */
+
+int
+avl_tree_use_monoid (avl_tree * tree, avl_monoid * monoid)
+{
+  int values = tree->value_offset != 0;
+
+  if (tree->length
+      || (tree->arena && (avl_arena_fit (tree->arena, avl_node_size (monoid, values)) != 0))) {
+    return -1;
+  }
+  tree->monoid = monoid;
+  if (values) {
+    tree->value_offset = avl_value_offset (monoid);
+  }
+  return 0;
+}
+
+int
+avl_tree_use_values (avl_tree * tree, avl_free_key_fun_type free_value_fun)
+{
+  if (tree->length
+      || (tree->arena && (avl_arena_fit (tree->arena, avl_node_size (tree->monoid, 1)) != 0))) {
+    return -1;
+  }
+  tree->value_offset = avl_value_offset (tree->monoid);
+  tree->free_value_fun = free_value_fun;
+  return 0;
+}
+
+/* recompute the aggregate of <node> from its key and children */
+
+static
+void
+avl_augment_node (avl_tree * tree, avl_node * node)
+{
+  avl_monoid * m = tree->monoid;
+  void * aggregate = AVL_NODE_AGGREGATE (node);
+
+  m->identity (m->monoid_arg, aggregate);
+  if (node->left) {
+    m->append (m->monoid_arg, aggregate, AVL_NODE_AGGREGATE (node->left));
+  }
+  m->append_key (m->monoid_arg, aggregate, node->key);
+  if (node->right) {
+    m->append (m->monoid_arg, aggregate, AVL_NODE_AGGREGATE (node->right));
+  }
+}
+
+/*
+ * Recompute the aggregates from <node> up to the top of its tree (the
+ * last node with a parent, so that the head is left alone).
+ */
+
+static
+void
+avl_augment_path (avl_tree * tree, avl_node * node)
+{
+  if (!tree->monoid) {
+    return;
+  }
+  while (node && node->parent) {
+    avl_augment_node (tree, node);
+    node = node->parent;
+  }
+}
+
+void
+avl_update_aggregates (avl_tree * tree, avl_node * node)
+{
+  avl_augment_path (tree, node);
+}
+
 static
 void
-free_avl_tree_helper (avl_node * node, avl_free_key_fun_type free_key_fun)
+free_avl_tree_helper (avl_tree * tree,
+                      avl_node * node,
+                      avl_free_key_fun_type free_key_fun,
+                      int free_nodes)
 {
   if (node->left) {
-    free_avl_tree_helper (node->left, free_key_fun);
+    free_avl_tree_helper (tree, node->left, free_key_fun, free_nodes);
+  }
+  if (free_key_fun) {
+    free_key_fun (node->key);
+  }
+  if (tree->value_offset && tree->free_value_fun) {
+    tree->free_value_fun (AVL_NODE_VALUE (tree, node));
   }
-  free_key_fun (node->key);
   if (node->right) {
-    free_avl_tree_helper (node->right, free_key_fun);
+    free_avl_tree_helper (tree, node->right, free_key_fun, free_nodes);
+  }
+  if (free_nodes) {
+    avl_free_tree_node (tree, node);
   }
-  free (node);
 }
 
 void
 avl_free_avl_tree (avl_tree * tree, avl_free_key_fun_type free_key_fun)
 {
-  if (tree->length) {
-    free_avl_tree_helper (tree->root->right, free_key_fun);
+  avl_node_arena * arena = tree->arena;
+
+  /*
+   * If we hold the last reference to the arena, its slabs go away
+   * wholesale and the nodes need not be visited one by one.
+   */
+  int free_nodes = !(arena && arena->refcount == 1);
+
+  if (tree->length && (free_nodes || free_key_fun || (tree->value_offset && tree->free_value_fun))) {
+    free_avl_tree_helper (tree, tree->root->right, free_key_fun, free_nodes);
+  }
+  if (arena) {
+    avl_release_node_arena (arena);
   }
   if (tree->root) {
     free (tree->root);
@@ -102,103 +495,191 @@ avl_free_avl_tree (avl_tree * tree, avl_free_key_fun_type free_key_fun)
   free (tree);
 }
 
+static int avl_insert_node (avl_tree * ob,
+                            void * key,
+                            void * value,
+                            unsigned int * index,
+                            avl_node ** existing);
+
 int
 avl_insert_by_key (avl_tree * ob,
                    void * key,
                    unsigned int * index
                    )
+{
+  return avl_insert_node (ob, key, NULL, index, NULL);
+}
+
+int
+avl_insert_kv (avl_tree * ob,
+               void * key,
+               void * value,
+               unsigned int * index
+               )
+{
+  if (!ob->value_offset) {
+    return -1;
+  }
+  return avl_insert_node (ob, key, value, index, NULL);
+}
+
+int
+avl_insert_unique (avl_tree * tree,
+                   void * key,
+                   unsigned int * index,
+                   void ** value_address)
+{
+  avl_node * existing;
+  int result = avl_insert_node (tree, key, NULL, index, &existing);
+
+  if (result == 1) {
+    *value_address = existing->key;
+  }
+  return result;
+}
+
+int
+avl_upsert (avl_tree * tree,
+            void * key,
+            void * value,
+            unsigned int * index)
+{
+  avl_node * existing;
+  int result;
+
+  if (!tree->value_offset) {
+    return -1;
+  }
+  result = avl_insert_node (tree, key, value, index, &existing);
+  if (result == 1) {
+    void * old_value = AVL_NODE_VALUE (tree, existing);
+    AVL_NODE_VALUE (tree, existing) = value;
+    if (tree->free_value_fun) {
+      tree->free_value_fun (old_value);
+    }
+  }
+  return result;
+}
+
+/*
+ * Insert a node for <key>.  The descent only reads the tree, recording
+ * its turns; ranks and balances are updated once the new node is in.
+ * If <existing> is not NULL, an item comparing equal to <key> ends the
+ * descent, and is returned there (with 1) instead.
+ */
+
+static
+int
+avl_insert_node (avl_tree * ob,
+                 void * key,
+                 void * value,
+                 unsigned int * index,
+                 avl_node ** existing)
 {
   if (!(ob->root->right)) {
-    avl_node * node = avl_new_avl_node (key, ob->root);
+    avl_node * node = avl_new_tree_node (ob, key, ob->root);
     if (!node) {
       return -1;
     } else {
+      if (ob->value_offset) {
+        AVL_NODE_VALUE (ob, node) = value;
+      }
       ob->root->right = node;
       ob->length = ob->length + 1;
+      avl_augment_path (ob, node);
+      *index = 0;
       return 0;
     }
   } else { /* not self.right == None */
-    avl_node *t, *p, *s, *q, *r;
+    avl_node *t, *p, *s, *q, *r, *x;
     int a;
+    /*
+     * Bit <d> of <path> is set if the descent went right at depth <d>,
+     * so that each key is compared only once on the way down.  An AVL
+     * tree of 2^32 items is under 48 levels deep.
+     */
+    unsigned long long path = 0;
+    unsigned int depth = 0, s_depth = 0;
     *index = 0;
 
     t = ob->root;
     s = p = t->right;
 
     while (1) {
-      if (ob->compare_fun (ob->compare_arg, key, p->key) < 1) {
+      int compare_result = ob->compare_fun (ob->compare_arg, key, p->key);
+      if (existing && (compare_result == 0)) {
+        *existing = p;
+        *index += AVL_GET_RANK (p) - 1;
+        return 1;
+      }
+      if (compare_result < 1) {
         /* move left */
-        AVL_SET_RANK (p, (AVL_GET_RANK (p) + 1));
         q = p->left;
-        if (!q) {
-          /* insert */
-          avl_node * q_node = avl_new_avl_node (key, p);
-          if (!q_node) {
-            return (-1);
-          } else {
-            q = q_node;
-            p->left = q;
-            break;
-          }
-        } else if (AVL_GET_BALANCE(q)) {
-          t = p;
-          s = q;
-        }
-        p = q;
       } else {
         /* move right */
+        path |= 1ULL << depth;
         q = p->right;
         *index += AVL_GET_RANK(p);
-        if (!q) {
-          /* insert */
-          avl_node * q_node = avl_new_avl_node (key, p);
-          if (!q_node) {
-            return -1;
-          } else {
-            q = q_node;
-            p->right = q;
-            break;
-          }
-        } else if (AVL_GET_BALANCE(q)) {
-          t = p;
-          s = q;
-        }
-        p = q;
       }
+      if (!q) {
+        break;
+      } else if (AVL_GET_BALANCE(q)) {
+        t = p;
+        s = q;
+        s_depth = depth + 1;
+      }
+      p = q;
+      depth = depth + 1;
     }
 
-    ob->length = ob->length + 1;
-
-    /* adjust balance factors */
-    if (ob->compare_fun (ob->compare_arg, key, s->key) < 1) {
-      r = p = s->left;
+    /* insert */
+    q = avl_new_tree_node (ob, key, p);
+    if (!q) {
+      return -1;
+    }
+    if (ob->value_offset) {
+      AVL_NODE_VALUE (ob, q) = value;
+    }
+    if (path & (1ULL << depth)) {
+      p->right = q;
     } else {
-      r = p = s->right;
+      p->left = q;
     }
-    while (p != q) {
-      if (ob->compare_fun (ob->compare_arg, key, p->key) < 1) {
-        AVL_SET_BALANCE (p, -1);
-        p = p->left;
-      } else {
-        AVL_SET_BALANCE (p, +1);
-        p = p->right;
+    /* every node we went left at has one more item on its left */
+    for (x = q; x != ob->root->right; x = x->parent) {
+      if (x->parent->left == x) {
+        AVL_SET_RANK (x->parent, (AVL_GET_RANK (x->parent) + 1));
       }
     }
 
-    /* balancing act */
+    ob->length = ob->length + 1;
 
-    if (ob->compare_fun (ob->compare_arg, key, s->key) < 1) {
-      a = -1;
-    } else {
+    /* adjust balance factors, retracing the path from <s> */
+    if (path & (1ULL << s_depth)) {
       a = +1;
+      r = p = s->right;
+    } else {
+      a = -1;
+      r = p = s->left;
+    }
+    depth = s_depth + 1;
+    while (p != q) {
+      if (path & (1ULL << depth)) {
+        AVL_SET_BALANCE (p, +1);
+        p = p->right;
+      } else {
+        AVL_SET_BALANCE (p, -1);
+        p = p->left;
+      }
+      depth = depth + 1;
     }
 
+    /* balancing act */
+
     if (AVL_GET_BALANCE (s) == 0) {
       AVL_SET_BALANCE (s, a);
-      return 0;
     } else if (AVL_GET_BALANCE (s) == -a) {
       AVL_SET_BALANCE (s, 0);
-      return 0;
     } else if (AVL_GET_BALANCE(s) == a) {
       if (AVL_GET_BALANCE (r) == a) {
         /* single rotation */
@@ -277,6 +758,12 @@ avl_insert_by_key (avl_tree * ob,
       }
       p->parent = t;
     }
+    if (ob->monoid) {
+      /* a rotation may have moved <s> or <r> off the path to <q> */
+      avl_augment_node (ob, s);
+      avl_augment_node (ob, r);
+      avl_augment_path (ob, q);
+    }
   }
   return 0;
 }
@@ -334,62 +821,129 @@ avl_get_item_by_key (avl_tree * tree,
   }
 }
 
+/* map mode */
+
+static
+avl_node *
+avl_get_first_node_by_key (avl_tree * tree, void * key)
+{
+  avl_cursor cursor;
+
+  avl_cursor_init (&cursor, tree);
+  if ((avl_cursor_seek_key (&cursor, key) == 0)
+      && (tree->compare_fun (tree->compare_arg, key, cursor.node->key) == 0)) {
+    return cursor.node;
+  } else {
+    return NULL;
+  }
+}
+
+int
+avl_get_value_by_key (avl_tree * tree,
+                      void * key,
+                      void ** value_address)
+{
+  avl_node * x;
+
+  if (!tree->value_offset || !(x = avl_get_first_node_by_key (tree, key))) {
+    return -1;
+  }
+  *value_address = AVL_NODE_VALUE (tree, x);
+  return 0;
+}
+
+int
+avl_get_value_by_index (avl_tree * tree,
+                        unsigned int index,
+                        void ** value_address)
+{
+  avl_cursor cursor;
+
+  if (!tree->value_offset) {
+    return -1;
+  }
+  avl_cursor_init (&cursor, tree);
+  if (avl_cursor_seek_index (&cursor, index) != 0) {
+    return -1;
+  }
+  *value_address = AVL_NODE_VALUE (tree, cursor.node);
+  return 0;
+}
+
+int
+avl_set_value_by_key (avl_tree * tree,
+                      void * key,
+                      void * value)
+{
+  avl_node * x;
+  void * old_value;
+
+  if (!tree->value_offset || !(x = avl_get_first_node_by_key (tree, key))) {
+    return -1;
+  }
+  old_value = AVL_NODE_VALUE (tree, x);
+  AVL_NODE_VALUE (tree, x) = value;
+  if (tree->free_value_fun) {
+    tree->free_value_fun (old_value);
+  }
+  return 0;
+}
+
+static int avl_remove_node (avl_tree * tree,
+                            avl_node * x,
+                            avl_free_key_fun_type free_key_fun);
+
 int
 avl_remove_by_key (avl_tree * tree,
                    void * key,
                    avl_free_key_fun_type free_key_fun)
 {
-  avl_node *x, *y, *p, *q, *r, *top, *x_child;
-  int shortened_side, shorter;
+  avl_node *x, *y;
 
   x = tree->root->right;
   if (!x) {
     return -1;
   }
-  /* find the node to remove */
+  /* find the node to remove, without touching the tree */
   while (1) {
     int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
     if (compare_result < 0) {
-      /* move left
-       * We will be deleting from the left, adjust this node's
-       * rank accordingly
-       */
-      AVL_SET_RANK (x, (AVL_GET_RANK(x) - 1));
-      if (x->left) {
-        x = x->left;
-      } else {
-        /* Oops! now we have to undo the rank changes
-         * all the way up the tree
-         */
-        AVL_SET_RANK(x, (AVL_GET_RANK (x) + 1));
-        while (x != tree->root->right) {
-          if (x->parent->left == x) {
-            AVL_SET_RANK(x->parent, (AVL_GET_RANK (x->parent) + 1));
-          }
-          x = x->parent;
-        }
-        return -1;              /* key not in tree */
-      }
+      x = x->left;
     } else if (compare_result > 0) {
-      /* move right */
-      if (x->right) {
-        x = x->right;
-      } else {
-        while (x != tree->root->right) {
-          if (x->parent->left == x) {
-            AVL_SET_RANK(x->parent, (AVL_GET_RANK (x->parent) + 1));
-          }
-          x = x->parent;
-        }
-        return -1;              /* key not in tree */
-      }
+      x = x->right;
     } else {
       break;
     }
+    if (!x) {
+      return -1;              /* key not in tree */
+    }
+  }
+  /* each node it lies to the left of loses one item from that side */
+  for (y = x; y != tree->root->right; y = y->parent) {
+    if (y->parent->left == y) {
+      AVL_SET_RANK (y->parent, (AVL_GET_RANK (y->parent) - 1));
+    }
   }
+  return avl_remove_node (tree, x, free_key_fun);
+}
+
+/*
+ * Remove node <x> from the tree and rebalance.  The ranks on the path
+ * down to <x> must already have been adjusted for its removal.
+ */
+
+static
+int
+avl_remove_node (avl_tree * tree,
+                 avl_node * x,
+                 avl_free_key_fun_type free_key_fun)
+{
+  avl_node *y, *p, *q, *r, *top, *x_child, *start;
+  int shortened_side, shorter;
 
   if (x->left && x->right) {
     void * temp_key;
+    void * temp_value;
 
     /* The complicated case.
      * reduce this to the simple case where we are deleting
@@ -405,6 +959,11 @@ avl_remove_by_key (avl_tree * tree,
     temp_key = x->key;
     x->key = y->key;
     y->key = temp_key;
+    if (tree->value_offset) {
+      temp_value = AVL_NODE_VALUE (tree, x);
+      AVL_NODE_VALUE (tree, x) = AVL_NODE_VALUE (tree, y);
+      AVL_NODE_VALUE (tree, y) = temp_value;
+    }
     /* we know <x>'s left subtree lost a node because that's
      * where we took it from
      */
@@ -440,11 +999,14 @@ avl_remove_by_key (avl_tree * tree,
    * for the change.
    */
   shorter = 1;
-  p = x->parent;
+  p = start = x->parent;
 
-  /* return the key and node to storage */
+  /* return the key, value and node to storage */
   free_key_fun (x->key);
-  free (x);
+  if (tree->value_offset && tree->free_value_fun) {
+    tree->free_value_fun (AVL_NODE_VALUE (tree, x));
+  }
+  avl_free_tree_node (tree, x);
 
   while (shorter && p->parent) {
 
@@ -581,6 +1143,10 @@ avl_remove_by_key (avl_tree * tree,
           AVL_SET_BALANCE (p, 0);
         }
         AVL_SET_BALANCE (r, 0);
+        if (tree->monoid) {
+          /* <q> is the one node moved off the path */
+          avl_augment_node (tree, q);
+        }
         q = r;
       }
       /* a rotation has caused <q> (or <r> in case 3c) to become
@@ -605,6 +1171,7 @@ avl_remove_by_key (avl_tree * tree,
   } /* end while(shorter) */
   /* when we're all done, we're one shorter */
   tree->length = tree->length - 1;
+  avl_augment_path (tree, start);
   return (0);
 }
 
@@ -671,308 +1238,1504 @@ avl_get_predecessor (avl_node * node)
   }
 }
 
-avl_node *
-avl_get_successor (avl_node * node)
+avl_node *
+avl_get_successor (avl_node * node)
+{
+  if (node->right) {
+    node = node->right;
+    while (node->left) {
+      node = node->left;
+    }
+    return node;
+  } else {
+    avl_node * child = node;
+    while (node->parent) {
+      node = node->parent;
+      if (child == node->left) {
+        return node;
+      }
+      child = node;
+    }
+    return node;
+  }
+}
+
+/* cursors */
+
+void
+avl_cursor_init (avl_cursor * cursor, avl_tree * tree)
+{
+  cursor->tree = tree;
+  cursor->node = NULL;
+  cursor->index = tree->length;
+}
+
+/* leave the cursor past the end of the tree */
+
+static
+int
+avl_cursor_past_end (avl_cursor * cursor)
+{
+  cursor->node = NULL;
+  cursor->index = cursor->tree->length;
+  return -1;
+}
+
+int
+avl_cursor_seek_first (avl_cursor * cursor)
+{
+  avl_node * x = cursor->tree->root->right;
+
+  if (!x) {
+    return avl_cursor_past_end (cursor);
+  }
+  while (x->left) {
+    x = x->left;
+  }
+  cursor->node = x;
+  cursor->index = 0;
+  return 0;
+}
+
+int
+avl_cursor_seek_last (avl_cursor * cursor)
+{
+  avl_node * x = cursor->tree->root->right;
+
+  if (!x) {
+    return avl_cursor_past_end (cursor);
+  }
+  while (x->right) {
+    x = x->right;
+  }
+  cursor->node = x;
+  cursor->index = cursor->tree->length - 1;
+  return 0;
+}
+
+int
+avl_cursor_seek_index (avl_cursor * cursor, unsigned int index)
+{
+  avl_node * p = cursor->tree->root->right;
+  unsigned int m = index + 1;
+
+  if (index >= cursor->tree->length) {
+    return avl_cursor_past_end (cursor);
+  }
+  while (1) {
+    if (m < AVL_GET_RANK (p)) {
+      p = p->left;
+    } else if (m > AVL_GET_RANK (p)) {
+      m = m - AVL_GET_RANK (p);
+      p = p->right;
+    } else {
+      cursor->node = p;
+      cursor->index = index;
+      return 0;
+    }
+  }
+}
+
+int
+avl_cursor_seek_key (avl_cursor * cursor, void * key)
+{
+  avl_tree * tree = cursor->tree;
+  avl_node * x = tree->root->right;
+  unsigned int m = 0;
+
+  cursor->node = NULL;
+  cursor->index = tree->length;
+  while (x) {
+    if (tree->compare_fun (tree->compare_arg, key, x->key) <= 0) {
+      /* a candidate; but there may be an earlier one to the left */
+      cursor->node = x;
+      cursor->index = m + AVL_GET_RANK (x) - 1;
+      x = x->left;
+    } else {
+      m = m + AVL_GET_RANK (x);
+      x = x->right;
+    }
+  }
+  return cursor->node ? 0 : -1;
+}
+
+int
+avl_cursor_next (avl_cursor * cursor)
+{
+  if (!cursor->node) {
+    if (cursor->index == (unsigned int) -1) {
+      return avl_cursor_seek_first (cursor);
+    }
+    return -1;
+  }
+  cursor->node = avl_get_successor (cursor->node);
+  cursor->index = cursor->index + 1;
+  if (cursor->node == cursor->tree->root) {
+    cursor->node = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int
+avl_cursor_prev (avl_cursor * cursor)
+{
+  if (!cursor->node) {
+    if (cursor->index == cursor->tree->length) {
+      return avl_cursor_seek_last (cursor);
+    }
+    return -1;
+  }
+  if (cursor->index == 0) {
+    cursor->node = NULL;
+    cursor->index = (unsigned int) -1;
+    return -1;
+  }
+  cursor->node = avl_get_predecessor (cursor->node);
+  cursor->index = cursor->index - 1;
+  return 0;
+}
+
+int
+avl_cursor_get (avl_cursor * cursor, void ** value_address)
+{
+  if (!cursor->node) {
+    return -1;
+  }
+  *value_address = cursor->node->key;
+  return 0;
+}
+
+/* iterate a function over a range of indices, using avl_get_predecessor */
+
+int
+avl_iterate_index_range (avl_tree * tree,
+                         avl_iter_index_fun_type iter_fun,
+                         unsigned int low,
+                         unsigned int high,
+                         void * iter_arg)
+{
+  unsigned int m;
+  unsigned int num_left;
+  avl_node * node;
+
+  if (high > tree->length) {
+    return -1;
+  }
+  num_left = (high - low);
+  /* find the <high-1>th node */
+  m = high;
+  node = tree->root->right;
+  while (1) {
+    if (m < AVL_GET_RANK (node)) {
+      node = node->left;
+    } else if (m > AVL_GET_RANK (node)) {
+      m = m - AVL_GET_RANK (node);
+      node = node->right;
+    } else {
+      break;
+    }
+  }
+  /* call <iter_fun> on <node>, <get_pred(node)>, ... */
+  while (num_left) {
+    num_left = num_left - 1;
+    if (iter_fun (num_left, node->key, iter_arg) != 0) {
+      return -1;
+    }
+    node = avl_get_predecessor (node);
+  }
+  return 0;
+}
+
+/*
+ * The index of the first item ordering at or after <key> (lower bound),
+ * or of the first one ordering after it (upper bound); <length> if
+ * there is none.  Each is a single descent, however many items compare
+ * equal to <key>.
+ */
+
+static
+unsigned int
+avl_bound_index (avl_tree * tree, void * key, int upper)
+{
+  avl_node * p = tree->root->right;
+  unsigned int base = 0, result = tree->length;
+
+  while (p) {
+    int compare_result = tree->compare_fun (tree->compare_arg, key, p->key);
+    if (upper ? (compare_result < 0) : (compare_result <= 0)) {
+      result = base + AVL_GET_RANK (p) - 1;
+      p = p->left;
+    } else {
+      base = base + AVL_GET_RANK (p);
+      p = p->right;
+    }
+  }
+  return result;
+}
+
+unsigned int
+avl_lower_bound_index (avl_tree * tree, void * key)
+{
+  return avl_bound_index (tree, key, 0);
+}
+
+unsigned int
+avl_upper_bound_index (avl_tree * tree, void * key)
+{
+  return avl_bound_index (tree, key, 1);
+}
+
+/* return the (low index, high index) pair that spans the given key */
+
+int
+avl_get_span_by_key (avl_tree * tree,
+                     void * key,
+                     unsigned int * low,
+                     unsigned int * high)
+{
+  *low = avl_bound_index (tree, key, 0);
+  *high = avl_bound_index (tree, key, 1);
+  return 0;
+}
+
+/* return the (low index, high index) pair that spans the given keys */
+
+int
+avl_get_span_by_two_keys (avl_tree * tree,
+                          void * low_key,
+                          void * high_key,
+                          unsigned int * low,
+                          unsigned int * high)
+{
+  /* we may need to swap them */
+  if (tree->compare_fun (tree->compare_arg, low_key, high_key) > 0) {
+    void * temp = low_key;
+    low_key = high_key;
+    high_key = temp;
+  }
+  *low = avl_bound_index (tree, low_key, 0);
+  *high = avl_bound_index (tree, high_key, 1);
+  return 0;
+}
+
+/*
+ * Range folds.  Below the node where the range divides, one side needs
+ * only the items from some index on and the other only those before
+ * some index, so each level adds at most a key and a whole subtree.
+ */
+
+static
+void
+avl_fold_from (avl_tree * tree, avl_node * p, unsigned int low, void * aggregate)
+{
+  avl_monoid * m = tree->monoid;
+
+  while (p) {
+    if (low < AVL_GET_RANK (p)) {
+      avl_fold_from (tree, p->left, low, aggregate);
+      m->append_key (m->monoid_arg, aggregate, p->key);
+      if (p->right) {
+        m->append (m->monoid_arg, aggregate, AVL_NODE_AGGREGATE (p->right));
+      }
+      return;
+    }
+    low = low - AVL_GET_RANK (p);
+    p = p->right;
+  }
+}
+
+static
+void
+avl_fold_before (avl_tree * tree, avl_node * p, unsigned int high, void * aggregate)
+{
+  avl_monoid * m = tree->monoid;
+
+  while (p) {
+    if (high < AVL_GET_RANK (p)) {
+      p = p->left;
+    } else {
+      if (p->left) {
+        m->append (m->monoid_arg, aggregate, AVL_NODE_AGGREGATE (p->left));
+      }
+      m->append_key (m->monoid_arg, aggregate, p->key);
+      high = high - AVL_GET_RANK (p);
+      p = p->right;
+    }
+  }
+}
+
+int
+avl_fold_index_range (avl_tree * tree,
+                      unsigned int low,
+                      unsigned int high,
+                      void * aggregate)
+{
+  avl_monoid * m = tree->monoid;
+  avl_node * p = tree->root->right;
+
+  if (!m) {
+    return -1;
+  }
+  m->identity (m->monoid_arg, aggregate);
+  if (high > tree->length) {
+    high = tree->length;
+  }
+  if (low >= high) {
+    return 0;
+  }
+  /* find the node where the range divides */
+  while (1) {
+    if (high < AVL_GET_RANK (p)) {
+      p = p->left;
+    } else if (low >= AVL_GET_RANK (p)) {
+      low = low - AVL_GET_RANK (p);
+      high = high - AVL_GET_RANK (p);
+      p = p->right;
+    } else {
+      avl_fold_from (tree, p->left, low, aggregate);
+      m->append_key (m->monoid_arg, aggregate, p->key);
+      avl_fold_before (tree, p->right, high - AVL_GET_RANK (p), aggregate);
+      return 0;
+    }
+  }
+}
+
+int
+avl_fold_key_range (avl_tree * tree,
+                    void * low_key,
+                    void * high_key,
+                    void * aggregate)
+{
+  return avl_fold_index_range (
+    tree,
+    avl_bound_index (tree, low_key, 0),
+    avl_bound_index (tree, high_key, 1),
+    aggregate
+    );
+}
+
+
+int
+avl_get_item_by_key_most (avl_tree * tree,
+                          void * key,
+                          void **value_address)
+{
+  avl_node * x = tree->root->right;
+  *value_address = NULL;
+
+  if (!x) {
+    return -1;
+  }
+  while (1) {
+    int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
+
+    if (compare_result == 0) {
+      *value_address = x->key;
+      return 0;
+    } else if (compare_result < 0) {
+      /* the given key is less than the current key */
+      if (x->left) {
+        x = x->left;
+      } else {
+        if (*value_address)
+          return 0;
+        else
+          return -1;
+      }
+    } else {
+      /* the given key is more than the current key */
+      /* save this value, it might end up being the right one! */
+      *value_address = x->key;
+      if (x->right) {
+        /* there is a bigger entry */
+        x = x->right;
+      } else {
+        if (*value_address)
+          return 0;
+        else
+          return -1;
+      }
+    }
+  }
+}
+
+int
+avl_get_item_by_key_least (avl_tree * tree,
+                           void * key,
+                           void **value_address)
+{
+  avl_node * x = tree->root->right;
+  *value_address = NULL;
+
+  if (!x) {
+    return -1;
+  }
+  while (1) {
+    int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
+    if (compare_result == 0) {
+      *value_address = x->key;
+      return 0;  /* exact match */
+    } else if (compare_result < 0) {
+      /* the given key is less than the current key */
+      /* save this value, it might end up being the right one! */
+      *value_address = x->key;
+      if (x->left) {
+        x = x->left;
+      } else {
+        if (*value_address)  /* we have found a valid entry */
+          return 0;
+        else
+          return -1;
+      }
+    } else {
+      if (x->right) {
+        /* there is a bigger entry */
+        x = x->right;
+      } else {
+        if (*value_address)  /* we have found a valid entry */
+          return 0;
+        else
+          return -1;
+      }
+    }
+  }
+}
+
+#define MAX(X, Y)  ((X) > (Y) ? (X) : (Y))
+
+/*
+ * Join and split.
+ *
+ * These work on detached subtrees, each described by its root node
+ * (whose parent pointer is meaningless), its node count and its
+ * height.  Heights are not stored in the nodes, but the height of a
+ * subtree can be found in O(log n) by following the taller side, and
+ * the heights of children follow from their parent's height and
+ * balance factor.  Likewise the size of a right subtree is the size of
+ * its parent less the parent's rank.
+ *
+ * Rebalancing is done underneath a temporary 'head' node, playing the
+ * part that tree->root plays for a whole tree, so that a rotation at
+ * the top of a subtree can relink it like any other.
+ */
+
+static
+int
+avl_node_height (avl_node * node)
+{
+  int height = 0;
+  while (node) {
+    height = height + 1;
+    if (AVL_GET_BALANCE (node) < 0) {
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return height;
+}
+
+/*
+ * Single rotations.  These fix up child links, parent pointers, ranks
+ * and aggregates, but leave the balance factors to the caller.  <p>
+ * must have a parent.
+ */
+
+static
+avl_node *
+avl_rotate_left (avl_tree * tree, avl_node * p)
+{
+  avl_node * q = p->right;
+  avl_node * top = p->parent;
+
+  p->right = q->left;
+  if (q->left) {
+    q->left->parent = p;
+  }
+  q->left = p;
+  q->parent = top;
+  p->parent = q;
+  if (top->left == p) {
+    top->left = q;
+  } else {
+    top->right = q;
+  }
+  AVL_SET_RANK (q, (AVL_GET_RANK (q) + AVL_GET_RANK (p)));
+  if (tree->monoid) {
+    avl_augment_node (tree, p);
+    avl_augment_node (tree, q);
+  }
+  return q;
+}
+
+static
+avl_node *
+avl_rotate_right (avl_tree * tree, avl_node * p)
+{
+  avl_node * q = p->left;
+  avl_node * top = p->parent;
+
+  p->left = q->right;
+  if (q->right) {
+    q->right->parent = p;
+  }
+  q->right = p;
+  q->parent = top;
+  p->parent = q;
+  if (top->left == p) {
+    top->left = q;
+  } else {
+    top->right = q;
+  }
+  AVL_SET_RANK (p, (AVL_GET_RANK (p) - AVL_GET_RANK (q)));
+  if (tree->monoid) {
+    avl_augment_node (tree, p);
+    avl_augment_node (tree, q);
+  }
+  return q;
+}
+
+/*
+ * <p> is out of balance by <balance> (+2 or -2, which cannot be
+ * stored in the node).  Rotate to fix it, and return the new root
+ * of the subtree.  If that root has a balance factor of zero, the
+ * subtree is now one shorter than it was out of balance; otherwise
+ * its height is unchanged.
+ */
+
+static
+avl_node *
+avl_rebalance (avl_tree * tree, avl_node * p, int balance)
+{
+  avl_node * q, * r;
+  int qb, rb;
+
+  if (balance > 0) {
+    q = p->right;
+    qb = AVL_GET_BALANCE (q);
+    if (qb < 0) {
+      /* double rotation */
+      r = q->left;
+      rb = AVL_GET_BALANCE (r);
+      avl_rotate_right (tree, q);
+      avl_rotate_left (tree, p);
+      AVL_SET_BALANCE (p, ((rb > 0) ? -1 : 0));
+      AVL_SET_BALANCE (q, ((rb < 0) ? +1 : 0));
+      AVL_SET_BALANCE (r, 0);
+      return r;
+    } else {
+      avl_rotate_left (tree, p);
+      AVL_SET_BALANCE (p, ((qb == 0) ? +1 : 0));
+      AVL_SET_BALANCE (q, ((qb == 0) ? -1 : 0));
+      return q;
+    }
+  } else {
+    q = p->left;
+    qb = AVL_GET_BALANCE (q);
+    if (qb > 0) {
+      /* double rotation */
+      r = q->right;
+      rb = AVL_GET_BALANCE (r);
+      avl_rotate_left (tree, q);
+      avl_rotate_right (tree, p);
+      AVL_SET_BALANCE (p, ((rb < 0) ? +1 : 0));
+      AVL_SET_BALANCE (q, ((rb > 0) ? -1 : 0));
+      AVL_SET_BALANCE (r, 0);
+      return r;
+    } else {
+      avl_rotate_right (tree, p);
+      AVL_SET_BALANCE (p, ((qb == 0) ? -1 : 0));
+      AVL_SET_BALANCE (q, ((qb == 0) ? +1 : 0));
+      return q;
+    }
+  }
+}
+
+/*
+ * The subtree rooted at <node> has just grown by one level.  Climb
+ * toward the head, adjusting balance factors and rotating, until the
+ * growth is absorbed.  Returns 1 if the whole tree grew.
+ */
+
+static
+int
+avl_propagate_growth (avl_tree * tree, avl_node * node)
+{
+  avl_node * p;
+
+  while ((p = node->parent)->parent) {
+    int balance = AVL_GET_BALANCE (p) + ((p->left == node) ? -1 : +1);
+    if (balance == 0) {
+      AVL_SET_BALANCE (p, 0);
+      return 0;
+    } else if ((balance == 1) || (balance == -1)) {
+      AVL_SET_BALANCE (p, balance);
+      node = p;
+    } else {
+      node = avl_rebalance (tree, p, balance);
+      if (AVL_GET_BALANCE (node) == 0) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+ * The <shortened_side> subtree of <p> has just lost a level.  The
+ * mirror image of avl_propagate_growth: returns 1 if the whole tree
+ * got shorter.
+ */
+
+static
+int
+avl_propagate_shrink (avl_tree * tree, avl_node * p, int shortened_side)
+{
+  while (p->parent) {
+    int balance = AVL_GET_BALANCE (p) - shortened_side;
+    avl_node * node;
+    if (balance == 0) {
+      AVL_SET_BALANCE (p, 0);
+      node = p;
+    } else if ((balance == 1) || (balance == -1)) {
+      AVL_SET_BALANCE (p, balance);
+      return 0;
+    } else {
+      node = avl_rebalance (tree, p, balance);
+      if (AVL_GET_BALANCE (node) != 0) {
+        return 0;
+      }
+    }
+    p = node->parent;
+    shortened_side = (p->left == node) ? -1 : +1;
+  }
+  return 1;
+}
+
+/*
+ * Sequence mode: insert and remove by position alone, without
+ * consulting the compare function.
+ */
+
+int
+avl_insert_by_index (avl_tree * tree,
+                     void * key,
+                     unsigned int index)
+{
+  avl_node * p = tree->root->right;
+  avl_node * node;
+  unsigned int m = index;
+  int left;
+
+  if (index > tree->length) {
+    return -1;
+  }
+  if (!p) {
+    node = avl_new_tree_node (tree, key, tree->root);
+    if (!node) {
+      return -1;
+    }
+    tree->root->right = node;
+    tree->length = 1;
+    return 0;
+  }
+  /* find the leaf position first, so that a failed allocation
+   * leaves the ranks untouched
+   */
+  while (1) {
+    left = (m < AVL_GET_RANK (p));
+    if (left) {
+      if (!p->left) {
+        break;
+      }
+      p = p->left;
+    } else {
+      m = m - AVL_GET_RANK (p);
+      if (!p->right) {
+        break;
+      }
+      p = p->right;
+    }
+  }
+  node = avl_new_tree_node (tree, key, p);
+  if (!node) {
+    return -1;
+  }
+  if (left) {
+    p->left = node;
+  } else {
+    p->right = node;
+  }
+  /* every node the new one hangs to the left of gains a rank */
+  for (p = node; p->parent->parent; p = p->parent) {
+    if (p->parent->left == p) {
+      AVL_SET_RANK (p->parent, (AVL_GET_RANK (p->parent) + 1));
+    }
+  }
+  tree->length = tree->length + 1;
+  avl_propagate_growth (tree, node);
+  avl_augment_path (tree, node);
+  return 0;
+}
+
+int
+avl_remove_by_index (avl_tree * tree,
+                     unsigned int index,
+                     avl_free_key_fun_type free_key_fun)
+{
+  avl_node * x = tree->root->right;
+  unsigned int m = index + 1;
+
+  if (index >= tree->length) {
+    return -1;
+  }
+  while (1) {
+    if (m < AVL_GET_RANK (x)) {
+      AVL_SET_RANK (x, (AVL_GET_RANK (x) - 1));
+      x = x->left;
+    } else if (m > AVL_GET_RANK (x)) {
+      m = m - AVL_GET_RANK (x);
+      x = x->right;
+    } else {
+      return avl_remove_node (tree, x, free_key_fun);
+    }
+  }
+}
+
+avl_subtree
+avl_detach_subtree (avl_tree * tree)
+{
+  avl_subtree t;
+
+  t.node = tree->root->right;
+  t.size = tree->length;
+  t.height = avl_node_height (t.node);
+  if (t.node) {
+    t.node->parent = NULL;
+  }
+  tree->root->right = NULL;
+  tree->length = 0;
+  return t;
+}
+
+void
+avl_attach_subtree (avl_tree * tree, avl_subtree t)
+{
+  tree->root->right = t.node;
+  if (t.node) {
+    t.node->parent = tree->root;
+  }
+  tree->length = t.size;
+}
+
+/*
+ * Join <l>, the single node <k> and <r>, where every key of <l>
+ * orders before <k> and every key of <r> after it.  We walk down the
+ * inner spine of the taller tree to a subtree about as tall as the
+ * shorter one, hang both from <k> there, and rebalance as for an
+ * insertion.  O(|l.height - r.height| + 1).
+ */
+
+avl_subtree
+avl_join3 (avl_tree * tree, avl_subtree l, avl_node * k, avl_subtree r)
+{
+  avl_node head;
+  avl_subtree result;
+
+  head.parent = NULL;
+  head.left = NULL;
+  k->rank_and_balance = 0;
+  result.size = l.size + 1 + r.size;
+
+  if (l.height > r.height + 1) {
+    /* walk down the right spine of <l> */
+    avl_node * p = &head, * c = l.node;
+    unsigned int c_size = l.size;
+    int c_height = l.height;
+
+    head.right = l.node;
+    l.node->parent = &head;
+    while (c_height > r.height + 1) {
+      c_height = c_height - ((AVL_GET_BALANCE (c) < 0) ? 2 : 1);
+      c_size = c_size - AVL_GET_RANK (c);
+      p = c;
+      c = c->right;
+    }
+    k->left = c;
+    if (c) {
+      c->parent = k;
+    }
+    k->right = r.node;
+    if (r.node) {
+      r.node->parent = k;
+    }
+    AVL_SET_RANK (k, c_size + 1);
+    AVL_SET_BALANCE (k, (r.height - c_height));
+    p->right = k;
+    k->parent = p;
+    result.height = l.height + avl_propagate_growth (tree, k);
+    avl_augment_path (tree, k);
+  } else if (r.height > l.height + 1) {
+    /* walk down the left spine of <r>; everything we pass
+     * gains <l> and <k> on its left
+     */
+    avl_node * p = &head, * c = r.node;
+    int c_height = r.height;
+
+    head.right = r.node;
+    r.node->parent = &head;
+    while (c_height > l.height + 1) {
+      AVL_SET_RANK (c, (AVL_GET_RANK (c) + l.size + 1));
+      c_height = c_height - ((AVL_GET_BALANCE (c) > 0) ? 2 : 1);
+      p = c;
+      c = c->left;
+    }
+    k->right = c;
+    if (c) {
+      c->parent = k;
+    }
+    k->left = l.node;
+    if (l.node) {
+      l.node->parent = k;
+    }
+    AVL_SET_RANK (k, l.size + 1);
+    AVL_SET_BALANCE (k, (c_height - l.height));
+    if (p == &head) {
+      p->right = k;
+    } else {
+      p->left = k;
+    }
+    k->parent = p;
+    result.height = r.height + avl_propagate_growth (tree, k);
+    avl_augment_path (tree, k);
+  } else {
+    k->left = l.node;
+    if (l.node) {
+      l.node->parent = k;
+    }
+    k->right = r.node;
+    if (r.node) {
+      r.node->parent = k;
+    }
+    AVL_SET_RANK (k, l.size + 1);
+    AVL_SET_BALANCE (k, (r.height - l.height));
+    head.right = k;
+    result.height = MAX (l.height, r.height) + 1;
+    if (tree->monoid) {
+      avl_augment_node (tree, k);
+    }
+  }
+  result.node = head.right;
+  result.node->parent = NULL;
+  return result;
+}
+
+/* unlink and return the last node of a non-empty subtree */
+
+static
+avl_node *
+avl_subtree_pop_last (avl_tree * tree, avl_subtree * t)
+{
+  avl_node head;
+  avl_node * x, * p;
+
+  head.parent = NULL;
+  head.left = NULL;
+  head.right = t->node;
+  t->node->parent = &head;
+
+  x = t->node;
+  while (x->right) {
+    x = x->right;
+  }
+  p = x->parent;
+  p->right = x->left;
+  if (x->left) {
+    x->left->parent = p;
+  }
+  t->height = t->height - avl_propagate_shrink (tree, p, +1);
+  avl_augment_path (tree, p);
+  t->size = t->size - 1;
+  t->node = head.right;
+  if (t->node) {
+    t->node->parent = NULL;
+  }
+  return x;
+}
+
+/* join two subtrees where every key of <l> orders before <r>'s */
+
+avl_subtree
+avl_join2 (avl_tree * tree, avl_subtree l, avl_subtree r)
+{
+  avl_node * k;
+
+  if (!l.node) {
+    return r;
+  } else if (!r.node) {
+    return l;
+  }
+  k = avl_subtree_pop_last (tree, &l);
+  return avl_join3 (tree, l, k, r);
+}
+
+/* break <t> into its root and the two subtrees underneath it */
+
+avl_node *
+avl_expose (avl_subtree t, avl_subtree * l, avl_subtree * r)
+{
+  avl_node * n = t.node;
+
+  l->node = n->left;
+  l->size = AVL_GET_RANK (n) - 1;
+  l->height = t.height - ((AVL_GET_BALANCE (n) > 0) ? 2 : 1);
+  r->node = n->right;
+  r->size = t.size - AVL_GET_RANK (n);
+  r->height = t.height - ((AVL_GET_BALANCE (n) < 0) ? 2 : 1);
+  if (l->node) {
+    l->node->parent = NULL;
+  }
+  if (r->node) {
+    r->node->parent = NULL;
+  }
+  return n;
+}
+
+/*
+ * Split <t> into the keys ordering before <key> (<*l>) and the rest
+ * (<*r>).  If <upper> is set, keys equal to <key> go to <*l> as well.
+ */
+
+void
+avl_split_subtree_by_key (avl_tree * tree,
+                          avl_subtree t,
+                          void * key,
+                          int upper,
+                          avl_subtree * l,
+                          avl_subtree * r)
+{
+  avl_subtree left, right, a, b;
+  avl_node * n;
+  int compare_result;
+
+  if (!t.node) {
+    *l = *r = t;
+    return;
+  }
+  n = avl_expose (t, &left, &right);
+  compare_result = tree->compare_fun (tree->compare_arg, key, n->key);
+  if ((compare_result < 0) || ((compare_result == 0) && !upper)) {
+    avl_split_subtree_by_key (tree, left, key, upper, &a, &b);
+    *l = a;
+    *r = avl_join3 (tree, b, n, right);
+  } else {
+    avl_split_subtree_by_key (tree, right, key, upper, &a, &b);
+    *l = avl_join3 (tree, left, n, a);
+    *r = b;
+  }
+}
+
+/* split <t> into its first <index> nodes and the rest */
+
+static
+void
+avl_split_subtree_by_index (avl_tree * tree,
+                            avl_subtree t,
+                            unsigned int index,
+                            avl_subtree * l,
+                            avl_subtree * r)
+{
+  avl_subtree left, right, a, b;
+  avl_node * n;
+
+  if (!t.node) {
+    *l = *r = t;
+    return;
+  }
+  n = avl_expose (t, &left, &right);
+  if (index < AVL_GET_RANK (n)) {
+    avl_split_subtree_by_index (tree, left, index, &a, &b);
+    *l = a;
+    *r = avl_join3 (tree, b, n, right);
+  } else {
+    avl_split_subtree_by_index (tree, right, index - AVL_GET_RANK (n), &a, &b);
+    *l = avl_join3 (tree, left, n, a);
+    *r = b;
+  }
+}
+
+/*
+ * Nodes may only move between trees that allocate them the same way
+ * and lay them out alike: the same aggregates, and values or none.
+ * How they order their keys is left to the callers, since a compare_arg
+ * may differ between two trees that order alike.
+ */
+
+int
+avl_same_layout (avl_tree * a, avl_tree * b)
+{
+  return ((a->arena == b->arena)
+          && (a->monoid == b->monoid)
+          && (a->value_offset == b->value_offset));
+}
+
+/* the receiving tree must also be empty */
+
+static
+int
+avl_split_check (avl_tree * tree, avl_tree * right)
+{
+  if (right->length || !avl_same_layout (tree, right)) {
+    return -1;
+  }
+  return 0;
+}
+
+int
+avl_split_by_key (avl_tree * tree,
+                  void * key,
+                  avl_tree * right)
+{
+  avl_subtree l, r;
+
+  if (avl_split_check (tree, right) != 0) {
+    return -1;
+  }
+  avl_split_subtree_by_key (tree, avl_detach_subtree (tree), key, 0, &l, &r);
+  avl_attach_subtree (tree, l);
+  avl_attach_subtree (right, r);
+  return 0;
+}
+
+int
+avl_split_by_index (avl_tree * tree,
+                    unsigned int index,
+                    avl_tree * right)
+{
+  avl_subtree l, r;
+
+  if ((avl_split_check (tree, right) != 0) || (index > tree->length)) {
+    return -1;
+  }
+  avl_split_subtree_by_index (tree, avl_detach_subtree (tree), index, &l, &r);
+  avl_attach_subtree (tree, l);
+  avl_attach_subtree (right, r);
+  return 0;
+}
+
+int
+avl_join (avl_tree * left, avl_tree * right)
+{
+  if (!avl_same_layout (left, right)) {
+    return -1;
+  }
+  if (left->length && right->length) {
+    /* the last key of <left> must not order after the first of <right> */
+    avl_node * last = left->root->right;
+    avl_node * first = right->root->right;
+    while (last->right) {
+      last = last->right;
+    }
+    while (first->left) {
+      first = first->left;
+    }
+    if (left->compare_fun (left->compare_arg, last->key, first->key) > 0) {
+      return -1;
+    }
+  }
+  avl_attach_subtree (
+    left,
+    avl_join2 (left, avl_detach_subtree (left), avl_detach_subtree (right))
+    );
+  return 0;
+}
+
+/*
+ * Range removal cuts the range out with two splits, joins what is left
+ * on either side, and only then visits the nodes cut out, to free them.
+ */
+
+static
+void
+avl_remove_cut (avl_tree * tree,
+                avl_subtree l,
+                avl_subtree middle,
+                avl_subtree r,
+                avl_free_key_fun_type free_key_fun)
+{
+  avl_attach_subtree (tree, avl_join2 (tree, l, r));
+  if (middle.node) {
+    free_avl_tree_helper (tree, middle.node, free_key_fun, 1);
+  }
+}
+
+int
+avl_remove_index_range (avl_tree * tree,
+                        unsigned int low,
+                        unsigned int high,
+                        avl_free_key_fun_type free_key_fun)
+{
+  avl_subtree l, middle, r;
+
+  if (high > tree->length) {
+    high = tree->length;
+  }
+  if (low >= high) {
+    return 0;
+  }
+  avl_split_subtree_by_index (tree, avl_detach_subtree (tree), high, &l, &r);
+  avl_split_subtree_by_index (tree, l, low, &l, &middle);
+  avl_remove_cut (tree, l, middle, r, free_key_fun);
+  return 0;
+}
+
+int
+avl_remove_key_range (avl_tree * tree,
+                      void * low_key,
+                      void * high_key,
+                      avl_free_key_fun_type free_key_fun)
+{
+  avl_subtree l, middle, r;
+
+  if (tree->compare_fun (tree->compare_arg, low_key, high_key) > 0) {
+    return 0;
+  }
+  avl_split_subtree_by_key (tree, avl_detach_subtree (tree), high_key, 1, &l, &r);
+  avl_split_subtree_by_key (tree, l, low_key, 0, &l, &middle);
+  avl_remove_cut (tree, l, middle, r, free_key_fun);
+  return 0;
+}
+
+/*
+ * Set operations, using the split/join algorithms of Blelloch,
+ * Ferizovic and Sun ("Just Join for Parallel Ordered Sets"), which
+ * take O(m log (n/m + 1)) time for trees of sizes m <= n.
+ *
+ * The trees are treated as sets of keys: union keeps every item of
+ * <a> and those items of <b> whose key does not occur in <a>;
+ * intersection and difference keep those items of <a> whose key does
+ * (or does not) occur in <b>.  Merge keeps everything.  Equal keys
+ * within <a> stay together.
+ *
+ * Nodes that are dropped are not freed straight away, but chained
+ * through their parent pointers onto <*dropped>.
+ */
+
+void
+avl_drop_subtree (avl_subtree t, avl_node ** dropped)
+{
+  if (t.node) {
+    t.node->parent = *dropped;
+    *dropped = t.node;
+  }
+}
+
+void
+avl_free_dropped (avl_tree * tree,
+                  avl_node * dropped,
+                  avl_free_key_fun_type free_key_fun)
 {
-  if (node->right) {
-    node = node->right;
-    while (node->left) {
-      node = node->left;
+  while (dropped) {
+    avl_node * next = dropped->parent;
+    free_avl_tree_helper (tree, dropped, free_key_fun, 1);
+    dropped = next;
+  }
+}
+
+/* does <t> begin (<last> == 0) or end with a key equal to <key>? */
+
+static
+int
+avl_subtree_has_end_key (avl_tree * tree,
+                         avl_subtree t,
+                         void * key,
+                         int last)
+{
+  avl_node * x = t.node;
+
+  if (!x) {
+    return 0;
+  }
+  if (last) {
+    while (x->right) {
+      x = x->right;
     }
-    return node;
   } else {
-    avl_node * child = node;
-    while (node->parent) {
-      node = node->parent;
-      if (child == node->left) {
-        return node;
-      }
-      child = node;
+    while (x->left) {
+      x = x->left;
     }
-    return node;
   }
+  return tree->compare_fun (tree->compare_arg, key, x->key) == 0;
 }
 
-/* iterate a function over a range of indices, using avl_get_predecessor */
+/*
+ * Handle the cases where either tree is empty; returns 1 and sets
+ * <*result> if so.
+ */
 
 int
-avl_iterate_index_range (avl_tree * tree,
-                         avl_iter_index_fun_type iter_fun,
-                         unsigned int low,
-                         unsigned int high,
-                         void * iter_arg)
+avl_set_trivial (int operation,
+                 avl_subtree a,
+                 avl_subtree b,
+                 avl_subtree * result,
+                 avl_node ** dropped)
 {
-  unsigned int m;
-  unsigned int num_left;
-  avl_node * node;
-
-  if (high > tree->length) {
-    return -1;
-  }
-  num_left = (high - low);
-  /* find the <high-1>th node */
-  m = high;
-  node = tree->root->right;
-  while (1) {
-    if (m < AVL_GET_RANK (node)) {
-      node = node->left;
-    } else if (m > AVL_GET_RANK (node)) {
-      m = m - AVL_GET_RANK (node);
-      node = node->right;
+  if (!a.node) {
+    if ((operation == AVL_SET_UNION) || (operation == AVL_SET_MERGE)) {
+      *result = b;
     } else {
-      break;
+      avl_drop_subtree (b, dropped);
+      *result = a;
     }
-  }
-  /* call <iter_fun> on <node>, <get_pred(node)>, ... */
-  while (num_left) {
-    num_left = num_left - 1;
-    if (iter_fun (num_left, node->key, iter_arg) != 0) {
-      return -1;
+    return 1;
+  } else if (!b.node) {
+    if (operation == AVL_SET_INTERSECTION) {
+      avl_drop_subtree (a, dropped);
+      *result = b;
+    } else {
+      *result = a;
     }
-    node = avl_get_predecessor (node);
+    return 1;
   }
   return 0;
 }
 
-/* If <key> is present in the tree, return that key's node, and set <*index>
- * appropriately.  If not, return NULL, and set <*index> to the position
- * representing the closest preceding value.
+/*
+ * Divide both (non-empty) trees around the root key of <a>.  Every item
+ * of <a> equal to that key is pulled out to one side of it.
  */
 
-avl_node *
-avl_get_index_by_key (avl_tree * tree,
-                      void * key,
-                      unsigned int * index)
+void
+avl_set_divide (avl_tree * tree,
+                avl_subtree a,
+                avl_subtree b,
+                avl_set_parts * parts)
 {
-  avl_node * x = tree->root->right;
-  unsigned int m;
-
-  if (!x) {
-    return NULL;
+  avl_subtree rest;
+  void * key;
+
+  parts->root = avl_expose (a, &parts->a_less, &parts->a_more);
+  key = parts->root->key;
+  parts->a_left_equal.node = parts->a_right_equal.node = NULL;
+  parts->a_left_equal.size = parts->a_right_equal.size = 0;
+  parts->a_left_equal.height = parts->a_right_equal.height = 0;
+  if (avl_subtree_has_end_key (tree, parts->a_less, key, 1)) {
+    avl_split_subtree_by_key (tree, parts->a_less, key, 0,
+                              &parts->a_less, &parts->a_left_equal);
   }
-  m = AVL_GET_RANK (x);
-
-  while (1) {
-    int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
-    if (compare_result < 0) {
-      if (x->left) {
-        m = m - AVL_GET_RANK(x);
-        x = x->left;
-        m = m + AVL_GET_RANK(x);
-      } else {
-        *index = m - 2;
-        return NULL;
-      }
-    } else if (compare_result > 0) {
-      if (x->right) {
-        x = x->right;
-        m = m + AVL_GET_RANK(x);
-      } else {
-        *index = m - 1;
-        return NULL;
-      }
-    } else {
-      *index = m - 1;
-      return x;
-    }
+  if (avl_subtree_has_end_key (tree, parts->a_more, key, 0)) {
+    avl_split_subtree_by_key (tree, parts->a_more, key, 1,
+                              &parts->a_right_equal, &parts->a_more);
   }
+  avl_split_subtree_by_key (tree, b, key, 0, &parts->b_less, &rest);
+  avl_split_subtree_by_key (tree, rest, key, 1, &parts->b_equal, &parts->b_more);
 }
 
-/* return the (low index, high index) pair that spans the given key */
+/*
+ * Put the pieces back together, given the results of the operation on
+ * the less-than (<left>) and greater-than (<right>) parts.
+ */
 
-int
-avl_get_span_by_key (avl_tree * tree,
-                     void * key,
-                     unsigned int * low,
-                     unsigned int * high)
+avl_subtree
+avl_set_combine (avl_tree * tree,
+                 int operation,
+                 avl_set_parts * parts,
+                 avl_subtree left,
+                 avl_subtree right,
+                 avl_node ** dropped)
 {
-  unsigned int m, i, j;
-  avl_node * node;
+  avl_node * r = parts->root;
+  int keep_equal;
 
-  node = avl_get_index_by_key (tree, key, &m);
-
-  /* did we find an exact match?
-   * if so, we have to search left and right
-   * to find the span, since we know nothing about
-   * the arrangement of like keys.
-   */
-  if (node) {
-    avl_node * left, * right;
-    /* search left */
-    left = avl_get_predecessor (node);
-    i = m;
-    while ((i > 0) && (tree->compare_fun (tree->compare_arg, key, left->key) == 0)) {
-      left = avl_get_predecessor (left);
-      i = i - 1;
-    }
-    /* search right */
-    right = avl_get_successor (node);
-    if (right == tree->root) {
-      // special case, tree->size == 1
-      *low = i;
-      *high = i + 1;
-      return 0;
+  if (operation == AVL_SET_MERGE) {
+    parts->a_right_equal = avl_join2 (tree, parts->a_right_equal, parts->b_equal);
+    keep_equal = 1;
+  } else {
+    if (operation == AVL_SET_UNION) {
+      keep_equal = 1;
+    } else if (operation == AVL_SET_INTERSECTION) {
+      keep_equal = (parts->b_equal.node != NULL);
     } else {
-      j = m;
-      while ((j <= tree->length) && (tree->compare_fun (tree->compare_arg, key, right->key) == 0)) {
-        right = avl_get_successor (right);
-        j = j + 1;
-      }
-      *low = i;
-      *high = j + 1;
-      return 0;
+      keep_equal = (parts->b_equal.node == NULL);
     }
+    avl_drop_subtree (parts->b_equal, dropped);
+  }
+
+  if (keep_equal) {
+    return avl_join3 (tree,
+                      avl_join2 (tree, left, parts->a_left_equal),
+                      r,
+                      avl_join2 (tree, parts->a_right_equal, right));
   } else {
-    *low = *high = m;
+    r->left = r->right = NULL;
+    r->parent = *dropped;
+    *dropped = r;
+    avl_drop_subtree (parts->a_left_equal, dropped);
+    avl_drop_subtree (parts->a_right_equal, dropped);
+    return avl_join2 (tree, left, right);
   }
-  return 0;
 }
 
-/* return the (low index, high index) pair that spans the given key */
-
-int
-avl_get_span_by_two_keys (avl_tree * tree,
-                          void * low_key,
-                          void * high_key,
-                          unsigned int * low,
-                          unsigned int * high)
+avl_subtree
+avl_set_operation (avl_tree * tree,
+                   int operation,
+                   avl_subtree a,
+                   avl_subtree b,
+                   avl_node ** dropped)
 {
-  unsigned int i, j;
-  avl_node * low_node, * high_node;
-  int order;
+  avl_set_parts parts;
+  avl_subtree left, right, result;
 
-  /* we may need to swap them */
-  order = tree->compare_fun (tree->compare_arg, low_key, high_key);
-  if (order > 0) {
-    void * temp = low_key;
-    low_key = high_key;
-    high_key = temp;
+  if (avl_set_trivial (operation, a, b, &result, dropped)) {
+    return result;
   }
+  avl_set_divide (tree, a, b, &parts);
+  left = avl_set_operation (tree, operation, parts.a_less, parts.b_less, dropped);
+  right = avl_set_operation (tree, operation, parts.a_more, parts.b_more, dropped);
+  return avl_set_combine (tree, operation, &parts, left, right, dropped);
+}
 
-  low_node = avl_get_index_by_key (tree, low_key, &i);
-  high_node = avl_get_index_by_key (tree, high_key, &j);
+static
+int
+avl_set_operation_on_trees (avl_tree * a,
+                            avl_tree * b,
+                            int operation,
+                            avl_free_key_fun_type free_key_fun)
+{
+  avl_node * dropped = NULL;
 
-  if (low_node) {
-    avl_node * left;
-    /* search left */
-    left = avl_get_predecessor (low_node);
-    while ((i > 0) && (tree->compare_fun (tree->compare_arg, low_key, left->key) == 0)) {
-      left = avl_get_predecessor (left);
-      i = i - 1;
-    }
-  } else {
-    i = i + 1;
-  }
-  if (high_node) {
-    avl_node * right;
-    /* search right */
-    right = avl_get_successor (high_node);
-    if (right == tree->root) {
-      // special case, tree->size == 1
-      j = i + 1;
-    } else {
-      while ((j <= tree->length) && (tree->compare_fun (tree->compare_arg, high_key, right->key) == 0)) {
-        right = avl_get_successor (right);
-        j = j + 1;
-      }
-    }
-  } else {
-    j = j + 1;
+  if ((a == b) || !avl_same_layout (a, b)) {
+    return -1;
   }
-
-  *low = i;
-  *high = j;
+  avl_attach_subtree (
+    a,
+    avl_set_operation (a, operation,
+                       avl_detach_subtree (a),
+                       avl_detach_subtree (b),
+                       &dropped)
+    );
+  avl_free_dropped (a, dropped, free_key_fun);
   return 0;
 }
 
+int
+avl_union (avl_tree * a,
+           avl_tree * b,
+           avl_free_key_fun_type free_key_fun)
+{
+  return avl_set_operation_on_trees (a, b, AVL_SET_UNION, free_key_fun);
+}
 
 int
-avl_get_item_by_key_most (avl_tree * tree,
-                          void * key,
-                          void **value_address)
+avl_intersection (avl_tree * a,
+                  avl_tree * b,
+                  avl_free_key_fun_type free_key_fun)
 {
-  avl_node * x = tree->root->right;
-  *value_address = NULL;
+  return avl_set_operation_on_trees (a, b, AVL_SET_INTERSECTION, free_key_fun);
+}
 
-  if (!x) {
-    return -1;
-  }
-  while (1) {
-    int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
+int
+avl_difference (avl_tree * a,
+                avl_tree * b,
+                avl_free_key_fun_type free_key_fun)
+{
+  return avl_set_operation_on_trees (a, b, AVL_SET_DIFFERENCE, free_key_fun);
+}
 
-    if (compare_result == 0) {
-      *value_address = x->key;
-      return 0;
-    } else if (compare_result < 0) {
-      /* the given key is less than the current key */
-      if (x->left) {
-        x = x->left;
-      } else {
-        if (*value_address)
-          return 0;
-        else
-          return -1;
-      }
-    } else {
-      /* the given key is more than the current key */
-      /* save this value, it might end up being the right one! */
-      *value_address = x->key;
-      if (x->right) {
-        /* there is a bigger entry */
-        x = x->right;
-      } else {
-        if (*value_address)
-          return 0;
-        else
-          return -1;
-      }
+int
+avl_merge (avl_tree * a,
+           avl_tree * b)
+{
+  return avl_set_operation_on_trees (a, b, AVL_SET_MERGE, NULL);
+}
+
+/*
+ * Bulk building.  The middle key becomes the root and each half is
+ * built the same way, so the left half is never smaller than the right
+ * nor more than one level taller.
+ */
+
+static
+avl_node *
+avl_build_subtree (avl_tree * tree,
+                   void ** keys,
+                   unsigned int length,
+                   int * height)
+{
+  unsigned int half = length / 2;
+  avl_node * node, * left, * right;
+  int lh, rh;
+
+  if (!length) {
+    *height = 0;
+    return NULL;
+  }
+  left = avl_build_subtree (tree, keys, half, &lh);
+  if (half && !left) {
+    return NULL;
+  }
+  right = avl_build_subtree (tree, keys + half + 1, length - half - 1, &rh);
+  if ((length - half - 1) && !right) {
+    free_avl_tree_helper (tree, left, NULL, 1);
+    return NULL;
+  }
+  node = avl_new_tree_node (tree, keys[half], NULL);
+  if (!node) {
+    if (left) {
+      free_avl_tree_helper (tree, left, NULL, 1);
     }
+    if (right) {
+      free_avl_tree_helper (tree, right, NULL, 1);
+    }
+    return NULL;
+  }
+  node->left = left;
+  node->right = right;
+  if (left) {
+    left->parent = node;
+  }
+  if (right) {
+    right->parent = node;
   }
+  AVL_SET_RANK (node, half + 1);
+  AVL_SET_BALANCE (node, rh - lh);
+  if (tree->monoid) {
+    avl_augment_node (tree, node);
+  }
+  *height = 1 + MAX (lh, rh);
+  return node;
 }
 
 int
-avl_get_item_by_key_least (avl_tree * tree,
-                           void * key,
-                           void **value_address)
+avl_build_by_keys (avl_tree * tree,
+                   void ** keys,
+                   unsigned int length)
 {
-  avl_node * x = tree->root->right;
-  *value_address = NULL;
+  unsigned int i;
+  avl_node * node;
+  int height;
 
-  if (!x) {
+  if (tree->length) {
     return -1;
   }
-  while (1) {
-    int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
-    if (compare_result == 0) {
-      *value_address = x->key;
-      return 0;  /* exact match */
-    } else if (compare_result < 0) {
-      /* the given key is less than the current key */
-      /* save this value, it might end up being the right one! */
-      *value_address = x->key;
-      if (x->left) {
-        x = x->left;
-      } else {
-        if (*value_address)  /* we have found a valid entry */
-          return 0;
-        else
-          return -1;
-      }
-    } else {
-      if (x->right) {
-        /* there is a bigger entry */
-        x = x->right;
-      } else {
-        if (*value_address)  /* we have found a valid entry */
-          return 0;
-        else
-          return -1;
-      }
+  for (i = 1; i < length; i++) {
+    if (tree->compare_fun (tree->compare_arg, keys[i - 1], keys[i]) > 0) {
+      return -1;
     }
   }
+  node = avl_build_subtree (tree, keys, length, &height);
+  if (length && !node) {
+    return -1;
+  }
+  tree->root->right = node;
+  if (node) {
+    node->parent = tree->root;
+  }
+  tree->length = length;
+  return 0;
 }
 
-#define MAX(X, Y)  ((X) > (Y) ? (X) : (Y))
 
 int
 avl_verify_balance (avl_node * node)
@@ -1032,6 +2795,32 @@ avl_verify_rank (avl_node * node)
 
 /* sanity-check the tree */
 
+static
+void
+avl_verify_aggregate (avl_tree * tree, avl_node * node, void * scratch)
+{
+  avl_monoid * m = tree->monoid;
+
+  if (node->left) {
+    avl_verify_aggregate (tree, node->left, scratch);
+  }
+  if (node->right) {
+    avl_verify_aggregate (tree, node->right, scratch);
+  }
+  m->identity (m->monoid_arg, scratch);
+  if (node->left) {
+    m->append (m->monoid_arg, scratch, AVL_NODE_AGGREGATE (node->left));
+  }
+  m->append_key (m->monoid_arg, scratch, node->key);
+  if (node->right) {
+    m->append (m->monoid_arg, scratch, AVL_NODE_AGGREGATE (node->right));
+  }
+  if (memcmp (scratch, AVL_NODE_AGGREGATE (node), m->size) != 0) {
+    fprintf (stderr, "invalid aggregate at node %p\n", node->key);
+    exit(1);
+  }
+}
+
 int
 avl_verify (avl_tree * tree)
 {
@@ -1039,6 +2828,11 @@ avl_verify (avl_tree * tree)
     avl_verify_balance (tree->root->right);
     avl_verify_parent  (tree->root->right, tree->root);
     avl_verify_rank    (tree->root->right);
+    if (tree->monoid) {
+      void * scratch = malloc (tree->monoid->size);
+      avl_verify_aggregate (tree, tree->root->right, scratch);
+      free (scratch);
+    }
   }
   return (0);
 }
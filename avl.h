@@ -5,6 +5,11 @@
  */
 
 
+#ifndef AVL_H
+#define AVL_H
+
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,11 +45,66 @@ typedef int (*avl_key_compare_fun_type) (void * compare_arg, void * a, void * b)
 typedef int (*avl_iter_fun_type)        (void * key, void * iter_arg);
 typedef int (*avl_iter_index_fun_type)  (unsigned int index, void * key, void * iter_arg);
 typedef int (*avl_free_key_fun_type)    (void * key);
+typedef void * (*avl_copy_key_fun_type) (void * key);
 typedef int (*avl_key_printer_fun_type) (char *, void *);
+typedef void * (*avl_alloc_fun_type)    (void * alloc_arg, size_t size);
+typedef void   (*avl_dealloc_fun_type)  (void * alloc_arg, void * block);
+
+/*
+ * A node arena carves nodes out of large slabs obtained from
+ * <alloc_fun>, and keeps released nodes on an intrusive free list
+ * (threaded through their <right> pointers).  Arenas are reference
+ * counted, so that several trees may share one - nodes can only move
+ * between trees that use the same arena.  An arena is not thread-safe.
+ */
+
+typedef struct _avl_arena_slab {
+  struct _avl_arena_slab *      next;
+} avl_arena_slab;
+
+typedef struct _avl_node_arena {
+  avl_arena_slab *              slabs;
+  avl_node *                    free_list;
+  char *                        bump;
+  char *                        bump_end;
+  unsigned int                  slab_nodes;
+  unsigned int                  next_slab_nodes;
+  unsigned int                  node_size;
+  unsigned int                  refcount;
+  avl_alloc_fun_type            alloc_fun;
+  avl_dealloc_fun_type          dealloc_fun;
+  void *                        alloc_arg;
+} avl_node_arena;
+
+/*
+ * A monoid describes a per-node aggregate of <size> bytes, kept just
+ * after each node and summarizing the node's whole subtree: the
+ * aggregate of the left subtree, then the node's own key, then the
+ * aggregate of the right subtree.  <identity> sets an aggregate to the
+ * empty one, <append_key> folds a key onto its right-hand end, and
+ * <append> folds another aggregate on the same way.  The operation need
+ * not commute, but it must be associative.
+ */
+
+typedef struct _avl_monoid {
+  size_t                        size;
+  void (*identity)              (void * monoid_arg, void * aggregate);
+  void (*append_key)            (void * monoid_arg, void * aggregate, void * key);
+  void (*append)                (void * monoid_arg, void * aggregate, const void * other);
+  void *                        monoid_arg;
+} avl_monoid;
+
+#define AVL_NODE_AGGREGATE(n)   ((void *) ((n) + 1))
 
 /*
  * <compare_fun> and <compare_arg> let us associate a particular compare
  * function with each tree, separately.
+ * If <arena> is NULL, each node is malloc'd and freed individually.
+ * If <monoid> is set, every node carries its subtree's aggregate.
+ * In map mode every node carries a value too, <value_offset> bytes
+ * from its start (after any aggregate); otherwise that is 0.
+ * <free_value_fun>, if set, is passed the value of each item the tree
+ * drops, along with the key.
  */
 
 typedef struct _avl_tree {
@@ -52,11 +112,73 @@ typedef struct _avl_tree {
   unsigned int                  length;
   avl_key_compare_fun_type      compare_fun;
   void *                        compare_arg;
+  avl_node_arena *              arena;
+  avl_monoid *                  monoid;
+  size_t                        value_offset;
+  avl_free_key_fun_type         free_value_fun;
 } avl_tree;
 
+#define AVL_NODE_VALUE(t,n)     (*(void **) (((char *) (n)) + (t)->value_offset))
+
 avl_tree * avl_new_avl_tree (avl_key_compare_fun_type compare_fun, void * compare_arg);
 avl_node * avl_new_avl_node (void * key, avl_node * parent);
 
+/*
+ * Slabs start small and double in size up to <slab_nodes> nodes, which
+ * may be 0 for a reasonable default.  <alloc_fun> and
+ * <dealloc_fun> go together: NULL for both means malloc() and free(),
+ * and giving only one of them is an error.
+ */
+
+avl_node_arena * avl_new_node_arena (
+  unsigned int          slab_nodes,
+  avl_alloc_fun_type    alloc_fun,
+  avl_dealloc_fun_type  dealloc_fun,
+  void *                alloc_arg
+  );
+
+/* drop a reference to <arena>, freeing all its slabs with the last one */
+void avl_release_node_arena (avl_node_arena * arena);
+
+/* attach <arena> to an empty <tree> (takes a new reference) */
+int avl_tree_use_arena (avl_tree * tree, avl_node_arena * arena);
+
+/*
+ * Copy the nodes of <tree> into <arena> (NULL for malloc), and make it
+ * the tree's arena in place of the old one.  This is O(n), and is how
+ * two trees with different arenas come to share one before a split,
+ * join or set operation.  Keys and values stay where they are.
+ */
+int avl_tree_move_to_arena (avl_tree * tree, avl_node_arena * arena);
+
+/*
+ * Make an empty <tree> keep aggregates for <monoid>, which must outlive
+ * it.  An arena in use must be fresh or already sized for them.
+ */
+int avl_tree_use_monoid (avl_tree * tree, avl_monoid * monoid);
+
+/*
+ * Put an empty <tree> in map mode, giving each node room for a value;
+ * <free_value_fun> may be NULL.  As with a monoid, an arena in use
+ * must be fresh or already sized for the larger nodes.
+ */
+int avl_tree_use_values (avl_tree * tree, avl_free_key_fun_type free_value_fun);
+
+/*
+ * Recompute the aggregates from <node> up to the root, after changing
+ * something its key contributes to them in place.
+ */
+void avl_update_aggregates (avl_tree * tree, avl_node * node);
+
+/* allocate and free nodes the way <tree> does */
+avl_node * avl_new_tree_node (avl_tree * tree, void * key, avl_node * parent);
+void avl_free_tree_node (avl_tree * tree, avl_node * node);
+
+/*
+ * <free_key_fun> may be NULL, in which case an arena-backed tree is
+ * torn down a slab at a time without visiting its nodes.
+ */
+
 void avl_free_avl_tree (
   avl_tree *            tree,
   avl_free_key_fun_type free_key_fun
@@ -68,12 +190,90 @@ int avl_insert_by_key (
   unsigned int *        index
   );
 
+/*
+ * Insert <key> unless an item comparing equal to it is present, in one
+ * descent.  Returns 1, with that item's key in <*value_address> and its
+ * index in <*index>, if so; <key> is then not kept.
+ */
+
+int avl_insert_unique (
+  avl_tree *            tree,
+  void *                key,
+  unsigned int *        index,
+  void **               value_address
+  );
+
 int avl_remove_by_key (
   avl_tree *            tree,
   void *                key,
   avl_free_key_fun_type free_key_fun
   );
 
+/*
+ * Map mode (see avl_tree_use_values): every item also carries a value,
+ * which is never compared.  Items inserted through the other calls
+ * have a NULL value.  Setting a value hands the old one to the tree's
+ * <free_value_fun>.  The get and set calls find the first item
+ * comparing equal to <key>.  All of these return -1 on a tree that is
+ * not in map mode.
+ */
+
+int avl_insert_kv (
+  avl_tree *            tree,
+  void *                key,
+  void *                value,
+  unsigned int *        index
+  );
+
+/*
+ * Map mode: insert <key> with <value>, or, if an item comparing equal
+ * to <key> is present, give it <value> instead and return 1 (<key> is
+ * then not kept).  One descent either way.
+ */
+
+int avl_upsert (
+  avl_tree *            tree,
+  void *                key,
+  void *                value,
+  unsigned int *        index
+  );
+
+int avl_get_value_by_key (
+  avl_tree *            tree,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_get_value_by_index (
+  avl_tree *            tree,
+  unsigned int          index,
+  void **               value_address
+  );
+
+int avl_set_value_by_key (
+  avl_tree *            tree,
+  void *                key,
+  void *                value
+  );
+
+/*
+ * Sequence mode: place <key> at position <index> (0 <= index <= length)
+ * or remove the item at <index>, ignoring the compare function.  Mixing
+ * these with the by-key calls on one tree is the caller's business.
+ */
+
+int avl_insert_by_index (
+  avl_tree *            tree,
+  void *                key,
+  unsigned int          index
+  );
+
+int avl_remove_by_index (
+  avl_tree *            tree,
+  unsigned int          index,
+  avl_free_key_fun_type free_key_fun
+  );
+
 int avl_get_item_by_index (
   avl_tree *            tree,
   unsigned int          index,
@@ -100,6 +300,27 @@ int avl_iterate_index_range (
   void *                iter_arg
   );
 
+/*
+ * The index of the first item ordering at or after <key>, or of the
+ * first ordering after it; <length> if there is none.  O(log n), no
+ * matter how many items compare equal to <key>.
+ */
+
+unsigned int avl_lower_bound_index (
+  avl_tree *            tree,
+  void *                key
+  );
+
+unsigned int avl_upper_bound_index (
+  avl_tree *            tree,
+  void *                key
+  );
+
+/*
+ * The span of <key> (or from <key_a> to <key_b>, inclusive, in either
+ * order): every item from <*low> up to, not including, <*high>.
+ */
+
 int avl_get_span_by_key (
   avl_tree *            tree,
   void *                key,
@@ -115,6 +336,125 @@ int avl_get_span_by_two_keys (
   unsigned int *        high
   );
 
+/*
+ * Fold the aggregates of the items at <low> up to (not including)
+ * <high>, or of those with keys from <low_key> to <high_key> inclusive,
+ * into <aggregate>.  O(log n).
+ */
+
+int avl_fold_index_range (
+  avl_tree *            tree,
+  unsigned int          low,
+  unsigned int          high,
+  void *                aggregate
+  );
+
+int avl_fold_key_range (
+  avl_tree *            tree,
+  void *                low_key,
+  void *                high_key,
+  void *                aggregate
+  );
+
+/*
+ * Split and join, each O(log n).  Splitting moves the tail of <tree>
+ * - the keys ordering at or after <key>, or the nodes from <index>
+ * on - into <right>, which must be empty and share <tree>'s arena.
+ * Joining appends all of <right> to <left>, leaving <right> empty;
+ * no key of <right> may order before a key of <left>.  Both trees
+ * must keep the same aggregates, and both or neither be in map mode.
+ * They must also order their keys alike, which is not checked: a join
+ * compares only the last key of <left> with the first of <right>.
+ */
+
+int avl_split_by_key (
+  avl_tree *            tree,
+  void *                key,
+  avl_tree *            right
+  );
+
+int avl_split_by_index (
+  avl_tree *            tree,
+  unsigned int          index,
+  avl_tree *            right
+  );
+
+int avl_join (
+  avl_tree *            left,
+  avl_tree *            right
+  );
+
+/*
+ * Remove the items at <low> up to (not including) <high>, or those with
+ * keys from <low_key> to <high_key> inclusive, in O(log n) plus the
+ * cost of freeing them.  <free_key_fun> may be NULL.
+ */
+
+int avl_remove_index_range (
+  avl_tree *            tree,
+  unsigned int          low,
+  unsigned int          high,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_remove_key_range (
+  avl_tree *            tree,
+  void *                low_key,
+  void *                high_key,
+  avl_free_key_fun_type free_key_fun
+  );
+
+/*
+ * Set algebra on keys, in O(m log (n/m + 1)).  The result is left in
+ * <a>, and <b> is emptied; both must share an arena, a monoid and
+ * map mode (or its absence), and order their keys alike, with the same
+ * compare_fun and compare_arg (or one equivalent to it), which is not
+ * checked.
+ * Union keeps the items of <a> plus those of <b> whose key is not in
+ * <a>; intersection and difference keep the items of <a> whose key is
+ * (or is not) in <b>.
+ * Dropped items are passed to <free_key_fun>, which may be NULL.
+ */
+
+int avl_union (
+  avl_tree *            a,
+  avl_tree *            b,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_intersection (
+  avl_tree *            a,
+  avl_tree *            b,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_difference (
+  avl_tree *            a,
+  avl_tree *            b,
+  avl_free_key_fun_type free_key_fun
+  );
+
+/*
+ * Bulk merge: move every item of <b> into <a>, keeping duplicates.
+ * The trees must be alike as for the set operations above.
+ */
+
+int avl_merge (
+  avl_tree *            a,
+  avl_tree *            b
+  );
+
+/*
+ * Build <tree>, which must be empty, from <length> keys already in
+ * order, in O(n) with n - 1 comparisons to check that order.
+ */
+
+int avl_build_by_keys (
+  avl_tree *            tree,
+  void **               keys,
+  unsigned int          length
+  );
+
 int avl_verify (avl_tree * tree);
 
 void avl_print_tree (
@@ -126,6 +466,38 @@ avl_node * avl_get_predecessor (avl_node * node);
 
 avl_node * avl_get_successor (avl_node * node);
 
+/*
+ * A cursor is a resumable position in a tree, which can be stepped
+ * in either direction in O(1) amortized time.  Any insertion into or
+ * removal from the tree invalidates its cursors.
+ *
+ * When a cursor runs off either end its <node> becomes NULL, and
+ * <index> is left at <length> (past the end) or (unsigned int) -1
+ * (before the start), so that stepping back in brings it to the last
+ * or first item.  The seek and step functions return 0 when the
+ * cursor is left on an item, -1 otherwise.
+ */
+
+typedef struct _avl_cursor {
+  avl_tree *            tree;
+  avl_node *            node;
+  unsigned int          index;
+} avl_cursor;
+
+void avl_cursor_init (avl_cursor * cursor, avl_tree * tree);
+
+int avl_cursor_seek_first (avl_cursor * cursor);
+int avl_cursor_seek_last (avl_cursor * cursor);
+int avl_cursor_seek_index (avl_cursor * cursor, unsigned int index);
+
+/* move to the first item not ordering before <key> */
+int avl_cursor_seek_key (avl_cursor * cursor, void * key);
+
+int avl_cursor_next (avl_cursor * cursor);
+int avl_cursor_prev (avl_cursor * cursor);
+
+int avl_cursor_get (avl_cursor * cursor, void ** value_address);
+
 /* These two are from David Ascher <david_ascher@brown.edu> */
 
 int avl_get_item_by_key_most (
@@ -143,3 +515,5 @@ int avl_get_item_by_key_least (
 #ifdef __cplusplus
 }
 #endif
+
+#endif /* AVL_H */
@@ -0,0 +1,845 @@
+// -*- Mode: C++; indent-tabs-mode: nil -*-
+//
+// Copyright (C) 1995-1997 by Sam Rushing <rushing@nightmare.com>
+// Copyright (C) 2005 by Germanischer Lloyd AG
+// Copyright (C) 2001-2005 by IronPort Systems, Inc.
+//
+//                         All Rights Reserved
+//
+// Permission to use, copy, modify, and distribute this software and
+// its documentation for any purpose and without fee is hereby
+// granted, provided that the above copyright notice appear in all
+// copies and that both that copyright notice and this permission
+// notice appear in supporting documentation, and that the name of Sam
+// Rushing not be used in advertising or publicity pertaining to
+// distribution of the software without specific, written prior
+// permission.
+//
+// SAM RUSHING DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+// INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+// NO EVENT SHALL SAM RUSHING BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+// CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+// OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+// NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+// CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+//
+// avl::ranked_tree<Key, Compare, Alloc> - a header-only C++17 version
+// of the library in avl.c.  The tree layout and algorithms are the
+// same (Knuth's insertion, a head node whose right child is the root,
+// parent pointers, and the left-subtree count packed with the balance
+// factor), but keys are stored by value in the nodes and <Compare> is
+// a template parameter, so the compiler can inline it.
+//
+// Like the C library, the tree is an ordered multiset which may also
+// be indexed by position.  Iterators are bidirectional and, as for
+// std::multiset, only give const access to the keys.
+//
+
+#ifndef AVL_HPP
+#define AVL_HPP
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace avl {
+
+namespace detail {
+
+// Everything but the key; the head node is just one of these.
+struct node_base {
+  node_base *   left;
+  node_base *   right;
+  node_base *   parent;
+  // The lower 2 bits of <rank_and_balance> specify the balance
+  // factor: 00==-1, 01==0, 10==+1.
+  // The rest of the bits are used for <rank>
+  unsigned int  rank_and_balance;
+
+  int balance () const { return (int) (rank_and_balance & 3) - 1; }
+  unsigned int rank () const { return rank_and_balance >> 2; }
+  void set_balance (int b) { rank_and_balance = (rank_and_balance & ~3u) | (unsigned int) (b + 1); }
+  void set_rank (unsigned int r) { rank_and_balance = (rank_and_balance & 3) | (r << 2); }
+};
+
+template <class Key>
+struct node : node_base {
+  Key key;
+};
+
+inline node_base *
+get_successor (node_base * node)
+{
+  if (node->right) {
+    node = node->right;
+    while (node->left) {
+      node = node->left;
+    }
+    return node;
+  } else {
+    node_base * child = node;
+    while (node->parent) {
+      node = node->parent;
+      if (child == node->left) {
+        return node;
+      }
+      child = node;
+    }
+    return node;
+  }
+}
+
+// The predecessor of the head node is the last node.
+inline node_base *
+get_predecessor (node_base * node)
+{
+  if (!node->parent) {
+    node = node->right;
+    while (node && node->right) {
+      node = node->right;
+    }
+    return node;
+  }
+  if (node->left) {
+    node = node->left;
+    while (node->right) {
+      node = node->right;
+    }
+    return node;
+  } else {
+    node_base * child = node;
+    while (node->parent) {
+      node = node->parent;
+      if (child == node->right) {
+        return node;
+      }
+      child = node;
+    }
+    return node;
+  }
+}
+
+// Single rotations: fix up links, parent pointers and ranks, but not
+// balance factors.  <p> must have a parent.
+inline node_base *
+rotate_left (node_base * p)
+{
+  node_base * q = p->right;
+  node_base * top = p->parent;
+  p->right = q->left;
+  if (q->left) {
+    q->left->parent = p;
+  }
+  q->left = p;
+  q->parent = top;
+  p->parent = q;
+  if (top->left == p) {
+    top->left = q;
+  } else {
+    top->right = q;
+  }
+  q->set_rank (q->rank () + p->rank ());
+  return q;
+}
+
+inline node_base *
+rotate_right (node_base * p)
+{
+  node_base * q = p->left;
+  node_base * top = p->parent;
+  p->left = q->right;
+  if (q->right) {
+    q->right->parent = p;
+  }
+  q->right = p;
+  q->parent = top;
+  p->parent = q;
+  if (top->left == p) {
+    top->left = q;
+  } else {
+    top->right = q;
+  }
+  p->set_rank (p->rank () - q->rank ());
+  return q;
+}
+
+// <p> is out of balance by <balance> (+2 or -2).  Rotate, and return
+// the new root of the subtree; if its balance factor is zero the
+// subtree got shorter, otherwise its height is unchanged.
+inline node_base *
+rebalance (node_base * p, int balance)
+{
+  if (balance > 0) {
+    node_base * q = p->right;
+    int qb = q->balance ();
+    if (qb < 0) {
+      node_base * r = q->left;
+      int rb = r->balance ();
+      rotate_right (q);
+      rotate_left (p);
+      p->set_balance ((rb > 0) ? -1 : 0);
+      q->set_balance ((rb < 0) ? +1 : 0);
+      r->set_balance (0);
+      return r;
+    } else {
+      rotate_left (p);
+      p->set_balance ((qb == 0) ? +1 : 0);
+      q->set_balance ((qb == 0) ? -1 : 0);
+      return q;
+    }
+  } else {
+    node_base * q = p->left;
+    int qb = q->balance ();
+    if (qb > 0) {
+      node_base * r = q->right;
+      int rb = r->balance ();
+      rotate_left (q);
+      rotate_right (p);
+      p->set_balance ((rb < 0) ? +1 : 0);
+      q->set_balance ((rb > 0) ? -1 : 0);
+      r->set_balance (0);
+      return r;
+    } else {
+      rotate_right (p);
+      p->set_balance ((qb == 0) ? -1 : 0);
+      q->set_balance ((qb == 0) ? +1 : 0);
+      return q;
+    }
+  }
+}
+
+} // namespace detail
+
+template <class Key, class Compare = std::less<Key>, class Alloc = std::allocator<Key> >
+class ranked_tree {
+
+  typedef detail::node_base node_base;
+  typedef detail::node<Key> node;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<node> node_allocator;
+  typedef std::allocator_traits<node_allocator> node_traits;
+
+public:
+
+  typedef Key                   key_type;
+  typedef Key                   value_type;
+  typedef Compare               key_compare;
+  typedef Compare               value_compare;
+  typedef Alloc                 allocator_type;
+  typedef std::size_t           size_type;
+  typedef std::ptrdiff_t        difference_type;
+  typedef const Key &           reference;
+  typedef const Key &           const_reference;
+  typedef const Key *           pointer;
+  typedef const Key *           const_pointer;
+
+  class const_iterator {
+  public:
+    typedef std::bidirectional_iterator_tag     iterator_category;
+    typedef Key                                 value_type;
+    typedef std::ptrdiff_t                      difference_type;
+    typedef const Key *                         pointer;
+    typedef const Key &                         reference;
+
+    const_iterator () : node_ (nullptr) {}
+
+    reference operator* () const { return static_cast<node *> (node_)->key; }
+    pointer operator-> () const { return &static_cast<node *> (node_)->key; }
+
+    const_iterator & operator++ () { node_ = detail::get_successor (node_); return *this; }
+    const_iterator operator++ (int) { const_iterator old = *this; ++*this; return old; }
+    const_iterator & operator-- () { node_ = detail::get_predecessor (node_); return *this; }
+    const_iterator operator-- (int) { const_iterator old = *this; --*this; return old; }
+
+    friend bool operator== (const_iterator a, const_iterator b) { return a.node_ == b.node_; }
+    friend bool operator!= (const_iterator a, const_iterator b) { return a.node_ != b.node_; }
+
+  private:
+    friend class ranked_tree;
+    explicit const_iterator (node_base * n) : node_ (n) {}
+    node_base * node_;
+  };
+
+  typedef const_iterator                                iterator;
+  typedef std::reverse_iterator<const_iterator>         const_reverse_iterator;
+  typedef const_reverse_iterator                        reverse_iterator;
+
+  ranked_tree () : ranked_tree (Compare (), Alloc ()) {}
+
+  explicit ranked_tree (const Compare & comp, const Alloc & alloc = Alloc ())
+    : comp_ (comp), alloc_ (alloc), length_ (0)
+  {
+    init_head ();
+  }
+
+  template <class InputIt>
+  ranked_tree (InputIt first, InputIt last,
+               const Compare & comp = Compare (), const Alloc & alloc = Alloc ())
+    : ranked_tree (comp, alloc)
+  {
+    for (; first != last; ++first) {
+      insert (*first);
+    }
+  }
+
+  ranked_tree (std::initializer_list<Key> keys,
+               const Compare & comp = Compare (), const Alloc & alloc = Alloc ())
+    : ranked_tree (keys.begin (), keys.end (), comp, alloc)
+  {
+  }
+
+  ranked_tree (const ranked_tree & other)
+    : comp_ (other.comp_),
+      alloc_ (node_traits::select_on_container_copy_construction (other.alloc_)),
+      length_ (0)
+  {
+    init_head ();
+    if (other.head_.right) {
+      head_.right = copy_nodes (other.head_.right, &head_);
+      length_ = other.length_;
+    }
+  }
+
+  ranked_tree (ranked_tree && other) noexcept
+    : comp_ (std::move (other.comp_)), alloc_ (std::move (other.alloc_)), length_ (0)
+  {
+    init_head ();
+    steal (other);
+  }
+
+  ranked_tree & operator= (const ranked_tree & other)
+  {
+    if (this != &other) {
+      ranked_tree copy (other);
+      swap (copy);
+    }
+    return *this;
+  }
+
+  ranked_tree & operator= (ranked_tree && other) noexcept
+  {
+    if (this != &other) {
+      clear ();
+      comp_ = std::move (other.comp_);
+      alloc_ = std::move (other.alloc_);
+      steal (other);
+    }
+    return *this;
+  }
+
+  ~ranked_tree () { clear (); }
+
+  void swap (ranked_tree & other) noexcept
+  {
+    using std::swap;
+    swap (comp_, other.comp_);
+    swap (alloc_, other.alloc_);
+    swap (head_.right, other.head_.right);
+    swap (length_, other.length_);
+    if (head_.right) {
+      head_.right->parent = &head_;
+    }
+    if (other.head_.right) {
+      other.head_.right->parent = &other.head_;
+    }
+  }
+
+  // iterators
+
+  const_iterator begin () const { return const_iterator (first_node ()); }
+  const_iterator end () const { return const_iterator (head ()); }
+  const_iterator cbegin () const { return begin (); }
+  const_iterator cend () const { return end (); }
+  const_reverse_iterator rbegin () const { return const_reverse_iterator (end ()); }
+  const_reverse_iterator rend () const { return const_reverse_iterator (begin ()); }
+
+  // capacity
+
+  bool empty () const { return length_ == 0; }
+  size_type size () const { return length_; }
+
+  key_compare key_comp () const { return comp_; }
+  allocator_type get_allocator () const { return allocator_type (alloc_); }
+
+  // modifiers
+
+  iterator insert (const Key & key) { return insert_node (make_node (key)); }
+  iterator insert (Key && key) { return insert_node (make_node (std::move (key))); }
+
+  template <class... Args>
+  iterator emplace (Args &&... args) { return insert_node (make_node (std::forward<Args> (args)...)); }
+
+  // Remove the item at <pos>, returning an iterator to the one after it.
+  iterator erase (const_iterator pos)
+  {
+    node_base * next = detail::get_successor (pos.node_);
+    remove_node (pos.node_);
+    return iterator (next);
+  }
+
+  // Remove one item comparing equal to <key>, as avl_remove_by_key does.
+  size_type erase (const Key & key)
+  {
+    const_iterator pos = find (key);
+    if (pos == end ()) {
+      return 0;
+    }
+    erase (pos);
+    return 1;
+  }
+
+  void clear () noexcept
+  {
+    if (head_.right) {
+      free_nodes (head_.right);
+    }
+    head_.right = nullptr;
+    length_ = 0;
+  }
+
+  // lookup
+
+  // some item comparing equal to <key>, as avl_get_item_by_key: the
+  // first one met on the way down, not necessarily the first in order
+  // (lower_bound finds that)
+  const_iterator find (const Key & key) const
+  {
+    node_base * x = head_.right;
+    while (x) {
+      const Key & k = key_of (x);
+      if (comp_ (key, k)) {
+        x = x->left;
+      } else if (comp_ (k, key)) {
+        x = x->right;
+      } else {
+        return const_iterator (x);
+      }
+    }
+    return end ();
+  }
+
+  bool contains (const Key & key) const { return find (key) != end (); }
+
+  // the first item not ordering before <key>
+  const_iterator lower_bound (const Key & key) const
+  {
+    node_base * x = head_.right, * result = head ();
+    while (x) {
+      if (comp_ (key_of (x), key)) {
+        x = x->right;
+      } else {
+        result = x;
+        x = x->left;
+      }
+    }
+    return const_iterator (result);
+  }
+
+  // the first item ordering after <key>
+  const_iterator upper_bound (const Key & key) const
+  {
+    node_base * x = head_.right, * result = head ();
+    while (x) {
+      if (comp_ (key, key_of (x))) {
+        result = x;
+        x = x->left;
+      } else {
+        x = x->right;
+      }
+    }
+    return const_iterator (result);
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range (const Key & key) const
+  {
+    return std::make_pair (lower_bound (key), upper_bound (key));
+  }
+
+  size_type count (const Key & key) const
+  {
+    return index_of (upper_bound (key)) - index_of (lower_bound (key));
+  }
+
+  // positional access, as avl_get_item_by_index
+
+  const_iterator nth (size_type index) const
+  {
+    node_base * p = head_.right;
+    size_type m = index + 1;
+    while (p) {
+      if (m < p->rank ()) {
+        p = p->left;
+      } else if (m > p->rank ()) {
+        m = m - p->rank ();
+        p = p->right;
+      } else {
+        return const_iterator (p);
+      }
+    }
+    return end ();
+  }
+
+  const Key & operator[] (size_type index) const { return *nth (index); }
+
+  const Key & at (size_type index) const
+  {
+    if (index >= length_) {
+      throw std::out_of_range ("avl::ranked_tree::at");
+    }
+    return *nth (index);
+  }
+
+  // the position of <pos> in the tree; end() is at size()
+  size_type index_of (const_iterator pos) const
+  {
+    node_base * x = pos.node_;
+    if (x == head ()) {
+      return length_;
+    }
+    size_type index = x->rank () - 1;
+    while (x->parent != head ()) {
+      if (x->parent->right == x) {
+        index = index + x->parent->rank ();
+      }
+      x = x->parent;
+    }
+    return index;
+  }
+
+  // sanity-check the tree, as avl_verify; returns false on corruption
+  bool verify () const
+  {
+    size_type count;
+    int height;
+    if (!head_.right) {
+      return length_ == 0;
+    }
+    return (head_.right->parent == head ()
+            && verify_node (head_.right, count, height)
+            && count == length_);
+  }
+
+private:
+
+  static const Key & key_of (node_base * n) { return static_cast<node *> (n)->key; }
+
+  node_base * head () const { return const_cast<node_base *> (&head_); }
+
+  node_base * first_node () const
+  {
+    node_base * x = head_.right;
+    if (!x) {
+      return head ();
+    }
+    while (x->left) {
+      x = x->left;
+    }
+    return x;
+  }
+
+  void init_head ()
+  {
+    head_.left = head_.right = head_.parent = nullptr;
+    head_.rank_and_balance = 0;
+  }
+
+  void steal (ranked_tree & other)
+  {
+    head_.right = other.head_.right;
+    length_ = other.length_;
+    if (head_.right) {
+      head_.right->parent = &head_;
+    }
+    other.head_.right = nullptr;
+    other.length_ = 0;
+  }
+
+  template <class... Args>
+  node * make_node (Args &&... args)
+  {
+    node * n = node_traits::allocate (alloc_, 1);
+    try {
+      node_traits::construct (alloc_, std::addressof (n->key), std::forward<Args> (args)...);
+    } catch (...) {
+      node_traits::deallocate (alloc_, n, 1);
+      throw;
+    }
+    n->left = n->right = n->parent = nullptr;
+    n->rank_and_balance = 0;
+    n->set_balance (0);
+    n->set_rank (1);
+    return n;
+  }
+
+  void destroy_node (node_base * n)
+  {
+    node * x = static_cast<node *> (n);
+    node_traits::destroy (alloc_, std::addressof (x->key));
+    node_traits::deallocate (alloc_, x, 1);
+  }
+
+  void free_nodes (node_base * n)
+  {
+    while (n) {
+      if (n->left) {
+        free_nodes (n->left);
+      }
+      node_base * right = n->right;
+      destroy_node (n);
+      n = right;
+    }
+  }
+
+  node_base * copy_nodes (node_base * source, node_base * parent)
+  {
+    node * n = make_node (key_of (source));
+    n->rank_and_balance = source->rank_and_balance;
+    n->parent = parent;
+    try {
+      if (source->left) {
+        n->left = copy_nodes (source->left, n);
+      }
+      if (source->right) {
+        n->right = copy_nodes (source->right, n);
+      }
+    } catch (...) {
+      if (n->left) {
+        free_nodes (n->left);
+      }
+      destroy_node (n);
+      throw;
+    }
+    return n;
+  }
+
+  // Knuth's algorithm A, as in avl_insert_by_key.  Equal keys go left.
+  iterator insert_node (node_base * q)
+  {
+    if (!head_.right) {
+      head_.right = q;
+      q->parent = &head_;
+      length_ = 1;
+      return iterator (q);
+    }
+
+    node_base * s = head_.right;
+    node_base * p = s;
+    const Key & key = key_of (q);
+
+    while (true) {
+      if (!comp_ (key_of (p), key)) {
+        // move left
+        p->set_rank (p->rank () + 1);
+        node_base * next = p->left;
+        if (!next) {
+          p->left = q;
+          break;
+        } else if (next->balance ()) {
+          s = next;
+        }
+        p = next;
+      } else {
+        // move right
+        node_base * next = p->right;
+        if (!next) {
+          p->right = q;
+          break;
+        } else if (next->balance ()) {
+          s = next;
+        }
+        p = next;
+      }
+    }
+    q->parent = p;
+    length_ = length_ + 1;
+
+    // adjust balance factors between <s> and <q>; the parent pointers
+    // tell us which way we went, so no more comparisons are needed
+    node_base * child = q;
+    for (node_base * x = q->parent; x != s; x = x->parent) {
+      x->set_balance ((x->left == child) ? -1 : +1);
+      child = x;
+    }
+    int a = (s->left == child) ? -1 : +1;
+    node_base * r = child;
+
+    // balancing act
+    if (s->balance () == 0) {
+      s->set_balance (a);
+    } else if (s->balance () == -a) {
+      s->set_balance (0);
+    } else {
+      if (r->balance () == a) {
+        // single rotation
+        if (a == -1) {
+          p = detail::rotate_right (s);
+        } else {
+          p = detail::rotate_left (s);
+        }
+        s->set_balance (0);
+        r->set_balance (0);
+      } else {
+        // double rotation
+        if (a == -1) {
+          detail::rotate_left (r);
+          p = detail::rotate_right (s);
+        } else {
+          detail::rotate_right (r);
+          p = detail::rotate_left (s);
+        }
+        if (p->balance () == a) {
+          s->set_balance (-a);
+          r->set_balance (0);
+        } else if (p->balance () == -a) {
+          s->set_balance (0);
+          r->set_balance (a);
+        } else {
+          s->set_balance (0);
+          r->set_balance (0);
+        }
+        p->set_balance (0);
+      }
+    }
+    return iterator (q);
+  }
+
+  // Exchange the places of <x> and <y>, the rightmost node of <x>'s
+  // left subtree, so that the removal only ever unlinks a node with at
+  // most one child.  (avl.c swaps the keys instead, which would
+  // invalidate iterators here.)
+  void swap_with_predecessor (node_base * x, node_base * y)
+  {
+    node_base * xp = x->parent;
+    node_base * xl = x->left;
+    node_base * xr = x->right;
+    node_base * yp = y->parent;
+    node_base * yl = y->left;
+
+    std::swap (x->rank_and_balance, y->rank_and_balance);
+    if (xp->left == x) {
+      xp->left = y;
+    } else {
+      xp->right = y;
+    }
+    y->parent = xp;
+    y->right = xr;
+    xr->parent = y;
+    if (yp == x) {
+      y->left = x;
+      x->parent = y;
+    } else {
+      y->left = xl;
+      xl->parent = y;
+      yp->right = x;
+      x->parent = yp;
+    }
+    x->left = yl;
+    if (yl) {
+      yl->parent = x;
+    }
+    x->right = nullptr;
+  }
+
+  void remove_node (node_base * x)
+  {
+    if (x->left && x->right) {
+      node_base * y = x->left;
+      while (y->right) {
+        y = y->right;
+      }
+      swap_with_predecessor (x, y);
+    }
+
+    // every node with <x> in its left subtree loses one from its rank
+    node_base * child = x;
+    for (node_base * p = x->parent; p != &head_; p = p->parent) {
+      if (p->left == child) {
+        p->set_rank (p->rank () - 1);
+      }
+      child = p;
+    }
+
+    // now <x> has at most one child; scoot it into the place of <x>
+    node_base * x_child = x->left ? x->left : x->right;
+    node_base * p = x->parent;
+    int shortened_side;
+    if (x_child) {
+      x_child->parent = p;
+    }
+    if (p->left == x) {
+      p->left = x_child;
+      shortened_side = -1;
+    } else {
+      p->right = x_child;
+      shortened_side = +1;
+    }
+    destroy_node (x);
+    length_ = length_ - 1;
+
+    // climb back up the tree, rotating when necessary
+    while (p != &head_) {
+      int balance = p->balance () - shortened_side;
+      node_base * n;
+      if (balance == 0) {
+        p->set_balance (0);
+        n = p;
+      } else if (balance == 1 || balance == -1) {
+        p->set_balance (balance);
+        break;
+      } else {
+        n = detail::rebalance (p, balance);
+        if (n->balance () != 0) {
+          break;
+        }
+      }
+      p = n->parent;
+      shortened_side = (p->left == n) ? -1 : +1;
+    }
+  }
+
+  bool verify_node (node_base * n, size_type & count, int & height) const
+  {
+    size_type left_count = 0, right_count = 0;
+    int left_height = 0, right_height = 0;
+    if (n->left) {
+      if (n->left->parent != n || comp_ (key_of (n), key_of (n->left))
+          || !verify_node (n->left, left_count, left_height)) {
+        return false;
+      }
+    }
+    if (n->right) {
+      if (n->right->parent != n || comp_ (key_of (n->right), key_of (n))
+          || !verify_node (n->right, right_count, right_height)) {
+        return false;
+      }
+    }
+    if (right_height - left_height != n->balance ()
+        || n->rank () != left_count + 1) {
+      return false;
+    }
+    count = left_count + right_count + 1;
+    height = 1 + ((left_height > right_height) ? left_height : right_height);
+    return true;
+  }
+
+  Compare               comp_;
+  node_allocator        alloc_;
+  node_base             head_;
+  size_type             length_;
+};
+
+template <class Key, class Compare, class Alloc>
+void
+swap (ranked_tree<Key, Compare, Alloc> & a, ranked_tree<Key, Compare, Alloc> & b) noexcept
+{
+  a.swap (b);
+}
+
+} // namespace avl
+
+#endif // AVL_HPP
@@ -29,17 +29,51 @@ cdef extern from "avl.h":
     ctypedef int (*avl_free_key_fun_type)    (void * key)
     ctypedef int (*avl_key_printer_fun_type) (char *, void *)
 
+    ctypedef void * (*avl_alloc_fun_type) (void * alloc_arg, size_t size)
+    ctypedef void (*avl_dealloc_fun_type) (void * alloc_arg, void * block)
+
+    ctypedef struct avl_node_arena:
+        unsigned int                  slab_nodes
+        unsigned int                  node_size
+        unsigned int                  refcount
+
     ctypedef struct avl_tree:
         avl_node * root
         unsigned int                  length
         avl_key_compare_fun_type      compare_fun
         void *                        compare_arg
+        avl_node_arena *              arena
+        size_t                        value_offset
+        avl_free_key_fun_type         free_value_fun
+
+    cdef void * AVL_NODE_VALUE(avl_tree * t, avl_node * n)
 
     cdef avl_tree * avl_new_avl_tree(
         avl_key_compare_fun_type compare_fun, void * compare_arg)
 
     cdef avl_node * avl_new_avl_node (void * key, avl_node * parent)
 
+    cdef avl_node_arena * avl_new_node_arena (
+        unsigned int          slab_nodes,
+        avl_alloc_fun_type    alloc_fun,
+        avl_dealloc_fun_type  dealloc_fun,
+        void *                alloc_arg
+    )
+
+    cdef void avl_release_node_arena (avl_node_arena * arena)
+
+    cdef int avl_tree_use_arena (avl_tree * tree, avl_node_arena * arena)
+
+    cdef int avl_tree_move_to_arena (avl_tree * tree, avl_node_arena * arena)
+
+    cdef int avl_tree_use_values (
+        avl_tree * tree, avl_free_key_fun_type free_value_fun)
+
+    cdef avl_node * avl_new_tree_node (
+        avl_tree * tree, void * key, avl_node * parent)
+
+    cdef void avl_free_tree_node (avl_tree * tree, avl_node * node)
+
     cdef void avl_free_avl_tree (
         avl_tree *            tree,
         avl_free_key_fun_type free_key_fun
@@ -51,12 +85,63 @@ cdef extern from "avl.h":
         unsigned int *        index
     )
 
+    cdef int avl_insert_unique (
+        avl_tree *            tree,
+        void *                key,
+        unsigned int *        index,
+        void **               value_address
+    )
+
+    cdef int avl_upsert (
+        avl_tree *            tree,
+        void *                key,
+        void *                value,
+        unsigned int *        index
+    )
+
     cdef int avl_remove_by_key (
         avl_tree *            tree,
         void *                key,
         avl_free_key_fun_type free_key_fun
     )
 
+    cdef int avl_insert_kv (
+        avl_tree *            tree,
+        void *                key,
+        void *                value,
+        unsigned int *        index
+    )
+
+    cdef int avl_get_value_by_key (
+        avl_tree *            tree,
+        void *                key,
+        void **               value_address
+    )
+
+    cdef int avl_get_value_by_index (
+        avl_tree *            tree,
+        unsigned int          index,
+        void **               value_address
+    )
+
+    cdef int avl_set_value_by_key (
+        avl_tree *            tree,
+        void *                key,
+        void *                value
+    )
+
+    cdef int avl_insert_by_index (
+        avl_tree *            tree,
+        void *                key,
+        unsigned int          index
+    )
+
+    cdef int avl_remove_by_index (
+        avl_tree *            tree,
+        unsigned int          index,
+        avl_free_key_fun_type free_key_fun
+    )
+
     cdef int avl_get_item_by_index (
         avl_tree *            tree,
         unsigned int          index,
@@ -69,6 +154,10 @@ cdef extern from "avl.h":
         void **               value_address
     )
 
+    cdef unsigned int avl_lower_bound_index (avl_tree * tree, void * key)
+
+    cdef unsigned int avl_upper_bound_index (avl_tree * tree, void * key)
+
     cdef int avl_get_span_by_key (
         avl_tree *            tree,
         void *                key,
@@ -84,6 +173,55 @@ cdef extern from "avl.h":
         unsigned int *        high
     )
 
+    cdef int avl_split_by_key (
+        avl_tree *            tree,
+        void *                key,
+        avl_tree *            right
+    )
+
+    cdef int avl_split_by_index (
+        avl_tree *            tree,
+        unsigned int          index,
+        avl_tree *            right
+    )
+
+    cdef int avl_join (
+        avl_tree *            left,
+        avl_tree *            right
+    )
+
+    cdef int avl_remove_index_range (
+        avl_tree *            tree,
+        unsigned int          low,
+        unsigned int          high,
+        avl_free_key_fun_type free_key_fun
+    )
+
+    cdef int avl_remove_key_range (
+        avl_tree *            tree,
+        void *                low_key,
+        void *                high_key,
+        avl_free_key_fun_type free_key_fun
+    )
+
+    cdef int avl_union (
+        avl_tree *            a,
+        avl_tree *            b,
+        avl_free_key_fun_type free_key_fun
+    )
+
+    cdef int avl_intersection (
+        avl_tree *            a,
+        avl_tree *            b,
+        avl_free_key_fun_type free_key_fun
+    )
+
+    cdef int avl_difference (
+        avl_tree *            a,
+        avl_tree *            b,
+        avl_free_key_fun_type free_key_fun
+    )
+
     cdef int avl_verify (avl_tree * tree)
 
     cdef void avl_print_tree (
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/* for posix_memalign() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <sched.h>
+
+#include "avl_combining.h"
+
+#define AVL_COMBINING_INSERT    1
+#define AVL_COMBINING_REMOVE    2
+
+/* how many times a combiner looks for more work before giving up the lock */
+#define AVL_COMBINING_PASSES    4
+
+static
+int
+avl_combining_no_free (void * key)
+{
+  return 0;
+}
+
+static
+void
+avl_combining_slot_exit (void * slot)
+{
+  /* the slot is kept, for the next thread to register */
+  __atomic_store_n (&((avl_combining_slot *) slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+avl_combining_tree *
+avl_new_combining_tree (avl_key_compare_fun_type compare_fun,
+                        void * compare_arg,
+                        avl_free_key_fun_type free_key_fun)
+{
+  avl_combining_tree * t = (avl_combining_tree *) malloc (sizeof (avl_combining_tree));
+
+  if (!t) {
+    return NULL;
+  }
+  t->tree = avl_new_avl_tree (compare_fun, compare_arg);
+  if (!t->tree) {
+    free (t);
+    return NULL;
+  }
+  if (pthread_key_create (&t->slot_key, avl_combining_slot_exit) != 0) {
+    avl_free_avl_tree (t->tree, NULL);
+    free (t);
+    return NULL;
+  }
+  t->free_key_fun = free_key_fun;
+  t->slots = NULL;
+  pthread_mutex_init (&t->lock, NULL);
+  pthread_mutex_init (&t->slots_lock, NULL);
+  return t;
+}
+
+void
+avl_free_combining_tree (avl_combining_tree * tree)
+{
+  while (tree->slots) {
+    avl_combining_slot * next = tree->slots->next;
+    free (tree->slots);
+    tree->slots = next;
+  }
+  pthread_key_delete (tree->slot_key);
+  pthread_mutex_destroy (&tree->slots_lock);
+  pthread_mutex_destroy (&tree->lock);
+  avl_free_avl_tree (tree->tree, tree->free_key_fun);
+  free (tree);
+}
+
+/* find or make the calling thread's slot */
+
+static
+avl_combining_slot *
+avl_combining_get_slot (avl_combining_tree * tree)
+{
+  avl_combining_slot * s = (avl_combining_slot *) pthread_getspecific (tree->slot_key);
+
+  if (s) {
+    return s;
+  }
+  pthread_mutex_lock (&tree->slots_lock);
+  for (s = tree->slots; s; s = s->next) {
+    if (!__atomic_load_n (&s->in_use, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+  }
+  if (!s) {
+    /* a cache line each, so that posting a request disturbs no one else */
+    void * block;
+    if (posix_memalign (&block, 64, sizeof (avl_combining_slot)) == 0) {
+      s = (avl_combining_slot *) block;
+      s->pending = 0;
+      s->next = tree->slots;
+      __atomic_store_n (&tree->slots, s, __ATOMIC_RELEASE);
+    }
+  }
+  if (s) {
+    s->in_use = 1;
+    if (pthread_setspecific (tree->slot_key, s) != 0) {
+      s->in_use = 0;
+      s = NULL;
+    }
+  }
+  pthread_mutex_unlock (&tree->slots_lock);
+  return s;
+}
+
+/* merge sort the batch by key */
+
+static
+avl_combining_slot *
+avl_combining_sort (avl_tree * tree,
+                    avl_combining_slot * batch,
+                    unsigned int length)
+{
+  avl_combining_slot * left, * right, * result, ** link;
+  unsigned int i;
+
+  if (length < 2) {
+    return batch;
+  }
+  /* cut the list in two */
+  right = batch;
+  for (i = 1; i < length / 2; i++) {
+    right = right->batch_next;
+  }
+  left = batch;
+  batch = right->batch_next;
+  right->batch_next = NULL;
+  left = avl_combining_sort (tree, left, length / 2);
+  right = avl_combining_sort (tree, batch, length - (length / 2));
+  link = &result;
+  while (left && right) {
+    if (tree->compare_fun (tree->compare_arg, right->key, left->key) < 0) {
+      *link = right;
+      right = right->batch_next;
+    } else {
+      *link = left;
+      left = left->batch_next;
+    }
+    link = &(*link)->batch_next;
+  }
+  *link = left ? left : right;
+  return result;
+}
+
+/* serve every posted request; the caller holds the lock */
+
+static
+void
+avl_combining_combine (avl_combining_tree * tree)
+{
+  avl_free_key_fun_type free_key_fun =
+    tree->free_key_fun ? tree->free_key_fun : avl_combining_no_free;
+  unsigned int pass;
+
+  for (pass = 0; pass < AVL_COMBINING_PASSES; pass++) {
+    avl_combining_slot * s, * batch = NULL;
+    unsigned int length = 0;
+    for (s = __atomic_load_n (&tree->slots, __ATOMIC_ACQUIRE); s; s = s->next) {
+      if (__atomic_load_n (&s->pending, __ATOMIC_ACQUIRE)) {
+        s->batch_next = batch;
+        batch = s;
+        length++;
+      }
+    }
+    if (!batch) {
+      break;
+    }
+    batch = avl_combining_sort (tree->tree, batch, length);
+    while (batch) {
+      avl_combining_slot * next = batch->batch_next;
+      if (batch->op == AVL_COMBINING_INSERT) {
+        batch->index = 0;
+        batch->result = avl_insert_by_key (tree->tree, batch->key, &batch->index);
+      } else {
+        batch->result = avl_remove_by_key (tree->tree, batch->key, free_key_fun);
+      }
+      /* the owner may reuse the slot as soon as it sees this */
+      __atomic_store_n (&batch->pending, 0, __ATOMIC_RELEASE);
+      batch = next;
+    }
+  }
+}
+
+static
+int
+avl_combining_submit (avl_combining_tree * tree,
+                      int op,
+                      void * key,
+                      unsigned int * index)
+{
+  avl_combining_slot * s = avl_combining_get_slot (tree);
+
+  if (!s) {
+    return -1;
+  }
+  s->op = op;
+  s->key = key;
+  __atomic_store_n (&s->pending, 1, __ATOMIC_RELEASE);
+  while (__atomic_load_n (&s->pending, __ATOMIC_ACQUIRE)) {
+    if (pthread_mutex_trylock (&tree->lock) == 0) {
+      avl_combining_combine (tree);
+      pthread_mutex_unlock (&tree->lock);
+    } else {
+      sched_yield ();
+    }
+  }
+  if (index) {
+    *index = s->index;
+  }
+  return s->result;
+}
+
+int
+avl_combining_insert_by_key (avl_combining_tree * tree,
+                             void * key,
+                             unsigned int * index)
+{
+  return avl_combining_submit (tree, AVL_COMBINING_INSERT, key, index);
+}
+
+int
+avl_combining_remove_by_key (avl_combining_tree * tree, void * key)
+{
+  return avl_combining_submit (tree, AVL_COMBINING_REMOVE, key, NULL);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A flat-combining front-end for one avl_tree shared by many writers.
+ *
+ * Rather than each thread taking a lock and walking the tree from its
+ * own core, a thread posts its request in a slot of its own and then
+ * either waits for it to be served or, if the tree's lock is free,
+ * becomes the combiner: it gathers every posted request, sorts them by
+ * key so that neighbouring requests walk the same path, and applies
+ * them all while the tree is warm in its cache.
+ *
+ * Each thread is registered with the front-end on its first call.  The
+ * tree itself may be read or changed directly by whoever holds
+ * <lock>.  Free the front-end only once no thread is using it.
+ */
+
+#ifndef AVL_COMBINING_H
+#define AVL_COMBINING_H
+
+#include <pthread.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_combining_slot {
+  /* the request, written by its owner */
+  int                           op;
+  void *                        key;
+  /* the answer, written by the combiner */
+  int                           result;
+  unsigned int                  index;
+  int                           pending;        /* set by the owner, cleared by the combiner */
+  int                           in_use;
+  struct _avl_combining_slot *  next;
+  struct _avl_combining_slot *  batch_next;     /* the combiner's batch */
+} avl_combining_slot;
+
+typedef struct _avl_combining_tree {
+  avl_tree *                    tree;
+  avl_free_key_fun_type         free_key_fun;
+  pthread_mutex_t               lock;           /* held by the combiner */
+  avl_combining_slot *          slots;
+  pthread_mutex_t               slots_lock;
+  pthread_key_t                 slot_key;
+} avl_combining_tree;
+
+/* <free_key_fun> releases removed keys and may be NULL */
+
+avl_combining_tree * avl_new_combining_tree (
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg,
+  avl_free_key_fun_type free_key_fun
+  );
+
+void avl_free_combining_tree (avl_combining_tree * tree);
+
+int avl_combining_insert_by_key (
+  avl_combining_tree *  tree,
+  void *                key,
+  unsigned int *        index
+  );
+
+int avl_combining_remove_by_key (
+  avl_combining_tree *  tree,
+  void *                key
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_COMBINING_H */
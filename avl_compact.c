@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * The compact, index-linked tree.  The algorithms are those of avl.c:
+ * insertion climbs back up from the new leaf, and removal searches
+ * without touching the tree before fixing the ranks on the way back up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_compact.h"
+
+#define AVL_COMPACT_NODE(t,i)   (&(t)->nodes[i])
+#define AVL_COMPACT_MIN_CAPACITY 64
+
+/* ranks use the upper 30 bits of <rank_and_balance> */
+#define AVL_COMPACT_MAX_LENGTH  ((1U << 30) - 1)
+
+avl_compact_tree *
+avl_new_compact_tree (avl_key_compare_fun_type compare_fun,
+                      void * compare_arg)
+{
+  avl_compact_tree * t = (avl_compact_tree *) malloc (sizeof (avl_compact_tree));
+
+  if (!t) {
+    return NULL;
+  }
+  t->nodes = (avl_compact_node *) malloc (
+    AVL_COMPACT_MIN_CAPACITY * sizeof (avl_compact_node)
+    );
+  if (!t->nodes) {
+    free (t);
+    return NULL;
+  }
+  t->capacity = AVL_COMPACT_MIN_CAPACITY;
+  t->used = 1;
+  t->free_list = 0;
+  t->length = 0;
+  t->compare_fun = compare_fun;
+  t->compare_arg = compare_arg;
+  /* the head */
+  t->nodes[0].key = NULL;
+  t->nodes[0].left = 0;
+  t->nodes[0].right = 0;
+  t->nodes[0].parent = 0;
+  t->nodes[0].rank_and_balance = 0;
+  AVL_SET_BALANCE (&t->nodes[0], 0);
+  return t;
+}
+
+static
+int
+free_compact_tree_helper (avl_compact_tree * tree,
+                          uint32_t node,
+                          avl_free_key_fun_type free_key_fun)
+{
+  avl_compact_node * n = AVL_COMPACT_NODE (tree, node);
+
+  if (n->left) {
+    free_compact_tree_helper (tree, n->left, free_key_fun);
+  }
+  free_key_fun (n->key);
+  if (n->right) {
+    free_compact_tree_helper (tree, n->right, free_key_fun);
+  }
+  return 0;
+}
+
+void
+avl_free_compact_tree (avl_compact_tree * tree,
+                       avl_free_key_fun_type free_key_fun)
+{
+  if (tree->length && free_key_fun) {
+    free_compact_tree_helper (tree, tree->nodes[0].right, free_key_fun);
+  }
+  free (tree->nodes);
+  free (tree);
+}
+
+static
+int
+avl_compact_grow (avl_compact_tree * tree, uint32_t capacity)
+{
+  avl_compact_node * nodes;
+
+  if (capacity <= tree->capacity) {
+    return 0;
+  }
+  nodes = (avl_compact_node *) realloc (
+    tree->nodes, (size_t) capacity * sizeof (avl_compact_node)
+    );
+  if (!nodes) {
+    return -1;
+  }
+  tree->nodes = nodes;
+  tree->capacity = capacity;
+  return 0;
+}
+
+int
+avl_compact_reserve (avl_compact_tree * tree, unsigned int count)
+{
+  if (count > AVL_COMPACT_MAX_LENGTH) {
+    return -1;
+  }
+  /* one extra for the head */
+  return avl_compact_grow (tree, count + 1);
+}
+
+/* returns the index of a fresh node, or 0 on failure */
+
+static
+uint32_t
+avl_compact_new_node (avl_compact_tree * tree, void * key, uint32_t parent)
+{
+  avl_compact_node * n;
+  uint32_t node;
+
+  if (tree->length >= AVL_COMPACT_MAX_LENGTH) {
+    return 0;
+  }
+  if (tree->free_list) {
+    node = tree->free_list;
+    tree->free_list = tree->nodes[node].right;
+  } else {
+    if (tree->used == tree->capacity) {
+      uint32_t capacity = tree->capacity * 2;
+      if (capacity > AVL_COMPACT_MAX_LENGTH + 1) {
+        capacity = AVL_COMPACT_MAX_LENGTH + 1;
+      }
+      if (avl_compact_grow (tree, capacity) != 0) {
+        return 0;
+      }
+    }
+    node = tree->used++;
+  }
+  n = AVL_COMPACT_NODE (tree, node);
+  n->key = key;
+  n->left = 0;
+  n->right = 0;
+  n->parent = parent;
+  n->rank_and_balance = 0;
+  AVL_SET_RANK (n, 1);
+  AVL_SET_BALANCE (n, 0);
+  return node;
+}
+
+static
+void
+avl_compact_free_node (avl_compact_tree * tree, uint32_t node)
+{
+  tree->nodes[node].right = tree->free_list;
+  tree->free_list = node;
+}
+
+/* rotations fix links, parents and ranks, but leave balances alone */
+
+static
+uint32_t
+avl_compact_rotate_left (avl_compact_tree * tree, uint32_t p)
+{
+  avl_compact_node * pn = AVL_COMPACT_NODE (tree, p);
+  uint32_t q = pn->right;
+  avl_compact_node * qn = AVL_COMPACT_NODE (tree, q);
+  uint32_t top = pn->parent;
+  avl_compact_node * tn = AVL_COMPACT_NODE (tree, top);
+
+  pn->right = qn->left;
+  if (qn->left) {
+    tree->nodes[qn->left].parent = p;
+  }
+  qn->left = p;
+  qn->parent = top;
+  pn->parent = q;
+  if (tn->left == p) {
+    tn->left = q;
+  } else {
+    tn->right = q;
+  }
+  AVL_SET_RANK (qn, (AVL_GET_RANK (qn) + AVL_GET_RANK (pn)));
+  return q;
+}
+
+static
+uint32_t
+avl_compact_rotate_right (avl_compact_tree * tree, uint32_t p)
+{
+  avl_compact_node * pn = AVL_COMPACT_NODE (tree, p);
+  uint32_t q = pn->left;
+  avl_compact_node * qn = AVL_COMPACT_NODE (tree, q);
+  uint32_t top = pn->parent;
+  avl_compact_node * tn = AVL_COMPACT_NODE (tree, top);
+
+  pn->left = qn->right;
+  if (qn->right) {
+    tree->nodes[qn->right].parent = p;
+  }
+  qn->right = p;
+  qn->parent = top;
+  pn->parent = q;
+  if (tn->left == p) {
+    tn->left = q;
+  } else {
+    tn->right = q;
+  }
+  AVL_SET_RANK (pn, (AVL_GET_RANK (pn) - AVL_GET_RANK (qn)));
+  return q;
+}
+
+/* see avl_rebalance in avl.c */
+
+static
+uint32_t
+avl_compact_rebalance (avl_compact_tree * tree, uint32_t p, int balance)
+{
+  avl_compact_node * pn = AVL_COMPACT_NODE (tree, p);
+  avl_compact_node * qn, * rn;
+  uint32_t q, r;
+  int qb, rb;
+
+  if (balance > 0) {
+    q = pn->right;
+    qn = AVL_COMPACT_NODE (tree, q);
+    qb = AVL_GET_BALANCE (qn);
+    if (qb < 0) {
+      /* double rotation */
+      r = qn->left;
+      rn = AVL_COMPACT_NODE (tree, r);
+      rb = AVL_GET_BALANCE (rn);
+      avl_compact_rotate_right (tree, q);
+      avl_compact_rotate_left (tree, p);
+      AVL_SET_BALANCE (pn, ((rb > 0) ? -1 : 0));
+      AVL_SET_BALANCE (qn, ((rb < 0) ? +1 : 0));
+      AVL_SET_BALANCE (rn, 0);
+      return r;
+    } else {
+      avl_compact_rotate_left (tree, p);
+      AVL_SET_BALANCE (pn, ((qb == 0) ? +1 : 0));
+      AVL_SET_BALANCE (qn, ((qb == 0) ? -1 : 0));
+      return q;
+    }
+  } else {
+    q = pn->left;
+    qn = AVL_COMPACT_NODE (tree, q);
+    qb = AVL_GET_BALANCE (qn);
+    if (qb > 0) {
+      /* double rotation */
+      r = qn->right;
+      rn = AVL_COMPACT_NODE (tree, r);
+      rb = AVL_GET_BALANCE (rn);
+      avl_compact_rotate_left (tree, q);
+      avl_compact_rotate_right (tree, p);
+      AVL_SET_BALANCE (pn, ((rb < 0) ? +1 : 0));
+      AVL_SET_BALANCE (qn, ((rb > 0) ? -1 : 0));
+      AVL_SET_BALANCE (rn, 0);
+      return r;
+    } else {
+      avl_compact_rotate_right (tree, p);
+      AVL_SET_BALANCE (pn, ((qb == 0) ? -1 : 0));
+      AVL_SET_BALANCE (qn, ((qb == 0) ? +1 : 0));
+      return q;
+    }
+  }
+}
+
+/* the subtree at <node> has grown by one level */
+
+static
+void
+avl_compact_propagate_growth (avl_compact_tree * tree, uint32_t node)
+{
+  uint32_t p;
+
+  while ((p = tree->nodes[node].parent) != 0) {
+    avl_compact_node * pn = AVL_COMPACT_NODE (tree, p);
+    int balance = AVL_GET_BALANCE (pn) + ((pn->left == node) ? -1 : +1);
+    if (balance == 0) {
+      AVL_SET_BALANCE (pn, 0);
+      return;
+    } else if ((balance == 1) || (balance == -1)) {
+      AVL_SET_BALANCE (pn, balance);
+      node = p;
+    } else {
+      node = avl_compact_rebalance (tree, p, balance);
+      if (AVL_GET_BALANCE (AVL_COMPACT_NODE (tree, node)) == 0) {
+        return;
+      }
+    }
+  }
+}
+
+/* the <shortened_side> subtree of <p> has lost a level */
+
+static
+void
+avl_compact_propagate_shrink (avl_compact_tree * tree,
+                              uint32_t p,
+                              int shortened_side)
+{
+  while (p != 0) {
+    avl_compact_node * pn = AVL_COMPACT_NODE (tree, p);
+    int balance = AVL_GET_BALANCE (pn) - shortened_side;
+    uint32_t node;
+    if (balance == 0) {
+      AVL_SET_BALANCE (pn, 0);
+      node = p;
+    } else if ((balance == 1) || (balance == -1)) {
+      AVL_SET_BALANCE (pn, balance);
+      return;
+    } else {
+      node = avl_compact_rebalance (tree, p, balance);
+      if (AVL_GET_BALANCE (AVL_COMPACT_NODE (tree, node)) != 0) {
+        return;
+      }
+    }
+    p = tree->nodes[node].parent;
+    shortened_side = (tree->nodes[p].left == node) ? -1 : +1;
+  }
+}
+
+int
+avl_compact_insert_by_key (avl_compact_tree * tree,
+                           void * key,
+                           unsigned int * index)
+{
+  /* allocate first: growing the pool moves every node */
+  uint32_t node = avl_compact_new_node (tree, key, 0);
+  uint32_t x = tree->nodes[0].right;
+  unsigned int i = 0;
+
+  if (!node) {
+    return -1;
+  }
+  if (!x) {
+    tree->nodes[0].right = node;
+  } else {
+    while (1) {
+      avl_compact_node * xn = AVL_COMPACT_NODE (tree, x);
+      if (tree->compare_fun (tree->compare_arg, key, xn->key) < 1) {
+        AVL_SET_RANK (xn, (AVL_GET_RANK (xn) + 1));
+        if (!xn->left) {
+          xn->left = node;
+          break;
+        }
+        x = xn->left;
+      } else {
+        i += AVL_GET_RANK (xn);
+        if (!xn->right) {
+          xn->right = node;
+          break;
+        }
+        x = xn->right;
+      }
+    }
+    tree->nodes[node].parent = x;
+    avl_compact_propagate_growth (tree, node);
+  }
+  tree->length = tree->length + 1;
+  if (index) {
+    *index = i;
+  }
+  return 0;
+}
+
+int
+avl_compact_remove_by_key (avl_compact_tree * tree,
+                           void * key,
+                           avl_free_key_fun_type free_key_fun)
+{
+  uint32_t x = tree->nodes[0].right;
+  uint32_t c, p, child;
+  avl_compact_node * xn;
+  int shortened_side;
+
+  /* find the node, leaving the tree untouched in case it is absent */
+  while (1) {
+    int compare_result;
+    if (!x) {
+      return -1;
+    }
+    xn = AVL_COMPACT_NODE (tree, x);
+    compare_result = tree->compare_fun (tree->compare_arg, key, xn->key);
+    if (compare_result < 0) {
+      x = xn->left;
+    } else if (compare_result > 0) {
+      x = xn->right;
+    } else {
+      break;
+    }
+  }
+  /* every ancestor that <x> hangs to the left of loses a rank */
+  for (c = x; (p = tree->nodes[c].parent) != 0; c = p) {
+    if (tree->nodes[p].left == c) {
+      AVL_SET_RANK (&tree->nodes[p], (AVL_GET_RANK (&tree->nodes[p]) - 1));
+    }
+  }
+  if (free_key_fun) {
+    free_key_fun (xn->key);
+  }
+  if (xn->left && xn->right) {
+    /* trade places with the immediate predecessor <y> */
+    uint32_t y = xn->left;
+    while (tree->nodes[y].right) {
+      y = tree->nodes[y].right;
+    }
+    xn->key = tree->nodes[y].key;
+    AVL_SET_RANK (xn, (AVL_GET_RANK (xn) - 1));
+    x = y;
+    xn = AVL_COMPACT_NODE (tree, x);
+  }
+  /* now <x> has at most one child */
+  child = xn->left ? xn->left : xn->right;
+  p = xn->parent;
+  if (child) {
+    tree->nodes[child].parent = p;
+  }
+  if (tree->nodes[p].left == x) {
+    tree->nodes[p].left = child;
+    shortened_side = -1;
+  } else {
+    tree->nodes[p].right = child;
+    shortened_side = +1;
+  }
+  avl_compact_free_node (tree, x);
+  tree->length = tree->length - 1;
+  avl_compact_propagate_shrink (tree, p, shortened_side);
+  return 0;
+}
+
+int
+avl_compact_get_item_by_index (avl_compact_tree * tree,
+                               unsigned int index,
+                               void ** value_address)
+{
+  uint32_t p = tree->nodes[0].right;
+  unsigned int m = index + 1;
+
+  while (p) {
+    avl_compact_node * pn = AVL_COMPACT_NODE (tree, p);
+    if (m < AVL_GET_RANK (pn)) {
+      p = pn->left;
+    } else if (m > AVL_GET_RANK (pn)) {
+      m = m - AVL_GET_RANK (pn);
+      p = pn->right;
+    } else {
+      *value_address = pn->key;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int
+avl_compact_get_item_by_key (avl_compact_tree * tree,
+                             void * key,
+                             void ** value_address)
+{
+  uint32_t x = tree->nodes[0].right;
+
+  while (x) {
+    avl_compact_node * xn = AVL_COMPACT_NODE (tree, x);
+    int compare_result = tree->compare_fun (tree->compare_arg, key, xn->key);
+    if (compare_result < 0) {
+      x = xn->left;
+    } else if (compare_result > 0) {
+      x = xn->right;
+    } else {
+      *value_address = xn->key;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static
+int
+iterate_compact_helper (avl_compact_tree * tree,
+                        uint32_t node,
+                        avl_iter_fun_type iter_fun,
+                        void * iter_arg)
+{
+  avl_compact_node * n = AVL_COMPACT_NODE (tree, node);
+  int result;
+
+  if (n->left) {
+    result = iterate_compact_helper (tree, n->left, iter_fun, iter_arg);
+    if (result != 0) {
+      return result;
+    }
+  }
+  result = iter_fun (n->key, iter_arg);
+  if (result != 0) {
+    return result;
+  }
+  if (n->right) {
+    return iterate_compact_helper (tree, n->right, iter_fun, iter_arg);
+  }
+  return 0;
+}
+
+int
+avl_compact_iterate_inorder (avl_compact_tree * tree,
+                             avl_iter_fun_type iter_fun,
+                             void * iter_arg)
+{
+  if (tree->length) {
+    return iterate_compact_helper (tree, tree->nodes[0].right, iter_fun, iter_arg);
+  }
+  return 0;
+}
+
+/* returns the height of <node>, and sets *<size> to its item count */
+
+static
+int
+avl_compact_verify_node (avl_compact_tree * tree,
+                         uint32_t node,
+                         uint32_t parent,
+                         unsigned int * size)
+{
+  avl_compact_node * n;
+  unsigned int left_size = 0, right_size = 0;
+  int lh, rh;
+
+  if (!node) {
+    *size = 0;
+    return 0;
+  }
+  n = AVL_COMPACT_NODE (tree, node);
+  if (n->parent != parent) {
+    fprintf (stderr, "invalid parent at node %u\n", node);
+    exit (1);
+  }
+  lh = avl_compact_verify_node (tree, n->left, node, &left_size);
+  rh = avl_compact_verify_node (tree, n->right, node, &right_size);
+  if ((rh - lh) != AVL_GET_BALANCE (n)) {
+    fprintf (stderr, "invalid balance at node %u\n", node);
+    exit (1);
+  }
+  if (AVL_GET_RANK (n) != left_size + 1) {
+    fprintf (stderr, "invalid rank at node %u\n", node);
+    exit (1);
+  }
+  *size = left_size + right_size + 1;
+  return 1 + ((lh > rh) ? lh : rh);
+}
+
+/* sanity-check the tree */
+
+int
+avl_compact_verify (avl_compact_tree * tree)
+{
+  unsigned int size;
+
+  avl_compact_verify_node (tree, tree->nodes[0].right, 0, &size);
+  if (size != tree->length) {
+    fprintf (stderr, "invalid length %u, counted %u\n", tree->length, size);
+    exit (1);
+  }
+  return 0;
+}
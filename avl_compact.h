@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A compact variant of the tree for very large collections.  Nodes live
+ * in one contiguous pool and link to each other by 32-bit indices, so a
+ * node takes 24 bytes on a 64-bit machine instead of 40 plus malloc
+ * overhead.  Slot 0 of the pool is the head node, whose <right> is the
+ * root; a <left> or <right> of 0 means no child.
+ *
+ * Rank and balance are packed as in avl_node, so the AVL_GET_/AVL_SET_
+ * macros apply, and a tree holds at most 2^30 - 1 items.  Growing the
+ * pool moves it, so node indices are stable but node addresses are not.
+ */
+
+#ifndef AVL_COMPACT_H
+#define AVL_COMPACT_H
+
+#include <stdint.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_compact_node {
+  void *                key;
+  uint32_t              left;
+  uint32_t              right;
+  uint32_t              parent;
+  uint32_t              rank_and_balance;
+} avl_compact_node;
+
+typedef struct _avl_compact_tree {
+  avl_compact_node *    nodes;
+  uint32_t              capacity;
+  uint32_t              used;           /* slots ever handed out */
+  uint32_t              free_list;      /* threaded through <right> */
+  unsigned int          length;
+  avl_key_compare_fun_type compare_fun;
+  void *                compare_arg;
+} avl_compact_tree;
+
+avl_compact_tree * avl_new_compact_tree (
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg
+  );
+
+void avl_free_compact_tree (
+  avl_compact_tree *    tree,
+  avl_free_key_fun_type free_key_fun
+  );
+
+/* make room for <count> items in all, so that inserts do not regrow the pool */
+
+int avl_compact_reserve (
+  avl_compact_tree *    tree,
+  unsigned int          count
+  );
+
+int avl_compact_insert_by_key (
+  avl_compact_tree *    tree,
+  void *                key,
+  unsigned int *        index
+  );
+
+int avl_compact_remove_by_key (
+  avl_compact_tree *    tree,
+  void *                key,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_compact_get_item_by_index (
+  avl_compact_tree *    tree,
+  unsigned int          index,
+  void **               value_address
+  );
+
+int avl_compact_get_item_by_key (
+  avl_compact_tree *    tree,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_compact_iterate_inorder (
+  avl_compact_tree *    tree,
+  avl_iter_fun_type     iter_fun,
+  void *                iter_arg
+  );
+
+int avl_compact_verify (avl_compact_tree * tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_COMPACT_H */
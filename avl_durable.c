@@ -0,0 +1,645 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * Both files start with a header holding a record number: for the log,
+ * that of the record before its first one; for a checkpoint, that of
+ * the last record it includes.  A log record is an op byte, the key's
+ * size (4 bytes), the key, and a checksum of all three (4 bytes); a
+ * checkpoint is the header and then each key as its size and bytes.
+ *
+ * A checkpoint is renamed into place before the new log is, so a crash
+ * in between leaves an old log whose records the checkpoint already
+ * holds, and recovery skips them by number.
+ */
+
+/* for fdatasync(), fileno(), ftruncate() and strdup() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "avl_durable.h"
+
+#define AVL_DURABLE_INSERT      'I'
+#define AVL_DURABLE_REMOVE      'R'
+
+/* op, size and checksum */
+#define AVL_DURABLE_RECORD_OVERHEAD     9
+
+typedef struct _avl_durable_header {
+  char                  magic[8];
+  uint64_t              sequence;
+  uint64_t              count;          /* keys in a checkpoint */
+} avl_durable_header;
+
+static
+int
+avl_durable_no_free (void * key)
+{
+  return 0;
+}
+
+/* FNV-1a */
+
+static
+uint32_t
+avl_durable_checksum (const unsigned char * data, size_t size)
+{
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static
+int
+avl_durable_reserve (avl_durable_buffer * b, size_t extra)
+{
+  if (b->size + extra > b->capacity) {
+    size_t capacity = b->capacity ? b->capacity : 4096;
+    unsigned char * data;
+    while (capacity < b->size + extra) {
+      capacity = capacity * 2;
+    }
+    data = (unsigned char *) realloc (b->data, capacity);
+    if (!data) {
+      return -1;
+    }
+    b->data = data;
+    b->capacity = capacity;
+  }
+  return 0;
+}
+
+/* encode <key> at the end of <b>, after <prefix> bytes of room */
+
+static
+int
+avl_durable_encode (avl_durable_tree * tree,
+                    avl_durable_buffer * b,
+                    size_t prefix,
+                    void * key,
+                    uint32_t * size)
+{
+  size_t room;
+
+  if (avl_durable_reserve (b, prefix + 64) != 0) {
+    return -1;
+  }
+  room = b->capacity - b->size - prefix;
+  *size = tree->encode_fun (key, b->data + b->size + prefix, room);
+  if (*size > room) {
+    if (avl_durable_reserve (b, prefix + *size) != 0) {
+      return -1;
+    }
+    tree->encode_fun (key, b->data + b->size + prefix, *size);
+  }
+  return 0;
+}
+
+static
+int
+avl_durable_append (avl_durable_tree * tree, int op, void * key)
+{
+  avl_durable_buffer * b = &tree->pending;
+  unsigned char * record;
+  uint32_t size, sum;
+
+  if (avl_durable_encode (tree, b, 5, key, &size) != 0) {
+    return -1;
+  }
+  if (avl_durable_reserve (b, AVL_DURABLE_RECORD_OVERHEAD + size) != 0) {
+    return -1;
+  }
+  record = b->data + b->size;
+  record[0] = (unsigned char) op;
+  memcpy (record + 1, &size, 4);
+  sum = avl_durable_checksum (record, 5 + size);
+  memcpy (record + 5 + size, &sum, 4);
+  b->size = b->size + AVL_DURABLE_RECORD_OVERHEAD + size;
+  return 0;
+}
+
+static
+int
+avl_durable_write_all (int fd, const unsigned char * data, size_t size)
+{
+  while (size) {
+    ssize_t n = write (fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data = data + n;
+    size = size - n;
+  }
+  return 0;
+}
+
+static
+char *
+avl_durable_temp_path (const char * path)
+{
+  size_t length = strlen (path);
+  char * temp = (char *) malloc (length + 5);
+
+  if (temp) {
+    memcpy (temp, path, length);
+    memcpy (temp + length, ".tmp", 5);
+  }
+  return temp;
+}
+
+/* sync the directory holding <path>, so that a rename into it lasts */
+
+static
+int
+avl_durable_sync_dir (const char * path)
+{
+  const char * slash = strrchr (path, '/');
+  size_t length = slash ? (size_t) (slash - path) : 0;
+  char * dir = (char *) malloc (length + 2);
+  int fd, result = -1;
+
+  if (!dir) {
+    return -1;
+  }
+  if (!slash) {
+    strcpy (dir, ".");
+  } else if (!length) {
+    strcpy (dir, "/");
+  } else {
+    memcpy (dir, path, length);
+    dir[length] = '\0';
+  }
+  fd = open (dir, O_RDONLY);
+  if (fd >= 0) {
+    result = fsync (fd);
+    close (fd);
+  }
+  free (dir);
+  return result;
+}
+
+/* replace the log with an empty one following record <sequence> */
+
+static
+int
+avl_durable_new_log (avl_durable_tree * tree, uint64_t sequence)
+{
+  avl_durable_header header;
+  char * temp = avl_durable_temp_path (tree->log_path);
+  int fd, result = -1;
+
+  if (!temp) {
+    return -1;
+  }
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, AVL_DURABLE_LOG_MAGIC, sizeof (AVL_DURABLE_LOG_MAGIC));
+  header.sequence = sequence;
+  fd = open (temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    if ((avl_durable_write_all (fd, (unsigned char *) &header, sizeof (header)) == 0)
+        && (fsync (fd) == 0)) {
+      result = 0;
+    }
+    close (fd);
+  }
+  if ((result == 0)
+      && ((rename (temp, tree->log_path) != 0) || (avl_durable_sync_dir (tree->log_path) != 0))) {
+    result = -1;
+  }
+  if (result != 0) {
+    remove (temp);
+  }
+  free (temp);
+  if (result == 0) {
+    fd = open (tree->log_path, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+      return -1;
+    }
+    if (tree->log_fd >= 0) {
+      close (tree->log_fd);
+    }
+    tree->log_fd = fd;
+  }
+  return result;
+}
+
+/*
+ * Write out every pending record with one sync.  Called with the lock
+ * held and no other writer syncing; the lock is dropped meanwhile.
+ */
+
+static
+void
+avl_durable_flush (avl_durable_tree * tree)
+{
+  avl_durable_buffer swap = tree->writing;
+  uint64_t target = tree->sequence;
+  int result;
+
+  tree->writing = tree->pending;
+  tree->pending = swap;
+  tree->pending.size = 0;
+  tree->syncing = 1;
+  pthread_mutex_unlock (&tree->lock);
+  result = avl_durable_write_all (tree->log_fd, tree->writing.data, tree->writing.size);
+  if (result == 0) {
+    result = fdatasync (tree->log_fd);
+  }
+  pthread_mutex_lock (&tree->lock);
+  tree->writing.size = 0;
+  if (result == 0) {
+    tree->synced = target;
+  } else {
+    tree->failed = 1;
+  }
+  tree->syncing = 0;
+  pthread_cond_broadcast (&tree->synced_cond);
+}
+
+/*
+ * Wait, with the lock held, for record <sequence> to reach the disk;
+ * the change is already in the tree, so failing to write it is
+ * AVL_DURABLE_UNSYNCED.
+ */
+
+static
+int
+avl_durable_commit (avl_durable_tree * tree, uint64_t sequence)
+{
+  while (!tree->failed && (tree->synced < sequence)) {
+    if (tree->syncing) {
+      pthread_cond_wait (&tree->synced_cond, &tree->lock);
+    } else {
+      avl_durable_flush (tree);
+    }
+  }
+  return (tree->synced < sequence) ? AVL_DURABLE_UNSYNCED : 0;
+}
+
+int
+avl_durable_insert_by_key (avl_durable_tree * tree,
+                           void * key,
+                           unsigned int * index)
+{
+  unsigned int local = 0;
+  size_t mark;
+  int result = -1;
+
+  pthread_mutex_lock (&tree->lock);
+  mark = tree->pending.size;
+  /*
+   * Change the tree now, before the lock is dropped to sync, so that
+   * it changes in the same order as the log.
+   */
+  if (!tree->failed && (avl_durable_append (tree, AVL_DURABLE_INSERT, key) == 0)) {
+    if (avl_insert_by_key (tree->tree, key, &local) == 0) {
+      tree->sequence = tree->sequence + 1;
+      result = avl_durable_commit (tree, tree->sequence);
+      if (index) {
+        *index = local;
+      }
+    } else {
+      tree->pending.size = mark;
+    }
+  }
+  pthread_mutex_unlock (&tree->lock);
+  return result;
+}
+
+int
+avl_durable_remove_by_key (avl_durable_tree * tree, void * key)
+{
+  avl_free_key_fun_type free_key_fun =
+    tree->free_key_fun ? tree->free_key_fun : avl_durable_no_free;
+  size_t mark;
+  int result = -1;
+
+  pthread_mutex_lock (&tree->lock);
+  mark = tree->pending.size;
+  /* encode first: the key may be the one that is freed */
+  if (!tree->failed && (avl_durable_append (tree, AVL_DURABLE_REMOVE, key) == 0)) {
+    if (avl_remove_by_key (tree->tree, key, free_key_fun) == 0) {
+      tree->sequence = tree->sequence + 1;
+      result = avl_durable_commit (tree, tree->sequence);
+    } else {
+      tree->pending.size = mark;
+    }
+  }
+  pthread_mutex_unlock (&tree->lock);
+  return result;
+}
+
+/* checkpoints */
+
+typedef struct _avl_durable_writer {
+  avl_durable_tree *    tree;
+  FILE *                f;
+  avl_durable_buffer    buffer;
+} avl_durable_writer;
+
+static
+int
+avl_durable_write_key (void * key, void * iter_arg)
+{
+  avl_durable_writer * w = (avl_durable_writer *) iter_arg;
+  uint32_t size;
+
+  w->buffer.size = 0;
+  if ((avl_durable_encode (w->tree, &w->buffer, 0, key, &size) != 0)
+      || (fwrite (&size, 4, 1, w->f) != 1)
+      || (fwrite (w->buffer.data, 1, size, w->f) != size)) {
+    return -1;
+  }
+  return 0;
+}
+
+int
+avl_durable_checkpoint (avl_durable_tree * tree)
+{
+  avl_durable_writer w;
+  avl_durable_header header;
+  char * temp = avl_durable_temp_path (tree->checkpoint_path);
+  int result = -1;
+
+  if (!temp) {
+    return -1;
+  }
+  pthread_mutex_lock (&tree->lock);
+  /* everything up to now must be in the log, and stay there */
+  while (!tree->failed && (tree->syncing || (tree->synced < tree->sequence))) {
+    avl_durable_commit (tree, tree->sequence);
+  }
+  if (tree->failed) {
+    goto done;
+  }
+  w.tree = tree;
+  w.buffer.data = NULL;
+  w.buffer.size = 0;
+  w.buffer.capacity = 0;
+  w.f = fopen (temp, "wb");
+  if (!w.f) {
+    goto done;
+  }
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, AVL_DURABLE_CHECKPOINT_MAGIC, sizeof (AVL_DURABLE_CHECKPOINT_MAGIC));
+  header.sequence = tree->sequence;
+  header.count = tree->tree->length;
+  if ((fwrite (&header, sizeof (header), 1, w.f) == 1)
+      && (avl_iterate_inorder (tree->tree, avl_durable_write_key, &w) == 0)
+      && (fflush (w.f) == 0)
+      && (fsync (fileno (w.f)) == 0)) {
+    result = 0;
+  }
+  free (w.buffer.data);
+  if (fclose (w.f) != 0) {
+    result = -1;
+  }
+  if ((result == 0)
+      && ((rename (temp, tree->checkpoint_path) != 0)
+          || (avl_durable_sync_dir (tree->checkpoint_path) != 0))) {
+    result = -1;
+  }
+  if (result != 0) {
+    remove (temp);
+    goto done;
+  }
+  /* should this fail, the old log carries on, its records all skipped */
+  result = avl_durable_new_log (tree, tree->sequence);
+ done:
+  pthread_mutex_unlock (&tree->lock);
+  free (temp);
+  return result;
+}
+
+/* recovery */
+
+static
+int
+avl_durable_read_checkpoint (avl_durable_tree * tree, uint64_t * sequence)
+{
+  avl_durable_header header;
+  avl_durable_buffer buffer = {NULL, 0, 0};
+  void ** keys = NULL;
+  uint64_t i = 0;
+  int result = -1;
+  FILE * f = fopen (tree->checkpoint_path, "rb");
+
+  if (!f) {
+    *sequence = 0;
+    return (errno == ENOENT) ? 0 : -1;
+  }
+  if ((fread (&header, sizeof (header), 1, f) != 1)
+      || (memcmp (header.magic, AVL_DURABLE_CHECKPOINT_MAGIC, sizeof (AVL_DURABLE_CHECKPOINT_MAGIC)) != 0)
+      || (header.count > (unsigned int) -1)) {
+    goto done;
+  }
+  keys = (void **) malloc ((header.count ? header.count : 1) * sizeof (void *));
+  if (!keys) {
+    goto done;
+  }
+  for (i = 0; i < header.count; i++) {
+    uint32_t size;
+    if ((fread (&size, 4, 1, f) != 1)
+        || (avl_durable_reserve (&buffer, size) != 0)
+        || (fread (buffer.data, 1, size, f) != size)) {
+      goto done;
+    }
+    keys[i] = tree->decode_fun (buffer.data, size);
+  }
+  if (avl_build_by_keys (tree->tree, keys, (unsigned int) header.count) == 0) {
+    *sequence = header.sequence;
+    result = 0;
+  }
+ done:
+  if ((result != 0) && keys && tree->free_key_fun) {
+    while (i) {
+      tree->free_key_fun (keys[--i]);
+    }
+  }
+  free (keys);
+  free (buffer.data);
+  fclose (f);
+  return result;
+}
+
+static
+int
+avl_durable_replay (avl_durable_tree * tree, int op, unsigned char * data, uint32_t size)
+{
+  void * key = tree->decode_fun (data, size);
+  unsigned int index;
+
+  if (op == AVL_DURABLE_INSERT) {
+    return avl_insert_by_key (tree->tree, key, &index);
+  }
+  avl_remove_by_key (
+    tree->tree, key, tree->free_key_fun ? tree->free_key_fun : avl_durable_no_free
+    );
+  if (tree->free_key_fun) {
+    tree->free_key_fun (key);
+  }
+  return 0;
+}
+
+/* replay the log after record <after>, dropping any torn tail */
+
+static
+int
+avl_durable_read_log (avl_durable_tree * tree, uint64_t after)
+{
+  avl_durable_header header;
+  unsigned char * data;
+  struct stat st;
+  size_t offset = sizeof (header), read_so_far = 0;
+  uint64_t sequence;
+  int fd = open (tree->log_path, O_RDWR);
+
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      return -1;
+    }
+    tree->sequence = after;
+    return avl_durable_new_log (tree, after);
+  }
+  if (fstat (fd, &st) != 0) {
+    close (fd);
+    return -1;
+  }
+  data = (unsigned char *) malloc (st.st_size ? st.st_size : 1);
+  if (!data) {
+    close (fd);
+    return -1;
+  }
+  while (read_so_far < (size_t) st.st_size) {
+    ssize_t n = read (fd, data + read_so_far, st.st_size - read_so_far);
+    if (n <= 0) {
+      if ((n < 0) && (errno == EINTR)) {
+        continue;
+      }
+      break;
+    }
+    read_so_far = read_so_far + n;
+  }
+  if ((read_so_far < sizeof (header)) || (read_so_far != (size_t) st.st_size)) {
+    goto fail;
+  }
+  memcpy (&header, data, sizeof (header));
+  if ((memcmp (header.magic, AVL_DURABLE_LOG_MAGIC, sizeof (AVL_DURABLE_LOG_MAGIC)) != 0)
+      || (header.sequence > after)) {
+    /* not a log, or one that follows a checkpoint we do not have */
+    goto fail;
+  }
+  sequence = header.sequence;
+  while (offset + AVL_DURABLE_RECORD_OVERHEAD <= read_so_far) {
+    unsigned char * record = data + offset;
+    uint32_t size, sum;
+    memcpy (&size, record + 1, 4);
+    if ((size > read_so_far - offset - AVL_DURABLE_RECORD_OVERHEAD)
+        || ((record[0] != AVL_DURABLE_INSERT) && (record[0] != AVL_DURABLE_REMOVE))) {
+      break;
+    }
+    memcpy (&sum, record + 5 + size, 4);
+    if (sum != avl_durable_checksum (record, 5 + size)) {
+      break;
+    }
+    sequence = sequence + 1;
+    if ((sequence > after)
+        && (avl_durable_replay (tree, record[0], record + 5, size) != 0)) {
+      goto fail;
+    }
+    offset = offset + AVL_DURABLE_RECORD_OVERHEAD + size;
+  }
+  free (data);
+  if (offset < read_so_far) {
+    if ((ftruncate (fd, offset) != 0) || (fsync (fd) != 0)) {
+      close (fd);
+      return -1;
+    }
+  }
+  close (fd);
+  if (sequence < after) {
+    /* the checkpoint holds every record; number on from it */
+    tree->sequence = after;
+    return avl_durable_new_log (tree, after);
+  }
+  tree->sequence = sequence;
+  tree->log_fd = open (tree->log_path, O_WRONLY | O_APPEND);
+  return (tree->log_fd < 0) ? -1 : 0;
+ fail:
+  free (data);
+  close (fd);
+  return -1;
+}
+
+avl_durable_tree *
+avl_open_durable_tree (const char * log_path,
+                       const char * checkpoint_path,
+                       avl_key_compare_fun_type compare_fun,
+                       void * compare_arg,
+                       avl_encode_key_fun_type encode_fun,
+                       avl_decode_key_fun_type decode_fun,
+                       avl_free_key_fun_type free_key_fun)
+{
+  avl_durable_tree * t = (avl_durable_tree *) calloc (1, sizeof (avl_durable_tree));
+  uint64_t sequence = 0;
+
+  if (!t) {
+    return NULL;
+  }
+  t->log_fd = -1;
+  t->encode_fun = encode_fun;
+  t->decode_fun = decode_fun;
+  t->free_key_fun = free_key_fun;
+  t->log_path = strdup (log_path);
+  t->checkpoint_path = strdup (checkpoint_path);
+  t->tree = avl_new_avl_tree (compare_fun, compare_arg);
+  if (!t->log_path || !t->checkpoint_path || !t->tree
+      || (avl_durable_read_checkpoint (t, &sequence) != 0)
+      || (avl_durable_read_log (t, sequence) != 0)) {
+    if (t->tree) {
+      avl_free_avl_tree (t->tree, free_key_fun);
+    }
+    if (t->log_fd >= 0) {
+      close (t->log_fd);
+    }
+    free (t->log_path);
+    free (t->checkpoint_path);
+    free (t);
+    return NULL;
+  }
+  t->synced = t->sequence;
+  pthread_mutex_init (&t->lock, NULL);
+  pthread_cond_init (&t->synced_cond, NULL);
+  return t;
+}
+
+void
+avl_close_durable_tree (avl_durable_tree * tree)
+{
+  close (tree->log_fd);
+  pthread_cond_destroy (&tree->synced_cond);
+  pthread_mutex_destroy (&tree->lock);
+  avl_free_avl_tree (tree->tree, tree->free_key_fun);
+  free (tree->pending.data);
+  free (tree->writing.data);
+  free (tree->log_path);
+  free (tree->checkpoint_path);
+  free (tree);
+}
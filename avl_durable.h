@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A durable tree: an avl_tree whose changes are appended to a log
+ * before they are acknowledged, so that it survives a crash.
+ *
+ * Log records are numbered.  Writers that arrive while the log is being
+ * synced queue their records in memory, and the next of them to find
+ * the log idle writes the whole queue with a single fdatasync() (group
+ * commit), so the sync rate does not bound the write rate.
+ *
+ * A checkpoint writes the keys in order, with the number of the last
+ * record they include, and then starts an empty log.  Recovery builds
+ * the tree from the checkpoint in linear time (see avl_build_by_keys)
+ * and replays the records after it.  A torn record at the end of the
+ * log, from a crash in mid-write, is discarded.
+ *
+ * Keys are written with <encode_fun> and read back with <decode_fun>
+ * (see avl_mapped.h).  The tree owns inserted keys; <free_key_fun>,
+ * which may be NULL, releases removed ones and those left at close.
+ * Reads may go straight to <tree> while holding <lock>.
+ */
+
+#ifndef AVL_DURABLE_H
+#define AVL_DURABLE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "avl_mapped.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AVL_DURABLE_LOG_MAGIC           "AVLLOG1"
+#define AVL_DURABLE_CHECKPOINT_MAGIC    "AVLCKP1"
+
+typedef struct _avl_durable_buffer {
+  unsigned char *       data;
+  size_t                size;
+  size_t                capacity;
+} avl_durable_buffer;
+
+typedef struct _avl_durable_tree {
+  avl_tree *            tree;
+  avl_encode_key_fun_type encode_fun;
+  avl_decode_key_fun_type decode_fun;
+  avl_free_key_fun_type free_key_fun;
+  char *                log_path;
+  char *                checkpoint_path;
+  int                   log_fd;
+  uint64_t              sequence;       /* the last record appended */
+  uint64_t              synced;         /* the last record on disk */
+  int                   syncing;        /* a writer is syncing the log */
+  int                   failed;         /* the log could not be written */
+  avl_durable_buffer    pending;        /* records not yet written */
+  avl_durable_buffer    writing;        /* records being written */
+  pthread_mutex_t       lock;
+  pthread_cond_t        synced_cond;
+} avl_durable_tree;
+
+/* open, recovering whatever <log_path> and <checkpoint_path> hold */
+
+avl_durable_tree * avl_open_durable_tree (
+  const char *          log_path,
+  const char *          checkpoint_path,
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg,
+  avl_encode_key_fun_type encode_fun,
+  avl_decode_key_fun_type decode_fun,
+  avl_free_key_fun_type free_key_fun
+  );
+
+void avl_close_durable_tree (avl_durable_tree * tree);
+
+/*
+ * These return 0 once the change is on disk, and -1 if it was not
+ * made: the key was not found, memory ran out, or the log had already
+ * failed.  A change that is made but cannot be written returns
+ * AVL_DURABLE_UNSYNCED; it stays in the tree (which then owns an
+ * inserted key) but may not survive a crash, and every later change
+ * returns -1.
+ */
+
+#define AVL_DURABLE_UNSYNCED    (-2)
+
+int avl_durable_insert_by_key (
+  avl_durable_tree *    tree,
+  void *                key,
+  unsigned int *        index
+  );
+
+int avl_durable_remove_by_key (
+  avl_durable_tree *    tree,
+  void *                key
+  );
+
+/* writers wait while a checkpoint is taken */
+
+int avl_durable_checkpoint (avl_durable_tree * tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_DURABLE_H */
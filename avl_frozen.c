@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "avl_frozen.h"
+
+#ifdef __GNUC__
+#define AVL_PREFETCH(p) __builtin_prefetch (p)
+#else
+#define AVL_PREFETCH(p)
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AVL_FROZEN_AVX2 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Sixteen slots below slot k sit the descendants four levels down,
+ * which share one or two cache lines; fetching them early hides most
+ * of the latency of the lower levels.
+ */
+#define AVL_FROZEN_PREFETCH_DISTANCE 16
+
+/* fill the eytzinger slots under <k> in order, from frozen->keys[*next] on */
+
+static
+void
+avl_frozen_fill (avl_frozen_tree * frozen, unsigned int k, unsigned int * next)
+{
+  if (k <= frozen->length) {
+    avl_frozen_fill (frozen, 2 * k, next);
+    frozen->eytzinger[k] = frozen->keys[*next];
+    frozen->slot_index[k] = *next;
+    *next = *next + 1;
+    avl_frozen_fill (frozen, 2 * k + 1, next);
+  }
+}
+
+avl_frozen_tree *
+avl_freeze (avl_tree * tree)
+{
+  avl_frozen_tree * frozen = (avl_frozen_tree *) malloc (sizeof (avl_frozen_tree));
+  unsigned int n = tree->length;
+  unsigned int i;
+  avl_node * node;
+
+  if (!frozen) {
+    return NULL;
+  }
+  frozen->length = n;
+  frozen->compare_fun = tree->compare_fun;
+  frozen->compare_arg = tree->compare_arg;
+  frozen->typed_kind = AVL_FROZEN_UNTYPED;
+  frozen->typed_simd = 0;
+  frozen->typed_blocks = 0;
+  frozen->typed_keys = NULL;
+  frozen->typed_rank = NULL;
+  frozen->keys = (void **) malloc ((n + 1) * sizeof (void *));
+  frozen->eytzinger = (void **) malloc ((n + 1) * sizeof (void *));
+  frozen->slot_index = (unsigned int *) malloc ((n + 1) * sizeof (unsigned int));
+  if (!frozen->keys || !frozen->eytzinger || !frozen->slot_index) {
+    avl_free_frozen_tree (frozen);
+    return NULL;
+  }
+  if (n) {
+    node = tree->root->right;
+    while (node->left) {
+      node = node->left;
+    }
+    for (i = 0; i < n; i++) {
+      frozen->keys[i] = node->key;
+      node = avl_get_successor (node);
+    }
+  }
+  /* slot 0 is unused */
+  frozen->eytzinger[0] = NULL;
+  frozen->slot_index[0] = n;
+  i = 0;
+  avl_frozen_fill (frozen, 1, &i);
+  return frozen;
+}
+
+void
+avl_free_frozen_tree (avl_frozen_tree * frozen)
+{
+  free (frozen->keys);
+  free (frozen->eytzinger);
+  free (frozen->slot_index);
+  free (frozen->typed_keys);
+  free (frozen->typed_rank);
+  free (frozen);
+}
+
+/*
+ * Descend the eytzinger layout, going right while <key> orders after
+ * the slot's key (or at or after it, if <or_equal>).  The trailing one
+ * bits of the final <k> record the right turns taken since the last
+ * left turn; stripping them along with that left turn leaves the slot
+ * where the search last went left, which holds the bound.
+ */
+
+static
+unsigned int
+avl_frozen_bound (avl_frozen_tree * frozen, void * key, int or_equal)
+{
+  void ** e = frozen->eytzinger;
+  unsigned int n = frozen->length;
+  unsigned int k = 1;
+
+  while (k <= n) {
+    int compare_result;
+    AVL_PREFETCH (e + (size_t) k * AVL_FROZEN_PREFETCH_DISTANCE);
+    compare_result = frozen->compare_fun (frozen->compare_arg, key, e[k]);
+    k = 2 * k + ((compare_result > 0) || (or_equal && compare_result == 0));
+  }
+  while (k & 1) {
+    k = k >> 1;
+  }
+  k = k >> 1;
+  /* k == 0 when every key was passed; slot_index[0] is <length> */
+  return frozen->slot_index[k];
+}
+
+unsigned int
+avl_frozen_lower_bound (avl_frozen_tree * frozen, void * key)
+{
+  return avl_frozen_bound (frozen, key, 0);
+}
+
+unsigned int
+avl_frozen_upper_bound (avl_frozen_tree * frozen, void * key)
+{
+  return avl_frozen_bound (frozen, key, 1);
+}
+
+int
+avl_frozen_get_item_by_index (avl_frozen_tree * frozen,
+                              unsigned int index,
+                              void ** value_address)
+{
+  if (index >= frozen->length) {
+    return -1;
+  }
+  *value_address = frozen->keys[index];
+  return 0;
+}
+
+int
+avl_frozen_get_item_by_key (avl_frozen_tree * frozen,
+                            void * key,
+                            void ** value_address)
+{
+  unsigned int i = avl_frozen_bound (frozen, key, 0);
+
+  if ((i < frozen->length)
+      && (frozen->compare_fun (frozen->compare_arg, key, frozen->keys[i]) == 0)) {
+    *value_address = frozen->keys[i];
+    return 0;
+  }
+  return -1;
+}
+
+int
+avl_frozen_get_item_by_key_most (avl_frozen_tree * frozen,
+                                 void * key,
+                                 void ** value_address)
+{
+  unsigned int i = avl_frozen_bound (frozen, key, 1);
+
+  *value_address = NULL;
+  if (i == 0) {
+    return -1;
+  }
+  *value_address = frozen->keys[i - 1];
+  return 0;
+}
+
+int
+avl_frozen_get_item_by_key_least (avl_frozen_tree * frozen,
+                                  void * key,
+                                  void ** value_address)
+{
+  unsigned int i = avl_frozen_bound (frozen, key, 0);
+
+  *value_address = NULL;
+  if (i == frozen->length) {
+    return -1;
+  }
+  *value_address = frozen->keys[i];
+  return 0;
+}
+
+/*
+ * Typed indexes.  Block k of the static B-tree has children
+ * k * (AVL_FROZEN_BLOCK + 1) + 1 + i, for i in 0..AVL_FROZEN_BLOCK;
+ * child i holds the keys between keys i-1 and i of block k.  The slots
+ * past the last key are padded with the largest value, so that every
+ * block is full and sorted, and have an in-order index of <length>.
+ */
+
+#define AVL_FROZEN_CHILD(k,i)   ((k) * (AVL_FROZEN_BLOCK + 1) + 1 + (i))
+
+typedef struct _avl_frozen_fill_state {
+  avl_frozen_tree *     frozen;
+  avl_int64_key_fun_type int64_key_fun;
+  avl_double_key_fun_type double_key_fun;
+  unsigned int          next;
+  int64_t               last_int64;
+  double                last_double;
+  int                   unsorted;
+} avl_frozen_fill_state;
+
+/* fill the blocks under <k> in order, checking the numbers as we go */
+
+static
+void
+avl_frozen_fill_typed (avl_frozen_fill_state * state, unsigned int k)
+{
+  avl_frozen_tree * frozen = state->frozen;
+  unsigned int i;
+
+  if (k >= frozen->typed_blocks) {
+    return;
+  }
+  for (i = 0; i < AVL_FROZEN_BLOCK; i++) {
+    unsigned int slot = k * AVL_FROZEN_BLOCK + i;
+    avl_frozen_fill_typed (state, AVL_FROZEN_CHILD (k, i));
+    if (state->next < frozen->length) {
+      void * key = frozen->keys[state->next];
+      if (frozen->typed_kind == AVL_FROZEN_INT64) {
+        int64_t value = state->int64_key_fun (key);
+        if (state->next && (value < state->last_int64)) {
+          state->unsorted = 1;
+        }
+        ((int64_t *) frozen->typed_keys)[slot] = state->last_int64 = value;
+      } else {
+        double value = state->double_key_fun (key);
+        if ((value != value) || (state->next && (value < state->last_double))) {
+          state->unsorted = 1;
+        }
+        ((double *) frozen->typed_keys)[slot] = state->last_double = value;
+      }
+      frozen->typed_rank[slot] = state->next;
+      state->next = state->next + 1;
+    } else {
+      if (frozen->typed_kind == AVL_FROZEN_INT64) {
+        ((int64_t *) frozen->typed_keys)[slot] = INT64_MAX;
+      } else {
+        ((double *) frozen->typed_keys)[slot] = INFINITY;
+      }
+      frozen->typed_rank[slot] = frozen->length;
+    }
+  }
+  avl_frozen_fill_typed (state, AVL_FROZEN_CHILD (k, AVL_FROZEN_BLOCK));
+}
+
+static
+int
+avl_frozen_index_typed (avl_frozen_tree * frozen,
+                        int kind,
+                        avl_int64_key_fun_type int64_key_fun,
+                        avl_double_key_fun_type double_key_fun)
+{
+  avl_frozen_fill_state state;
+  unsigned int blocks = (frozen->length + AVL_FROZEN_BLOCK - 1) / AVL_FROZEN_BLOCK;
+  size_t slots = (size_t) (blocks ? blocks : 1) * AVL_FROZEN_BLOCK;
+  void * typed_keys;
+
+  if (frozen->typed_kind != AVL_FROZEN_UNTYPED) {
+    return -1;
+  }
+  /* both int64_t and double are eight bytes: one block per cache line */
+  if (posix_memalign (&typed_keys, 64, slots * 8) != 0) {
+    return -1;
+  }
+  frozen->typed_rank = (unsigned int *) malloc (slots * sizeof (unsigned int));
+  if (!frozen->typed_rank) {
+    free (typed_keys);
+    return -1;
+  }
+  frozen->typed_keys = typed_keys;
+  frozen->typed_blocks = blocks;
+  frozen->typed_kind = kind;
+  state.frozen = frozen;
+  state.int64_key_fun = int64_key_fun;
+  state.double_key_fun = double_key_fun;
+  state.next = 0;
+  state.last_int64 = 0;
+  state.last_double = 0.0;
+  state.unsorted = 0;
+  avl_frozen_fill_typed (&state, 0);
+  if (state.unsorted) {
+    free (frozen->typed_keys);
+    free (frozen->typed_rank);
+    frozen->typed_keys = NULL;
+    frozen->typed_rank = NULL;
+    frozen->typed_blocks = 0;
+    frozen->typed_kind = AVL_FROZEN_UNTYPED;
+    return -1;
+  }
+#ifdef AVL_FROZEN_AVX2
+  frozen->typed_simd = __builtin_cpu_supports ("avx2");
+#endif
+  return 0;
+}
+
+int
+avl_frozen_index_int64 (avl_frozen_tree * frozen,
+                        avl_int64_key_fun_type key_fun)
+{
+  return avl_frozen_index_typed (frozen, AVL_FROZEN_INT64, key_fun, NULL);
+}
+
+int
+avl_frozen_index_double (avl_frozen_tree * frozen,
+                         avl_double_key_fun_type key_fun)
+{
+  return avl_frozen_index_typed (frozen, AVL_FROZEN_DOUBLE, NULL, key_fun);
+}
+
+/*
+ * Each search counts, within a block, the keys that <key> passes:
+ * those strictly less (lower bound) or less or equal (upper bound).
+ * That count picks both the candidate slot in the block and the child
+ * to descend into.
+ */
+
+static
+unsigned int
+avl_frozen_search_int64 (avl_frozen_tree * frozen, int64_t key, int or_equal)
+{
+  const int64_t * t = (const int64_t *) frozen->typed_keys;
+  unsigned int k = 0, result = frozen->length;
+
+  while (k < frozen->typed_blocks) {
+    const int64_t * b = t + (size_t) k * AVL_FROZEN_BLOCK;
+    unsigned int i, passed = 0;
+    for (i = 0; i < AVL_FROZEN_BLOCK; i++) {
+      passed += or_equal ? (key >= b[i]) : (key > b[i]);
+    }
+    if (passed < AVL_FROZEN_BLOCK) {
+      result = frozen->typed_rank[k * AVL_FROZEN_BLOCK + passed];
+    }
+    k = AVL_FROZEN_CHILD (k, passed);
+  }
+  return result;
+}
+
+static
+unsigned int
+avl_frozen_search_double (avl_frozen_tree * frozen, double key, int or_equal)
+{
+  const double * t = (const double *) frozen->typed_keys;
+  unsigned int k = 0, result = frozen->length;
+
+  while (k < frozen->typed_blocks) {
+    const double * b = t + (size_t) k * AVL_FROZEN_BLOCK;
+    unsigned int i, passed = 0;
+    for (i = 0; i < AVL_FROZEN_BLOCK; i++) {
+      passed += or_equal ? (key >= b[i]) : (key > b[i]);
+    }
+    if (passed < AVL_FROZEN_BLOCK) {
+      result = frozen->typed_rank[k * AVL_FROZEN_BLOCK + passed];
+    }
+    k = AVL_FROZEN_CHILD (k, passed);
+  }
+  return result;
+}
+
+#ifdef AVL_FROZEN_AVX2
+
+__attribute__ ((target ("avx2")))
+static
+unsigned int
+avl_frozen_search_int64_avx2 (avl_frozen_tree * frozen, int64_t key, int or_equal)
+{
+  const int64_t * t = (const int64_t *) frozen->typed_keys;
+  unsigned int k = 0, result = frozen->length;
+  __m256i x = _mm256_set1_epi64x (key);
+
+  while (k < frozen->typed_blocks) {
+    const __m256i * b = (const __m256i *) (t + (size_t) k * AVL_FROZEN_BLOCK);
+    __m256i lo = _mm256_load_si256 (b);
+    __m256i hi = _mm256_load_si256 (b + 1);
+    unsigned int passed;
+    if (or_equal) {
+      /* key >= b[i] is !(b[i] > key) */
+      __m256i gt_lo = _mm256_cmpgt_epi64 (lo, x);
+      __m256i gt_hi = _mm256_cmpgt_epi64 (hi, x);
+      passed = AVL_FROZEN_BLOCK - __builtin_popcount (
+        (unsigned int) _mm256_movemask_pd (_mm256_castsi256_pd (gt_lo))
+        | ((unsigned int) _mm256_movemask_pd (_mm256_castsi256_pd (gt_hi)) << 4)
+        );
+    } else {
+      __m256i lt_lo = _mm256_cmpgt_epi64 (x, lo);
+      __m256i lt_hi = _mm256_cmpgt_epi64 (x, hi);
+      passed = __builtin_popcount (
+        (unsigned int) _mm256_movemask_pd (_mm256_castsi256_pd (lt_lo))
+        | ((unsigned int) _mm256_movemask_pd (_mm256_castsi256_pd (lt_hi)) << 4)
+        );
+    }
+    if (passed < AVL_FROZEN_BLOCK) {
+      result = frozen->typed_rank[k * AVL_FROZEN_BLOCK + passed];
+    }
+    k = AVL_FROZEN_CHILD (k, passed);
+  }
+  return result;
+}
+
+__attribute__ ((target ("avx2")))
+static
+unsigned int
+avl_frozen_search_double_avx2 (avl_frozen_tree * frozen, double key, int or_equal)
+{
+  const double * t = (const double *) frozen->typed_keys;
+  unsigned int k = 0, result = frozen->length;
+  __m256d x = _mm256_set1_pd (key);
+
+  while (k < frozen->typed_blocks) {
+    const double * b = t + (size_t) k * AVL_FROZEN_BLOCK;
+    __m256d lo = _mm256_load_pd (b);
+    __m256d hi = _mm256_load_pd (b + 4);
+    __m256d pass_lo, pass_hi;
+    unsigned int passed;
+    if (or_equal) {
+      pass_lo = _mm256_cmp_pd (x, lo, _CMP_GE_OQ);
+      pass_hi = _mm256_cmp_pd (x, hi, _CMP_GE_OQ);
+    } else {
+      pass_lo = _mm256_cmp_pd (x, lo, _CMP_GT_OQ);
+      pass_hi = _mm256_cmp_pd (x, hi, _CMP_GT_OQ);
+    }
+    passed = __builtin_popcount (
+      (unsigned int) _mm256_movemask_pd (pass_lo)
+      | ((unsigned int) _mm256_movemask_pd (pass_hi) << 4)
+      );
+    if (passed < AVL_FROZEN_BLOCK) {
+      result = frozen->typed_rank[k * AVL_FROZEN_BLOCK + passed];
+    }
+    k = AVL_FROZEN_CHILD (k, passed);
+  }
+  return result;
+}
+
+#endif /* AVL_FROZEN_AVX2 */
+
+unsigned int
+avl_frozen_lower_bound_int64 (avl_frozen_tree * frozen, int64_t key)
+{
+#ifdef AVL_FROZEN_AVX2
+  if (frozen->typed_simd) {
+    return avl_frozen_search_int64_avx2 (frozen, key, 0);
+  }
+#endif
+  return avl_frozen_search_int64 (frozen, key, 0);
+}
+
+unsigned int
+avl_frozen_upper_bound_int64 (avl_frozen_tree * frozen, int64_t key)
+{
+#ifdef AVL_FROZEN_AVX2
+  if (frozen->typed_simd) {
+    return avl_frozen_search_int64_avx2 (frozen, key, 1);
+  }
+#endif
+  return avl_frozen_search_int64 (frozen, key, 1);
+}
+
+unsigned int
+avl_frozen_lower_bound_double (avl_frozen_tree * frozen, double key)
+{
+#ifdef AVL_FROZEN_AVX2
+  if (frozen->typed_simd) {
+    return avl_frozen_search_double_avx2 (frozen, key, 0);
+  }
+#endif
+  return avl_frozen_search_double (frozen, key, 0);
+}
+
+unsigned int
+avl_frozen_upper_bound_double (avl_frozen_tree * frozen, double key)
+{
+#ifdef AVL_FROZEN_AVX2
+  if (frozen->typed_simd) {
+    return avl_frozen_search_double_avx2 (frozen, key, 1);
+  }
+#endif
+  return avl_frozen_search_double (frozen, key, 1);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A frozen tree is an immutable snapshot of an avl_tree for lookup-heavy
+ * phases.  The keys are laid out twice: in order, for index queries,
+ * and in Eytzinger (breadth-first) order, for key searches, where the
+ * top levels of every descent share a few cache lines and the next
+ * levels can be prefetched.
+ *
+ * A snapshot shares its keys with the tree it was taken from and does
+ * not own them; it stays valid for as long as the keys do.
+ */
+
+#ifndef AVL_FROZEN_H
+#define AVL_FROZEN_H
+
+#include <stdint.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* keys per block of a typed index: one 64-byte cache line */
+#define AVL_FROZEN_BLOCK        8
+
+#define AVL_FROZEN_UNTYPED      0
+#define AVL_FROZEN_INT64        1
+#define AVL_FROZEN_DOUBLE       2
+
+typedef struct _avl_frozen_tree {
+  void **               keys;           /* in order */
+  void **               eytzinger;      /* 1-based; slot k has children 2k, 2k+1 */
+  unsigned int *        slot_index;     /* in-order index of each eytzinger slot */
+  unsigned int          length;
+  avl_key_compare_fun_type compare_fun;
+  void *                compare_arg;
+  /* the optional typed index; see avl_frozen_index_int64 */
+  int                   typed_kind;
+  int                   typed_simd;
+  unsigned int          typed_blocks;
+  void *                typed_keys;     /* blocks of AVL_FROZEN_BLOCK keys */
+  unsigned int *        typed_rank;     /* in-order index of each typed slot */
+} avl_frozen_tree;
+
+avl_frozen_tree * avl_freeze (avl_tree * tree);
+
+void avl_free_frozen_tree (avl_frozen_tree * frozen);
+
+int avl_frozen_get_item_by_index (
+  avl_frozen_tree *     frozen,
+  unsigned int          index,
+  void **               value_address
+  );
+
+/* finds the first item comparing equal to <key> */
+
+int avl_frozen_get_item_by_key (
+  avl_frozen_tree *     frozen,
+  void *                key,
+  void **               value_address
+  );
+
+/* as avl_get_item_by_key_most and avl_get_item_by_key_least */
+
+int avl_frozen_get_item_by_key_most (
+  avl_frozen_tree *     frozen,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_frozen_get_item_by_key_least (
+  avl_frozen_tree *     frozen,
+  void *                key,
+  void **               value_address
+  );
+
+/*
+ * The number of items ordering before <key> (lower bound), and the
+ * number ordering before or equal to it (upper bound).
+ */
+
+unsigned int avl_frozen_lower_bound (avl_frozen_tree * frozen, void * key);
+unsigned int avl_frozen_upper_bound (avl_frozen_tree * frozen, void * key);
+
+/*
+ * Typed indexes for numeric keys.  <key_fun> maps each key to a number
+ * that must order the keys the same way the tree's compare function
+ * does (no NaNs).  The numbers are laid out as a static B-tree with one
+ * cache line of AVL_FROZEN_BLOCK keys per node and a fanout of nine,
+ * searched with AVX2 where the CPU has it.  Building an index fails if
+ * the numbers are out of order; a snapshot holds at most one index.
+ *
+ * The bound functions return an index into <keys>, as do
+ * avl_frozen_lower_bound and avl_frozen_upper_bound, from which point,
+ * predecessor and successor queries follow.
+ */
+
+typedef int64_t (*avl_int64_key_fun_type)  (void * key);
+typedef double  (*avl_double_key_fun_type) (void * key);
+
+int avl_frozen_index_int64 (
+  avl_frozen_tree *     frozen,
+  avl_int64_key_fun_type key_fun
+  );
+
+int avl_frozen_index_double (
+  avl_frozen_tree *     frozen,
+  avl_double_key_fun_type key_fun
+  );
+
+unsigned int avl_frozen_lower_bound_int64 (avl_frozen_tree * frozen, int64_t key);
+unsigned int avl_frozen_upper_bound_int64 (avl_frozen_tree * frozen, int64_t key);
+unsigned int avl_frozen_lower_bound_double (avl_frozen_tree * frozen, double key);
+unsigned int avl_frozen_upper_bound_double (avl_frozen_tree * frozen, double key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_FROZEN_H */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * Internal interfaces shared between avl.c and the other parts of
+ * the library.  Not for use by applications.
+ */
+
+#ifndef AVL_INTERNAL_H
+#define AVL_INTERNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* can nodes move between <a> and <b>? */
+
+int avl_same_layout (avl_tree * a, avl_tree * b);
+
+/*
+ * A detached subtree: its root node (whose parent pointer is
+ * meaningless), its node count and its height.
+ */
+
+typedef struct _avl_subtree {
+  avl_node *    node;
+  unsigned int  size;
+  int           height;
+} avl_subtree;
+
+avl_subtree avl_detach_subtree (avl_tree * tree);
+void avl_attach_subtree (avl_tree * tree, avl_subtree t);
+
+avl_node * avl_expose (avl_subtree t, avl_subtree * l, avl_subtree * r);
+avl_subtree avl_join3 (avl_tree * tree, avl_subtree l, avl_node * k, avl_subtree r);
+avl_subtree avl_join2 (avl_tree * tree, avl_subtree l, avl_subtree r);
+
+void avl_split_subtree_by_key (
+  avl_tree *            tree,
+  avl_subtree           t,
+  void *                key,
+  int                   upper,
+  avl_subtree *         l,
+  avl_subtree *         r
+  );
+
+/* set operations */
+
+#define AVL_SET_UNION           0
+#define AVL_SET_INTERSECTION    1
+#define AVL_SET_DIFFERENCE      2
+#define AVL_SET_MERGE           3
+
+typedef struct _avl_set_parts {
+  avl_node *    root;
+  avl_subtree   a_less;
+  avl_subtree   a_left_equal;
+  avl_subtree   a_right_equal;
+  avl_subtree   a_more;
+  avl_subtree   b_less;
+  avl_subtree   b_equal;
+  avl_subtree   b_more;
+} avl_set_parts;
+
+void avl_drop_subtree (avl_subtree t, avl_node ** dropped);
+
+void avl_free_dropped (
+  avl_tree *            tree,
+  avl_node *            dropped,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_set_trivial (
+  int                   operation,
+  avl_subtree           a,
+  avl_subtree           b,
+  avl_subtree *         result,
+  avl_node **           dropped
+  );
+
+void avl_set_divide (
+  avl_tree *            tree,
+  avl_subtree           a,
+  avl_subtree           b,
+  avl_set_parts *       parts
+  );
+
+avl_subtree avl_set_combine (
+  avl_tree *            tree,
+  int                   operation,
+  avl_set_parts *       parts,
+  avl_subtree           left,
+  avl_subtree           right,
+  avl_node **           dropped
+  );
+
+avl_subtree avl_set_operation (
+  avl_tree *            tree,
+  int                   operation,
+  avl_subtree           a,
+  avl_subtree           b,
+  avl_node **           dropped
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_INTERNAL_H */
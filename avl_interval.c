@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+#include "avl_interval.h"
+
+#define AVL_INTERVAL_MAX_HIGH(n)        (*(int64_t *) AVL_NODE_AGGREGATE (n))
+
+static
+int
+avl_interval_compare (void * compare_arg, void * a, void * b)
+{
+  avl_interval_mode * mode = (avl_interval_mode *) compare_arg;
+  int64_t a_low, a_high, b_low, b_high;
+
+  mode->interval_fun (a, &a_low, &a_high);
+  mode->interval_fun (b, &b_low, &b_high);
+  if (a_low != b_low) {
+    return (a_low < b_low) ? -1 : 1;
+  } else if (a_high != b_high) {
+    return (a_high < b_high) ? -1 : 1;
+  } else {
+    return 0;
+  }
+}
+
+/* the monoid: the maximum high endpoint */
+
+static
+void
+avl_interval_identity (void * monoid_arg, void * aggregate)
+{
+  *(int64_t *) aggregate = INT64_MIN;
+}
+
+static
+void
+avl_interval_append_key (void * monoid_arg, void * aggregate, void * key)
+{
+  avl_interval_mode * mode = (avl_interval_mode *) monoid_arg;
+  int64_t low, high;
+
+  mode->interval_fun (key, &low, &high);
+  if (high > *(int64_t *) aggregate) {
+    *(int64_t *) aggregate = high;
+  }
+}
+
+static
+void
+avl_interval_append (void * monoid_arg, void * aggregate, const void * other)
+{
+  if (*(const int64_t *) other > *(int64_t *) aggregate) {
+    *(int64_t *) aggregate = *(const int64_t *) other;
+  }
+}
+
+int
+avl_tree_use_intervals (avl_tree * tree,
+                        avl_interval_mode * mode,
+                        avl_interval_fun_type interval_fun)
+{
+  if (tree->length) {
+    return -1;
+  }
+  mode->monoid.size = sizeof (int64_t);
+  mode->monoid.identity = avl_interval_identity;
+  mode->monoid.append_key = avl_interval_append_key;
+  mode->monoid.append = avl_interval_append;
+  mode->monoid.monoid_arg = mode;
+  mode->interval_fun = interval_fun;
+  if (avl_tree_use_monoid (tree, &mode->monoid) != 0) {
+    return -1;
+  }
+  tree->compare_fun = avl_interval_compare;
+  tree->compare_arg = mode;
+  return 0;
+}
+
+/*
+ * A subtree is entered only if something in it ends at or after <low>,
+ * and the walk stops at the first key starting after <high>, since
+ * every key after it starts later still; <*stop> is set once the walk
+ * is past <high>.
+ */
+
+static
+int
+avl_interval_walk (avl_interval_mode * mode,
+                   avl_node * node,
+                   int64_t low,
+                   int64_t high,
+                   avl_iter_fun_type iter_fun,
+                   void * iter_arg,
+                   int * stop)
+{
+  while (node && (AVL_INTERVAL_MAX_HIGH (node) >= low)) {
+    int64_t node_low, node_high;
+    int result = avl_interval_walk (mode, node->left, low, high, iter_fun, iter_arg, stop);
+    if ((result != 0) || *stop) {
+      return result;
+    }
+    mode->interval_fun (node->key, &node_low, &node_high);
+    if (node_low > high) {
+      *stop = 1;
+      return 0;
+    }
+    if (node_high >= low) {
+      result = iter_fun (node->key, iter_arg);
+      if (result != 0) {
+        return result;
+      }
+    }
+    node = node->right;
+  }
+  return 0;
+}
+
+int
+avl_interval_overlap (avl_tree * tree,
+                      int64_t low,
+                      int64_t high,
+                      avl_iter_fun_type iter_fun,
+                      void * iter_arg)
+{
+  int stop = 0;
+
+  if (tree->compare_fun != avl_interval_compare) {
+    return -1;
+  }
+  return avl_interval_walk (
+    (avl_interval_mode *) tree->compare_arg, tree->root->right,
+    low, high, iter_fun, iter_arg, &stop
+    );
+}
+
+int
+avl_interval_stab (avl_tree * tree,
+                   int64_t point,
+                   avl_iter_fun_type iter_fun,
+                   void * iter_arg)
+{
+  return avl_interval_overlap (tree, point, point, iter_fun, iter_arg);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * Interval mode: each key is a closed interval [low, high] with int64
+ * endpoints, read by <interval_fun>.  The tree orders keys by low
+ * endpoint (then high), and keeps the largest high endpoint of every
+ * subtree as a monoid aggregate (see avl_tree_use_monoid), so that
+ * subtrees ending before a query are skipped whole.
+ *
+ * Overlap and stabbing queries report the matching keys in order.
+ * They cost O(log n + k) in the usual case, and never more than
+ * O((k + 1) log n), for k matches.
+ */
+
+#ifndef AVL_INTERVAL_H
+#define AVL_INTERVAL_H
+
+#include <stdint.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*avl_interval_fun_type) (void * key, int64_t * low, int64_t * high);
+
+typedef struct _avl_interval_mode {
+  avl_monoid            monoid;
+  avl_interval_fun_type interval_fun;
+} avl_interval_mode;
+
+/*
+ * Put an empty <tree> in interval mode.  This replaces its compare
+ * function; <mode> is filled in here and must outlive the tree.
+ */
+
+int avl_tree_use_intervals (
+  avl_tree *            tree,
+  avl_interval_mode *   mode,
+  avl_interval_fun_type interval_fun
+  );
+
+/*
+ * Call <iter_fun> on every key overlapping [<low>, <high>], or holding
+ * <point>.  A nonzero return from <iter_fun> stops the walk and is
+ * passed back.
+ */
+
+int avl_interval_overlap (
+  avl_tree *            tree,
+  int64_t               low,
+  int64_t               high,
+  avl_iter_fun_type     iter_fun,
+  void *                iter_arg
+  );
+
+int avl_interval_stab (
+  avl_tree *            tree,
+  int64_t               point,
+  avl_iter_fun_type     iter_fun,
+  void *                iter_arg
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_INTERVAL_H */
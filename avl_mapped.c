@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/* for fileno() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "avl_mapped.h"
+
+/* deeper than any tree of 2^32 items can be */
+#define AVL_MAPPED_MAX_HEIGHT   64
+
+#define AVL_MAPPED_ALIGN(n)     (((n) + 7) & ~((uint64_t) 7))
+
+/* saving */
+
+static
+int
+avl_mapped_write_key (FILE * f,
+                      void * key,
+                      avl_encode_key_fun_type encode_fun,
+                      unsigned char ** buffer,
+                      unsigned int * capacity,
+                      uint64_t * offset)
+{
+  static const char padding[8] = {0};
+  avl_mapped_key header;
+  unsigned int size = encode_fun (key, *buffer, *capacity);
+
+  if (size > *capacity) {
+    unsigned char * grown = (unsigned char *) realloc (*buffer, size);
+    if (!grown) {
+      return -1;
+    }
+    *buffer = grown;
+    *capacity = size;
+    encode_fun (key, *buffer, size);
+  }
+  header.size = size;
+  header.unused = 0;
+  if ((fwrite (&header, sizeof (header), 1, f) != 1)
+      || (fwrite (*buffer, 1, size, f) != size)
+      || (fwrite (padding, 1, AVL_MAPPED_ALIGN (size) - size, f) != AVL_MAPPED_ALIGN (size) - size)) {
+    return -1;
+  }
+  *offset = *offset + sizeof (header) + AVL_MAPPED_ALIGN (size);
+  return 0;
+}
+
+static
+int
+avl_save_to (avl_tree * tree, FILE * f, avl_encode_key_fun_type encode_fun)
+{
+  avl_mapped_header header;
+  avl_node ** queue = NULL;
+  uint64_t * offsets = NULL;
+  unsigned char * buffer = NULL;
+  unsigned int capacity = 0, i, tail;
+  uint64_t offset = sizeof (header);
+  int result = -1;
+
+  memset (&header, 0, sizeof (header));
+  if (fwrite (&header, sizeof (header), 1, f) != 1) {
+    return -1;
+  }
+  if (tree->length) {
+    queue = (avl_node **) malloc (tree->length * sizeof (avl_node *));
+    offsets = (uint64_t *) malloc (tree->length * sizeof (uint64_t));
+    if (!queue || !offsets) {
+      goto done;
+    }
+    /* the keys, in breadth-first order */
+    queue[0] = tree->root->right;
+    tail = 1;
+    for (i = 0; i < tree->length; i++) {
+      avl_node * node = queue[i];
+      if (node->left) {
+        queue[tail++] = node->left;
+      }
+      if (node->right) {
+        queue[tail++] = node->right;
+      }
+      offsets[i] = offset;
+      if (avl_mapped_write_key (f, node->key, encode_fun, &buffer, &capacity, &offset) != 0) {
+        goto done;
+      }
+    }
+    /* the nodes, numbering the children the same way again */
+    tail = 1;
+    for (i = 0; i < tree->length; i++) {
+      avl_mapped_node m;
+      m.key = offsets[i];
+      m.left = queue[i]->left ? ++tail : 0;
+      m.right = queue[i]->right ? ++tail : 0;
+      m.rank_and_balance = queue[i]->rank_and_balance;
+      m.unused = 0;
+      if (fwrite (&m, sizeof (m), 1, f) != 1) {
+        goto done;
+      }
+    }
+  }
+  memcpy (header.magic, AVL_MAPPED_MAGIC, sizeof (AVL_MAPPED_MAGIC));
+  header.version = AVL_MAPPED_VERSION;
+  header.byte_order = AVL_MAPPED_BYTE_ORDER;
+  header.length = tree->length;
+  header.nodes = offset;
+  header.size = offset + (uint64_t) tree->length * sizeof (avl_mapped_node);
+  if ((fseek (f, 0, SEEK_SET) == 0)
+      && (fwrite (&header, sizeof (header), 1, f) == 1)
+      && (fflush (f) == 0)
+      && (fsync (fileno (f)) == 0)) {
+    result = 0;
+  }
+ done:
+  free (queue);
+  free (offsets);
+  free (buffer);
+  return result;
+}
+
+int
+avl_save (avl_tree * tree,
+          const char * path,
+          avl_encode_key_fun_type encode_fun)
+{
+  /* write beside the old file and rename, so that it is never half-written */
+  size_t length = strlen (path);
+  char * temp = (char *) malloc (length + 5);
+  FILE * f;
+  int result;
+
+  if (!temp) {
+    return -1;
+  }
+  memcpy (temp, path, length);
+  memcpy (temp + length, ".tmp", 5);
+  f = fopen (temp, "wb");
+  if (!f) {
+    free (temp);
+    return -1;
+  }
+  result = avl_save_to (tree, f, encode_fun);
+  if (fclose (f) != 0) {
+    result = -1;
+  }
+  if ((result == 0) && (rename (temp, path) != 0)) {
+    result = -1;
+  }
+  if (result != 0) {
+    remove (temp);
+  }
+  free (temp);
+  return result;
+}
+
+/* loading */
+
+avl_mapped_tree *
+avl_load_mmap (const char * path,
+               avl_key_compare_fun_type compare_fun,
+               void * compare_arg)
+{
+  avl_mapped_tree * mapped;
+  avl_mapped_header * header;
+  struct stat st;
+  void * base;
+  int fd = open (path, O_RDONLY);
+
+  if (fd < 0) {
+    return NULL;
+  }
+  if ((fstat (fd, &st) != 0) || ((size_t) st.st_size < sizeof (avl_mapped_header))) {
+    close (fd);
+    return NULL;
+  }
+  base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  header = (avl_mapped_header *) base;
+  if ((memcmp (header->magic, AVL_MAPPED_MAGIC, sizeof (AVL_MAPPED_MAGIC)) != 0)
+      || (header->version != AVL_MAPPED_VERSION)
+      || (header->byte_order != AVL_MAPPED_BYTE_ORDER)
+      || (header->size != (uint64_t) st.st_size)
+      || (header->length > (unsigned int) -1)
+      || (header->nodes < sizeof (avl_mapped_header))
+      || (header->nodes % 8)
+      || ((header->size - header->nodes) / sizeof (avl_mapped_node) != header->length)
+      || ((header->size - header->nodes) % sizeof (avl_mapped_node))) {
+    munmap (base, st.st_size);
+    return NULL;
+  }
+  mapped = (avl_mapped_tree *) malloc (sizeof (avl_mapped_tree));
+  if (!mapped) {
+    munmap (base, st.st_size);
+    return NULL;
+  }
+  mapped->base = (char *) base;
+  mapped->size = st.st_size;
+  mapped->nodes = ((avl_mapped_node *) (mapped->base + header->nodes)) - 1;
+  mapped->length = (unsigned int) header->length;
+  mapped->compare_fun = compare_fun;
+  mapped->compare_arg = compare_arg;
+  return mapped;
+}
+
+void
+avl_free_mapped_tree (avl_mapped_tree * mapped)
+{
+  munmap (mapped->base, mapped->size);
+  free (mapped);
+}
+
+/* queries */
+
+static
+void *
+avl_mapped_key_of (avl_mapped_tree * mapped, unsigned int n)
+{
+  return mapped->base + mapped->nodes[n].key;
+}
+
+int
+avl_mapped_get_item_by_index (avl_mapped_tree * mapped,
+                              unsigned int index,
+                              void ** value_address)
+{
+  unsigned int n = 1, m;
+
+  if (index >= mapped->length) {
+    return -1;
+  }
+  m = index + 1;
+  for (;;) {
+    unsigned int rank = mapped->nodes[n].rank_and_balance >> 2;
+    if (m < rank) {
+      n = mapped->nodes[n].left;
+    } else if (m > rank) {
+      n = mapped->nodes[n].right;
+      m = m - rank;
+    } else {
+      *value_address = avl_mapped_key_of (mapped, n);
+      return 0;
+    }
+  }
+}
+
+/* the index of the first item ordering at or (if <upper>) after <key> */
+
+static
+unsigned int
+avl_mapped_bound (avl_mapped_tree * mapped, void * key, int upper)
+{
+  unsigned int n = mapped->length ? 1 : 0;
+  unsigned int base = 0, result = mapped->length;
+
+  while (n) {
+    int c = mapped->compare_fun (mapped->compare_arg, key, avl_mapped_key_of (mapped, n));
+    unsigned int rank = mapped->nodes[n].rank_and_balance >> 2;
+    if (upper ? (c < 0) : (c <= 0)) {
+      result = base + rank - 1;
+      n = mapped->nodes[n].left;
+    } else {
+      base = base + rank;
+      n = mapped->nodes[n].right;
+    }
+  }
+  return result;
+}
+
+int
+avl_mapped_get_item_by_key (avl_mapped_tree * mapped,
+                            void * key,
+                            void ** value_address)
+{
+  unsigned int i = avl_mapped_bound (mapped, key, 0);
+  void * found;
+
+  if ((i < mapped->length)
+      && (avl_mapped_get_item_by_index (mapped, i, &found) == 0)
+      && (mapped->compare_fun (mapped->compare_arg, key, found) == 0)) {
+    *value_address = found;
+    return 0;
+  }
+  return -1;
+}
+
+int
+avl_mapped_get_span_by_key (avl_mapped_tree * mapped,
+                            void * key,
+                            unsigned int * low,
+                            unsigned int * high)
+{
+  *low = avl_mapped_bound (mapped, key, 0);
+  *high = avl_mapped_bound (mapped, key, 1);
+  return 0;
+}
+
+int
+avl_mapped_iterate_inorder (avl_mapped_tree * mapped,
+                            avl_iter_fun_type iter_fun,
+                            void * iter_arg)
+{
+  unsigned int stack[AVL_MAPPED_MAX_HEIGHT];
+  unsigned int depth = 0, n = mapped->length ? 1 : 0;
+  int result;
+
+  for (;;) {
+    while (n) {
+      stack[depth++] = n;
+      n = mapped->nodes[n].left;
+    }
+    if (!depth) {
+      return 0;
+    }
+    n = stack[--depth];
+    result = iter_fun (avl_mapped_key_of (mapped, n), iter_arg);
+    if (result != 0) {
+      return result;
+    }
+    n = mapped->nodes[n].right;
+  }
+}
+
+/* upgrading */
+
+avl_tree *
+avl_mapped_upgrade (avl_mapped_tree * mapped,
+                    avl_decode_key_fun_type decode_fun,
+                    avl_free_key_fun_type free_key_fun,
+                    avl_key_compare_fun_type compare_fun,
+                    void * compare_arg)
+{
+  avl_tree * tree = avl_new_avl_tree (compare_fun, compare_arg);
+  avl_node ** nodes;
+  unsigned int n;
+
+  if (!tree) {
+    return NULL;
+  }
+  if (!mapped->length) {
+    return tree;
+  }
+  nodes = (avl_node **) calloc (mapped->length + 1, sizeof (avl_node *));
+  if (!nodes) {
+    avl_free_avl_tree (tree, NULL);
+    return NULL;
+  }
+  for (n = 1; n <= mapped->length; n++) {
+    avl_mapped_key * k = (avl_mapped_key *) avl_mapped_key_of (mapped, n);
+    void * key = decode_fun ? decode_fun (k->data, k->size) : (void *) k;
+    nodes[n] = avl_new_tree_node (tree, key, NULL);
+    if (!nodes[n]) {
+      /* only decoded keys are ours to release */
+      if (decode_fun && free_key_fun) {
+        free_key_fun (key);
+      }
+      while (--n) {
+        if (decode_fun && free_key_fun) {
+          free_key_fun (nodes[n]->key);
+        }
+        avl_free_tree_node (tree, nodes[n]);
+      }
+      free (nodes);
+      avl_free_avl_tree (tree, NULL);
+      return NULL;
+    }
+  }
+  /* children always come after their parent */
+  for (n = 1; n <= mapped->length; n++) {
+    avl_mapped_node * m = &mapped->nodes[n];
+    nodes[n]->rank_and_balance = m->rank_and_balance;
+    if (m->left) {
+      nodes[n]->left = nodes[m->left];
+      nodes[m->left]->parent = nodes[n];
+    }
+    if (m->right) {
+      nodes[n]->right = nodes[m->right];
+      nodes[m->right]->parent = nodes[n];
+    }
+  }
+  tree->root->right = nodes[1];
+  nodes[1]->parent = tree->root;
+  tree->length = mapped->length;
+  free (nodes);
+  return tree;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * An on-disk image of a tree that can be searched straight from an
+ * mmap() of the file, with no allocation per node.
+ *
+ * The file is a header, then the keys, then the nodes.  Each key is a
+ * length-prefixed blob, aligned to 8 bytes, written by the caller's
+ * <encode_fun>.  Nodes are numbered from 1 in breadth-first order, so
+ * that the top levels of every search share a few pages; a node holds
+ * the file offset of its key, the numbers of its children (0 for none)
+ * and the rank and balance of the tree it was saved from.  All fields
+ * are in host byte order, which the header records.
+ *
+ * A mapped tree passes its stored keys to <compare_fun> as
+ * avl_mapped_key pointers, and hands them back the same way; they are
+ * valid until the tree is freed.  Beyond the header, which is checked,
+ * the file is trusted.
+ */
+
+#ifndef AVL_MAPPED_H
+#define AVL_MAPPED_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AVL_MAPPED_MAGIC        "AVLTREE"
+#define AVL_MAPPED_VERSION      1
+#define AVL_MAPPED_BYTE_ORDER   0x01020304
+
+typedef struct _avl_mapped_header {
+  char                  magic[8];
+  uint32_t              version;
+  uint32_t              byte_order;
+  uint64_t              length;
+  uint64_t              nodes;          /* file offset of node 1 */
+  uint64_t              size;           /* of the whole file */
+  uint64_t              unused[3];
+} avl_mapped_header;
+
+typedef struct _avl_mapped_key {
+  uint32_t              size;
+  uint32_t              unused;
+  unsigned char         data[];         /* 8-byte aligned */
+} avl_mapped_key;
+
+typedef struct _avl_mapped_node {
+  uint64_t              key;            /* file offset of an avl_mapped_key */
+  uint32_t              left;
+  uint32_t              right;
+  uint32_t              rank_and_balance;
+  uint32_t              unused;
+} avl_mapped_node;
+
+typedef struct _avl_mapped_tree {
+  char *                base;
+  size_t                size;
+  avl_mapped_node *     nodes;          /* 1-based */
+  unsigned int          length;
+  avl_key_compare_fun_type compare_fun;
+  void *                compare_arg;
+} avl_mapped_tree;
+
+/*
+ * Write the bytes of <key> to <buffer> if they fit in <size>, and
+ * return how many there are, as snprintf() does.
+ */
+
+typedef unsigned int (*avl_encode_key_fun_type) (void * key, void * buffer, unsigned int size);
+
+/* make a key from the bytes of a stored one */
+
+typedef void * (*avl_decode_key_fun_type) (const void * data, unsigned int size);
+
+/* write <tree> to <path>, replacing it, and sync it to disk */
+
+int avl_save (
+  avl_tree *            tree,
+  const char *          path,
+  avl_encode_key_fun_type encode_fun
+  );
+
+avl_mapped_tree * avl_load_mmap (
+  const char *          path,
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg
+  );
+
+void avl_free_mapped_tree (avl_mapped_tree * mapped);
+
+int avl_mapped_get_item_by_index (
+  avl_mapped_tree *     mapped,
+  unsigned int          index,
+  void **               value_address
+  );
+
+/* finds the first item comparing equal to <key> */
+
+int avl_mapped_get_item_by_key (
+  avl_mapped_tree *     mapped,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_mapped_get_span_by_key (
+  avl_mapped_tree *     mapped,
+  void *                key,
+  unsigned int *        low,
+  unsigned int *        high
+  );
+
+int avl_mapped_iterate_inorder (
+  avl_mapped_tree *     mapped,
+  avl_iter_fun_type     iter_fun,
+  void *                iter_arg
+  );
+
+/*
+ * Build a mutable tree of the same shape, in O(n) with no comparisons.
+ * Each key is passed through <decode_fun>; if that is NULL the keys are
+ * the avl_mapped_key pointers themselves, and the mapping must then
+ * outlive the new tree.  Should a node allocation fail, the keys
+ * decoded so far are passed to <free_key_fun>, which may be NULL.
+ */
+
+avl_tree * avl_mapped_upgrade (
+  avl_mapped_tree *     mapped,
+  avl_decode_key_fun_type decode_fun,
+  avl_free_key_fun_type free_key_fun,
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_MAPPED_H */
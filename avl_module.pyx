@@ -31,16 +31,20 @@ from __future__ import (absolute_import, division, print_function,
 
 import cython
 
+from cpython.bytes cimport PyBytes_AS_STRING, PyBytes_CheckExact, PyBytes_GET_SIZE
+from cpython.float cimport PyFloat_AS_DOUBLE, PyFloat_CheckExact
 from cpython.int cimport PyInt_Check
 from cpython.list cimport (PyList_Sort, PyList_Check, PyList_GetSlice,
                            PyList_Size)
+from cpython.long cimport PyLong_AsLongAndOverflow, PyLong_CheckExact
 from cpython.object cimport PyObject_RichCompareBool, Py_EQ, Py_LT
 from cpython.ref cimport PyObject, Py_DECREF, Py_XDECREF, Py_XINCREF
 from cpython.slice cimport PySlice_Check, PySlice_GetIndices
 from cpython.unicode cimport PyUnicode_AsASCIIString, PyUnicode_GET_SIZE
+from cpython.unicode cimport PyUnicode_CheckExact, PyUnicode_Compare
 from cpython.version cimport PY_MAJOR_VERSION
 
-from libc.string cimport strcpy
+from libc.string cimport memcmp, strcpy
 
 cimport avl
 
@@ -68,19 +72,98 @@ cdef unicode _text(s):
         raise TypeError("Could not convert to unicode.")
 
 
-cdef int avl_key_compare_for_python(void * compare_arg, void * a, void * b):
-    cdef object self = <object>compare_arg
-
-    if not self.compare_function:
-        if PyObject_RichCompareBool(<object>a, <object>b, Py_LT):
-            return -1
-        elif PyObject_RichCompareBool(<object>a, <object>b, Py_EQ):
-            return 0
-        return 1
-    return self.compare_function(<object>a, <object>b)
+# Key modes.  Exact int, float, str and bytes keys are compared in C,
+# in the same order rich comparison would give; any other pair of keys,
+# or a tree with its own compare function, takes the generic path.
+# AVL_KEYS_AUTO picks the path from each pair of keys' types, and the
+# others allow only their own type through the fast path.
+cdef enum:
+    AVL_KEYS_AUTO
+    AVL_KEYS_INT
+    AVL_KEYS_FLOAT
+    AVL_KEYS_STR
+    AVL_KEYS_BYTES
+    AVL_KEYS_GENERIC
+
+
+# what a tree's compare_arg points at; <compare_function> is borrowed
+# from the tree's attribute of the same name
+ctypedef struct avl_py_compare:
+    int key_mode
+    PyObject * compare_function
+
+
+cdef int avl_key_mode(object key_type) except -1:
+    if key_type is None:
+        return AVL_KEYS_AUTO
+    elif key_type is int:
+        return AVL_KEYS_INT
+    elif key_type is float:
+        return AVL_KEYS_FLOAT
+    elif key_type is unicode:
+        return AVL_KEYS_STR
+    elif key_type is bytes:
+        return AVL_KEYS_BYTES
+    elif key_type is object:
+        return AVL_KEYS_GENERIC
+    raise ValueError("unsupported key_type {!r}".format(key_type))
+
+
+cdef inline int avl_compare_ints(PyObject * a, PyObject * b, int * result):
+    cdef int overflow_a, overflow_b
+    cdef long x = PyLong_AsLongAndOverflow(<object>a, &overflow_a)
+    cdef long y = PyLong_AsLongAndOverflow(<object>b, &overflow_b)
+    if overflow_a or overflow_b:
+        return 0
+    result[0] = -1 if x < y else (1 if x > y else 0)
+    return 1
+
+
+cdef inline int avl_compare_bytes(PyObject * a, PyObject * b):
+    cdef Py_ssize_t size_a = PyBytes_GET_SIZE(<object>a)
+    cdef Py_ssize_t size_b = PyBytes_GET_SIZE(<object>b)
+    cdef int result = memcmp(PyBytes_AS_STRING(<object>a),
+                             PyBytes_AS_STRING(<object>b),
+                             size_a if size_a < size_b else size_b)
+    if result:
+        return -1 if result < 0 else 1
+    return -1 if size_a < size_b else (1 if size_a > size_b else 0)
 
 
-cdef int tree_from_list(object list,
+cdef int avl_key_compare_for_python(void * compare_arg, void * a, void * b):
+    cdef avl_py_compare * compare = <avl_py_compare*>compare_arg
+    cdef int mode = compare.key_mode
+    cdef int result
+    cdef double x, y
+
+    if compare.compare_function:
+        return (<object>compare.compare_function)(<object>a, <object>b)
+
+    if mode == AVL_KEYS_AUTO or mode == AVL_KEYS_INT:
+        if PyLong_CheckExact(<object>a) and PyLong_CheckExact(<object>b):
+            if avl_compare_ints(<PyObject*>a, <PyObject*>b, &result):
+                return result
+    if mode == AVL_KEYS_AUTO or mode == AVL_KEYS_STR:
+        if PyUnicode_CheckExact(<object>a) and PyUnicode_CheckExact(<object>b):
+            return PyUnicode_Compare(<object>a, <object>b)
+    if mode == AVL_KEYS_AUTO or mode == AVL_KEYS_FLOAT:
+        if PyFloat_CheckExact(<object>a) and PyFloat_CheckExact(<object>b):
+            x = PyFloat_AS_DOUBLE(<object>a)
+            y = PyFloat_AS_DOUBLE(<object>b)
+            # as with rich comparison, a NaN orders after everything
+            return -1 if x < y else (0 if x == y else 1)
+    if mode == AVL_KEYS_AUTO or mode == AVL_KEYS_BYTES:
+        if PyBytes_CheckExact(<object>a) and PyBytes_CheckExact(<object>b):
+            return avl_compare_bytes(<PyObject*>a, <PyObject*>b)
+
+    if PyObject_RichCompareBool(<object>a, <object>b, Py_LT):
+        return -1
+    elif PyObject_RichCompareBool(<object>a, <object>b, Py_EQ):
+        return 0
+    return 1
+
+
+cdef int tree_from_list(avl.avl_tree * dest, object list,
                         avl.avl_node * parent, avl.avl_node ** address,
                         unsigned int low, unsigned int high):
     cdef unsigned int midway = ((high - low) // 2) + low
@@ -92,18 +175,18 @@ cdef int tree_from_list(object list,
     else:
         item = list[midway]
 
-        new_node = avl.avl_new_avl_node (<void*>item, parent)
+        new_node = avl.avl_new_tree_node(dest, <void*>item, parent)
         if not new_node:
             return -1
         address[0] = new_node
         Py_XINCREF(< PyObject*>item)
         avl.AVL_SET_RANK(new_node, (midway-low)+1)
         left_height = tree_from_list(
-            list, new_node, &(new_node.left), low, midway)
+            dest, list, new_node, &(new_node.left), low, midway)
         if left_height < 0:
             return -1
         right_height = tree_from_list(
-            list, new_node, &(new_node.right), midway+1, high)
+            dest, list, new_node, &(new_node.right), midway+1, high)
         if right_height < 0:
             return -1
         if left_height > right_height:
@@ -122,7 +205,8 @@ cdef int avl_tree_key_free_fun(void * key):
     return 0
 
 
-cdef int tree_from_tree(avl.avl_node ** node,
+cdef int tree_from_tree(avl.avl_tree * dest,
+                        avl.avl_node ** node,
                         avl.avl_node * parent,
                         avl.avl_node ** address,
                         unsigned int low,
@@ -136,13 +220,13 @@ cdef int tree_from_tree(avl.avl_node ** node,
         address[0] = NULL
         return 1
     else:
-        new_node = avl.avl_new_avl_node(NULL, parent)
+        new_node = avl.avl_new_tree_node(dest, NULL, parent)
         if not new_node:
             return -1
         address[0] = new_node
         avl.AVL_SET_RANK(new_node, (midway-low)+1)
         left_height = tree_from_tree(
-            node, new_node, &(new_node[0].left), low, midway)
+            dest, node, new_node, &(new_node[0].left), low, midway)
         if left_height < 0:
             return -1
 
@@ -152,7 +236,7 @@ cdef int tree_from_tree(avl.avl_node ** node,
         node[0] = avl.avl_get_successor(node[0])
 
         right_height = tree_from_tree(
-            node, new_node, &(new_node[0].right), midway+1, high)
+            dest, node, new_node, &(new_node[0].right), midway+1, high)
         if right_height < 0:
             return -1
         if left_height > right_height:
@@ -166,25 +250,26 @@ cdef int tree_from_tree(avl.avl_node ** node,
             return left_height + 1
 
 
-cdef int avl_copy_avl_node(avl.avl_node * source_node,
+cdef int avl_copy_avl_node(avl.avl_tree * dest,
+                           avl.avl_node * source_node,
                            avl.avl_node * dest_parent,
                            avl.avl_node ** dest_node) except *:
     cdef avl.avl_node * new_node
-    new_node = avl.avl_new_avl_node(
-        source_node[0].key, dest_parent)
+    new_node = avl.avl_new_tree_node(
+        dest, source_node[0].key, dest_parent)
     if not new_node:
         raise MemoryError("Cannot allocate node")
     Py_XINCREF (<PyObject*>new_node[0].key)
     new_node[0].rank_and_balance = source_node[0].rank_and_balance
     if source_node[0].left:
-        if avl_copy_avl_node(source_node[0].left,
+        if avl_copy_avl_node(dest, source_node[0].left,
                              new_node,
                              &(new_node[0].left)):
             return -1
     else:
         new_node[0].left = NULL
     if source_node[0].right:
-        if avl_copy_avl_node(source_node[0].right,
+        if avl_copy_avl_node(dest, source_node[0].right,
                              new_node,
                              &(new_node[0].right)):
             return -1
@@ -197,6 +282,7 @@ cdef int avl_copy_avl_node(avl.avl_node * source_node,
 cdef void avl_copy_avl_tree(tree source, tree dest) except *:
     if source.tree[0].length:
         if avl_copy_avl_node(
+                dest.tree,
                 source.tree[0].root[0].right,
                 dest.tree[0].root,
                 &(dest.tree[0].root[0].right)):
@@ -206,6 +292,20 @@ cdef void avl_copy_avl_tree(tree source, tree dest) except *:
     dest.tree[0].length = source.tree[0].length
 
 
+# Each tree gets a node arena of its own, so that its slabs go away
+# with it.  Trees split from one another share theirs, and nodes are
+# moved between arenas only to join or combine trees that do not.  The
+# GIL serializes access to an arena.
+cdef int avl_tree_use_new_arena(avl.avl_tree * tree):
+    cdef avl.avl_node_arena * arena = avl.avl_new_node_arena(
+        0, NULL, NULL, NULL)
+    if not arena:
+        return -1
+    avl.avl_tree_use_arena(tree, arena)
+    avl.avl_release_node_arena(arena)
+    return 0
+
+
 cdef int avl_tree_key_printer(char * buffer, void * key):
     cdef object repr_string
     cdef int length
@@ -230,20 +330,30 @@ cdef class tree:
     cdef avl.avl_tree * tree
     cdef avl.avl_node * node_cache
     cdef Py_ssize_t cache_index
+    cdef avl_py_compare compare
     cpdef readonly object compare_function
 
-    def __cinit__(self, args=None, object compare_function=None):
+    def __cinit__(self, args=None, object compare_function=None,
+                  object key_type=None):
         cdef object tmp_list
 
         cdef Py_ssize_t low = 0, length
-        self.tree = avl.avl_new_avl_tree(avl_key_compare_for_python, <void*>self)
+        self.compare.key_mode = avl_key_mode(key_type)
+        self.compare.compare_function = NULL
+        self.tree = avl.avl_new_avl_tree(
+            avl_key_compare_for_python, <void*>&self.compare)
         if not self.tree:
             raise MemoryError("Cannot allocate tree")
-        self.tree[0].root = avl.avl_new_avl_node(NULL, <avl.avl_node*>NULL)
+
+        # nodes come from a slab arena rather than one malloc() apiece
+        if avl_tree_use_new_arena(self.tree) != 0:
+            avl.avl_free_avl_tree(self.tree, NULL)
+            self.tree = NULL
+            raise MemoryError("Cannot allocate node arena")
 
         self.node_cache = NULL
         self.cache_index = 0
-        self.compare_function = compare_function
+        self.set_compare_function(compare_function)
 
         if args is None:
             pass
@@ -254,6 +364,7 @@ cdef class tree:
                 avl.avl_free_avl_tree(self.tree, avl_tree_key_free_fun)
                 raise
             if (tree_from_list(
+                    self.tree,
                     tmp_list,
                     self.tree[0].root,
                     &(self.tree[0].root[0].right),
@@ -264,13 +375,69 @@ cdef class tree:
                     "something went amiss whilst building the tree!")
             self.tree[0].length = length
         elif isinstance(args, tree):
-            self.compare_function = (<tree>args).compare_function
+            self.set_compare_function((<tree>args).compare_function)
+            if key_type is None:
+                self.compare.key_mode = (<tree>args).compare.key_mode
             avl_copy_avl_tree(args, self)
         else:
             raise TypeError("unsupported argument {}".format(args))
 
+    cdef set_compare_function(self, object compare_function):
+        self.compare_function = compare_function
+        if compare_function is None:
+            self.compare.compare_function = NULL
+        else:
+            self.compare.compare_function = <PyObject*>compare_function
+
+    cdef bint same_order(self, tree other):
+        "do <other>'s keys order the way ours do?"
+        return (other.compare_function is self.compare_function
+                and other.compare.key_mode == self.compare.key_mode)
+
+    cdef tree empty_copy(self):
+        "a new empty tree ordering its keys the way this one does"
+        cdef tree other = tree(None, self.compare_function)
+        other.compare.key_mode = self.compare.key_mode
+        # share our arena, so that nodes can move between the two
+        if avl.avl_tree_move_to_arena(other.tree, self.tree[0].arena) != 0:
+            raise MemoryError("Cannot share node arena")
+        return other
+
+    cdef tree copy_of(self, tree source):
+        "a copy of <source> built in this tree's arena"
+        cdef tree other = self.empty_copy()
+        avl_copy_avl_tree(source, other)
+        return other
+
+    cdef adopt(self, tree other):
+        "move the nodes of <other> into our arena, if not there already"
+        if avl.avl_tree_move_to_arena(other.tree, self.tree[0].arena) != 0:
+            raise MemoryError("Cannot move nodes")
+        other.node_cache = NULL
+
+    cdef tree ordered_copy(self, tree other):
+        "a copy of <other> in our arena, its keys ordered as ours are"
+        cdef tree result
+        if self.same_order(other):
+            return self.copy_of(other)
+        result = self.empty_copy()
+        for item in other:
+            result.insert(item)
+        return result
+
+    cdef tree take(self, tree other):
+        "the items of <other> as ordered_copy has them, leaving <other> empty"
+        cdef tree result
+        if self.same_order(other):
+            self.adopt(other)
+            return other
+        result = self.ordered_copy(other)
+        del other[:]
+        return result
+
     def __dealloc__(self):
-        avl.avl_free_avl_tree(self.tree, avl_tree_key_free_fun)
+        if self.tree:
+            avl.avl_free_avl_tree(self.tree, avl_tree_key_free_fun)
 
     def __str__(self):
         cdef object s = "["
@@ -394,6 +561,7 @@ cdef class tree:
                     break
 
             if tree_from_tree(
+                    new_tree.tree,
                     &node,
                     new_tree.tree[0].root,
                     &(new_tree.tree[0].root[0].right),
@@ -408,17 +576,45 @@ cdef class tree:
 
         raise ValueError("index is neiter int nor slice")
 
+    def __delitem__(self, object arg):
+        cdef Py_ssize_t ilow, ihigh, step
+
+        if PyInt_Check(arg):
+            self.remove_at(arg)
+            return
+        elif PySlice_Check(arg):
+            if (PySlice_GetIndices(
+                    arg, self.tree[0].length, &ilow, &ihigh, &step) < 0):
+                raise IndexError("invalid slice")
+            if step != 1:
+                raise IndexError("slice with step not supported")
+            if ilow < 0:
+                ilow = 0
+            if ihigh > self.tree[0].length:
+                ihigh = self.tree[0].length
+            if ilow < ihigh:
+                # cut the range out and rejoin the rest, rather than
+                # removing the items one at a time
+                avl.avl_remove_index_range(
+                    self.tree, ilow, ihigh, avl_tree_key_free_fun)
+                self.node_cache = NULL
+            return
+        raise ValueError("index is neiter int nor slice")
+
     def __add__(self, tree other):
-        cdef tree self_copy = tree(self.compare_function)
+        cdef tree self_copy = tree(self)
         cdef unsigned int other_node_counter = other.tree[0].length
         cdef avl.avl_node * other_node
         cdef unsigned int ignore
 
-        avl_copy_avl_tree(self, self_copy)
-        if not self_copy:
-            raise MemoryError()
-
         if other_node_counter:
+            # if <other> orders its keys as we do, and entirely after
+            # <self>, a copy of it can be joined on in O(log n), instead
+            # of inserting its items one by one
+            if self.same_order(other) and avl.avl_join(self_copy.tree,
+                            self_copy.copy_of(other).tree) == 0:
+                return self_copy
+
             # find the leftmost node of other
             other_node = other.tree[0].root[0].right
             while other_node[0].left:
@@ -449,6 +645,24 @@ cdef class tree:
             self.node_cache = NULL
             return index
 
+    cpdef bint insert_unique(self, val):
+        """t.insert_unique (val) => bool
+Insert <val> unless an item comparing equal to it is present, in one
+descent; returns whether it was inserted"""
+        cdef unsigned int index = 0
+        cdef void * existing
+        cdef int result
+        Py_XINCREF(<PyObject*>val)
+        result = avl.avl_insert_unique(
+            self.tree, <void*>val, &index, &existing)
+        if result != 0:
+            Py_DECREF(val)
+            if result < 0:
+                raise Exception("error while inserting item")
+            return False
+        self.node_cache = NULL
+        return True
+
     cpdef remove(self, val):
         "Remove an item from the tree"
         if (avl.avl_remove_by_key(
@@ -458,6 +672,146 @@ cdef class tree:
             self.node_cache = NULL
         return None
 
+    cpdef insert_at(self, Py_ssize_t index, val):
+        """t.insert_at (index, val)
+Insert an item at position <index>, without consulting the compare
+function; as with list.insert, indices past either end are clamped.
+Keeping <t> in order is up to the caller"""
+        if index < 0:
+            index = max(index + <Py_ssize_t>self.tree[0].length, 0)
+        index = min(index, <Py_ssize_t>self.tree[0].length)
+        Py_XINCREF(<PyObject*>val)
+        if avl.avl_insert_by_index(self.tree, <void*>val, index) != 0:
+            Py_DECREF(val)
+            raise Exception("error while inserting item")
+        self.node_cache = NULL
+
+    cpdef object remove_at(self, Py_ssize_t index):
+        """t.remove_at (index) => item
+Remove the item at position <index> and return it"""
+        cdef void * value
+
+        if index < 0:
+            index += self.tree[0].length
+        if avl.avl_get_item_by_index(self.tree, index, &value) != 0:
+            raise IndexError("tree index out of range")
+        item = <object>value
+        avl.avl_remove_by_index(self.tree, index, avl_tree_key_free_fun)
+        self.node_cache = NULL
+        return item
+
+    cpdef remove_range(self, low_key, high_key):
+        """t.remove_range (low_key, high_key)
+Remove every item with a key from <low_key> to <high_key> inclusive"""
+        avl.avl_remove_key_range(
+            self.tree, <void*>low_key, <void*>high_key, avl_tree_key_free_fun)
+        self.node_cache = NULL
+
+    cpdef tree split(self, key):
+        """t.split (key) => tree
+Remove the items ordering at or after <key> from <t>, and return them
+as a new tree"""
+        cdef tree right = self.empty_copy()
+
+        if avl.avl_split_by_key(self.tree, <void*>key, right.tree) != 0:
+            raise Exception("error while splitting tree")
+        self.node_cache = NULL
+        return right
+
+    cpdef tree split_at(self, Py_ssize_t index):
+        """t.split_at (index) => tree
+Remove the items from position <index> on from <t>, and return them
+as a new tree"""
+        cdef tree right = self.empty_copy()
+
+        if index < 0:
+            index += self.tree[0].length
+        if index < 0 or index > self.tree[0].length:
+            raise IndexError("tree index out of range")
+        if avl.avl_split_by_index(self.tree, index, right.tree) != 0:
+            raise Exception("error while splitting tree")
+        self.node_cache = NULL
+        return right
+
+    cpdef join(self, tree other):
+        """t.join (other)
+Move all the items of <other> onto the end of <t>, leaving <other>
+empty.  <other> must order its keys as <t> does, and no item of it may
+order before an item of <t>.  This is O(log n) for trees split from one
+another, and O(len (other)) for others, whose nodes must first move
+into <t>'s arena"""
+        if not self.same_order(other):
+            raise ValueError("trees are ordered differently")
+        self.adopt(other)
+        if avl.avl_join(self.tree, other.tree) != 0:
+            raise ValueError("trees overlap")
+        self.node_cache = NULL
+        other.node_cache = NULL
+
+    cpdef tree union(self, tree other):
+        """t.union (other) => tree
+Return a new tree holding the items of <t>, plus those items of
+<other> whose key does not occur in <t>.  Both trees are copied, which
+is O(n + m); see update for the in-place form"""
+        cdef tree result = tree(self)
+
+        if avl.avl_union(result.tree, result.ordered_copy(other).tree,
+                         avl_tree_key_free_fun) != 0:
+            raise Exception("error in set operation")
+        return result
+
+    cpdef tree intersection(self, tree other):
+        """t.intersection (other) => tree
+Return a new tree holding those items of <t> whose key occurs in
+<other>.  Both trees are copied; see intersection_update"""
+        cdef tree result = tree(self)
+
+        if avl.avl_intersection(result.tree, result.ordered_copy(other).tree,
+                                avl_tree_key_free_fun) != 0:
+            raise Exception("error in set operation")
+        return result
+
+    cpdef tree difference(self, tree other):
+        """t.difference (other) => tree
+Return a new tree holding those items of <t> whose key does not occur
+in <other>.  Both trees are copied; see difference_update"""
+        cdef tree result = tree(self)
+
+        if avl.avl_difference(result.tree, result.ordered_copy(other).tree,
+                              avl_tree_key_free_fun) != 0:
+            raise Exception("error in set operation")
+        return result
+
+    cpdef update(self, tree other):
+        """t.update (other)
+Add to <t> those items of <other> whose key does not occur in <t>,
+consuming <other>, which is left empty.  Nothing is copied: this is
+O(m log (n / m + 1)) for trees sharing an arena (say, split from one
+another), plus O(m) to move the nodes of <other> otherwise, or
+O(m log m) to insert its items afresh if it orders them differently"""
+        if avl.avl_union(self.tree, self.take(other).tree,
+                         avl_tree_key_free_fun) != 0:
+            raise Exception("error in set operation")
+        self.node_cache = NULL
+
+    cpdef intersection_update(self, tree other):
+        """t.intersection_update (other)
+Keep only those items of <t> whose key occurs in <other>, consuming
+<other> as update does"""
+        if avl.avl_intersection(
+                self.tree, self.take(other).tree, avl_tree_key_free_fun) != 0:
+            raise Exception("error in set operation")
+        self.node_cache = NULL
+
+    cpdef difference_update(self, tree other):
+        """t.difference_update (other)
+Drop those items of <t> whose key occurs in <other>, consuming <other>
+as update does"""
+        if avl.avl_difference(
+                self.tree, self.take(other).tree, avl_tree_key_free_fun) != 0:
+            raise Exception("error in set operation")
+        self.node_cache = NULL
+
     cpdef object lookup(self, key):
         "Return the first object comparing equal to the <key> argument"
         cdef PyObject * return_value
@@ -517,6 +871,22 @@ Returns a pair of indices (low, high) that span the range of <key>"""
         else:
             raise Exception("error while locating key span")
 
+    cpdef Py_ssize_t count(self, key):
+        """t.count (key) => int
+Return the number of items comparing equal to <key>"""
+        return (avl.avl_upper_bound_index(self.tree, <void*>key)
+                - avl.avl_lower_bound_index(self.tree, <void*>key))
+
+    cpdef Py_ssize_t count_range(self, low_key, high_key):
+        """t.count_range (low_key, high_key) => int
+Return the number of items with keys from <low_key> to <high_key>
+inclusive"""
+        cdef Py_ssize_t low = avl.avl_lower_bound_index(
+            self.tree, <void*>low_key)
+        cdef Py_ssize_t high = avl.avl_upper_bound_index(
+            self.tree, <void*>high_key)
+        return high - low if high > low else 0
+
     cpdef at_least(self, key_val):
         """Return the first object comparing greater to or equal to the <key> 
 argument"""
@@ -559,10 +929,163 @@ argument"""
         avl.avl_print_tree(self.tree, avl_tree_key_printer)
 
 
-def newavl(arg=None, compare_function=None):
+# the free_value_fun of a SortedDict's tree
+cdef int avl_tree_value_free_fun(void * value):
+    Py_XDECREF(<PyObject*>value)
+    return 0
+
+
+cdef class SortedDict:
+    """A mapping kept in key order.  Each key and its value share one
+tree node, so lookups compare keys alone and no (key, value) tuple is
+built per entry."""
+    cdef avl.avl_tree * tree
+    cdef unsigned int changes
+    cdef avl_py_compare compare
+    cpdef readonly object compare_function
+
+    def __cinit__(self, items=None, object compare_function=None,
+                  object key_type=None):
+        self.compare.key_mode = avl_key_mode(key_type)
+        self.compare.compare_function = (
+            NULL if compare_function is None else <PyObject*>compare_function)
+        self.tree = avl.avl_new_avl_tree(
+            avl_key_compare_for_python, <void*>&self.compare)
+        if not self.tree:
+            raise MemoryError("Cannot allocate tree")
+        avl.avl_tree_use_values(self.tree, avl_tree_value_free_fun)
+        if avl_tree_use_new_arena(self.tree) != 0:
+            avl.avl_free_avl_tree(self.tree, NULL)
+            self.tree = NULL
+            raise MemoryError("Cannot allocate node arena")
+        self.changes = 0
+        self.compare_function = compare_function
+
+    def __init__(self, items=None, object compare_function=None,
+                 object key_type=None):
+        if items is None:
+            return
+        if hasattr(items, "items"):
+            items = items.items()
+        for key, value in items:
+            self[key] = value
+
+    def __dealloc__(self):
+        if self.tree:
+            avl.avl_free_avl_tree(self.tree, avl_tree_key_free_fun)
+
+    def __len__(self):
+        return <int>self.tree[0].length
+
+    def __contains__(self, key):
+        cdef void * value
+        return avl.avl_get_value_by_key(self.tree, <void*>key, &value) == 0
+
+    def __getitem__(self, key):
+        cdef void * value
+        if avl.avl_get_value_by_key(self.tree, <void*>key, &value) != 0:
+            raise KeyError(key)
+        return <object>value
+
+    def __setitem__(self, key, value):
+        cdef unsigned int index = 0
+        cdef int result
+        Py_XINCREF(<PyObject*>key)
+        Py_XINCREF(<PyObject*>value)
+        # an existing key keeps its node; the old value is released
+        # through free_value_fun
+        result = avl.avl_upsert(
+            self.tree, <void*>key, <void*>value, &index)
+        if result < 0:
+            Py_DECREF(key)
+            Py_DECREF(value)
+            raise MemoryError("error while inserting item")
+        elif result == 1:
+            Py_DECREF(key)
+        else:
+            self.changes += 1
+
+    def __delitem__(self, key):
+        if avl.avl_remove_by_key(
+                self.tree, <void*>key, avl_tree_key_free_fun) != 0:
+            raise KeyError(key)
+        self.changes += 1
+
+    def get(self, key, default=None):
+        cdef void * value
+        if avl.avl_get_value_by_key(self.tree, <void*>key, &value) != 0:
+            return default
+        return <object>value
+
+    def key_at(self, Py_ssize_t index):
+        "Return the key at position <index>"
+        cdef void * key
+        if index < 0:
+            index += self.tree[0].length
+        if index < 0 or avl.avl_get_item_by_index(self.tree, index, &key) != 0:
+            raise IndexError("index out of range")
+        return <object>key
+
+    def value_at(self, Py_ssize_t index):
+        "Return the value at position <index>"
+        cdef void * value
+        if index < 0:
+            index += self.tree[0].length
+        if index < 0 or avl.avl_get_value_by_index(
+                self.tree, index, &value) != 0:
+            raise IndexError("index out of range")
+        return <object>value
+
+    def _walk(self, int what):
+        cdef avl.avl_node * node = self.tree[0].root[0].right
+        cdef unsigned int changes = self.changes
+        cdef unsigned int remaining = self.tree[0].length
+
+        if node:
+            while node[0].left:
+                node = node[0].left
+        while remaining:
+            remaining -= 1
+            if what == 0:
+                yield <object>node[0].key
+            elif what == 1:
+                yield <object>avl.AVL_NODE_VALUE(self.tree, node)
+            else:
+                yield (<object>node[0].key,
+                       <object>avl.AVL_NODE_VALUE(self.tree, node))
+            # a removal may have freed <node>
+            if self.changes != changes:
+                raise RuntimeError("SortedDict changed size during iteration")
+            node = avl.avl_get_successor(node)
+
+    def __iter__(self):
+        return self._walk(0)
+
+    def keys(self):
+        return self._walk(0)
+
+    def values(self):
+        return self._walk(1)
+
+    def items(self):
+        return self._walk(2)
+
+    def __repr__(self):
+        return "SortedDict({{{}}})".format(", ".join(
+            "{!r}: {!r}".format(k, v) for k, v in self.items()))
+
+    cpdef bint verify(self):
+        """Verify the internal structure of the AVL tree (testing only)"""
+        return avl.avl_verify(self.tree) == 0
+
+
+def newavl(arg=None, compare_function=None, key_type=None):
     """With no arguments, returns a new and empty tree.
 Given a list, it will return a new tree containing the elements
   of the list, and will sort the list as a side-effect
 Given a tree, will return a copy of the original tree
-An optional second argument is a key-comparison function"""
-    return tree(arg, compare_function)
+An optional second argument is a key-comparison function
+<key_type> may be int, float, str or bytes, to compare keys of just
+  that type in C, or object, for rich comparison throughout; the
+  default compares any of the four in C"""
+    return tree(arg, compare_function, key_type)
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+#include <stdlib.h>
+
+#include "avl_multiset.h"
+
+#define AVL_MULTISET_TOTAL(n)   (*(unsigned int *) AVL_NODE_AGGREGATE (n))
+
+#define AVL_MULTISET_ENTRY(n)   ((avl_multiset_entry *) (n)->key)
+
+static
+int
+avl_multiset_compare (void * compare_arg, void * a, void * b)
+{
+  avl_multiset * multiset = (avl_multiset *) compare_arg;
+
+  return multiset->compare_fun (
+    multiset->compare_arg,
+    ((avl_multiset_entry *) a)->key,
+    ((avl_multiset_entry *) b)->key
+    );
+}
+
+/* the monoid: the number of copies in a subtree */
+
+static
+void
+avl_multiset_identity (void * monoid_arg, void * aggregate)
+{
+  *(unsigned int *) aggregate = 0;
+}
+
+static
+void
+avl_multiset_append_key (void * monoid_arg, void * aggregate, void * key)
+{
+  *(unsigned int *) aggregate += ((avl_multiset_entry *) key)->count;
+}
+
+static
+void
+avl_multiset_append (void * monoid_arg, void * aggregate, const void * other)
+{
+  *(unsigned int *) aggregate += *(const unsigned int *) other;
+}
+
+avl_multiset *
+avl_new_multiset (avl_key_compare_fun_type compare_fun,
+                  void * compare_arg)
+{
+  avl_multiset * multiset = (avl_multiset *) malloc (sizeof (avl_multiset));
+
+  if (!multiset) {
+    return NULL;
+  }
+  multiset->tree = avl_new_avl_tree (avl_multiset_compare, multiset);
+  if (!multiset->tree) {
+    free (multiset);
+    return NULL;
+  }
+  multiset->length = 0;
+  multiset->monoid.size = sizeof (unsigned int);
+  multiset->monoid.identity = avl_multiset_identity;
+  multiset->monoid.append_key = avl_multiset_append_key;
+  multiset->monoid.append = avl_multiset_append;
+  multiset->monoid.monoid_arg = NULL;
+  multiset->compare_fun = compare_fun;
+  multiset->compare_arg = compare_arg;
+  avl_tree_use_monoid (multiset->tree, &multiset->monoid);
+  return multiset;
+}
+
+static
+int
+avl_multiset_free_entry (void * key, void * iter_arg)
+{
+  avl_multiset_entry * entry = (avl_multiset_entry *) key;
+  avl_free_key_fun_type * free_key_fun = (avl_free_key_fun_type *) iter_arg;
+
+  if (*free_key_fun) {
+    (*free_key_fun) (entry->key);
+  }
+  free (entry);
+  return 0;
+}
+
+void
+avl_free_multiset (avl_multiset * multiset,
+                   avl_free_key_fun_type free_key_fun)
+{
+  avl_iterate_inorder (multiset->tree, avl_multiset_free_entry, &free_key_fun);
+  avl_free_avl_tree (multiset->tree, NULL);
+  free (multiset);
+}
+
+/* the node holding <key>, or NULL */
+
+static
+avl_node *
+avl_multiset_find (avl_multiset * multiset, void * key)
+{
+  avl_node * p = multiset->tree->root->right;
+
+  while (p) {
+    int compare_result = multiset->compare_fun (
+      multiset->compare_arg, key, AVL_MULTISET_ENTRY (p)->key
+      );
+    if (compare_result < 0) {
+      p = p->left;
+    } else if (compare_result > 0) {
+      p = p->right;
+    } else {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+int
+avl_multiset_insert (avl_multiset * multiset,
+                     void * key,
+                     unsigned int count)
+{
+  avl_node * node;
+  avl_multiset_entry * entry;
+  unsigned int index;
+
+  if (!count) {
+    return -1;
+  }
+  node = avl_multiset_find (multiset, key);
+  if (node) {
+    AVL_MULTISET_ENTRY (node)->count += count;
+    avl_update_aggregates (multiset->tree, node);
+    multiset->length += count;
+    return 1;
+  }
+  entry = (avl_multiset_entry *) malloc (sizeof (avl_multiset_entry));
+  if (!entry) {
+    return -1;
+  }
+  entry->key = key;
+  entry->count = count;
+  if (avl_insert_by_key (multiset->tree, entry, &index) != 0) {
+    free (entry);
+    return -1;
+  }
+  multiset->length += count;
+  return 0;
+}
+
+static
+int
+avl_multiset_keep_entry (void * key)
+{
+  return 0;
+}
+
+int
+avl_multiset_remove (avl_multiset * multiset,
+                     void * key,
+                     unsigned int count,
+                     avl_free_key_fun_type free_key_fun)
+{
+  avl_node * node = avl_multiset_find (multiset, key);
+  avl_multiset_entry * entry;
+
+  if (!node) {
+    return -1;
+  }
+  entry = AVL_MULTISET_ENTRY (node);
+  if (count < entry->count) {
+    entry->count -= count;
+    avl_update_aggregates (multiset->tree, node);
+    multiset->length -= count;
+    return 0;
+  }
+  multiset->length -= entry->count;
+  avl_remove_by_key (multiset->tree, entry, avl_multiset_keep_entry);
+  if (free_key_fun) {
+    free_key_fun (entry->key);
+  }
+  free (entry);
+  return 0;
+}
+
+unsigned int
+avl_multiset_count (avl_multiset * multiset, void * key)
+{
+  avl_node * node = avl_multiset_find (multiset, key);
+
+  return node ? AVL_MULTISET_ENTRY (node)->count : 0;
+}
+
+int
+avl_multiset_get_item_by_index (avl_multiset * multiset,
+                                unsigned int index,
+                                void ** value_address)
+{
+  avl_node * p = multiset->tree->root->right;
+
+  while (p) {
+    unsigned int left = p->left ? AVL_MULTISET_TOTAL (p->left) : 0;
+    unsigned int count = AVL_MULTISET_ENTRY (p)->count;
+    if (index < left) {
+      p = p->left;
+    } else if (index < left + count) {
+      *value_address = AVL_MULTISET_ENTRY (p)->key;
+      return 0;
+    } else {
+      index = index - left - count;
+      p = p->right;
+    }
+  }
+  return -1;
+}
+
+int
+avl_multiset_get_span_by_key (avl_multiset * multiset,
+                              void * key,
+                              unsigned int * low,
+                              unsigned int * high)
+{
+  avl_node * p = multiset->tree->root->right;
+  unsigned int base = 0;
+
+  while (p) {
+    unsigned int left = p->left ? AVL_MULTISET_TOTAL (p->left) : 0;
+    int compare_result = multiset->compare_fun (
+      multiset->compare_arg, key, AVL_MULTISET_ENTRY (p)->key
+      );
+    if (compare_result < 0) {
+      p = p->left;
+    } else if (compare_result > 0) {
+      base = base + left + AVL_MULTISET_ENTRY (p)->count;
+      p = p->right;
+    } else {
+      *low = base + left;
+      *high = base + left + AVL_MULTISET_ENTRY (p)->count;
+      return 0;
+    }
+  }
+  *low = *high = base;
+  return 0;
+}
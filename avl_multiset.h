@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A multiset: equal keys share one node, which counts them, instead of
+ * taking a node apiece.  The nodes of <tree> hold avl_multiset_entry
+ * pointers, and a monoid (see avl_tree_use_monoid) keeps the total
+ * count of each subtree, so that indices and spans are weighted by
+ * multiplicity and still found in one O(log d) descent, for d distinct
+ * keys.
+ *
+ * The first of a run of equal keys is the one kept; it is released with
+ * <free_key_fun> when its count drops to zero, or with the multiset.
+ */
+
+#ifndef AVL_MULTISET_H
+#define AVL_MULTISET_H
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_multiset_entry {
+  void *                key;
+  unsigned int          count;
+} avl_multiset_entry;
+
+typedef struct _avl_multiset {
+  avl_tree *            tree;
+  unsigned int          length;         /* counting every copy */
+  avl_monoid            monoid;
+  avl_key_compare_fun_type compare_fun;
+  void *                compare_arg;
+} avl_multiset;
+
+avl_multiset * avl_new_multiset (
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg
+  );
+
+void avl_free_multiset (
+  avl_multiset *        multiset,
+  avl_free_key_fun_type free_key_fun
+  );
+
+/*
+ * Add <count> copies of <key>.  Returns 1 if an equal key was already
+ * present, in which case <key> itself is not kept.  A <count> of zero
+ * is refused with -1, so that every node counts at least one copy.
+ */
+
+int avl_multiset_insert (
+  avl_multiset *        multiset,
+  void *                key,
+  unsigned int          count
+  );
+
+/* remove up to <count> copies of <key>; -1 if there are none */
+
+int avl_multiset_remove (
+  avl_multiset *        multiset,
+  void *                key,
+  unsigned int          count,
+  avl_free_key_fun_type free_key_fun
+  );
+
+unsigned int avl_multiset_count (
+  avl_multiset *        multiset,
+  void *                key
+  );
+
+/* the key at <index>, counting each copy as an item */
+
+int avl_multiset_get_item_by_index (
+  avl_multiset *        multiset,
+  unsigned int          index,
+  void **               value_address
+  );
+
+int avl_multiset_get_span_by_key (
+  avl_multiset *        multiset,
+  void *                key,
+  unsigned int *        low,
+  unsigned int *        high
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_MULTISET_H */
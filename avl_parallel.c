@@ -0,0 +1,442 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+/*
+ * Copyright (C) 1995-1997 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ *
+ *                         All Rights Reserved
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of Sam
+ * Rushing not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission.
+ *
+ * SAM RUSHING DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL SAM RUSHING BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * Parallel set operations.
+ *
+ * The recursion in avl_set_operation() makes two independent calls,
+ * on the parts of the trees less than and greater than the pivot.
+ * Here the first of these is handed to the pool as a task while the
+ * current thread carries on with the second, until the subproblems
+ * fall below the pool's cutoff.  Since the recursion neither allocates
+ * nor frees nodes (dropped nodes are only collected on a list), the
+ * tasks never touch the shared arena.
+ *
+ * The pool itself is the classic work-stealing arrangement: every
+ * worker owns a deque, pushing and popping its own tasks at the
+ * bottom, while idle workers steal from the top of the others'.  The
+ * tasks are coarse (the cutoff sees to that), so a single mutex
+ * guarding all the deques costs nothing measurable.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+#include "avl_internal.h"
+#include "avl_parallel.h"
+
+#define AVL_DEFAULT_CUTOFF 4096
+
+typedef struct _avl_pool_task {
+  void (*run) (struct _avl_pool_task * task, unsigned int worker);
+  int                           done;
+} avl_pool_task;
+
+typedef struct _avl_pool_deque {
+  avl_pool *                    pool;
+  unsigned int                  worker;
+  avl_pool_task **              tasks;
+  unsigned int                  top;
+  unsigned int                  bottom;
+  unsigned int                  capacity;
+} avl_pool_deque;
+
+struct _avl_pool {
+  pthread_mutex_t               lock;
+  pthread_cond_t                changed;
+  avl_pool_deque *              deques;
+  pthread_t *                   threads;
+  unsigned int                  num_workers;
+  unsigned int                  num_threads;
+  unsigned int                  cutoff;
+  unsigned int                  next_victim;
+  int                           shutdown;
+};
+
+/* all of the following are called with <pool->lock> held */
+
+static
+int
+avl_pool_push (avl_pool_deque * deque, avl_pool_task * task)
+{
+  if (deque->bottom == deque->capacity) {
+    if (deque->top) {
+      memmove (deque->tasks,
+               deque->tasks + deque->top,
+               (deque->bottom - deque->top) * sizeof (avl_pool_task *));
+      deque->bottom = deque->bottom - deque->top;
+      deque->top = 0;
+    } else {
+      unsigned int capacity = deque->capacity ? (deque->capacity * 2) : 32;
+      avl_pool_task ** tasks = (avl_pool_task **)
+        realloc (deque->tasks, capacity * sizeof (avl_pool_task *));
+      if (!tasks) {
+        return -1;
+      }
+      deque->tasks = tasks;
+      deque->capacity = capacity;
+    }
+  }
+  deque->tasks[deque->bottom] = task;
+  deque->bottom = deque->bottom + 1;
+  return 0;
+}
+
+static
+avl_pool_task *
+avl_pool_steal (avl_pool * pool)
+{
+  unsigned int i;
+
+  for (i = 0; i < pool->num_workers; i++) {
+    unsigned int victim = (pool->next_victim + i) % pool->num_workers;
+    avl_pool_deque * deque = &pool->deques[victim];
+    if (deque->bottom > deque->top) {
+      avl_pool_task * task = deque->tasks[deque->top];
+      deque->top = deque->top + 1;
+      if (deque->top == deque->bottom) {
+        deque->top = deque->bottom = 0;
+      }
+      pool->next_victim = victim + 1;
+      return task;
+    }
+  }
+  return NULL;
+}
+
+static
+int
+avl_pool_queued (avl_pool * pool)
+{
+  unsigned int i;
+
+  for (i = 0; i < pool->num_workers; i++) {
+    if (pool->deques[i].bottom > pool->deques[i].top) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static
+void
+avl_pool_run (avl_pool * pool, avl_pool_task * task, unsigned int worker)
+{
+  pthread_mutex_unlock (&pool->lock);
+  task->run (task, worker);
+  pthread_mutex_lock (&pool->lock);
+  task->done = 1;
+  pthread_cond_broadcast (&pool->changed);
+}
+
+static
+void *
+avl_pool_worker (void * arg)
+{
+  avl_pool_deque * deque = (avl_pool_deque *) arg;
+  avl_pool * pool = deque->pool;
+
+  pthread_mutex_lock (&pool->lock);
+  while (!pool->shutdown) {
+    avl_pool_task * task = avl_pool_steal (pool);
+    if (task) {
+      avl_pool_run (pool, task, deque->worker);
+    } else {
+      pthread_cond_wait (&pool->changed, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* queue <task> on <worker>'s deque; if that fails, run it right away */
+
+static
+void
+avl_pool_spawn (avl_pool * pool, unsigned int worker, avl_pool_task * task)
+{
+  int result;
+
+  pthread_mutex_lock (&pool->lock);
+  task->done = 0;
+  result = avl_pool_push (&pool->deques[worker], task);
+  if (result == 0) {
+    /* one new task wants one thief */
+    pthread_cond_signal (&pool->changed);
+  }
+  pthread_mutex_unlock (&pool->lock);
+  if (result != 0) {
+    task->run (task, worker);
+    task->done = 1;
+  }
+}
+
+/*
+ * Wait for a task spawned by <worker>.  If nobody has stolen it, it is
+ * still at the bottom of our deque and we run it ourselves; otherwise
+ * we help out with other work until the thief is done.
+ */
+
+static
+void
+avl_pool_sync (avl_pool * pool, unsigned int worker, avl_pool_task * task)
+{
+  avl_pool_deque * deque = &pool->deques[worker];
+
+  pthread_mutex_lock (&pool->lock);
+  while (!task->done) {
+    avl_pool_task * other;
+    if ((deque->bottom > deque->top) && (deque->tasks[deque->bottom - 1] == task)) {
+      deque->bottom = deque->bottom - 1;
+      avl_pool_run (pool, task, worker);
+    } else if ((other = avl_pool_steal (pool))) {
+      avl_pool_run (pool, other, worker);
+    } else {
+      pthread_cond_wait (&pool->changed, &pool->lock);
+    }
+  }
+  /*
+   * The wakeup we last took may have been meant for a thief; if work
+   * is still queued, pass it on rather than swallow it.
+   */
+  if (avl_pool_queued (pool)) {
+    pthread_cond_signal (&pool->changed);
+  }
+  pthread_mutex_unlock (&pool->lock);
+}
+
+avl_pool *
+avl_new_pool (unsigned int threads, unsigned int cutoff)
+{
+  avl_pool * pool = (avl_pool *) malloc (sizeof (avl_pool));
+  unsigned int i;
+
+  if (!pool) {
+    return NULL;
+  }
+  if (!threads) {
+    threads = 1;
+  }
+  pool->num_workers = threads;
+  pool->num_threads = 0;
+  pool->cutoff = cutoff ? cutoff : AVL_DEFAULT_CUTOFF;
+  pool->next_victim = 0;
+  pool->shutdown = 0;
+  pool->deques = (avl_pool_deque *) calloc (threads, sizeof (avl_pool_deque));
+  pool->threads = (pthread_t *) calloc (threads, sizeof (pthread_t));
+  if (!pool->deques || !pool->threads) {
+    free (pool->deques);
+    free (pool->threads);
+    free (pool);
+    return NULL;
+  }
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->changed, NULL);
+  for (i = 0; i < threads; i++) {
+    pool->deques[i].pool = pool;
+    pool->deques[i].worker = i;
+  }
+  /* worker 0 is whoever calls into the pool */
+  for (i = 1; i < threads; i++) {
+    if (pthread_create (&pool->threads[i], NULL, avl_pool_worker, &pool->deques[i]) != 0) {
+      avl_free_pool (pool);
+      return NULL;
+    }
+    pool->num_threads = i;
+  }
+  return pool;
+}
+
+void
+avl_free_pool (avl_pool * pool)
+{
+  unsigned int i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast (&pool->changed);
+  pthread_mutex_unlock (&pool->lock);
+  for (i = 1; i <= pool->num_threads; i++) {
+    pthread_join (pool->threads[i], NULL);
+  }
+  for (i = 0; i < pool->num_workers; i++) {
+    free (pool->deques[i].tasks);
+  }
+  pthread_cond_destroy (&pool->changed);
+  pthread_mutex_destroy (&pool->lock);
+  free (pool->deques);
+  free (pool->threads);
+  free (pool);
+}
+
+typedef struct _avl_set_task {
+  avl_pool_task                 task;
+  avl_pool *                    pool;
+  avl_tree *                    tree;
+  int                           operation;
+  avl_subtree                   a;
+  avl_subtree                   b;
+  avl_subtree                   result;
+  avl_node *                    dropped;
+} avl_set_task;
+
+static
+avl_subtree
+avl_parallel_set_operation (avl_pool * pool,
+                            unsigned int worker,
+                            avl_tree * tree,
+                            int operation,
+                            avl_subtree a,
+                            avl_subtree b,
+                            avl_node ** dropped);
+
+static
+void
+avl_set_task_run (avl_pool_task * task, unsigned int worker)
+{
+  avl_set_task * t = (avl_set_task *) task;
+
+  t->result = avl_parallel_set_operation (t->pool, worker, t->tree, t->operation,
+                                          t->a, t->b, &t->dropped);
+}
+
+/* put the nodes dropped by a subtask onto our own list */
+
+static
+void
+avl_splice_dropped (avl_node ** dropped, avl_node * more)
+{
+  if (more) {
+    avl_node * tail = more;
+    while (tail->parent) {
+      tail = tail->parent;
+    }
+    tail->parent = *dropped;
+    *dropped = more;
+  }
+}
+
+static
+avl_subtree
+avl_parallel_set_operation (avl_pool * pool,
+                            unsigned int worker,
+                            avl_tree * tree,
+                            int operation,
+                            avl_subtree a,
+                            avl_subtree b,
+                            avl_node ** dropped)
+{
+  avl_set_parts parts;
+  avl_set_task left;
+  avl_subtree right, result;
+
+  if ((a.size + b.size) < pool->cutoff) {
+    return avl_set_operation (tree, operation, a, b, dropped);
+  }
+  if (avl_set_trivial (operation, a, b, &result, dropped)) {
+    return result;
+  }
+  avl_set_divide (tree, a, b, &parts);
+
+  left.task.run = avl_set_task_run;
+  left.pool = pool;
+  left.tree = tree;
+  left.operation = operation;
+  left.a = parts.a_less;
+  left.b = parts.b_less;
+  left.dropped = NULL;
+  avl_pool_spawn (pool, worker, &left.task);
+
+  right = avl_parallel_set_operation (pool, worker, tree, operation,
+                                      parts.a_more, parts.b_more, dropped);
+
+  avl_pool_sync (pool, worker, &left.task);
+  avl_splice_dropped (dropped, left.dropped);
+  return avl_set_combine (tree, operation, &parts, left.result, right, dropped);
+}
+
+static
+int
+avl_parallel_set_operation_on_trees (avl_pool * pool,
+                                     avl_tree * a,
+                                     avl_tree * b,
+                                     int operation,
+                                     avl_free_key_fun_type free_key_fun)
+{
+  avl_node * dropped = NULL;
+
+  if ((a == b) || !avl_same_layout (a, b)) {
+    return -1;
+  }
+  avl_attach_subtree (
+    a,
+    avl_parallel_set_operation (pool, 0, a, operation,
+                                avl_detach_subtree (a),
+                                avl_detach_subtree (b),
+                                &dropped)
+    );
+  avl_free_dropped (a, dropped, free_key_fun);
+  return 0;
+}
+
+int
+avl_parallel_union (avl_pool * pool,
+                    avl_tree * a,
+                    avl_tree * b,
+                    avl_free_key_fun_type free_key_fun)
+{
+  return avl_parallel_set_operation_on_trees (pool, a, b, AVL_SET_UNION, free_key_fun);
+}
+
+int
+avl_parallel_intersection (avl_pool * pool,
+                           avl_tree * a,
+                           avl_tree * b,
+                           avl_free_key_fun_type free_key_fun)
+{
+  return avl_parallel_set_operation_on_trees (pool, a, b, AVL_SET_INTERSECTION, free_key_fun);
+}
+
+int
+avl_parallel_difference (avl_pool * pool,
+                         avl_tree * a,
+                         avl_tree * b,
+                         avl_free_key_fun_type free_key_fun)
+{
+  return avl_parallel_set_operation_on_trees (pool, a, b, AVL_SET_DIFFERENCE, free_key_fun);
+}
+
+int
+avl_parallel_merge (avl_pool * pool,
+                    avl_tree * a,
+                    avl_tree * b)
+{
+  return avl_parallel_set_operation_on_trees (pool, a, b, AVL_SET_MERGE, NULL);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * Parallel set operations and bulk merge, run by fork-join recursion
+ * on a small work-stealing pool of pthreads.
+ *
+ * The compare function of the trees involved is called from several
+ * threads at once, so it must be thread-safe.  A pool runs one
+ * operation at a time.
+ */
+
+#ifndef AVL_PARALLEL_H
+#define AVL_PARALLEL_H
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_pool avl_pool;
+
+/*
+ * <threads> counts the calling thread, so a pool of one thread runs
+ * everything sequentially.  Subproblems with fewer than <cutoff> items
+ * between them are not split any further; 0 picks a default.
+ */
+
+avl_pool * avl_new_pool (unsigned int threads, unsigned int cutoff);
+void avl_free_pool (avl_pool * pool);
+
+int avl_parallel_union (
+  avl_pool *            pool,
+  avl_tree *            a,
+  avl_tree *            b,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_parallel_intersection (
+  avl_pool *            pool,
+  avl_tree *            a,
+  avl_tree *            b,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_parallel_difference (
+  avl_pool *            pool,
+  avl_tree *            a,
+  avl_tree *            b,
+  avl_free_key_fun_type free_key_fun
+  );
+
+int avl_parallel_merge (
+  avl_pool *            pool,
+  avl_tree *            a,
+  avl_tree *            b
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_PARALLEL_H */
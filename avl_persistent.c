@@ -0,0 +1,574 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * Updates walk down the search path through links (child pointers, or
+ * the version's root), making each node writable before going on.  A
+ * node reached through a writable node can be written in place when its
+ * reference count is one, since then no other version can reach it;
+ * otherwise it is copied, the copy taking a reference to each child,
+ * and the link moves over to the copy.
+ *
+ * Giving up a reference goes through avl_pnode_release.  When a count
+ * drops to zero the node dies, releasing its key and its children.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_persistent.h"
+
+#define AVL_PNODE_COUNT(n)      __atomic_load_n (&(n)->refcount, __ATOMIC_ACQUIRE)
+#define AVL_PNODE_RETAIN(n)     __atomic_add_fetch (&(n)->refcount, 1, __ATOMIC_RELAXED)
+#define AVL_PNODE_DROP(n)       __atomic_sub_fetch (&(n)->refcount, 1, __ATOMIC_ACQ_REL)
+
+avl_ptree *
+avl_new_ptree (avl_key_compare_fun_type compare_fun,
+               void * compare_arg,
+               avl_copy_key_fun_type copy_key_fun,
+               avl_free_key_fun_type free_key_fun)
+{
+  avl_ptree * t;
+
+  if (free_key_fun && !copy_key_fun) {
+    return NULL;
+  }
+  t = (avl_ptree *) malloc (sizeof (avl_ptree));
+  if (!t) {
+    return NULL;
+  }
+  t->root = NULL;
+  t->length = 0;
+  t->compare_fun = compare_fun;
+  t->compare_arg = compare_arg;
+  t->copy_key_fun = copy_key_fun;
+  t->free_key_fun = free_key_fun;
+  t->spare = NULL;
+  t->spare_count = 0;
+  return t;
+}
+
+static
+void
+avl_pnode_release (avl_ptree * tree, avl_pnode * node)
+{
+  while (node && AVL_PNODE_DROP (node) == 0) {
+    avl_pnode * right = node->right;
+    if (tree->free_key_fun) {
+      tree->free_key_fun (node->key);
+    }
+    avl_pnode_release (tree, node->left);
+    free (node);
+    node = right;
+  }
+}
+
+void
+avl_free_ptree (avl_ptree * tree)
+{
+  avl_pnode_release (tree, tree->root);
+  while (tree->spare) {
+    avl_pnode * next = tree->spare->right;
+    free (tree->spare);
+    tree->spare = next;
+  }
+  free (tree);
+}
+
+avl_ptree *
+avl_ptree_snapshot (avl_ptree * tree)
+{
+  avl_ptree * t = avl_new_ptree (
+    tree->compare_fun, tree->compare_arg,
+    tree->copy_key_fun, tree->free_key_fun
+    );
+
+  if (!t) {
+    return NULL;
+  }
+  if (tree->root) {
+    AVL_PNODE_RETAIN (tree->root);
+  }
+  t->root = tree->root;
+  t->length = tree->length;
+  return t;
+}
+
+/* the tallest an AVL tree of <length> nodes can be */
+
+static
+unsigned int
+avl_ptree_max_height (unsigned int length)
+{
+  /* the sparsest trees of height h have N(h) = N(h-1) + N(h-2) + 1 nodes */
+  unsigned long a = 0, b = 1;
+  unsigned int h = 0;
+
+  while (b <= length) {
+    unsigned long c = a + b + 1;
+    a = b;
+    b = c;
+    h = h + 1;
+  }
+  return h;
+}
+
+/* make sure <count> nodes are set aside */
+
+static
+int
+avl_ptree_reserve (avl_ptree * tree, unsigned int count)
+{
+  while (tree->spare_count < count) {
+    avl_pnode * node = (avl_pnode *) malloc (sizeof (avl_pnode));
+    if (!node) {
+      return -1;
+    }
+    node->right = tree->spare;
+    tree->spare = node;
+    tree->spare_count = tree->spare_count + 1;
+  }
+  return 0;
+}
+
+static
+avl_pnode *
+avl_pnode_new (avl_ptree * tree,
+               void * key,
+               avl_pnode * left,
+               avl_pnode * right,
+               unsigned int rank_and_balance)
+{
+  avl_pnode * node = tree->spare;
+
+  tree->spare = node->right;
+  tree->spare_count = tree->spare_count - 1;
+  node->key = key;
+  node->left = left;
+  node->right = right;
+  node->refcount = 1;
+  node->rank_and_balance = rank_and_balance;
+  return node;
+}
+
+/*
+ * Make the node at <*link>, which sits in a node we may write (or is
+ * the root), writable too, copying it if another version shares it.
+ */
+
+static
+avl_pnode *
+avl_pnode_own (avl_ptree * tree, avl_pnode ** link)
+{
+  avl_pnode * node = *link;
+  avl_pnode * copy;
+
+  if (AVL_PNODE_COUNT (node) == 1) {
+    return node;
+  }
+  if (node->left) {
+    AVL_PNODE_RETAIN (node->left);
+  }
+  if (node->right) {
+    AVL_PNODE_RETAIN (node->right);
+  }
+  copy = avl_pnode_new (
+    tree,
+    tree->copy_key_fun ? tree->copy_key_fun (node->key) : node->key,
+    node->left, node->right, node->rank_and_balance
+    );
+  *link = copy;
+  avl_pnode_release (tree, node);
+  return copy;
+}
+
+/* replace the writable node at <*link> by its only child, or none */
+
+static
+void
+avl_pnode_splice (avl_ptree * tree, avl_pnode ** link)
+{
+  avl_pnode * node = *link;
+  avl_pnode * child = node->left ? node->left : node->right;
+
+  if (child) {
+    AVL_PNODE_RETAIN (child);
+  }
+  *link = child;
+  avl_pnode_release (tree, node);
+}
+
+/* rotations move references around without changing any counts */
+
+static
+avl_pnode *
+avl_pnode_rotate_left (avl_pnode * p)
+{
+  avl_pnode * q = p->right;
+
+  p->right = q->left;
+  q->left = p;
+  AVL_SET_RANK (q, (AVL_GET_RANK (q) + AVL_GET_RANK (p)));
+  return q;
+}
+
+static
+avl_pnode *
+avl_pnode_rotate_right (avl_pnode * p)
+{
+  avl_pnode * q = p->left;
+
+  p->left = q->right;
+  q->right = p;
+  AVL_SET_RANK (p, (AVL_GET_RANK (p) - AVL_GET_RANK (q)));
+  return q;
+}
+
+/*
+ * As avl_rebalance in avl.c, for the writable node at <*link>, out of
+ * balance by <balance>; the children it rotates are made writable first.
+ */
+
+static
+avl_pnode *
+avl_pnode_rebalance (avl_ptree * tree, avl_pnode ** link, int balance)
+{
+  avl_pnode * p = *link;
+  avl_pnode * q, * r;
+  int qb, rb;
+
+  if (balance > 0) {
+    q = avl_pnode_own (tree, &p->right);
+    qb = AVL_GET_BALANCE (q);
+    if (qb < 0) {
+      r = avl_pnode_own (tree, &q->left);
+      rb = AVL_GET_BALANCE (r);
+      p->right = avl_pnode_rotate_right (q);
+      *link = avl_pnode_rotate_left (p);
+      AVL_SET_BALANCE (p, ((rb > 0) ? -1 : 0));
+      AVL_SET_BALANCE (q, ((rb < 0) ? +1 : 0));
+      AVL_SET_BALANCE (r, 0);
+    } else {
+      *link = avl_pnode_rotate_left (p);
+      AVL_SET_BALANCE (p, ((qb == 0) ? +1 : 0));
+      AVL_SET_BALANCE (q, ((qb == 0) ? -1 : 0));
+    }
+  } else {
+    q = avl_pnode_own (tree, &p->left);
+    qb = AVL_GET_BALANCE (q);
+    if (qb > 0) {
+      r = avl_pnode_own (tree, &q->right);
+      rb = AVL_GET_BALANCE (r);
+      p->left = avl_pnode_rotate_left (q);
+      *link = avl_pnode_rotate_right (p);
+      AVL_SET_BALANCE (p, ((rb < 0) ? +1 : 0));
+      AVL_SET_BALANCE (q, ((rb > 0) ? -1 : 0));
+      AVL_SET_BALANCE (r, 0);
+    } else {
+      *link = avl_pnode_rotate_right (p);
+      AVL_SET_BALANCE (p, ((qb == 0) ? -1 : 0));
+      AVL_SET_BALANCE (q, ((qb == 0) ? +1 : 0));
+    }
+  }
+  return *link;
+}
+
+/* the <side> subtree of the node at <*link> grew; did the node's? */
+
+static
+int
+avl_pnode_grow (avl_ptree * tree, avl_pnode ** link, int side)
+{
+  avl_pnode * p = *link;
+  int balance = AVL_GET_BALANCE (p) + side;
+
+  if (balance == 0) {
+    AVL_SET_BALANCE (p, 0);
+    return 0;
+  } else if ((balance == 1) || (balance == -1)) {
+    AVL_SET_BALANCE (p, balance);
+    return 1;
+  } else {
+    avl_pnode_rebalance (tree, link, balance);
+    return 0;
+  }
+}
+
+/* the <side> subtree of the node at <*link> shrank; did the node's? */
+
+static
+int
+avl_pnode_shrink (avl_ptree * tree, avl_pnode ** link, int side)
+{
+  avl_pnode * p = *link;
+  int balance = AVL_GET_BALANCE (p) - side;
+
+  if (balance == 0) {
+    AVL_SET_BALANCE (p, 0);
+    return 1;
+  } else if ((balance == 1) || (balance == -1)) {
+    AVL_SET_BALANCE (p, balance);
+    return 0;
+  } else {
+    return (AVL_GET_BALANCE (avl_pnode_rebalance (tree, link, balance)) == 0);
+  }
+}
+
+/* returns 1 if the subtree at <*link> grew */
+
+static
+int
+avl_pnode_insert (avl_ptree * tree,
+                  avl_pnode ** link,
+                  void * key,
+                  unsigned int * index)
+{
+  avl_pnode * node;
+
+  if (!*link) {
+    node = avl_pnode_new (tree, key, NULL, NULL, 0);
+    AVL_SET_RANK (node, 1);
+    AVL_SET_BALANCE (node, 0);
+    *link = node;
+    return 1;
+  }
+  node = avl_pnode_own (tree, link);
+  if (tree->compare_fun (tree->compare_arg, key, node->key) < 1) {
+    AVL_SET_RANK (node, (AVL_GET_RANK (node) + 1));
+    if (avl_pnode_insert (tree, &node->left, key, index)) {
+      return avl_pnode_grow (tree, link, -1);
+    }
+  } else {
+    *index = *index + AVL_GET_RANK (node);
+    if (avl_pnode_insert (tree, &node->right, key, index)) {
+      return avl_pnode_grow (tree, link, +1);
+    }
+  }
+  return 0;
+}
+
+int
+avl_ptree_insert_by_key (avl_ptree * tree,
+                         void * key,
+                         unsigned int * index)
+{
+  unsigned int i = 0;
+
+  /* one copy per level, plus the new leaf */
+  if (avl_ptree_reserve (tree, avl_ptree_max_height (tree->length) + 1) != 0) {
+    return -1;
+  }
+  avl_pnode_insert (tree, &tree->root, key, &i);
+  tree->length = tree->length + 1;
+  if (index) {
+    *index = i;
+  }
+  return 0;
+}
+
+/*
+ * Remove the last node under <*link>, handing back a reference to its
+ * key.  Returns 1 if the subtree got shorter.
+ */
+
+static
+int
+avl_pnode_remove_last (avl_ptree * tree, avl_pnode ** link, void ** key)
+{
+  avl_pnode * node = avl_pnode_own (tree, link);
+
+  if (!node->right) {
+    *key = tree->copy_key_fun ? tree->copy_key_fun (node->key) : node->key;
+    avl_pnode_splice (tree, link);
+    return 1;
+  }
+  if (avl_pnode_remove_last (tree, &node->right, key)) {
+    return avl_pnode_shrink (tree, link, +1);
+  }
+  return 0;
+}
+
+/* <key> must be present; returns 1 if the subtree at <*link> got shorter */
+
+static
+int
+avl_pnode_remove (avl_ptree * tree, avl_pnode ** link, void * key)
+{
+  avl_pnode * node = avl_pnode_own (tree, link);
+  int compare_result = tree->compare_fun (tree->compare_arg, key, node->key);
+
+  if (compare_result < 0) {
+    AVL_SET_RANK (node, (AVL_GET_RANK (node) - 1));
+    if (avl_pnode_remove (tree, &node->left, key)) {
+      return avl_pnode_shrink (tree, link, -1);
+    }
+  } else if (compare_result > 0) {
+    if (avl_pnode_remove (tree, &node->right, key)) {
+      return avl_pnode_shrink (tree, link, +1);
+    }
+  } else if (!node->left || !node->right) {
+    avl_pnode_splice (tree, link);
+    return 1;
+  } else {
+    /* take over the key of the immediate predecessor */
+    void * predecessor_key;
+    int shorter = avl_pnode_remove_last (tree, &node->left, &predecessor_key);
+    if (tree->free_key_fun) {
+      tree->free_key_fun (node->key);
+    }
+    node->key = predecessor_key;
+    AVL_SET_RANK (node, (AVL_GET_RANK (node) - 1));
+    if (shorter) {
+      return avl_pnode_shrink (tree, link, -1);
+    }
+  }
+  return 0;
+}
+
+int
+avl_ptree_remove_by_key (avl_ptree * tree, void * key)
+{
+  void * value;
+
+  /*
+   * Look first, so that nothing is copied when <key> is absent; the
+   * removal then follows the same path to the same node.
+   */
+  if (avl_ptree_get_item_by_key (tree, key, &value) != 0) {
+    return -1;
+  }
+  /* a copy per level, and up to two more for a rotation at each */
+  if (avl_ptree_reserve (tree, 3 * avl_ptree_max_height (tree->length)) != 0) {
+    return -1;
+  }
+  avl_pnode_remove (tree, &tree->root, key);
+  tree->length = tree->length - 1;
+  return 0;
+}
+
+int
+avl_ptree_get_item_by_index (avl_ptree * tree,
+                             unsigned int index,
+                             void ** value_address)
+{
+  avl_pnode * p = tree->root;
+  unsigned int m = index + 1;
+
+  while (p) {
+    if (m < AVL_GET_RANK (p)) {
+      p = p->left;
+    } else if (m > AVL_GET_RANK (p)) {
+      m = m - AVL_GET_RANK (p);
+      p = p->right;
+    } else {
+      *value_address = p->key;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int
+avl_ptree_get_item_by_key (avl_ptree * tree,
+                           void * key,
+                           void ** value_address)
+{
+  avl_pnode * x = tree->root;
+
+  while (x) {
+    int compare_result = tree->compare_fun (tree->compare_arg, key, x->key);
+    if (compare_result < 0) {
+      x = x->left;
+    } else if (compare_result > 0) {
+      x = x->right;
+    } else {
+      *value_address = x->key;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static
+int
+iterate_pnode_helper (avl_pnode * node,
+                      avl_iter_fun_type iter_fun,
+                      void * iter_arg)
+{
+  int result;
+
+  if (node->left) {
+    result = iterate_pnode_helper (node->left, iter_fun, iter_arg);
+    if (result != 0) {
+      return result;
+    }
+  }
+  result = iter_fun (node->key, iter_arg);
+  if (result != 0) {
+    return result;
+  }
+  if (node->right) {
+    return iterate_pnode_helper (node->right, iter_fun, iter_arg);
+  }
+  return 0;
+}
+
+int
+avl_ptree_iterate_inorder (avl_ptree * tree,
+                           avl_iter_fun_type iter_fun,
+                           void * iter_arg)
+{
+  if (tree->root) {
+    return iterate_pnode_helper (tree->root, iter_fun, iter_arg);
+  }
+  return 0;
+}
+
+/* returns the height of <node>, and sets *<size> to its item count */
+
+static
+int
+avl_ptree_verify_node (avl_pnode * node, unsigned int * size)
+{
+  unsigned int left_size, right_size;
+  int lh, rh;
+
+  if (!node) {
+    *size = 0;
+    return 0;
+  }
+  if (AVL_PNODE_COUNT (node) == 0) {
+    fprintf (stderr, "dead node %p\n", node->key);
+    exit (1);
+  }
+  lh = avl_ptree_verify_node (node->left, &left_size);
+  rh = avl_ptree_verify_node (node->right, &right_size);
+  if ((rh - lh) != AVL_GET_BALANCE (node)) {
+    fprintf (stderr, "invalid balance at node %p\n", node->key);
+    exit (1);
+  }
+  if (AVL_GET_RANK (node) != left_size + 1) {
+    fprintf (stderr, "invalid rank at node %p\n", node->key);
+    exit (1);
+  }
+  *size = left_size + right_size + 1;
+  return 1 + ((lh > rh) ? lh : rh);
+}
+
+/* sanity-check the tree */
+
+int
+avl_ptree_verify (avl_ptree * tree)
+{
+  unsigned int size;
+
+  avl_ptree_verify_node (tree->root, &size);
+  if (size != tree->length) {
+    fprintf (stderr, "invalid length %u, counted %u\n", tree->length, size);
+    exit (1);
+  }
+  return 0;
+}
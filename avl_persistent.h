@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A persistent (path-copying) variant of the tree, for point-in-time
+ * snapshots.  Nodes have no parent pointers and are reference counted,
+ * so a node may be shared by any number of versions.  Taking a snapshot
+ * costs O(1); an update copies only the nodes on its path (and, when
+ * removing, the siblings it rotates) that are shared with another
+ * version, and works in place on everything else.
+ *
+ * Each avl_ptree is one version.  A version must only be used by one
+ * thread at a time, but different versions may be used and released
+ * from different threads, since shared nodes are never written and the
+ * reference counts are atomic.
+ *
+ * Each node owns one reference to its key.  When a node is copied the
+ * key is passed through <copy_key_fun>, and when a node dies its key
+ * goes to <free_key_fun>.  Both may be NULL, in which case the caller
+ * must keep every key alive until all the versions holding it are gone;
+ * <free_key_fun> alone is refused, since one key may outlive its node.
+ */
+
+#ifndef AVL_PERSISTENT_H
+#define AVL_PERSISTENT_H
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_pnode {
+  void *                key;
+  struct _avl_pnode *   left;
+  struct _avl_pnode *   right;
+  unsigned int          refcount;
+  unsigned int          rank_and_balance;
+} avl_pnode;
+
+typedef struct _avl_ptree {
+  avl_pnode *           root;
+  unsigned int          length;
+  avl_key_compare_fun_type compare_fun;
+  void *                compare_arg;
+  avl_copy_key_fun_type copy_key_fun;
+  avl_free_key_fun_type free_key_fun;
+  /* nodes set aside so that an update cannot fail half-way */
+  avl_pnode *           spare;
+  unsigned int          spare_count;
+} avl_ptree;
+
+avl_ptree * avl_new_ptree (
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg,
+  avl_copy_key_fun_type copy_key_fun,
+  avl_free_key_fun_type free_key_fun
+  );
+
+/* release one version; nodes still used by other versions survive */
+
+void avl_free_ptree (avl_ptree * tree);
+
+/* a new version sharing every node with <tree>, in O(1) */
+
+avl_ptree * avl_ptree_snapshot (avl_ptree * tree);
+
+/* the tree takes over the caller's reference to <key> */
+
+int avl_ptree_insert_by_key (
+  avl_ptree *           tree,
+  void *                key,
+  unsigned int *        index
+  );
+
+/* the removed key is released when no version uses it any more */
+
+int avl_ptree_remove_by_key (
+  avl_ptree *           tree,
+  void *                key
+  );
+
+int avl_ptree_get_item_by_index (
+  avl_ptree *           tree,
+  unsigned int          index,
+  void **               value_address
+  );
+
+int avl_ptree_get_item_by_key (
+  avl_ptree *           tree,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_ptree_iterate_inorder (
+  avl_ptree *           tree,
+  avl_iter_fun_type     iter_fun,
+  void *                iter_arg
+  );
+
+int avl_ptree_verify (avl_ptree * tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_PERSISTENT_H */
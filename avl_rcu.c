@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * The ordering argument: the writer stores the new version, then bumps
+ * the epoch, then scans the readers.  A reader stores its epoch, then
+ * loads the published version.  All four are sequentially consistent,
+ * so either the writer's scan sees the reader's epoch (which is then no
+ * later than the retired version's), or the reader's load comes after
+ * the new version was stored and it never sees the retired one.
+ */
+
+#include <stdlib.h>
+
+#include "avl_rcu.h"
+
+static
+void
+avl_rcu_reader_exit (void * reader)
+{
+  /* the slot is kept, for the next thread to register */
+  __atomic_store_n (&((avl_rcu_reader *) reader)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+avl_rcu_tree *
+avl_new_rcu_tree (avl_key_compare_fun_type compare_fun,
+                  void * compare_arg,
+                  avl_copy_key_fun_type copy_key_fun,
+                  avl_free_key_fun_type free_key_fun)
+{
+  avl_rcu_tree * t = (avl_rcu_tree *) malloc (sizeof (avl_rcu_tree));
+
+  if (!t) {
+    return NULL;
+  }
+  t->writer = avl_new_ptree (compare_fun, compare_arg, copy_key_fun, free_key_fun);
+  if (!t->writer) {
+    free (t);
+    return NULL;
+  }
+  t->published = avl_ptree_snapshot (t->writer);
+  if (!t->published) {
+    avl_free_ptree (t->writer);
+    free (t);
+    return NULL;
+  }
+  if (pthread_key_create (&t->reader_key, avl_rcu_reader_exit) != 0) {
+    avl_free_ptree (t->published);
+    avl_free_ptree (t->writer);
+    free (t);
+    return NULL;
+  }
+  pthread_mutex_init (&t->readers_lock, NULL);
+  t->epoch = 1;
+  t->retired = NULL;
+  t->readers = NULL;
+  return t;
+}
+
+void
+avl_free_rcu_tree (avl_rcu_tree * tree)
+{
+  while (tree->retired) {
+    avl_rcu_retired * next = tree->retired->next;
+    avl_free_ptree (tree->retired->version);
+    free (tree->retired);
+    tree->retired = next;
+  }
+  while (tree->readers) {
+    avl_rcu_reader * next = tree->readers->next;
+    free (tree->readers);
+    tree->readers = next;
+  }
+  pthread_key_delete (tree->reader_key);
+  pthread_mutex_destroy (&tree->readers_lock);
+  avl_free_ptree (tree->published);
+  avl_free_ptree (tree->writer);
+  free (tree);
+}
+
+void
+avl_rcu_reclaim (avl_rcu_tree * tree)
+{
+  unsigned long oldest = (unsigned long) -1;
+  avl_rcu_reader * r;
+  avl_rcu_retired ** link = &tree->retired;
+
+  /* slots are only ever prepended, so the list can be walked freely */
+  for (r = __atomic_load_n (&tree->readers, __ATOMIC_ACQUIRE); r; r = r->next) {
+    unsigned long epoch = __atomic_load_n (&r->epoch, __ATOMIC_SEQ_CST);
+    if (epoch && (epoch < oldest)) {
+      oldest = epoch;
+    }
+  }
+  while (*link) {
+    avl_rcu_retired * retired = *link;
+    if (retired->epoch < oldest) {
+      *link = retired->next;
+      avl_free_ptree (retired->version);
+      free (retired);
+    } else {
+      link = &retired->next;
+    }
+  }
+}
+
+/* swap in <version>, a fresh handle, as a snapshot of the writer's version */
+
+static
+void
+avl_rcu_publish (avl_rcu_tree * tree,
+                 avl_ptree * version,
+                 avl_rcu_retired * retired)
+{
+  avl_ptree * writer = tree->writer;
+
+  if (writer->root) {
+    __atomic_add_fetch (&writer->root->refcount, 1, __ATOMIC_RELAXED);
+  }
+  version->root = writer->root;
+  version->length = writer->length;
+  retired->version = tree->published;
+  retired->epoch = tree->epoch;
+  retired->next = tree->retired;
+  tree->retired = retired;
+  __atomic_store_n (&tree->published, version, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&tree->epoch, 1, __ATOMIC_SEQ_CST);
+  avl_rcu_reclaim (tree);
+}
+
+/*
+ * Everything a publish needs is allocated before the writer's version
+ * changes, so that a change is never left unpublished.
+ */
+
+static
+int
+avl_rcu_prepare (avl_rcu_tree * tree,
+                 avl_ptree ** version,
+                 avl_rcu_retired ** retired)
+{
+  avl_ptree * w = tree->writer;
+
+  *version = avl_new_ptree (w->compare_fun, w->compare_arg, w->copy_key_fun, w->free_key_fun);
+  *retired = (avl_rcu_retired *) malloc (sizeof (avl_rcu_retired));
+  if (!*version || !*retired) {
+    if (*version) {
+      avl_free_ptree (*version);
+    }
+    free (*retired);
+    return -1;
+  }
+  return 0;
+}
+
+int
+avl_rcu_insert_by_key (avl_rcu_tree * tree,
+                       void * key,
+                       unsigned int * index)
+{
+  avl_ptree * version;
+  avl_rcu_retired * retired;
+
+  if (avl_rcu_prepare (tree, &version, &retired) != 0) {
+    return -1;
+  }
+  if (avl_ptree_insert_by_key (tree->writer, key, index) != 0) {
+    avl_free_ptree (version);
+    free (retired);
+    return -1;
+  }
+  avl_rcu_publish (tree, version, retired);
+  return 0;
+}
+
+int
+avl_rcu_remove_by_key (avl_rcu_tree * tree, void * key)
+{
+  avl_ptree * version;
+  avl_rcu_retired * retired;
+
+  if (avl_rcu_prepare (tree, &version, &retired) != 0) {
+    return -1;
+  }
+  if (avl_ptree_remove_by_key (tree->writer, key) != 0) {
+    avl_free_ptree (version);
+    free (retired);
+    return -1;
+  }
+  avl_rcu_publish (tree, version, retired);
+  return 0;
+}
+
+/* find or make the calling thread's slot */
+
+static
+avl_rcu_reader *
+avl_rcu_get_reader (avl_rcu_tree * tree)
+{
+  avl_rcu_reader * r = (avl_rcu_reader *) pthread_getspecific (tree->reader_key);
+
+  if (r) {
+    return r;
+  }
+  pthread_mutex_lock (&tree->readers_lock);
+  for (r = tree->readers; r; r = r->next) {
+    if (!__atomic_load_n (&r->in_use, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+  }
+  if (!r) {
+    r = (avl_rcu_reader *) malloc (sizeof (avl_rcu_reader));
+    if (r) {
+      r->epoch = 0;
+      r->next = tree->readers;
+      __atomic_store_n (&tree->readers, r, __ATOMIC_RELEASE);
+    }
+  }
+  if (r) {
+    r->nesting = 0;
+    r->in_use = 1;
+    if (pthread_setspecific (tree->reader_key, r) != 0) {
+      r->in_use = 0;
+      r = NULL;
+    }
+  }
+  pthread_mutex_unlock (&tree->readers_lock);
+  return r;
+}
+
+int
+avl_rcu_read_lock (avl_rcu_tree * tree)
+{
+  avl_rcu_reader * r = avl_rcu_get_reader (tree);
+
+  if (!r) {
+    return -1;
+  }
+  if (r->nesting++ == 0) {
+    unsigned long epoch = __atomic_load_n (&tree->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n (&r->epoch, epoch, __ATOMIC_SEQ_CST);
+  }
+  return 0;
+}
+
+void
+avl_rcu_read_unlock (avl_rcu_tree * tree)
+{
+  avl_rcu_reader * r = (avl_rcu_reader *) pthread_getspecific (tree->reader_key);
+
+  /* an unlock without a matching lock is ignored */
+  if (!r || !r->nesting) {
+    return;
+  }
+  if (--r->nesting == 0) {
+    __atomic_store_n (&r->epoch, 0, __ATOMIC_RELEASE);
+  }
+}
+
+static
+avl_ptree *
+avl_rcu_current (avl_rcu_tree * tree)
+{
+  return __atomic_load_n (&tree->published, __ATOMIC_SEQ_CST);
+}
+
+unsigned int
+avl_rcu_length (avl_rcu_tree * tree)
+{
+  unsigned int length;
+
+  if (avl_rcu_read_lock (tree) != 0) {
+    return 0;
+  }
+  length = avl_rcu_current (tree)->length;
+  avl_rcu_read_unlock (tree);
+  return length;
+}
+
+int
+avl_rcu_get_item_by_index (avl_rcu_tree * tree,
+                           unsigned int index,
+                           void ** value_address)
+{
+  int result;
+
+  if (avl_rcu_read_lock (tree) != 0) {
+    return -1;
+  }
+  result = avl_ptree_get_item_by_index (avl_rcu_current (tree), index, value_address);
+  avl_rcu_read_unlock (tree);
+  return result;
+}
+
+int
+avl_rcu_get_item_by_key (avl_rcu_tree * tree,
+                         void * key,
+                         void ** value_address)
+{
+  int result;
+
+  if (avl_rcu_read_lock (tree) != 0) {
+    return -1;
+  }
+  result = avl_ptree_get_item_by_key (avl_rcu_current (tree), key, value_address);
+  avl_rcu_read_unlock (tree);
+  return result;
+}
+
+int
+avl_rcu_iterate_inorder (avl_rcu_tree * tree,
+                         avl_iter_fun_type iter_fun,
+                         void * iter_arg)
+{
+  int result;
+
+  if (avl_rcu_read_lock (tree) != 0) {
+    return -1;
+  }
+  result = avl_ptree_iterate_inorder (avl_rcu_current (tree), iter_fun, iter_arg);
+  avl_rcu_read_unlock (tree);
+  return result;
+}
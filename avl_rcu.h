@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A single-writer, many-reader tree whose readers take no locks.
+ *
+ * The writer updates a private persistent version (see avl_persistent.h)
+ * and publishes an O(1) snapshot of it after every change with one
+ * atomic store.  Readers search whichever version is published when
+ * they start.  Versions that are no longer published are reclaimed by
+ * epochs: a reader announces the global epoch while it reads, and a
+ * retired version is released once every active reader has announced a
+ * later epoch.
+ *
+ * All writes must come from one thread at a time.  Reads may come from
+ * any number of threads; each thread is registered with the tree on its
+ * first read.  A key handed back by a read stays valid only until the
+ * read section ends if the tree frees keys, so callers that need it
+ * longer should bracket their reads with avl_rcu_read_lock and
+ * avl_rcu_read_unlock (which nest).  Free the tree only once no reader
+ * is using it.
+ */
+
+#ifndef AVL_RCU_H
+#define AVL_RCU_H
+
+#include <pthread.h>
+
+#include "avl_persistent.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_rcu_reader {
+  unsigned long                 epoch;          /* 0 outside a read section */
+  unsigned int                  nesting;
+  int                           in_use;
+  struct _avl_rcu_reader *      next;
+} avl_rcu_reader;
+
+typedef struct _avl_rcu_retired {
+  avl_ptree *                   version;
+  unsigned long                 epoch;
+  struct _avl_rcu_retired *     next;
+} avl_rcu_retired;
+
+typedef struct _avl_rcu_tree {
+  avl_ptree *                   writer;         /* the writer's version */
+  avl_ptree *                   published;      /* what readers see */
+  unsigned long                 epoch;
+  avl_rcu_retired *             retired;
+  avl_rcu_reader *              readers;
+  pthread_mutex_t               readers_lock;
+  pthread_key_t                 reader_key;
+} avl_rcu_tree;
+
+avl_rcu_tree * avl_new_rcu_tree (
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg,
+  avl_copy_key_fun_type copy_key_fun,
+  avl_free_key_fun_type free_key_fun
+  );
+
+void avl_free_rcu_tree (avl_rcu_tree * tree);
+
+/* writer side */
+
+int avl_rcu_insert_by_key (
+  avl_rcu_tree *        tree,
+  void *                key,
+  unsigned int *        index
+  );
+
+int avl_rcu_remove_by_key (
+  avl_rcu_tree *        tree,
+  void *                key
+  );
+
+/* release what no reader can still see; publishing does this too */
+
+void avl_rcu_reclaim (avl_rcu_tree * tree);
+
+/* reader side */
+
+/* every unlock must match a lock; one that does not is ignored */
+
+int avl_rcu_read_lock (avl_rcu_tree * tree);
+void avl_rcu_read_unlock (avl_rcu_tree * tree);
+
+unsigned int avl_rcu_length (avl_rcu_tree * tree);
+
+int avl_rcu_get_item_by_index (
+  avl_rcu_tree *        tree,
+  unsigned int          index,
+  void **               value_address
+  );
+
+int avl_rcu_get_item_by_key (
+  avl_rcu_tree *        tree,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_rcu_iterate_inorder (
+  avl_rcu_tree *        tree,
+  avl_iter_fun_type     iter_fun,
+  void *                iter_arg
+  );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_RCU_H */
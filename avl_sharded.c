@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * Every call holds the directory lock for reading, which keeps the
+ * shard array and the boundaries still, and then locks the one shard it
+ * works on.  The Fenwick counts are updated with atomics under the
+ * shard lock, so that readers of other shards can sum them at any time.
+ * Splits and merges hold the directory lock for writing and so need no
+ * shard locks.
+ */
+
+/* pthread_rwlock_t is POSIX.1-2001; strict C modes hide it otherwise */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_sharded.h"
+
+#define AVL_DEFAULT_SPLIT_THRESHOLD 65536
+
+static
+int
+avl_sharded_no_free (void * key)
+{
+  return 0;
+}
+
+static
+avl_shard *
+avl_new_shard (avl_sharded_tree * tree, avl_tree * t, void * low_key)
+{
+  avl_shard * shard = (avl_shard *) malloc (sizeof (avl_shard));
+
+  if (!shard) {
+    return NULL;
+  }
+  if (!t) {
+    t = avl_new_avl_tree (tree->compare_fun, tree->compare_arg);
+    if (!t) {
+      free (shard);
+      return NULL;
+    }
+  }
+  shard->tree = t;
+  shard->low_key = low_key;
+  pthread_mutex_init (&shard->lock, NULL);
+  return shard;
+}
+
+static
+void
+avl_free_shard (avl_sharded_tree * tree, avl_shard * shard, int first)
+{
+  avl_free_avl_tree (shard->tree, tree->free_key_fun);
+  if (!first && tree->free_key_fun) {
+    tree->free_key_fun (shard->low_key);
+  }
+  pthread_mutex_destroy (&shard->lock);
+  free (shard);
+}
+
+avl_sharded_tree *
+avl_new_sharded_tree (avl_key_compare_fun_type compare_fun,
+                      void * compare_arg,
+                      avl_copy_key_fun_type copy_key_fun,
+                      avl_free_key_fun_type free_key_fun,
+                      unsigned int split_threshold)
+{
+  avl_sharded_tree * t;
+
+  if (free_key_fun && !copy_key_fun) {
+    return NULL;
+  }
+  t = (avl_sharded_tree *) malloc (sizeof (avl_sharded_tree));
+  if (!t) {
+    return NULL;
+  }
+  t->compare_fun = compare_fun;
+  t->compare_arg = compare_arg;
+  t->copy_key_fun = copy_key_fun;
+  t->free_key_fun = free_key_fun;
+  t->split_threshold = split_threshold ? split_threshold : AVL_DEFAULT_SPLIT_THRESHOLD;
+  t->capacity = 4;
+  t->shard_count = 1;
+  t->shards = (avl_shard **) malloc (t->capacity * sizeof (avl_shard *));
+  t->counts = (unsigned int *) calloc (t->capacity + 1, sizeof (unsigned int));
+  if (!t->shards || !t->counts
+      || !(t->shards[0] = avl_new_shard (t, NULL, NULL))) {
+    free (t->shards);
+    free (t->counts);
+    free (t);
+    return NULL;
+  }
+  pthread_rwlock_init (&t->directory_lock, NULL);
+  return t;
+}
+
+void
+avl_free_sharded_tree (avl_sharded_tree * tree)
+{
+  unsigned int i;
+
+  for (i = 0; i < tree->shard_count; i++) {
+    avl_free_shard (tree, tree->shards[i], i == 0);
+  }
+  pthread_rwlock_destroy (&tree->directory_lock);
+  free (tree->shards);
+  free (tree->counts);
+  free (tree);
+}
+
+/* the prefix-count directory */
+
+static
+void
+avl_sharded_count_add (avl_sharded_tree * tree, unsigned int shard, int delta)
+{
+  unsigned int k;
+
+  for (k = shard + 1; k <= tree->shard_count; k += k & (-k)) {
+    __atomic_add_fetch (&tree->counts[k], (unsigned int) delta, __ATOMIC_RELAXED);
+  }
+}
+
+/* the number of items in the shards before <shard> */
+
+static
+unsigned int
+avl_sharded_count_before (avl_sharded_tree * tree, unsigned int shard)
+{
+  unsigned int k, sum = 0;
+
+  for (k = shard; k > 0; k -= k & (-k)) {
+    sum += __atomic_load_n (&tree->counts[k], __ATOMIC_RELAXED);
+  }
+  return sum;
+}
+
+/* the shard holding global <index>, and the index within it */
+
+static
+unsigned int
+avl_sharded_count_find (avl_sharded_tree * tree,
+                        unsigned int index,
+                        unsigned int * local)
+{
+  unsigned int position = 0, step = 1;
+
+  while (step * 2 <= tree->shard_count) {
+    step = step * 2;
+  }
+  for (; step; step = step / 2) {
+    if (position + step <= tree->shard_count) {
+      unsigned int count = __atomic_load_n (&tree->counts[position + step], __ATOMIC_RELAXED);
+      if (count <= index) {
+        position = position + step;
+        index = index - count;
+      }
+    }
+  }
+  *local = index;
+  return position;
+}
+
+static
+void
+avl_sharded_count_rebuild (avl_sharded_tree * tree)
+{
+  unsigned int i;
+
+  memset (tree->counts, 0, (tree->capacity + 1) * sizeof (unsigned int));
+  for (i = 0; i < tree->shard_count; i++) {
+    avl_sharded_count_add (tree, i, (int) tree->shards[i]->tree->length);
+  }
+}
+
+/* the shard whose range holds <key> */
+
+static
+unsigned int
+avl_sharded_route (avl_sharded_tree * tree, void * key)
+{
+  unsigned int low = 0, high = tree->shard_count;
+
+  /* find the last shard whose boundary does not order after <key> */
+  while (high - low > 1) {
+    unsigned int mid = (low + high) / 2;
+    if (tree->compare_fun (tree->compare_arg, key, tree->shards[mid]->low_key) < 0) {
+      high = mid;
+    } else {
+      low = mid;
+    }
+  }
+  return low;
+}
+
+/*
+ * Where to split <t>: at its middle key, or if the lower half is all
+ * one key, at the first key ordering after that.  -1 if every key in
+ * <t> is the same, when no split is possible.
+ */
+
+static
+int
+avl_sharded_split_key (avl_sharded_tree * tree, avl_tree * t, void ** key)
+{
+  void * first, * middle;
+  unsigned int index;
+
+  if (avl_get_item_by_index (t, 0, &first) != 0) {
+    return -1;
+  }
+  avl_get_item_by_index (t, t->length / 2, &middle);
+  if (tree->compare_fun (tree->compare_arg, first, middle) != 0) {
+    *key = middle;
+    return 0;
+  }
+  index = avl_upper_bound_index (t, middle);
+  if (index == t->length) {
+    return -1;
+  }
+  return avl_get_item_by_index (t, index, key);
+}
+
+/* split the shard holding <key> if it is still too big */
+
+static
+void
+avl_sharded_split (avl_sharded_tree * tree, void * key)
+{
+  unsigned int i;
+  avl_shard * shard, * right;
+  void * middle;
+
+  pthread_rwlock_wrlock (&tree->directory_lock);
+  i = avl_sharded_route (tree, key);
+  shard = tree->shards[i];
+  if (shard->tree->length <= tree->split_threshold) {
+    goto done;
+  }
+  if (tree->shard_count == tree->capacity) {
+    unsigned int capacity = tree->capacity * 2;
+    avl_shard ** shards = (avl_shard **) realloc (tree->shards, capacity * sizeof (avl_shard *));
+    unsigned int * counts;
+    if (!shards) {
+      goto done;
+    }
+    tree->shards = shards;
+    counts = (unsigned int *) realloc (tree->counts, (capacity + 1) * sizeof (unsigned int));
+    if (!counts) {
+      goto done;
+    }
+    tree->counts = counts;
+    tree->capacity = capacity;
+  }
+  if (avl_sharded_split_key (tree, shard->tree, &middle) != 0) {
+    goto done;
+  }
+  right = avl_new_shard (
+    tree, NULL, tree->copy_key_fun ? tree->copy_key_fun (middle) : middle
+    );
+  if (!right) {
+    goto done;
+  }
+  avl_split_by_key (shard->tree, middle, right->tree);
+  memmove (
+    tree->shards + i + 2, tree->shards + i + 1,
+    (tree->shard_count - i - 1) * sizeof (avl_shard *)
+    );
+  tree->shards[i + 1] = right;
+  tree->shard_count = tree->shard_count + 1;
+  avl_sharded_count_rebuild (tree);
+ done:
+  pthread_rwlock_unlock (&tree->directory_lock);
+}
+
+/* join the shard holding <key> onto a neighbour if it is still too small */
+
+static
+void
+avl_sharded_merge (avl_sharded_tree * tree, void * key)
+{
+  unsigned int i;
+  avl_shard * left, * right;
+
+  pthread_rwlock_wrlock (&tree->directory_lock);
+  i = avl_sharded_route (tree, key);
+  if ((tree->shard_count < 2)
+      || (tree->shards[i]->tree->length >= tree->split_threshold / 4)) {
+    goto done;
+  }
+  /* join onto the smaller neighbour */
+  if ((i + 1 == tree->shard_count)
+      || ((i > 0)
+          && (tree->shards[i - 1]->tree->length < tree->shards[i + 1]->tree->length))) {
+    i = i - 1;
+  }
+  left = tree->shards[i];
+  right = tree->shards[i + 1];
+  if (left->tree->length + right->tree->length > tree->split_threshold / 2) {
+    goto done;
+  }
+  if (avl_join (left->tree, right->tree) != 0) {
+    goto done;
+  }
+  avl_free_shard (tree, right, 0);
+  memmove (
+    tree->shards + i + 1, tree->shards + i + 2,
+    (tree->shard_count - i - 2) * sizeof (avl_shard *)
+    );
+  tree->shard_count = tree->shard_count - 1;
+  avl_sharded_count_rebuild (tree);
+ done:
+  pthread_rwlock_unlock (&tree->directory_lock);
+}
+
+unsigned int
+avl_sharded_length (avl_sharded_tree * tree)
+{
+  unsigned int length;
+
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  length = avl_sharded_count_before (tree, tree->shard_count);
+  pthread_rwlock_unlock (&tree->directory_lock);
+  return length;
+}
+
+int
+avl_sharded_insert_by_key (avl_sharded_tree * tree,
+                           void * key,
+                           unsigned int * index)
+{
+  unsigned int i, local = 0;
+  avl_shard * shard;
+  void * middle;
+  int result, split = 0;
+
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  i = avl_sharded_route (tree, key);
+  shard = tree->shards[i];
+  pthread_mutex_lock (&shard->lock);
+  result = avl_insert_by_key (shard->tree, key, &local);
+  if (result == 0) {
+    avl_sharded_count_add (tree, i, +1);
+    /* a shard of one key stays whole, so spare the write lock */
+    split = ((shard->tree->length > tree->split_threshold)
+             && (avl_sharded_split_key (tree, shard->tree, &middle) == 0));
+    if (index) {
+      *index = avl_sharded_count_before (tree, i) + local;
+    }
+  }
+  pthread_mutex_unlock (&shard->lock);
+  pthread_rwlock_unlock (&tree->directory_lock);
+  if (split) {
+    avl_sharded_split (tree, key);
+  }
+  return result;
+}
+
+int
+avl_sharded_remove_by_key (avl_sharded_tree * tree, void * key)
+{
+  unsigned int i, length = 0;
+  avl_shard * shard;
+  int result;
+
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  i = avl_sharded_route (tree, key);
+  shard = tree->shards[i];
+  pthread_mutex_lock (&shard->lock);
+  result = avl_remove_by_key (
+    shard->tree, key,
+    tree->free_key_fun ? tree->free_key_fun : avl_sharded_no_free
+    );
+  if (result == 0) {
+    avl_sharded_count_add (tree, i, -1);
+    length = shard->tree->length;
+  }
+  pthread_mutex_unlock (&shard->lock);
+  pthread_rwlock_unlock (&tree->directory_lock);
+  if ((result == 0) && (length < tree->split_threshold / 4)) {
+    avl_sharded_merge (tree, key);
+  }
+  return result;
+}
+
+int
+avl_sharded_get_item_by_key (avl_sharded_tree * tree,
+                             void * key,
+                             void ** value_address)
+{
+  avl_shard * shard;
+  int result;
+
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  shard = tree->shards[avl_sharded_route (tree, key)];
+  pthread_mutex_lock (&shard->lock);
+  result = avl_get_item_by_key (shard->tree, key, value_address);
+  pthread_mutex_unlock (&shard->lock);
+  pthread_rwlock_unlock (&tree->directory_lock);
+  return result;
+}
+
+int
+avl_sharded_get_item_by_index (avl_sharded_tree * tree,
+                               unsigned int index,
+                               void ** value_address)
+{
+  unsigned int i, local;
+  int result = -1;
+
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  i = avl_sharded_count_find (tree, index, &local);
+  if (i < tree->shard_count) {
+    avl_shard * shard = tree->shards[i];
+    pthread_mutex_lock (&shard->lock);
+    result = avl_get_item_by_index (shard->tree, local, value_address);
+    pthread_mutex_unlock (&shard->lock);
+  }
+  pthread_rwlock_unlock (&tree->directory_lock);
+  return result;
+}
+
+/*
+ * The global index of the first item ordering at or after <key>, or,
+ * if <upper>, of the first item ordering after it.  The caller holds
+ * the directory lock.
+ */
+
+static
+unsigned int
+avl_sharded_bound (avl_sharded_tree * tree, void * key, int upper)
+{
+  unsigned int i = avl_sharded_route (tree, key);
+  avl_shard * shard = tree->shards[i];
+  unsigned int local;
+
+  /* one descent either way, however many keys equal <key> */
+  pthread_mutex_lock (&shard->lock);
+  if (upper) {
+    local = avl_upper_bound_index (shard->tree, key);
+  } else {
+    local = avl_lower_bound_index (shard->tree, key);
+  }
+  pthread_mutex_unlock (&shard->lock);
+  return avl_sharded_count_before (tree, i) + local;
+}
+
+int
+avl_sharded_get_span_by_key (avl_sharded_tree * tree,
+                             void * key,
+                             unsigned int * low,
+                             unsigned int * high)
+{
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  *low = avl_sharded_bound (tree, key, 0);
+  *high = avl_sharded_bound (tree, key, 1);
+  pthread_rwlock_unlock (&tree->directory_lock);
+  return 0;
+}
+
+int
+avl_sharded_get_span_by_two_keys (avl_sharded_tree * tree,
+                                  void * low_key,
+                                  void * high_key,
+                                  unsigned int * low,
+                                  unsigned int * high)
+{
+  /* we may need to swap them */
+  if (tree->compare_fun (tree->compare_arg, low_key, high_key) > 0) {
+    void * temp = low_key;
+    low_key = high_key;
+    high_key = temp;
+  }
+  pthread_rwlock_rdlock (&tree->directory_lock);
+  *low = avl_sharded_bound (tree, low_key, 0);
+  *high = avl_sharded_bound (tree, high_key, 1);
+  pthread_rwlock_unlock (&tree->directory_lock);
+  return 0;
+}
+
+/* sanity-check every shard, its range, and the directory */
+
+int
+avl_sharded_verify (avl_sharded_tree * tree)
+{
+  unsigned int i, total = 0;
+
+  pthread_rwlock_wrlock (&tree->directory_lock);
+  for (i = 0; i < tree->shard_count; i++) {
+    avl_tree * t = tree->shards[i]->tree;
+    void * first, * last;
+    avl_verify (t);
+    if (avl_sharded_count_before (tree, i) != total) {
+      fprintf (stderr, "invalid prefix count at shard %u\n", i);
+      exit (1);
+    }
+    total = total + t->length;
+    if (!t->length) {
+      continue;
+    }
+    avl_get_item_by_index (t, 0, &first);
+    avl_get_item_by_index (t, t->length - 1, &last);
+    if ((i > 0)
+        && (tree->compare_fun (tree->compare_arg, first, tree->shards[i]->low_key) < 0)) {
+      fprintf (stderr, "shard %u holds a key below its range\n", i);
+      exit (1);
+    }
+    if ((i + 1 < tree->shard_count)
+        && (tree->compare_fun (tree->compare_arg, last, tree->shards[i + 1]->low_key) >= 0)) {
+      fprintf (stderr, "shard %u holds a key above its range\n", i);
+      exit (1);
+    }
+  }
+  pthread_rwlock_unlock (&tree->directory_lock);
+  return 0;
+}
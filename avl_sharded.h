@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 1995 by Sam Rushing <rushing@nightmare.com>
+ * Copyright (C) 2005 by Germanischer Lloyd AG
+ * Copyright (C) 2001-2005 by IronPort Systems, Inc.
+ */
+
+/*
+ * A range-sharded tree for many concurrent writers.  The key space is
+ * cut into shards, each an avl_tree with its own mutex, so writers to
+ * different key ranges do not contend.  Shard i holds the keys ordering
+ * at or after its boundary key and before shard i+1's.
+ *
+ * A prefix-count directory (a Fenwick tree over the shard lengths)
+ * turns global indices into a shard and a local index.  When a shard
+ * outgrows <split_threshold> it is split in two with avl_split_by_key,
+ * unless every key in it is the same, and a shard that falls below a
+ * quarter of that is joined onto a neighbour with avl_join; both take
+ * the directory's write lock.
+ *
+ * Each call is atomic within its shard.  Index and span answers are
+ * exact when no writer is running; otherwise they reflect each shard
+ * as it was when that shard was visited.
+ *
+ * Boundary keys are retained through <copy_key_fun> and released with
+ * <free_key_fun>, which also frees the keys of removed items.  As with
+ * the persistent tree, both may be NULL, but not <free_key_fun> alone.
+ */
+
+#ifndef AVL_SHARDED_H
+#define AVL_SHARDED_H
+
+/*
+ * pthread_rwlock_t needs POSIX.1-2001 or later, which strict C modes
+ * (-std=c99) hide unless asked; this only helps when no system header
+ * has been included yet.
+ */
+#if !defined(_POSIX_C_SOURCE) && !defined(_XOPEN_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <pthread.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _avl_shard {
+  avl_tree *            tree;
+  void *                low_key;        /* unused for the first shard */
+  pthread_mutex_t       lock;
+} avl_shard;
+
+typedef struct _avl_sharded_tree {
+  avl_shard **          shards;         /* in key order */
+  unsigned int *        counts;         /* Fenwick tree, 1-based */
+  unsigned int          shard_count;
+  unsigned int          capacity;
+  unsigned int          split_threshold;
+  pthread_rwlock_t      directory_lock;
+  avl_key_compare_fun_type compare_fun;
+  void *                compare_arg;
+  avl_copy_key_fun_type copy_key_fun;
+  avl_free_key_fun_type free_key_fun;
+} avl_sharded_tree;
+
+/* a <split_threshold> of 0 picks a default */
+
+avl_sharded_tree * avl_new_sharded_tree (
+  avl_key_compare_fun_type compare_fun,
+  void *                compare_arg,
+  avl_copy_key_fun_type copy_key_fun,
+  avl_free_key_fun_type free_key_fun,
+  unsigned int          split_threshold
+  );
+
+void avl_free_sharded_tree (avl_sharded_tree * tree);
+
+unsigned int avl_sharded_length (avl_sharded_tree * tree);
+
+int avl_sharded_insert_by_key (
+  avl_sharded_tree *    tree,
+  void *                key,
+  unsigned int *        index
+  );
+
+int avl_sharded_remove_by_key (
+  avl_sharded_tree *    tree,
+  void *                key
+  );
+
+int avl_sharded_get_item_by_key (
+  avl_sharded_tree *    tree,
+  void *                key,
+  void **               value_address
+  );
+
+int avl_sharded_get_item_by_index (
+  avl_sharded_tree *    tree,
+  unsigned int          index,
+  void **               value_address
+  );
+
+int avl_sharded_get_span_by_key (
+  avl_sharded_tree *    tree,
+  void *                key,
+  unsigned int *        low,
+  unsigned int *        high
+  );
+
+int avl_sharded_get_span_by_two_keys (
+  avl_sharded_tree *    tree,
+  void *                low_key,
+  void *                high_key,
+  unsigned int *        low,
+  unsigned int *        high
+  );
+
+int avl_sharded_verify (avl_sharded_tree * tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AVL_SHARDED_H */
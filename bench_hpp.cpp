@@ -0,0 +1,125 @@
+//
+// avl::ranked_tree against the C library in avl.c (and std::multiset,
+// for scale): insert <size> random keys, then look each one up.
+//
+//   make bench
+//   ./bench_hpp [size]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "avl.h"
+#include "avl.hpp"
+
+static int
+compare_longs (void * compare_arg, void * a, void * b)
+{
+  long la = (long) a;
+  long lb = (long) b;
+
+  if (la < lb) {
+    return -1;
+  } else if (la > lb) {
+    return +1;
+  } else {
+    return 0;
+  }
+}
+
+static int failed = 0;
+
+static void
+report (const char * name, double insert, double lookup, long hits, long size)
+{
+  std::printf ("%-14s %8.3f  %8.3f\n", name, insert, lookup);
+  // using <hits> also keeps the lookups from being optimized away
+  if (hits != size) {
+    std::printf ("%s: %ld of %ld keys found\n", name, hits, size);
+    failed = 1;
+  }
+}
+
+static double
+now ()
+{
+  return std::chrono::duration<double> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+int
+main (int argc, char ** argv)
+{
+  long size = (argc > 1) ? std::atol (argv[1]) : 1000000;
+  std::mt19937 rng (5);
+  std::vector<long> keys (size);
+  long hits;
+  double start, insert, lookup;
+
+  for (long & key : keys) {
+    key = rng ();
+  }
+  std::printf ("%ld random keys\n", size);
+  std::printf ("                 insert    lookup\n");
+
+  {
+    avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+    avl_node_arena * arena = avl_new_node_arena (0, NULL, NULL, NULL);
+    unsigned int index;
+    void * value;
+
+    avl_tree_use_arena (tree, arena);
+    start = now ();
+    for (long key : keys) {
+      avl_insert_by_key (tree, (void *) key, &index);
+    }
+    insert = now () - start;
+    hits = 0;
+    start = now ();
+    for (long key : keys) {
+      hits += (avl_get_item_by_key (tree, (void *) key, &value) == 0);
+    }
+    lookup = now () - start;
+    report ("avl.c", insert, lookup, hits, size);
+    avl_free_avl_tree (tree, NULL);
+    avl_release_node_arena (arena);
+  }
+
+  {
+    avl::ranked_tree<long> tree;
+
+    start = now ();
+    for (long key : keys) {
+      tree.insert (key);
+    }
+    insert = now () - start;
+    hits = 0;
+    start = now ();
+    for (long key : keys) {
+      hits += tree.contains (key);
+    }
+    lookup = now () - start;
+    report ("ranked_tree", insert, lookup, hits, size);
+  }
+
+  {
+    std::multiset<long> tree;
+
+    start = now ();
+    for (long key : keys) {
+      tree.insert (key);
+    }
+    insert = now () - start;
+    hits = 0;
+    start = now ();
+    for (long key : keys) {
+      hits += (tree.find (key) != tree.end ());
+    }
+    lookup = now () - start;
+    report ("std::multiset", insert, lookup, hits, size);
+  }
+  return failed;
+}
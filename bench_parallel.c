@@ -0,0 +1,88 @@
+/*
+ * Speedup of the parallel set operations against the number of threads.
+ *
+ *   make bench
+ *   ./bench_parallel [size] [max-threads] [cutoff]
+ *
+ * Two trees of <size> interleaved integer keys are built, then merged
+ * (union) with 1, 2, 4, ... up to <max-threads> threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "avl.h"
+#include "avl_parallel.h"
+
+int
+compare_longs (void * compare_arg, void * a, void * b)
+{
+  long la = (long) a;
+  long lb = (long) b;
+
+  if (la < lb) {
+    return -1;
+  } else if (la > lb) {
+    return +1;
+  } else {
+    return 0;
+  }
+}
+
+double
+now (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + (tv.tv_usec / 1e6);
+}
+
+avl_tree *
+build_tree (avl_node_arena * arena, long size, long offset)
+{
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+  unsigned int index;
+  long i;
+
+  avl_tree_use_arena (tree, arena);
+  for (i = 0; i < size; i++) {
+    avl_insert_by_key (tree, (void *) ((i * 2) + offset), &index);
+  }
+  return tree;
+}
+
+int
+main (int argc, char ** argv)
+{
+  long size = (argc > 1) ? atol (argv[1]) : 2000000;
+  unsigned int max_threads = (argc > 2) ? atoi (argv[2]) : 8;
+  unsigned int cutoff = (argc > 3) ? atoi (argv[3]) : 0;
+  double base = 0;
+  unsigned int threads;
+
+  fprintf (stdout, "union of two trees of %ld keys\n", size);
+  fprintf (stdout, "threads   seconds   speedup\n");
+  for (threads = 1; threads <= max_threads; threads = threads * 2) {
+    avl_node_arena * arena = avl_new_node_arena (0, NULL, NULL, NULL);
+    avl_tree * a = build_tree (arena, size, 0);
+    avl_tree * b = build_tree (arena, size, 1);
+    avl_pool * pool = avl_new_pool (threads, cutoff);
+    double start, elapsed;
+
+    start = now ();
+    avl_parallel_union (pool, a, b, NULL);
+    elapsed = now () - start;
+    if (threads == 1) {
+      base = elapsed;
+    }
+    fprintf (stdout, "%7u %9.4f %9.2f\n", threads, elapsed, base / elapsed);
+    avl_verify (a);
+
+    avl_free_pool (pool);
+    avl_free_avl_tree (a, NULL);
+    avl_free_avl_tree (b, NULL);
+    avl_release_node_arena (arena);
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Helpers shared by the C tests, which 'make check' builds and runs.
+ * Keys are longs stored directly in the key pointers, or in malloc'd
+ * boxes where a test must see keys copied and freed.
+ */
+
+#ifndef AVL_TEST_H
+#define AVL_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf (stderr, "%s:%d: check failed: %s\n",                     \
+               __FILE__, __LINE__, #cond);                              \
+      exit (1);                                                         \
+    }                                                                   \
+  } while (0)
+
+static inline
+int
+compare_longs (void * compare_arg, void * a, void * b)
+{
+  long la = (long) a;
+  long lb = (long) b;
+
+  if (la < lb) {
+    return -1;
+  } else if (la > lb) {
+    return +1;
+  } else {
+    return 0;
+  }
+}
+
+/* for qsort() */
+static inline
+int
+compare_long_array (const void * a, const void * b)
+{
+  long la = *(const long *) a;
+  long lb = *(const long *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+/* boxes made and not yet freed; only one thread may make or free them */
+static long boxes_live;
+
+static inline
+void *
+new_box (long value)
+{
+  long * box = (long *) malloc (sizeof (long));
+
+  CHECK (box != NULL);
+  *box = value;
+  boxes_live = boxes_live + 1;
+  return box;
+}
+
+static inline
+void *
+copy_box (void * key)
+{
+  return new_box (*(long *) key);
+}
+
+static inline
+int
+free_box (void * key)
+{
+  boxes_live = boxes_live - 1;
+  free (key);
+  return 0;
+}
+
+static inline
+int
+compare_boxes (void * compare_arg, void * a, void * b)
+{
+  return compare_longs (compare_arg, (void *) *(long *) a, (void *) *(long *) b);
+}
+
+static inline
+int
+free_nothing (void * key)
+{
+  return 0;
+}
+
+static inline
+int
+append_key (void * key, void * iter_arg)
+{
+  long ** keys = (long **) iter_arg;
+
+  **keys = (long) key;
+  *keys = *keys + 1;
+  return 0;
+}
+
+/* check that <tree> is sound and holds exactly the <n> sorted <keys> */
+static inline
+void
+check_keys (avl_tree * tree, long * keys, unsigned int n)
+{
+  long * found = (long *) malloc ((n + 1) * sizeof (long));
+  long * end = found;
+  unsigned int i;
+
+  CHECK (avl_verify (tree) == 0);
+  CHECK (tree->length == n);
+  avl_iterate_inorder (tree, append_key, &end);
+  CHECK (end == found + n);
+  for (i = 0; i < n; i++) {
+    CHECK (found[i] == keys[i]);
+  }
+  free (found);
+}
+
+#endif /* AVL_TEST_H */
@@ -0,0 +1,83 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Several threads insert and remove through one combining front-end.
+ * Each thread works on its own keys (those equal to its number modulo
+ * the thread count), so it knows what each of its removes must find;
+ * at the end the tree must hold exactly what the threads left there.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_combining.h"
+#include "avl_test.h"
+
+#define THREADS 6
+#define OPS     20000
+#define RANGE   3000
+
+typedef struct {
+  avl_combining_tree *  tree;
+  unsigned int          thread;
+  unsigned int          seed;
+  unsigned int          counts[RANGE];
+} worker;
+
+static
+void *
+work (void * arg)
+{
+  worker * w = (worker *) arg;
+  unsigned int i, index;
+
+  for (i = 0; i < OPS; i++) {
+    long k = (rand_r (&w->seed) % (RANGE / THREADS)) * THREADS + w->thread;
+    if (rand_r (&w->seed) % 3 == 0) {
+      CHECK ((avl_combining_remove_by_key (w->tree, (void *) k) == 0) == (w->counts[k] > 0));
+      if (w->counts[k]) {
+        w->counts[k] = w->counts[k] - 1;
+      }
+    } else {
+      CHECK (avl_combining_insert_by_key (w->tree, (void *) k, &index) == 0);
+      w->counts[k] = w->counts[k] + 1;
+    }
+  }
+  return NULL;
+}
+
+int
+main (int argc, char ** argv)
+{
+  static worker workers[THREADS];
+  avl_combining_tree * tree = avl_new_combining_tree (compare_longs, NULL, NULL);
+  pthread_t threads[THREADS];
+  long * keys = (long *) malloc (THREADS * OPS * sizeof (long));
+  unsigned int n = 0, i, j;
+  long k;
+
+  CHECK (tree != NULL && keys != NULL);
+  for (i = 0; i < THREADS; i++) {
+    workers[i].tree = tree;
+    workers[i].thread = i;
+    workers[i].seed = 14 + i;
+    CHECK (pthread_create (&threads[i], NULL, work, &workers[i]) == 0);
+  }
+  for (i = 0; i < THREADS; i++) {
+    CHECK (pthread_join (threads[i], NULL) == 0);
+  }
+  for (k = 0; k < RANGE; k++) {
+    for (i = 0; i < THREADS; i++) {
+      for (j = 0; j < workers[i].counts[k]; j++) {
+        keys[n++] = k;
+      }
+    }
+  }
+  check_keys (tree->tree, keys, n);
+  avl_free_combining_tree (tree);
+  free (keys);
+  printf ("test_combining: %u threads, %u items left ok\n", THREADS, n);
+  return 0;
+}
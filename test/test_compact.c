@@ -0,0 +1,128 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * The compact tree against a sorted array: random inserts and removes,
+ * then lookups by index and by key.  The tree is verified each time
+ * its pool grows (and so may move), and a reserved pool must take its
+ * items without growing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+#include "avl_compact.h"
+#include "avl_test.h"
+
+static
+void
+check_compact (avl_compact_tree * tree, long * keys, unsigned int n)
+{
+  long * found = (long *) malloc ((n + 1) * sizeof (long));
+  long * end = found;
+  unsigned int i;
+  void * key;
+
+  CHECK (avl_compact_verify (tree) == 0);
+  CHECK (tree->length == n);
+  avl_compact_iterate_inorder (tree, append_key, &end);
+  CHECK (end == found + n);
+  for (i = 0; i < n; i++) {
+    CHECK (found[i] == keys[i]);
+    CHECK (avl_compact_get_item_by_index (tree, i, &key) == 0);
+    CHECK ((long) key == keys[i]);
+    CHECK (avl_compact_get_item_by_key (tree, (void *) keys[i], &key) == 0);
+    CHECK ((long) key == keys[i]);
+  }
+  CHECK (avl_compact_get_item_by_index (tree, n, &key) == -1);
+  free (found);
+}
+
+/* position of the first key not before <key> */
+static
+unsigned int
+lower_bound (long * keys, unsigned int n, long key)
+{
+  unsigned int i = 0;
+
+  while (i < n && keys[i] < key) {
+    i++;
+  }
+  return i;
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, grown = 0;
+
+  srand (8);
+  for (round = 0; round < 200; round++) {
+    avl_compact_tree * tree = avl_new_compact_tree (compare_longs, NULL);
+    unsigned int ops = rand () % 3000, n = 0, i, index, capacity;
+    long * keys = (long *) malloc ((ops + 1) * sizeof (long));
+    long range = 1 + rand () % 1000;
+    void * key;
+
+    CHECK (tree != NULL);
+    capacity = tree->capacity;
+    for (i = 0; i < ops; i++) {
+      long k = rand () % range;
+      unsigned int at = lower_bound (keys, n, k);
+      if (n && (rand () % 3 == 0)) {
+        if (at < n && keys[at] == k) {
+          CHECK (avl_compact_remove_by_key (tree, (void *) k, free_nothing) == 0);
+          memmove (keys + at, keys + at + 1, (n - at - 1) * sizeof (long));
+          n = n - 1;
+        } else {
+          CHECK (avl_compact_remove_by_key (tree, (void *) k, free_nothing) == -1);
+          CHECK (avl_compact_get_item_by_key (tree, (void *) k, &key) == -1);
+        }
+      } else {
+        CHECK (avl_compact_insert_by_key (tree, (void *) k, &index) == 0);
+        /* equal keys go before those already present */
+        CHECK (index == at);
+        memmove (keys + at + 1, keys + at, (n - at) * sizeof (long));
+        keys[at] = k;
+        n = n + 1;
+      }
+      if (tree->capacity != capacity) {
+        /* the pool was reallocated: every link must have come along */
+        capacity = tree->capacity;
+        grown = grown + 1;
+        check_compact (tree, keys, n);
+      }
+    }
+    check_compact (tree, keys, n);
+    avl_free_compact_tree (tree, free_nothing);
+    free (keys);
+  }
+  CHECK (grown > 0);
+
+  /* a reserved pool takes everything without moving */
+  {
+    avl_compact_tree * tree = avl_new_compact_tree (compare_longs, NULL);
+    avl_compact_node * nodes;
+    long keys[5000];
+    unsigned int i, index;
+
+    CHECK (avl_compact_reserve (tree, 5000) == 0);
+    CHECK (tree->capacity >= 5001);
+    nodes = tree->nodes;
+    for (i = 0; i < 5000; i++) {
+      keys[i] = i;
+      CHECK (avl_compact_insert_by_key (tree, (void *) (long) ((i * 7919) % 5000), &index) == 0);
+    }
+    CHECK (tree->nodes == nodes);
+    check_compact (tree, keys, 5000);
+    /* reserving less than the pool holds changes nothing */
+    CHECK (avl_compact_reserve (tree, 10) == 0);
+    CHECK (tree->nodes == nodes);
+    CHECK (avl_compact_reserve (tree, 1U << 30) == -1);
+    check_compact (tree, keys, 5000);
+    avl_free_compact_tree (tree, free_nothing);
+  }
+  printf ("test_compact: %u rounds ok, pool grown %u times\n", round, grown);
+  return 0;
+}
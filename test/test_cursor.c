@@ -0,0 +1,121 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Cursors against a sorted array: seeks by key and by index, walks in
+ * both directions, and stepping back in after running off either end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_test.h"
+
+/* check that <cursor> sits on <keys>[<index>], or off the end past it */
+static
+void
+check_cursor (avl_cursor * cursor, long * keys, unsigned int n, unsigned int index)
+{
+  void * key;
+
+  CHECK (cursor->index == index);
+  if (index < n) {
+    CHECK (avl_cursor_get (cursor, &key) == 0);
+    CHECK ((long) key == keys[index]);
+  } else {
+    CHECK (cursor->node == NULL);
+    CHECK (avl_cursor_get (cursor, &key) == -1);
+  }
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round;
+
+  srand (6);
+  for (round = 0; round < 500; round++) {
+    avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+    unsigned int n = rand () % (round < 50 ? 4 : 300);
+    long * keys = (long *) malloc ((n + 1) * sizeof (long));
+    avl_cursor cursor;
+    unsigned int i, index, step;
+    long key;
+
+    for (i = 0; i < n; i++) {
+      keys[i] = rand () % 100;
+      CHECK (avl_insert_by_key (tree, (void *) keys[i], &index) == 0);
+    }
+    qsort (keys, n, sizeof (long), compare_long_array);
+    check_keys (tree, keys, n);
+
+    avl_cursor_init (&cursor, tree);
+    CHECK (avl_cursor_get (&cursor, (void **) &key) == -1);
+
+    /* all the way forwards, off the end, and back in */
+    CHECK ((avl_cursor_seek_first (&cursor) == 0) == (n > 0));
+    for (i = 0; i < n; i++) {
+      check_cursor (&cursor, keys, n, i);
+      CHECK ((avl_cursor_next (&cursor) == 0) == (i + 1 < n));
+    }
+    check_cursor (&cursor, keys, n, n);
+    CHECK (avl_cursor_next (&cursor) == -1);
+    if (n) {
+      CHECK (avl_cursor_prev (&cursor) == 0);
+      check_cursor (&cursor, keys, n, n - 1);
+    }
+
+    /* all the way backwards, off the start, and back in */
+    CHECK ((avl_cursor_seek_last (&cursor) == 0) == (n > 0));
+    for (i = n; i > 0; i--) {
+      check_cursor (&cursor, keys, n, i - 1);
+      CHECK ((avl_cursor_prev (&cursor) == 0) == (i > 1));
+    }
+    if (n) {
+      CHECK (cursor.node == NULL && cursor.index == (unsigned int) -1);
+      CHECK (avl_cursor_prev (&cursor) == -1);
+      CHECK (avl_cursor_next (&cursor) == 0);
+      check_cursor (&cursor, keys, n, 0);
+    }
+
+    /* every key, each side of every key, and a short walk from each */
+    for (key = -1; key <= 100; key++) {
+      unsigned int lower = 0;
+      while (lower < n && keys[lower] < key) {
+        lower++;
+      }
+      CHECK ((avl_cursor_seek_key (&cursor, (void *) key) == 0) == (lower < n));
+      check_cursor (&cursor, keys, n, lower);
+      index = lower;
+      for (step = 0; step < 5; step++) {
+        if (rand () % 2) {
+          if (index < n) {
+            CHECK ((avl_cursor_next (&cursor) == 0) == (index + 1 < n));
+            index = index + 1;
+          }
+        } else if (index > 0) {
+          CHECK (avl_cursor_prev (&cursor) == 0);
+          index = index - 1;
+        } else {
+          break;
+        }
+        check_cursor (&cursor, keys, n, index);
+      }
+    }
+
+    /* by index, including one past the end */
+    for (i = 0; i <= n; i++) {
+      CHECK ((avl_cursor_seek_index (&cursor, i) == 0) == (i < n));
+      check_cursor (&cursor, keys, n, i);
+      if (i == n && n) {
+        CHECK (avl_cursor_prev (&cursor) == 0);
+        check_cursor (&cursor, keys, n, n - 1);
+      }
+    }
+
+    avl_free_avl_tree (tree, free_nothing);
+    free (keys);
+  }
+  printf ("test_cursor: %u rounds ok\n", round);
+  return 0;
+}
@@ -0,0 +1,265 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * The durable tree against a plain one, reopened after every round of
+ * inserts, removes and checkpoints.  Between rounds the log may lose
+ * part of its last record, gain garbage at its end, or be the one from
+ * before the last checkpoint, as a crash could leave it; recovery must
+ * still find exactly the changes that were acknowledged.  Writers in
+ * several threads share syncs, and a log that cannot be written must
+ * report the change it lost.
+ */
+
+/* for mkdtemp() and truncate() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "avl.h"
+#include "avl_durable.h"
+#include "avl_test.h"
+
+#define ROUNDS          120
+#define THREADS         4
+#define THREAD_KEYS     300
+
+static char log_path[64];
+static char checkpoint_path[64];
+
+static
+unsigned int
+encode_long (void * key, void * buffer, unsigned int size)
+{
+  long k = (long) key;
+
+  if (size >= sizeof (k)) {
+    memcpy (buffer, &k, sizeof (k));
+  }
+  return sizeof (k);
+}
+
+static
+void *
+decode_long (const void * data, unsigned int size)
+{
+  long k;
+
+  CHECK (size == sizeof (k));
+  memcpy (&k, data, sizeof (k));
+  return (void *) k;
+}
+
+static
+avl_durable_tree *
+open_durable (void)
+{
+  avl_durable_tree * durable =
+    avl_open_durable_tree (log_path, checkpoint_path, compare_longs, NULL,
+                           encode_long, decode_long, NULL);
+
+  CHECK (durable != NULL);
+  return durable;
+}
+
+static
+void
+check_durable (avl_durable_tree * durable, avl_tree * model)
+{
+  long * keys = (long *) malloc ((model->length + 1) * sizeof (long));
+  long * end = keys;
+
+  avl_iterate_inorder (model, append_key, &end);
+  check_keys (durable->tree, keys, model->length);
+  free (keys);
+}
+
+static
+long
+file_size (const char * path)
+{
+  struct stat st;
+
+  CHECK (stat (path, &st) == 0);
+  return (long) st.st_size;
+}
+
+static
+unsigned char *
+read_file (const char * path, long * size)
+{
+  FILE * f = fopen (path, "rb");
+  unsigned char * data;
+
+  CHECK (f != NULL);
+  *size = file_size (path);
+  data = (unsigned char *) malloc (*size + 1);
+  CHECK (fread (data, 1, *size, f) == (size_t) *size);
+  fclose (f);
+  return data;
+}
+
+static
+void
+write_file (const char * path, const unsigned char * data, long size, const char * mode)
+{
+  FILE * f = fopen (path, mode);
+
+  CHECK (f != NULL);
+  CHECK (fwrite (data, 1, size, f) == (size_t) size);
+  CHECK (fclose (f) == 0);
+}
+
+typedef struct {
+  avl_durable_tree *    durable;
+  long                  first;
+} writer_arg;
+
+static
+void *
+writer (void * arg)
+{
+  writer_arg * w = (writer_arg *) arg;
+  long i;
+
+  for (i = 0; i < THREAD_KEYS; i++) {
+    CHECK (avl_durable_insert_by_key (w->durable, (void *) (w->first + i * THREADS), NULL) == 0);
+  }
+  return NULL;
+}
+
+int
+main (int argc, char ** argv)
+{
+  char dir[] = "/tmp/test_durable.XXXXXX";
+  avl_tree * model = avl_new_avl_tree (compare_longs, NULL);
+  avl_durable_tree * durable;
+  pthread_t threads[THREADS];
+  writer_arg args[THREADS];
+  unsigned int round, i, index, torn = 0, restored = 0;
+  void * found;
+  long k;
+
+  CHECK (mkdtemp (dir) != NULL);
+  snprintf (log_path, sizeof (log_path), "%s/log", dir);
+  snprintf (checkpoint_path, sizeof (checkpoint_path), "%s/checkpoint", dir);
+  srand (16);
+  durable = open_durable ();
+  check_durable (durable, model);
+  for (round = 0; round < ROUNDS; round++) {
+    unsigned int ops = rand () % 200;
+    long range = 1 + rand () % 300;
+    /* the last change in the log, to be lost with its record */
+    int last_op = 0;
+    long last_key = 0;
+    unsigned char * old_log = NULL;
+    long old_size = 0;
+
+    for (i = 0; i < ops; i++) {
+      k = rand () % range;
+      if (rand () % 3 == 0) {
+        int result = avl_remove_by_key (model, (void *) k, free_nothing);
+        CHECK (avl_durable_remove_by_key (durable, (void *) k) == result);
+        if (result == 0) {
+          last_op = 'R';
+          last_key = k;
+        }
+      } else {
+        CHECK (avl_insert_by_key (model, (void *) k, &index) == 0);
+        CHECK (avl_durable_insert_by_key (durable, (void *) k, &index) == 0);
+        last_op = 'I';
+        last_key = k;
+      }
+      if (rand () % 150 == 0) {
+        CHECK (avl_durable_checkpoint (durable) == 0);
+        last_op = 0;
+      }
+    }
+    check_durable (durable, model);
+    switch (rand () % 4) {
+    case 0:
+      /* cut into the last record: its change never happened */
+      if (last_op) {
+        avl_close_durable_tree (durable);
+        CHECK (truncate (log_path, file_size (log_path) - 1 - rand () % 16) == 0);
+        if (last_op == 'I') {
+          CHECK (avl_remove_by_key (model, (void *) last_key, free_nothing) == 0);
+        } else {
+          CHECK (avl_insert_by_key (model, (void *) last_key, &index) == 0);
+        }
+        durable = open_durable ();
+        torn++;
+      }
+      break;
+    case 1:
+      /* garbage after the last record */
+      {
+        unsigned char garbage[24];
+        unsigned int size = 1 + rand () % sizeof (garbage);
+        for (i = 0; i < size; i++) {
+          garbage[i] = rand ();
+        }
+        avl_close_durable_tree (durable);
+        write_file (log_path, garbage, size, "ab");
+        durable = open_durable ();
+      }
+      break;
+    case 2:
+      /* a crash after the checkpoint was renamed, but not the new log */
+      old_log = read_file (log_path, &old_size);
+      CHECK (avl_durable_checkpoint (durable) == 0);
+      avl_close_durable_tree (durable);
+      write_file (log_path, old_log, old_size, "wb");
+      free (old_log);
+      durable = open_durable ();
+      restored++;
+      break;
+    default:
+      avl_close_durable_tree (durable);
+      durable = open_durable ();
+      break;
+    }
+    check_durable (durable, model);
+  }
+  /* group commit: every acknowledged insert must be there on reopening */
+  for (i = 0; i < THREADS; i++) {
+    args[i].durable = durable;
+    args[i].first = 1000 + i;
+    CHECK (pthread_create (&threads[i], NULL, writer, &args[i]) == 0);
+  }
+  for (i = 0; i < THREADS; i++) {
+    CHECK (pthread_join (threads[i], NULL) == 0);
+  }
+  for (k = 1000; k < 1000 + THREADS * THREAD_KEYS; k++) {
+    CHECK (avl_insert_by_key (model, (void *) k, &index) == 0);
+  }
+  check_durable (durable, model);
+  avl_close_durable_tree (durable);
+  durable = open_durable ();
+  check_durable (durable, model);
+  /* a log that cannot be written: the first change is kept but unsynced */
+  close (durable->log_fd);
+  durable->log_fd = open (log_path, O_RDONLY);
+  CHECK (durable->log_fd >= 0);
+  CHECK (avl_durable_insert_by_key (durable, (void *) -1L, &index) == AVL_DURABLE_UNSYNCED);
+  CHECK (avl_get_item_by_key (durable->tree, (void *) -1L, &found) == 0);
+  CHECK (avl_durable_insert_by_key (durable, (void *) -2L, &index) == -1);
+  CHECK (avl_get_item_by_key (durable->tree, (void *) -2L, &found) == -1);
+  CHECK (avl_durable_remove_by_key (durable, (void *) -1L) == -1);
+  CHECK (avl_durable_checkpoint (durable) == -1);
+  avl_close_durable_tree (durable);
+  durable = open_durable ();
+  check_durable (durable, model);
+  avl_close_durable_tree (durable);
+  avl_free_avl_tree (model, free_nothing);
+  CHECK (remove (log_path) == 0);
+  CHECK (remove (checkpoint_path) == 0);
+  CHECK (rmdir (dir) == 0);
+  printf ("test_durable: %u rounds ok, %u torn records, %u old logs\n", round, torn, restored);
+  return 0;
+}
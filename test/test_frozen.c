@@ -0,0 +1,197 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Frozen snapshots against the live tree they were taken from.  Keys
+ * are records compared by <key> alone, so that among equal keys we can
+ * tell which one a lookup found.  The typed indexes are checked with
+ * AVX2 (where the CPU has it) and without, and with keys equal to the
+ * values that pad their blocks.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_frozen.h"
+#include "avl_test.h"
+
+typedef struct {
+  long          key;
+  unsigned int  tag;
+} record;
+
+static
+int
+compare_records (void * compare_arg, void * a, void * b)
+{
+  return compare_longs (compare_arg, (void *) ((record *) a)->key, (void *) ((record *) b)->key);
+}
+
+static
+int64_t
+record_int64 (void * key)
+{
+  return ((record *) key)->key;
+}
+
+/* the extreme keys stand for the infinities */
+static
+double
+record_double (void * key)
+{
+  long k = ((record *) key)->key;
+
+  if (k == INT64_MAX) {
+    return INFINITY;
+  } else if (k == INT64_MIN) {
+    return -INFINITY;
+  }
+  return (double) k;
+}
+
+static
+void
+check_typed (avl_tree * tree, avl_frozen_tree * frozen, long * probes, unsigned int count)
+{
+  unsigned int i;
+  record probe = {0, 0};
+
+  for (i = 0; i < count; i++) {
+    unsigned int lower, upper;
+    probe.key = probes[i];
+    lower = avl_lower_bound_index (tree, &probe);
+    upper = avl_upper_bound_index (tree, &probe);
+    if (frozen->typed_kind == AVL_FROZEN_INT64) {
+      CHECK (avl_frozen_lower_bound_int64 (frozen, probes[i]) == lower);
+      CHECK (avl_frozen_upper_bound_int64 (frozen, probes[i]) == upper);
+    } else {
+      double d = record_double (&probe);
+      CHECK (avl_frozen_lower_bound_double (frozen, d) == lower);
+      CHECK (avl_frozen_upper_bound_double (frozen, d) == upper);
+      /* between two keys, both bounds fall after the smaller one */
+      if (probes[i] != INT64_MAX && probes[i] != INT64_MIN) {
+        CHECK (avl_frozen_lower_bound_double (frozen, d + 0.5) == upper);
+        CHECK (avl_frozen_upper_bound_double (frozen, d + 0.5) == upper);
+      }
+    }
+  }
+}
+
+static
+void
+check_untyped (avl_tree * tree, avl_frozen_tree * frozen, long low, long high)
+{
+  unsigned int i;
+  record probe = {0, 0};
+  void * found, * expect;
+
+  CHECK (frozen->length == tree->length);
+  for (i = 0; i < tree->length; i++) {
+    CHECK (avl_frozen_get_item_by_index (frozen, i, &found) == 0);
+    CHECK (avl_get_item_by_index (tree, i, &expect) == 0);
+    CHECK (found == expect);
+  }
+  CHECK (avl_frozen_get_item_by_index (frozen, tree->length, &found) == -1);
+
+  for (probe.key = low; probe.key <= high; probe.key++) {
+    unsigned int lower = avl_lower_bound_index (tree, &probe);
+    unsigned int upper = avl_upper_bound_index (tree, &probe);
+    int expect_result;
+
+    CHECK (avl_frozen_lower_bound (frozen, &probe) == lower);
+    CHECK (avl_frozen_upper_bound (frozen, &probe) == upper);
+
+    /* by key: the first of the equal items, in order */
+    expect_result = avl_get_item_by_key (tree, &probe, &expect);
+    CHECK (avl_frozen_get_item_by_key (frozen, &probe, &found) == expect_result);
+    CHECK (expect_result == ((lower < upper) ? 0 : -1));
+    if (expect_result == 0) {
+      avl_get_item_by_index (tree, lower, &expect);
+      CHECK (found == expect);
+    }
+
+    /*
+     * The live tree's most and least stop at any equal item, so
+     * compare keys only; the frozen tree's take the last and first.
+     */
+    expect_result = avl_get_item_by_key_most (tree, &probe, &expect);
+    CHECK (avl_frozen_get_item_by_key_most (frozen, &probe, &found) == expect_result);
+    if (expect_result == 0) {
+      CHECK (((record *) found)->key == ((record *) expect)->key);
+      avl_get_item_by_index (tree, upper - 1, &expect);
+      CHECK (found == expect);
+    }
+    expect_result = avl_get_item_by_key_least (tree, &probe, &expect);
+    CHECK (avl_frozen_get_item_by_key_least (frozen, &probe, &found) == expect_result);
+    if (expect_result == 0) {
+      CHECK (((record *) found)->key == ((record *) expect)->key);
+      avl_get_item_by_index (tree, lower, &expect);
+      CHECK (found == expect);
+    }
+  }
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, simd_rounds = 0;
+
+  srand (9);
+  for (round = 0; round < 300; round++) {
+    avl_tree * tree = avl_new_avl_tree (compare_records, NULL);
+    unsigned int n = (round < 40) ? round : rand () % 2000;
+    long range = 1 + rand () % (2 * n + 1);
+    record * records = (record *) malloc ((n + 1) * sizeof (record));
+    avl_frozen_tree * frozen;
+    unsigned int i, index;
+    int kind;
+
+    for (i = 0; i < n; i++) {
+      records[i].key = rand () % range;
+      /* now and then, a key at the padding value (or the other end) */
+      if ((round % 3) && (rand () % 50 == 0)) {
+        records[i].key = (rand () % 2) ? INT64_MAX : INT64_MIN;
+      }
+      records[i].tag = i;
+      CHECK (avl_insert_by_key (tree, &records[i], &index) == 0);
+    }
+    frozen = avl_freeze (tree);
+    CHECK (frozen != NULL);
+    check_untyped (tree, frozen, -2, range + 2);
+    avl_free_frozen_tree (frozen);
+
+    /* the typed indexes */
+    for (kind = AVL_FROZEN_INT64; kind <= AVL_FROZEN_DOUBLE; kind++) {
+      long probes[3004];
+      unsigned int count = 0;
+      long k;
+
+      for (k = -2; k <= range + 2 && count < 3000; k++) {
+        probes[count++] = k;
+      }
+      probes[count++] = INT64_MIN;
+      probes[count++] = INT64_MAX;
+      frozen = avl_freeze (tree);
+      CHECK (frozen != NULL);
+      if (kind == AVL_FROZEN_INT64) {
+        CHECK (avl_frozen_index_int64 (frozen, record_int64) == 0);
+      } else {
+        CHECK (avl_frozen_index_double (frozen, record_double) == 0);
+      }
+      /* one typed index per snapshot */
+      CHECK (avl_frozen_index_int64 (frozen, record_int64) == -1);
+      simd_rounds = simd_rounds + (frozen->typed_simd != 0);
+      check_typed (tree, frozen, probes, count);
+      /* and again with the scalar search */
+      frozen->typed_simd = 0;
+      check_typed (tree, frozen, probes, count);
+      avl_free_frozen_tree (frozen);
+    }
+    avl_free_avl_tree (tree, free_nothing);
+    free (records);
+  }
+  printf ("test_frozen: %u rounds ok, %u typed indexes searched with AVX2\n", round, simd_rounds);
+  return 0;
+}
@@ -0,0 +1,85 @@
+// -*- Mode: C++; indent-tabs-mode: nil -*-
+
+//
+// avl::ranked_tree against std::multiset: random inserts and erases
+// (by key and by position), then the contents, bounds, counts and
+// positions must agree, forwards and backwards.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+
+#include "avl.hpp"
+#include "avl_test.h"
+
+int
+main ()
+{
+  std::mt19937 rng (5);
+  unsigned int round;
+
+  for (round = 0; round < 300; round++) {
+    avl::ranked_tree<int> tree;
+    std::multiset<int> model;
+    unsigned int ops = rng () % 2000;
+
+    for (unsigned int i = 0; i < ops; i++) {
+      int key = rng () % 300;
+      if (!model.empty () && rng () % 3 == 0) {
+        if (rng () % 2) {
+          auto it = model.find (key);
+          CHECK (tree.erase (key) == (it != model.end () ? 1u : 0u));
+          if (it != model.end ()) {
+            model.erase (it);
+          }
+        } else {
+          std::size_t index = rng () % tree.size ();
+          auto pos = tree.nth (index);
+          auto mpos = std::next (model.begin (), index);
+          CHECK (tree.index_of (pos) == index && *pos == *mpos);
+          auto next = tree.erase (pos);
+          mpos = model.erase (mpos);
+          CHECK (mpos == model.end () ? next == tree.end () : *next == *mpos);
+        }
+      } else {
+        CHECK (*tree.insert (key) == key);
+        model.insert (key);
+      }
+    }
+    CHECK (tree.verify ());
+    CHECK (tree.size () == model.size ());
+    CHECK (std::equal (tree.begin (), tree.end (), model.begin (), model.end ()));
+    CHECK (std::equal (tree.rbegin (), tree.rend (), model.rbegin (), model.rend ()));
+    for (int key = -1; key < 302; key++) {
+      auto lower = tree.lower_bound (key);
+      auto upper = tree.upper_bound (key);
+      CHECK (tree.index_of (lower) == (std::size_t) std::distance (model.begin (), model.lower_bound (key)));
+      CHECK (tree.index_of (upper) == (std::size_t) std::distance (model.begin (), model.upper_bound (key)));
+      CHECK (tree.count (key) == model.count (key));
+      CHECK (tree.contains (key) == (model.count (key) != 0));
+      if (tree.contains (key)) {
+        // find() gives some equal item, which lies in equal_range()
+        auto found = tree.find (key);
+        CHECK (*found == key);
+        CHECK (tree.index_of (found) >= tree.index_of (lower) && tree.index_of (found) < tree.index_of (upper));
+      }
+    }
+
+    avl::ranked_tree<int> copy (tree);
+    CHECK (copy.verify () && std::equal (copy.begin (), copy.end (), model.begin (), model.end ()));
+    avl::ranked_tree<int> moved (std::move (copy));
+    CHECK (copy.empty () && moved.verify () && moved.size () == model.size ());
+    copy = moved;
+    CHECK (copy.verify () && copy.size () == model.size ());
+  }
+
+  avl::ranked_tree<std::string> strings {"b", "a", "c", "b"};
+  CHECK (strings[0] == "a" && strings.at (3) == "c" && strings.count ("b") == 2);
+
+  std::printf ("test_hpp: %u rounds ok\n", round);
+  return 0;
+}
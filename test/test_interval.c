@@ -0,0 +1,221 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Interval queries against a scan of every interval, while intervals
+ * come and go.  Each overlap and stabbing query must report exactly
+ * the intervals the scan finds, each once, in the tree's order, and
+ * stop when told to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "avl.h"
+#include "avl_interval.h"
+#include "avl_test.h"
+
+typedef struct {
+  int64_t       low;
+  int64_t       high;
+  unsigned int  seen;           /* the last query that reported it */
+} interval;
+
+typedef struct {
+  interval **   found;
+  unsigned int  count;
+  unsigned int  query;
+  unsigned int  stop_after;     /* 0 for never */
+} collector;
+
+static interval * removed;
+
+static
+void
+interval_of (void * key, int64_t * low, int64_t * high)
+{
+  interval * i = (interval *) key;
+
+  *low = i->low;
+  *high = i->high;
+}
+
+static
+int
+note_removed (void * key)
+{
+  removed = (interval *) key;
+  return 0;
+}
+
+static
+int
+collect (void * key, void * iter_arg)
+{
+  collector * c = (collector *) iter_arg;
+  interval * i = (interval *) key;
+
+  CHECK (i->seen != c->query);
+  i->seen = c->query;
+  c->found[c->count++] = i;
+  if (c->stop_after && (c->count == c->stop_after)) {
+    return 7;
+  }
+  return 0;
+}
+
+/* the tree's order: by low endpoint, then high */
+static
+int
+compare_intervals (const void * a, const void * b)
+{
+  const interval * ia = *(interval * const *) a;
+  const interval * ib = *(interval * const *) b;
+
+  if (ia->low != ib->low) {
+    return (ia->low < ib->low) ? -1 : 1;
+  }
+  return (ia->high > ib->high) - (ia->high < ib->high);
+}
+
+static
+int64_t
+random_endpoint (int64_t range)
+{
+  switch (rand () % 50) {
+  case 0:
+    return INT64_MIN;
+  case 1:
+    return INT64_MAX;
+  default:
+    return rand () % range - range / 2;
+  }
+}
+
+/* run one query on <tree>, compare it with a scan of <live>, and count its matches */
+static
+unsigned int
+check_query (avl_tree * tree, interval ** live, unsigned int n,
+             int64_t low, int64_t high, int stab, collector * c, interval ** expect)
+{
+  unsigned int i, m = 0;
+  int result;
+
+  for (i = 0; i < n; i++) {
+    if ((live[i]->low <= high) && (live[i]->high >= low)) {
+      expect[m++] = live[i];
+    }
+  }
+  qsort (expect, m, sizeof (interval *), compare_intervals);
+  c->count = 0;
+  c->query = c->query + 1;
+  c->stop_after = 0;
+  if (stab) {
+    result = avl_interval_stab (tree, low, collect, c);
+  } else {
+    result = avl_interval_overlap (tree, low, high, collect, c);
+  }
+  CHECK (result == 0);
+  CHECK (c->count == m);
+  for (i = 0; i < m; i++) {
+    /* equal intervals may come in either order, but all of them come */
+    CHECK (compare_intervals (&c->found[i], &expect[i]) == 0);
+    CHECK (expect[i]->seen == c->query);
+  }
+  if (m > 1) {
+    /* stop partway: exactly that many, and the walk's result passed back */
+    c->count = 0;
+    c->query = c->query + 1;
+    c->stop_after = 1 + rand () % (m - 1);
+    CHECK (avl_interval_overlap (tree, low, high, collect, c) == 7);
+    CHECK (c->count == c->stop_after);
+    for (i = 0; i < c->count; i++) {
+      CHECK (compare_intervals (&c->found[i], &expect[i]) == 0);
+    }
+  }
+  return m;
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, queries = 0, matches = 0;
+  avl_interval_mode mode;
+  avl_tree * plain = avl_new_avl_tree (compare_longs, NULL);
+  collector c;
+
+  /* only trees in interval mode answer, and only empty ones can switch */
+  c.count = 0;
+  c.query = 0;
+  c.stop_after = 0;
+  CHECK (plain != NULL);
+  CHECK (avl_interval_overlap (plain, 0, 1, collect, &c) == -1);
+  avl_free_avl_tree (plain, free_nothing);
+  srand (18);
+  for (round = 0; round < 100; round++) {
+    avl_tree * tree = avl_new_avl_tree (NULL, NULL);
+    unsigned int ops = rand () % 800, n = 0, i, j, index;
+    interval ** live = (interval **) malloc ((ops + 1) * sizeof (interval *));
+    interval ** expect = (interval **) malloc ((ops + 1) * sizeof (interval *));
+    int64_t range = 2 + rand () % 2000;
+    int64_t width = 1 + rand () % (range / 2 + 1);
+
+    c.found = (interval **) malloc ((ops + 1) * sizeof (interval *));
+    CHECK (tree != NULL);
+    CHECK (avl_tree_use_intervals (tree, &mode, interval_of) == 0);
+    for (i = 0; i < ops; i++) {
+      if (n && (rand () % 3 == 0)) {
+        /* remove an interval equal to a live one: the tree picks which */
+        interval * victim = live[rand () % n];
+        removed = NULL;
+        CHECK (avl_remove_by_key (tree, victim, note_removed) == 0);
+        CHECK (removed != NULL);
+        CHECK (compare_intervals (&removed, &victim) == 0);
+        for (j = 0; live[j] != removed; j++) {
+          CHECK (j + 1 < n);
+        }
+        live[j] = live[--n];
+        free (removed);
+      } else {
+        interval * x = (interval *) malloc (sizeof (interval));
+        CHECK (x != NULL);
+        x->low = random_endpoint (range);
+        x->high = (x->low > INT64_MAX - width) ? INT64_MAX : x->low + rand () % width;
+        if (rand () % 50 == 0) {
+          x->high = INT64_MAX;
+        }
+        x->seen = 0;
+        CHECK (avl_insert_by_key (tree, x, &index) == 0);
+        live[n++] = x;
+        if (n == 1) {
+          CHECK (avl_tree_use_intervals (tree, &mode, interval_of) == -1);
+        }
+      }
+      CHECK (avl_verify (tree) == 0);
+      CHECK (tree->length == n);
+      if (rand () % 4 == 0) {
+        int64_t a = random_endpoint (range), b;
+        int64_t delta = rand () % range - range / 8;
+        if ((delta > 0) && (a > INT64_MAX - delta)) {
+          b = INT64_MAX;
+        } else if ((delta < 0) && (a < INT64_MIN - delta)) {
+          b = INT64_MIN;
+        } else {
+          b = a + delta;
+        }
+        matches = matches + check_query (tree, live, n, a, b, 0, &c, expect);
+        matches = matches + check_query (tree, live, n, a, a, 1, &c, expect);
+        queries = queries + 2;
+      }
+    }
+    avl_free_avl_tree (tree, free_nothing);
+    for (i = 0; i < n; i++) {
+      free (live[i]);
+    }
+    free (live);
+    free (expect);
+    free (c.found);
+  }
+  printf ("test_interval: %u rounds ok, %u queries, %u matches\n", round, queries, matches);
+  return 0;
+}
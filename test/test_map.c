@@ -0,0 +1,244 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Map mode against a sorted array of (key, value) pairs, with and
+ * without aggregates and an arena in front of the value.  Values must
+ * follow their keys through removals, splits and joins, and every
+ * value the tree drops must reach its free_value_fun exactly once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+#include "avl_test.h"
+
+typedef struct {
+  long          key;
+  long          value;
+} pair;
+
+static long values_freed;
+
+static
+int
+free_value (void * value)
+{
+  values_freed = values_freed + 1;
+  return 0;
+}
+
+static
+void
+count_identity (void * monoid_arg, void * aggregate)
+{
+  /* the padding too, since avl_verify() compares whole aggregates */
+  memset (aggregate, 0, sizeof (long) + 4);
+}
+
+static
+void
+count_append_key (void * monoid_arg, void * aggregate, void * key)
+{
+  *(long *) aggregate = *(long *) aggregate + 1;
+}
+
+static
+void
+count_append (void * monoid_arg, void * aggregate, const void * other)
+{
+  *(long *) aggregate = *(long *) aggregate + *(const long *) other;
+}
+
+/* an odd size, so that the value must be aligned past it */
+static avl_monoid count_monoid = {
+  sizeof (long) + 4,
+  count_identity,
+  count_append_key,
+  count_append,
+  NULL
+};
+
+static
+void
+check_map (avl_tree * tree, pair * pairs, unsigned int n)
+{
+  unsigned int i;
+  void * key, * value;
+
+  CHECK (avl_verify (tree) == 0);
+  CHECK (tree->length == n);
+  for (i = 0; i < n; i++) {
+    CHECK (avl_get_item_by_index (tree, i, &key) == 0);
+    CHECK ((long) key == pairs[i].key);
+    CHECK (avl_get_value_by_index (tree, i, &value) == 0);
+    CHECK ((long) value == pairs[i].value);
+    /* the first of equal keys */
+    if (!i || pairs[i - 1].key != pairs[i].key) {
+      CHECK (avl_get_value_by_key (tree, key, &value) == 0);
+      CHECK ((long) value == pairs[i].value);
+    }
+  }
+  CHECK (avl_get_value_by_index (tree, n, &value) == -1);
+}
+
+static
+unsigned int
+lower_bound (pair * pairs, unsigned int n, long key)
+{
+  unsigned int i = 0;
+
+  while (i < n && pairs[i].key < key) {
+    i++;
+  }
+  return i;
+}
+
+static
+avl_tree *
+new_map (int aggregates, avl_node_arena * arena)
+{
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+
+  CHECK (tree != NULL);
+  /* either order will do while the tree and arena are fresh */
+  if (aggregates && (rand () % 2)) {
+    CHECK (avl_tree_use_monoid (tree, &count_monoid) == 0);
+    aggregates = 0;
+  }
+  CHECK (avl_tree_use_values (tree, free_value) == 0);
+  if (aggregates) {
+    CHECK (avl_tree_use_monoid (tree, &count_monoid) == 0);
+  }
+  if (arena) {
+    CHECK (avl_tree_use_arena (tree, arena) == 0);
+  }
+  return tree;
+}
+
+int
+main (int argc, char ** argv)
+{
+  avl_tree * plain = avl_new_avl_tree (compare_longs, NULL);
+  unsigned int round, index, version = 0;
+  long dropped = 0;
+  void * value;
+
+  /* four pointers and the rank and balance, with no room for a value */
+  CHECK (sizeof (avl_node) <= 5 * sizeof (void *));
+  CHECK (plain != NULL);
+  CHECK (avl_insert_kv (plain, (void *) 1L, (void *) 2L, &index) == -1);
+  CHECK (avl_upsert (plain, (void *) 1L, (void *) 2L, &index) == -1);
+  CHECK (avl_insert_by_key (plain, (void *) 1L, &index) == 0);
+  CHECK (avl_get_value_by_key (plain, (void *) 1L, &value) == -1);
+  CHECK (avl_get_value_by_index (plain, 0, &value) == -1);
+  CHECK (avl_set_value_by_key (plain, (void *) 1L, (void *) 2L) == -1);
+  CHECK (avl_tree_use_values (plain, NULL) == -1);
+  avl_free_avl_tree (plain, free_nothing);
+
+  srand (19);
+  for (round = 0; round < 200; round++) {
+    int aggregates = round % 2;
+    avl_node_arena * arena = NULL;
+    avl_tree * tree, * right, * other;
+    unsigned int ops = rand () % 1000, n = 0, i, at;
+    pair * pairs = (pair *) malloc ((ops + 1) * sizeof (pair));
+    long range = 1 + rand () % 500;
+
+    if (round % 4 >= 2) {
+      arena = avl_new_node_arena (rand () % 64, NULL, NULL, NULL);
+      CHECK (arena != NULL);
+    }
+    tree = new_map (aggregates, arena);
+    right = new_map (aggregates, arena);
+    /* nodes only move between trees laid out alike */
+    other = avl_new_avl_tree (compare_longs, NULL);
+    if (arena) {
+      CHECK (avl_tree_use_arena (other, arena) == 0);
+      avl_release_node_arena (arena);
+    }
+    if (aggregates) {
+      CHECK (avl_tree_use_monoid (other, &count_monoid) == 0);
+    }
+    CHECK (avl_split_by_index (tree, 0, other) == -1);
+    CHECK (avl_join (tree, other) == -1);
+    CHECK (avl_union (tree, other, NULL) == -1);
+    avl_free_avl_tree (other, free_nothing);
+    values_freed = 0;
+    dropped = 0;
+    for (i = 0; i < ops; i++) {
+      long k = rand () % range;
+      /* values are longs too, different each time */
+      long v = k * 1000 + (version++ % 1000);
+      unsigned int choice = rand () % 10;
+      at = lower_bound (pairs, n, k);
+      if (choice < 4) {
+        CHECK (avl_insert_kv (tree, (void *) k, (void *) v, &index) == 0);
+        /* equal keys go before the ones already there */
+        memmove (pairs + at + 1, pairs + at, (n - at) * sizeof (pair));
+        pairs[at].key = k;
+        pairs[at].value = v;
+        n = n + 1;
+      } else if (choice < 6) {
+        int present = (at < n) && (pairs[at].key == k);
+        /* which of several equal items it finds is not specified */
+        if (present && (at + 1 < n) && (pairs[at + 1].key == k)) {
+          continue;
+        }
+        CHECK (avl_upsert (tree, (void *) k, (void *) v, &index) == present);
+        if (present) {
+          pairs[at].value = v;
+          dropped++;
+        } else {
+          memmove (pairs + at + 1, pairs + at, (n - at) * sizeof (pair));
+          pairs[at].key = k;
+          pairs[at].value = v;
+          n = n + 1;
+        }
+      } else if (choice < 7) {
+        if ((at < n) && (pairs[at].key == k)) {
+          CHECK (avl_set_value_by_key (tree, (void *) k, (void *) v) == 0);
+          pairs[at].value = v;
+          dropped++;
+        } else {
+          CHECK (avl_set_value_by_key (tree, (void *) k, (void *) v) == -1);
+        }
+      } else if (choice < 9) {
+        /* removes one of the equal items, so only unique keys */
+        if ((at < n) && (pairs[at].key == k)
+            && !((at + 1 < n) && (pairs[at + 1].key == k))) {
+          CHECK (avl_remove_by_key (tree, (void *) k, free_nothing) == 0);
+          memmove (pairs + at, pairs + at + 1, (n - at - 1) * sizeof (pair));
+          n = n - 1;
+          dropped++;
+        }
+      } else {
+        at = rand () % (n + 1);
+        CHECK (avl_split_by_index (tree, at, right) == 0);
+        check_map (tree, pairs, at);
+        check_map (right, pairs + at, n - at);
+        CHECK (avl_join (tree, right) == 0);
+      }
+      CHECK (values_freed == dropped);
+    }
+    check_map (tree, pairs, n);
+    if (n) {
+      /* range removal drops values as well */
+      unsigned int low = rand () % n;
+      unsigned int high = low + rand () % (n - low + 1);
+      CHECK (avl_remove_index_range (tree, low, high, NULL) == 0);
+      memmove (pairs + low, pairs + high, (n - high) * sizeof (pair));
+      n = n - (high - low);
+      dropped = dropped + (high - low);
+      CHECK (values_freed == dropped);
+      check_map (tree, pairs, n);
+    }
+    avl_free_avl_tree (tree, free_nothing);
+    avl_free_avl_tree (right, free_nothing);
+    CHECK (values_freed == dropped + n);
+    free (pairs);
+  }
+  printf ("test_map: %u rounds ok\n", round);
+  return 0;
+}
@@ -0,0 +1,282 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Saved trees against the trees they were saved from: every index,
+ * first-equal lookup, span and inorder walk of the mapping must agree,
+ * and so must both kinds of upgrade.  A file that is cut short or has
+ * a bad header must not load.
+ */
+
+/* for mkstemp() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avl.h"
+#include "avl_mapped.h"
+#include "avl_test.h"
+
+/* keys are stored as the bytes of a long */
+
+static
+unsigned int
+encode_long (void * key, void * buffer, unsigned int size)
+{
+  long k = (long) key;
+
+  if (size >= sizeof (k)) {
+    memcpy (buffer, &k, sizeof (k));
+  }
+  return sizeof (k);
+}
+
+static
+void *
+decode_long (const void * data, unsigned int size)
+{
+  long k;
+
+  CHECK (size == sizeof (k));
+  memcpy (&k, data, sizeof (k));
+  return (void *) k;
+}
+
+static
+long
+mapped_long (void * key)
+{
+  avl_mapped_key * k = (avl_mapped_key *) key;
+
+  return (long) decode_long (k->data, k->size);
+}
+
+static
+int
+compare_mapped (void * compare_arg, void * a, void * b)
+{
+  return compare_longs (compare_arg, (void *) mapped_long (a), (void *) mapped_long (b));
+}
+
+/* a stored key to search with, in <buffer> */
+static
+void *
+probe (uint64_t * buffer, long k)
+{
+  avl_mapped_key * key = (avl_mapped_key *) buffer;
+
+  key->size = sizeof (k);
+  key->unused = 0;
+  memcpy (key->data, &k, sizeof (k));
+  return key;
+}
+
+static
+int
+append_mapped (void * key, void * iter_arg)
+{
+  return append_key ((void *) mapped_long (key), iter_arg);
+}
+
+static
+void
+check_mapped (avl_mapped_tree * mapped, avl_tree * tree, long range)
+{
+  unsigned int i, low, high, expect_low, expect_high;
+  long * found = (long *) malloc ((tree->length + 1) * sizeof (long));
+  long * end = found;
+  uint64_t buffer[2];
+  void * key, * expect;
+  long a;
+
+  CHECK (mapped->length == tree->length);
+  for (i = 0; i < tree->length; i++) {
+    CHECK (avl_mapped_get_item_by_index (mapped, i, &key) == 0);
+    CHECK (avl_get_item_by_index (tree, i, &expect) == 0);
+    CHECK (mapped_long (key) == (long) expect);
+  }
+  CHECK (avl_mapped_get_item_by_index (mapped, tree->length, &key) == -1);
+  avl_mapped_iterate_inorder (mapped, append_mapped, &end);
+  CHECK (end == found + tree->length);
+  for (i = 0; i < tree->length; i++) {
+    CHECK (avl_get_item_by_index (tree, i, &expect) == 0);
+    CHECK (found[i] == (long) expect);
+  }
+  for (a = -1; a <= range; a++) {
+    CHECK (avl_mapped_get_span_by_key (mapped, probe (buffer, a), &low, &high) == 0);
+    avl_get_span_by_key (tree, (void *) a, &expect_low, &expect_high);
+    CHECK (low == expect_low && high == expect_high);
+    if (low < high) {
+      /* the first of the equal keys, not just any of them */
+      CHECK (avl_mapped_get_item_by_key (mapped, probe (buffer, a), &key) == 0);
+      CHECK (avl_mapped_get_item_by_index (mapped, low, &expect) == 0);
+      CHECK (key == expect);
+      CHECK (mapped_long (key) == a);
+    } else {
+      CHECK (avl_mapped_get_item_by_key (mapped, probe (buffer, a), &key) == -1);
+    }
+  }
+  free (found);
+}
+
+/* the upgraded tree must hold the same keys in the same order */
+static
+void
+check_upgrade (avl_tree * upgraded, avl_tree * tree, int decoded)
+{
+  unsigned int i;
+  void * key, * expect;
+
+  CHECK (upgraded != NULL);
+  CHECK (avl_verify (upgraded) == 0);
+  CHECK (upgraded->length == tree->length);
+  for (i = 0; i < tree->length; i++) {
+    CHECK (avl_get_item_by_index (upgraded, i, &key) == 0);
+    CHECK (avl_get_item_by_index (tree, i, &expect) == 0);
+    CHECK ((decoded ? (long) key : mapped_long (key)) == (long) expect);
+  }
+}
+
+/* copy the first <size> bytes of <from> to <to> */
+static
+void
+copy_file (const char * from, const char * to, long size)
+{
+  FILE * in = fopen (from, "rb");
+  FILE * out = fopen (to, "wb");
+  int c;
+
+  CHECK (in != NULL && out != NULL);
+  while ((size-- != 0) && ((c = getc (in)) != EOF)) {
+    CHECK (putc (c, out) != EOF);
+  }
+  fclose (in);
+  CHECK (fclose (out) == 0);
+}
+
+static
+long
+file_size (const char * path)
+{
+  FILE * f = fopen (path, "rb");
+  long size;
+
+  CHECK (f != NULL);
+  CHECK (fseek (f, 0, SEEK_END) == 0);
+  size = ftell (f);
+  fclose (f);
+  return size;
+}
+
+/* overwrite <size> bytes at <offset> in <path> */
+static
+void
+patch_file (const char * path, long offset, const void * data, size_t size)
+{
+  FILE * f = fopen (path, "r+b");
+
+  CHECK (f != NULL);
+  CHECK (fseek (f, offset, SEEK_SET) == 0);
+  CHECK (fwrite (data, 1, size, f) == size);
+  CHECK (fclose (f) == 0);
+}
+
+static
+void
+check_rejected (const char * path, const char * bad, long size)
+{
+  static const char wrong_magic[8] = "AVLTREF";
+  uint32_t wrong_version = AVL_MAPPED_VERSION + 1;
+  uint32_t wrong_order = 0x04030201;
+  uint64_t wrong_size = size + 8;
+  uint64_t wrong_nodes = 12;
+  uint64_t wrong_length;
+  avl_mapped_header header;
+  avl_mapped_tree * mapped;
+  FILE * f;
+  long cut;
+
+  /* cut short anywhere: in the header, in the keys or in the nodes */
+  for (cut = 0; cut < size; cut = cut + 1 + cut / 3) {
+    copy_file (path, bad, cut);
+    CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  }
+  copy_file (path, bad, -1);
+  patch_file (bad, offsetof (avl_mapped_header, magic), wrong_magic, sizeof (wrong_magic));
+  CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  copy_file (path, bad, -1);
+  patch_file (bad, offsetof (avl_mapped_header, version), &wrong_version, sizeof (wrong_version));
+  CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  copy_file (path, bad, -1);
+  patch_file (bad, offsetof (avl_mapped_header, byte_order), &wrong_order, sizeof (wrong_order));
+  CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  copy_file (path, bad, -1);
+  patch_file (bad, offsetof (avl_mapped_header, size), &wrong_size, sizeof (wrong_size));
+  CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  copy_file (path, bad, -1);
+  patch_file (bad, offsetof (avl_mapped_header, nodes), &wrong_nodes, sizeof (wrong_nodes));
+  CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  /* a length that does not match the nodes */
+  copy_file (path, bad, -1);
+  f = fopen (bad, "rb");
+  CHECK (f != NULL);
+  CHECK (fread (&header, sizeof (header), 1, f) == 1);
+  fclose (f);
+  wrong_length = header.length + 1;
+  patch_file (bad, offsetof (avl_mapped_header, length), &wrong_length, sizeof (wrong_length));
+  CHECK (avl_load_mmap (bad, compare_mapped, NULL) == NULL);
+  /* and the untouched copy still loads */
+  copy_file (path, bad, -1);
+  mapped = avl_load_mmap (bad, compare_mapped, NULL);
+  CHECK (mapped != NULL);
+  avl_free_mapped_tree (mapped);
+}
+
+int
+main (int argc, char ** argv)
+{
+  char path[] = "/tmp/test_mapped.XXXXXX";
+  char bad[sizeof (path) + 4];
+  unsigned int round;
+  int fd;
+
+  fd = mkstemp (path);
+  CHECK (fd >= 0);
+  close (fd);
+  memcpy (bad, path, sizeof (path) - 1);
+  memcpy (bad + sizeof (path) - 1, ".bad", 5);
+  srand (15);
+  for (round = 0; round < 60; round++) {
+    avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+    avl_mapped_tree * mapped;
+    avl_tree * upgraded;
+    unsigned int n = (round == 0) ? 0 : rand () % 2000, i, index;
+    long range = 1 + rand () % 1000;
+
+    CHECK (tree != NULL);
+    for (i = 0; i < n; i++) {
+      CHECK (avl_insert_by_key (tree, (void *) (long) (rand () % range), &index) == 0);
+    }
+    CHECK (avl_save (tree, path, encode_long) == 0);
+    mapped = avl_load_mmap (path, compare_mapped, NULL);
+    CHECK (mapped != NULL);
+    check_mapped (mapped, tree, range);
+    upgraded = avl_mapped_upgrade (mapped, decode_long, free_nothing, compare_longs, NULL);
+    check_upgrade (upgraded, tree, 1);
+    avl_free_avl_tree (upgraded, free_nothing);
+    upgraded = avl_mapped_upgrade (mapped, NULL, NULL, compare_mapped, NULL);
+    check_upgrade (upgraded, tree, 0);
+    avl_free_avl_tree (upgraded, free_nothing);
+    if (round % 10 == 0) {
+      check_rejected (path, bad, file_size (path));
+    }
+    avl_free_mapped_tree (mapped);
+    avl_free_avl_tree (tree, free_nothing);
+  }
+  remove (path);
+  remove (bad);
+  printf ("test_mapped: %u rounds ok\n", round);
+  return 0;
+}
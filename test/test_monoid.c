@@ -0,0 +1,247 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Aggregates against a sorted array.  The monoid keeps a count, a sum
+ * and a polynomial hash of the keys in order, which does not commute,
+ * so a fold that takes its pieces out of order shows up.  Every insert,
+ * remove, range removal, split and join is followed by avl_verify(),
+ * which recomputes each node's aggregate, and by folds of random index
+ * and key ranges.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "avl.h"
+#include "avl_test.h"
+
+#define HASH_BASE       1000003
+
+typedef struct {
+  uint64_t      count;
+  uint64_t      sum;
+  uint64_t      hash;
+  uint64_t      power;          /* HASH_BASE ** count */
+} summary;
+
+static
+void
+summary_identity (void * monoid_arg, void * aggregate)
+{
+  summary * s = (summary *) aggregate;
+
+  s->count = 0;
+  s->sum = 0;
+  s->hash = 0;
+  s->power = 1;
+}
+
+static
+void
+summary_append_key (void * monoid_arg, void * aggregate, void * key)
+{
+  summary * s = (summary *) aggregate;
+
+  s->count = s->count + 1;
+  s->sum = s->sum + (uint64_t) (long) key;
+  s->hash = s->hash * HASH_BASE + (uint64_t) (long) key;
+  s->power = s->power * HASH_BASE;
+}
+
+static
+void
+summary_append (void * monoid_arg, void * aggregate, const void * other)
+{
+  summary * s = (summary *) aggregate;
+  const summary * o = (const summary *) other;
+
+  s->count = s->count + o->count;
+  s->sum = s->sum + o->sum;
+  s->hash = s->hash * o->power + o->hash;
+  s->power = s->power * o->power;
+}
+
+static avl_monoid summary_monoid = {
+  sizeof (summary),
+  summary_identity,
+  summary_append_key,
+  summary_append,
+  NULL
+};
+
+/* position of the first key not before (or if <upper>, after) <key> */
+static
+unsigned int
+bound (long * keys, unsigned int n, long key, int upper)
+{
+  unsigned int i = 0;
+
+  while (i < n && (upper ? keys[i] <= key : keys[i] < key)) {
+    i++;
+  }
+  return i;
+}
+
+static
+void
+check_summary (summary * s, long * keys, unsigned int low, unsigned int high)
+{
+  summary expect;
+
+  summary_identity (NULL, &expect);
+  while (low < high) {
+    summary_append_key (NULL, &expect, (void *) keys[low++]);
+  }
+  CHECK (memcmp (s, &expect, sizeof (expect)) == 0);
+}
+
+/* the tree holds the <n> sorted <keys>; fold some ranges of it */
+static
+void
+check_folds (avl_tree * tree, long * keys, unsigned int n, long range)
+{
+  unsigned int i, low, high;
+  summary s;
+  long a, b;
+
+  check_keys (tree, keys, n);
+  CHECK (avl_fold_index_range (tree, 0, n, &s) == 0);
+  check_summary (&s, keys, 0, n);
+  for (i = 0; i < 8; i++) {
+    low = rand () % (n + 2);
+    high = rand () % (n + 2);
+    CHECK (avl_fold_index_range (tree, low, high, &s) == 0);
+    if (high > n) {
+      high = n;
+    }
+    check_summary (&s, keys, low < high ? low : high, high);
+    a = rand () % (range + 2) - 1;
+    b = a + rand () % (range / 2 + 2) - 1;
+    CHECK (avl_fold_key_range (tree, (void *) a, (void *) b, &s) == 0);
+    low = bound (keys, n, a, 0);
+    high = bound (keys, n, b, 1);
+    check_summary (&s, keys, low, low < high ? high : low);
+  }
+}
+
+static
+avl_tree *
+new_summary_tree (avl_node_arena * arena, int arena_first)
+{
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+
+  CHECK (tree != NULL);
+  if (arena_first) {
+    CHECK (avl_tree_use_arena (tree, arena) == 0);
+    CHECK (avl_tree_use_monoid (tree, &summary_monoid) == 0);
+  } else {
+    CHECK (avl_tree_use_monoid (tree, &summary_monoid) == 0);
+    CHECK (avl_tree_use_arena (tree, arena) == 0);
+  }
+  return tree;
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, splits = 0, range_removes = 0;
+  avl_tree * plain = avl_new_avl_tree (compare_longs, NULL);
+  avl_node_arena * arena = avl_new_node_arena (0, NULL, NULL, NULL);
+  unsigned int index;
+  summary s;
+
+  /* no aggregates without a monoid, and none for a tree already filled */
+  CHECK (plain != NULL && arena != NULL);
+  CHECK (avl_tree_use_arena (plain, arena) == 0);
+  CHECK (avl_insert_by_key (plain, (void *) 1L, &index) == 0);
+  CHECK (avl_fold_index_range (plain, 0, 1, &s) == -1);
+  CHECK (avl_tree_use_monoid (plain, &summary_monoid) == -1);
+  avl_free_avl_tree (plain, free_nothing);
+  /* nor for one whose arena already hands out smaller nodes */
+  plain = avl_new_avl_tree (compare_longs, NULL);
+  CHECK (avl_tree_use_arena (plain, arena) == 0);
+  CHECK (avl_tree_use_monoid (plain, &summary_monoid) == -1);
+  avl_free_avl_tree (plain, free_nothing);
+  avl_release_node_arena (arena);
+
+  srand (17);
+  for (round = 0; round < 100; round++) {
+    avl_tree * tree, * right;
+    unsigned int ops = rand () % 600, n = 0, i, at, low, high;
+    long * keys = (long *) malloc ((2 * ops + 1) * sizeof (long));
+    long range = 1 + rand () % 1000;
+
+    /* half the rounds malloc their nodes */
+    if (round % 2) {
+      arena = avl_new_node_arena (rand () % 64, NULL, NULL, NULL);
+      CHECK (arena != NULL);
+      tree = new_summary_tree (arena, rand () % 2);
+      right = new_summary_tree (arena, rand () % 2);
+      avl_release_node_arena (arena);
+    } else {
+      tree = avl_new_avl_tree (compare_longs, NULL);
+      right = avl_new_avl_tree (compare_longs, NULL);
+      CHECK (tree != NULL && right != NULL);
+      CHECK (avl_tree_use_monoid (tree, &summary_monoid) == 0);
+      CHECK (avl_tree_use_monoid (right, &summary_monoid) == 0);
+    }
+    for (i = 0; i < ops; i++) {
+      long k = rand () % range;
+      unsigned int choice = rand () % 20;
+      if (choice < 10) {
+        at = bound (keys, n, k, 0);
+        CHECK (avl_insert_by_key (tree, (void *) k, &index) == 0);
+        memmove (keys + at + 1, keys + at, (n - at) * sizeof (long));
+        keys[at] = k;
+        n = n + 1;
+      } else if (choice < 15) {
+        at = bound (keys, n, k, 0);
+        if (at < n && keys[at] == k) {
+          CHECK (avl_remove_by_key (tree, (void *) k, free_nothing) == 0);
+          memmove (keys + at, keys + at + 1, (n - at - 1) * sizeof (long));
+          n = n - 1;
+        } else {
+          CHECK (avl_remove_by_key (tree, (void *) k, free_nothing) == -1);
+        }
+      } else if (choice < 17) {
+        /* cut a range out, by index or by key */
+        if (choice == 15) {
+          low = rand () % (n + 1);
+          high = low + rand () % (n - low + 1);
+          CHECK (avl_remove_index_range (tree, low, high, NULL) == 0);
+        } else {
+          long b = k + rand () % (range / 8 + 1);
+          low = bound (keys, n, k, 0);
+          high = bound (keys, n, b, 1);
+          CHECK (avl_remove_key_range (tree, (void *) k, (void *) b, NULL) == 0);
+        }
+        memmove (keys + low, keys + high, (n - high) * sizeof (long));
+        n = n - (high - low);
+        range_removes++;
+      } else {
+        /* split, check both halves, and join them again */
+        if (choice == 17) {
+          at = rand () % (n + 1);
+          CHECK (avl_split_by_index (tree, at, right) == 0);
+        } else {
+          at = bound (keys, n, k, 0);
+          CHECK (avl_split_by_key (tree, (void *) k, right) == 0);
+        }
+        check_folds (tree, keys, at, range);
+        check_folds (right, keys + at, n - at, range);
+        CHECK (avl_join (tree, right) == 0);
+        CHECK (right->length == 0);
+        splits++;
+      }
+      check_folds (tree, keys, n, range);
+    }
+    avl_free_avl_tree (tree, free_nothing);
+    avl_free_avl_tree (right, free_nothing);
+    free (keys);
+  }
+  printf ("test_monoid: %u rounds ok, %u splits, %u range removals\n",
+          round, splits, range_removes);
+  return 0;
+}
@@ -0,0 +1,97 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * The multiset against an array of counts: after every insert and
+ * remove, each count, each weighted index and each span must agree,
+ * and the nodes' totals must pass avl_verify().  Keys are boxed, to
+ * check that each kept key is released exactly once and the others
+ * are left to the caller.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_multiset.h"
+#include "avl_test.h"
+
+static
+void
+check_multiset (avl_multiset * multiset, unsigned int * counts, long range)
+{
+  unsigned int index = 0, low, high, i;
+  void * key;
+  long k;
+
+  CHECK (avl_verify (multiset->tree) == 0);
+  for (k = -1; k <= range; k++) {
+    unsigned int count = (k >= 0 && k < range) ? counts[k] : 0;
+    long probe = k;
+    CHECK (avl_multiset_count (multiset, &probe) == count);
+    CHECK (avl_multiset_get_span_by_key (multiset, &probe, &low, &high) == 0);
+    CHECK (low == index && high == index + count);
+    for (i = 0; i < count; i++) {
+      CHECK (avl_multiset_get_item_by_index (multiset, index + i, &key) == 0);
+      CHECK (*(long *) key == k);
+    }
+    index = index + count;
+  }
+  CHECK (multiset->length == index);
+  CHECK (avl_multiset_get_item_by_index (multiset, index, &key) == -1);
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, refused = 0;
+
+  srand (22);
+  for (round = 0; round < 100; round++) {
+    avl_multiset * multiset = avl_new_multiset (compare_boxes, NULL);
+    long range = 1 + rand () % 200;
+    unsigned int * counts = (unsigned int *) calloc (range, sizeof (unsigned int));
+    unsigned int ops = rand () % 1500, distinct = 0, i;
+
+    CHECK (multiset != NULL && counts != NULL);
+    for (i = 0; i < ops; i++) {
+      long k = rand () % range;
+      unsigned int count = rand () % 6;
+      if (rand () % 3) {
+        long * box = new_box (k);
+        int result = avl_multiset_insert (multiset, box, count);
+        if (!count) {
+          /* no copies would leave a node counting nothing */
+          CHECK (result == -1);
+          refused++;
+        } else {
+          CHECK (result == (counts[k] ? 1 : 0));
+          distinct = distinct + !counts[k];
+          counts[k] = counts[k] + count;
+        }
+        if (result != 0) {
+          free_box (box);
+        }
+      } else {
+        long probe = k;
+        int result = avl_multiset_remove (multiset, &probe, count, free_box);
+        if (!counts[k]) {
+          CHECK (result == -1);
+        } else {
+          CHECK (result == 0);
+          counts[k] = (count < counts[k]) ? counts[k] - count : 0;
+          distinct = distinct - !counts[k];
+        }
+      }
+      CHECK (multiset->tree->length == distinct);
+      CHECK (boxes_live == distinct);
+      if ((i % 16 == 0) || (i + 1 == ops)) {
+        check_multiset (multiset, counts, range);
+      }
+    }
+    avl_free_multiset (multiset, free_box);
+    CHECK (boxes_live == 0);
+    free (counts);
+  }
+  printf ("test_multiset: %u rounds ok, %u empty inserts refused\n", round, refused);
+  return 0;
+}
@@ -0,0 +1,280 @@
+#! /usr/bin/env python
+# -*- coding: utf-8 -*-
+"""tests for the O(log n) structural operations.
+"""
+from __future__ import (
+    division, print_function, absolute_import, unicode_literals)
+
+# Standard libraries.
+import random
+
+# Third party libraries.
+import avl
+import pytest
+
+
+@pytest.fixture
+def numbers():
+    random.seed(4)
+    return [random.randint(0, 1000) for i in range(500)]
+
+
+def test_split(numbers):
+    t = avl.newavl(numbers[:])
+    right = t.split(500)
+    assert t.verify() and right.verify()
+    assert list(t) == sorted(x for x in numbers if x < 500)
+    assert list(right) == sorted(x for x in numbers if x >= 500)
+
+
+def test_split_at(numbers):
+    t = avl.newavl(numbers[:])
+    right = t.split_at(123)
+    assert t.verify() and right.verify()
+    assert list(t) == sorted(numbers)[:123]
+    assert list(right) == sorted(numbers)[123:]
+    with pytest.raises(IndexError):
+        t.split_at(124)
+
+
+def test_join(numbers):
+    t = avl.newavl(numbers[:])
+    right = t.split(700)
+    right.insert(2000)
+    t.join(right)
+    assert t.verify()
+    assert len(right) == 0
+    assert list(t) == sorted(numbers + [2000])
+    with pytest.raises(ValueError):
+        t.join(avl.newavl([5]))
+
+
+
+def test_join_separate_trees(numbers):
+    # trees built apart have arenas of their own; joining moves nodes
+    t = avl.newavl([x for x in numbers if x < 500])
+    right = avl.newavl([x for x in numbers if x >= 500])
+    t.join(right)
+    assert t.verify() and right.verify()
+    assert len(right) == 0
+    assert list(t) == sorted(numbers)
+    right.insert(5000)
+    t.join(right)
+    assert list(t) == sorted(numbers + [5000])
+    assert list(avl.newavl([1, 2]) + avl.newavl([3])) == [1, 2, 3]
+
+
+def reverse(a, b):
+    return (a < b) - (a > b)
+
+
+def test_join_other_order():
+    # only the boundary keys are compared, so the orders must match
+    t = avl.newavl([1, 2, 3, 5])
+    u = avl.newavl(None, reverse)
+    for x in (9, 8, 7):
+        u.insert(x)
+    with pytest.raises(ValueError):
+        t.join(u)
+    assert list(t) == [1, 2, 3, 5] and list(u) == [9, 8, 7]
+    result = t + u
+    assert result.verify()
+    assert list(result) == [1, 2, 3, 5, 7, 8, 9]
+    result = u + t
+    assert result.verify() and result.compare_function is reverse
+    assert list(result) == [9, 8, 7, 5, 3, 2, 1]
+
+
+@pytest.fixture
+def two_sets():
+    random.seed(5)
+    a = set(random.randint(0, 300) for i in range(200))
+    b = set(random.randint(0, 300) for i in range(100))
+    return a, b
+
+
+def test_union(two_sets):
+    a, b = two_sets
+    ta, tb = avl.newavl(list(a)), avl.newavl(list(b))
+    result = ta.union(tb)
+    assert result.verify()
+    assert list(result) == sorted(a | b)
+    assert list(ta) == sorted(a) and list(tb) == sorted(b)
+
+
+def test_intersection(two_sets):
+    a, b = two_sets
+    result = avl.newavl(list(a)).intersection(avl.newavl(list(b)))
+    assert result.verify()
+    assert list(result) == sorted(a & b)
+
+
+def test_difference(two_sets):
+    a, b = two_sets
+    result = avl.newavl(list(a)).difference(avl.newavl(list(b)))
+    assert result.verify()
+    assert list(result) == sorted(a - b)
+
+
+@pytest.mark.parametrize("method, expect", [
+    ("update", lambda a, b: a | b),
+    ("intersection_update", lambda a, b: a & b),
+    ("difference_update", lambda a, b: a - b),
+])
+def test_in_place(two_sets, method, expect):
+    a, b = two_sets
+    # once with trees built apart, once with trees split from one tree
+    ta, tb = avl.newavl(list(a)), avl.newavl(list(b))
+    tc = avl.newavl(list(a) + [x + 1000 for x in b])
+    td = tc.split(1000)
+    for x in list(td):
+        td.remove(x)
+        td.insert(x - 1000)
+    for t, other in ((ta, tb), (tc, td)):
+        assert getattr(t, method)(other) is None
+        assert t.verify() and other.verify()
+        assert list(t) == sorted(expect(a, b))
+        assert len(other) == 0
+
+
+def test_treeset_iterables(two_sets):
+    import treeset
+    a, b = two_sets
+    assert list(treeset.union(avl.newavl(list(a)), b)) == sorted(a | b)
+    assert list(treeset.intersection(list(a), b)) == sorted(a & b)
+    assert list(treeset.difference(a, iter(b))) == sorted(a - b)
+
+
+def reversed_tree(items):
+    t = avl.newavl(None, reverse)
+    for x in items:
+        t.insert(x)
+    return t
+
+
+@pytest.mark.parametrize("method, in_place, expect", [
+    ("union", "update", lambda a, b: a | b),
+    ("intersection", "intersection_update", lambda a, b: a & b),
+    ("difference", "difference_update", lambda a, b: a - b),
+])
+def test_other_order(method, in_place, expect):
+    # <other>'s items are taken in the order of the tree they join
+    a, b = {1, 2, 3, 5}, {4, 3, 2}
+    result = getattr(avl.newavl(list(a)), method)(reversed_tree(b))
+    assert result.verify() and list(result) == sorted(expect(a, b))
+    result = getattr(reversed_tree(a), method)(avl.newavl(list(b)))
+    assert result.verify() and result.compare_function is reverse
+    assert list(result) == sorted(expect(a, b), reverse=True)
+    t, other = avl.newavl(list(a)), reversed_tree(b)
+    getattr(t, in_place)(other)
+    assert t.verify() and list(t) == sorted(expect(a, b))
+    assert len(other) == 0
+
+
+def test_treeset_other_order():
+    import treeset
+    a = reversed_tree([5, 3, 1])
+    result = treeset.union(a, [2, 4, 6])
+    assert result.verify() and list(result) == [6, 5, 4, 3, 2, 1]
+    assert list(treeset.intersection(a, [3, 4, 5])) == [5, 3]
+    assert list(treeset.difference(a, avl.newavl([3]))) == [5, 1]
+    assert list(treeset.union([2], a)) == [1, 2, 3, 5]
+
+
+def test_insert_remove_at(numbers):
+    t = avl.newavl()
+    model = []
+    for i, x in enumerate(numbers):
+        position = (x * 7) % (len(model) + 1)
+        t.insert_at(position, x)
+        model.insert(position, x)
+        if i % 3 == 2:
+            assert t.remove_at(x % len(model)) == model.pop(x % len(model))
+    assert t.verify()
+    assert list(t) == model
+    assert t.remove_at(-1) == model.pop()
+    with pytest.raises(IndexError):
+        t.remove_at(len(model))
+
+
+def test_del_slice(numbers):
+    t = avl.newavl(numbers[:])
+    model = sorted(numbers)
+    del t[100:250]
+    del model[100:250]
+    assert t.verify()
+    assert list(t) == model
+    del t[-10:]
+    del model[-10:]
+    del t[5]
+    del model[5]
+    del t[50:20]
+    assert t.verify()
+    assert list(t) == model
+
+
+def test_remove_range(numbers):
+    t = avl.newavl(numbers[:])
+    t.remove_range(200, 600)
+    assert t.verify()
+    assert list(t) == sorted(x for x in numbers if not 200 <= x <= 600)
+    t.remove_range(900, 100)
+    assert len(t) == len([x for x in numbers if not 200 <= x <= 600])
+
+
+def test_count(numbers):
+    t = avl.newavl(numbers * 3)
+    model = sorted(numbers * 3)
+    for key in (model[0], model[-1], 500, -1, 1001) + tuple(numbers[:20]):
+        assert t.count(key) == model.count(key)
+        assert t.span(key) == (
+            len([x for x in model if x < key]),
+            len([x for x in model if x <= key]))
+    assert t.count_range(100, 300) == len(
+        [x for x in model if 100 <= x <= 300])
+    assert t.count_range(300, 100) == 0
+    assert t.span(300, 100) == t.span(100, 300)
+
+
+def test_insert_unique(numbers):
+    t = avl.newavl()
+    inserted = [t.insert_unique(x) for x in numbers]
+    assert t.verify()
+    assert list(t) == sorted(set(numbers))
+    assert inserted.count(True) == len(set(numbers))
+    t.remove(numbers[0])
+    with pytest.raises(Exception):
+        t.remove(numbers[0])
+    assert t.verify()
+
+
+@pytest.mark.parametrize("key_type, keys", [
+    (int, [random.randint(-2 ** 70, 2 ** 70) for i in range(200)] +
+     list(range(-100, 100))),
+    (float, [random.uniform(-1e6, 1e6) for i in range(300)] +
+     [0.0, -0.0, float("inf"), float("-inf")]),
+    (str, ["".join(random.choice("abcé中") for j in range(
+        random.randint(0, 6))) for i in range(300)]),
+    (bytes, [bytes(bytearray(random.randint(0, 255) for j in range(
+        random.randint(0, 6)))) for i in range(300)]),
+])
+def test_key_types(key_type, keys):
+    expected = sorted(keys)
+    for mode in (None, key_type, object):
+        t = avl.newavl(None, None, mode)
+        for key in keys:
+            t.insert(key)
+        assert t.verify()
+        assert list(t) == expected
+        assert all(t.count(key) == expected.count(key) for key in keys[:20])
+    d = avl.SortedDict(zip(keys, range(len(keys))), None, key_type)
+    assert list(d) == sorted(set(keys))
+
+
+def test_mixed_keys():
+    # int and float keys still order together, through rich comparison
+    keys = [3, 1.5, 2, 0.25, 10 ** 30, -7]
+    t = avl.newavl(keys[:])
+    assert list(t) == sorted(keys)
+    with pytest.raises(ValueError):
+        avl.newavl(None, None, list)
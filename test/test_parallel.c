@@ -0,0 +1,131 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * The parallel set operations and merge must leave exactly what the
+ * sequential ones do, and drop (free) the same number of keys.  A
+ * small cutoff makes the pool split and steal even on small trees.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_parallel.h"
+#include "avl_test.h"
+
+static unsigned long keys_freed;
+
+static
+int
+count_free (void * key)
+{
+  keys_freed = keys_freed + 1;
+  return 0;
+}
+
+static
+avl_tree *
+random_tree (avl_node_arena * arena, unsigned int size, long range)
+{
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+  unsigned int index, i;
+
+  CHECK (tree != NULL);
+  CHECK (avl_tree_use_arena (tree, arena) == 0);
+  for (i = 0; i < size; i++) {
+    CHECK (avl_insert_by_key (tree, (void *) (rand () % range), &index) == 0);
+  }
+  return tree;
+}
+
+static
+avl_tree *
+copy_tree (avl_node_arena * arena, avl_tree * source)
+{
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+  long * keys = (long *) malloc ((source->length + 1) * sizeof (long));
+  long * end = keys;
+
+  CHECK (tree != NULL && keys != NULL);
+  CHECK (avl_tree_use_arena (tree, arena) == 0);
+  avl_iterate_inorder (source, append_key, &end);
+  CHECK (avl_build_by_keys (tree, (void **) keys, source->length) == 0);
+  free (keys);
+  return tree;
+}
+
+enum { UNION, INTERSECTION, DIFFERENCE, MERGE };
+
+static
+void
+sequential (int operation, avl_tree * a, avl_tree * b)
+{
+  switch (operation) {
+  case UNION:           CHECK (avl_union (a, b, count_free) == 0); break;
+  case INTERSECTION:    CHECK (avl_intersection (a, b, count_free) == 0); break;
+  case DIFFERENCE:      CHECK (avl_difference (a, b, count_free) == 0); break;
+  case MERGE:           CHECK (avl_merge (a, b) == 0); break;
+  }
+}
+
+static
+void
+parallel (avl_pool * pool, int operation, avl_tree * a, avl_tree * b)
+{
+  switch (operation) {
+  case UNION:           CHECK (avl_parallel_union (pool, a, b, count_free) == 0); break;
+  case INTERSECTION:    CHECK (avl_parallel_intersection (pool, a, b, count_free) == 0); break;
+  case DIFFERENCE:      CHECK (avl_parallel_difference (pool, a, b, count_free) == 0); break;
+  case MERGE:           CHECK (avl_parallel_merge (pool, a, b) == 0); break;
+  }
+}
+
+int
+main (int argc, char ** argv)
+{
+  static const unsigned int sizes[][2] = {
+    {0, 0}, {0, 300}, {300, 0}, {1, 5000}, {5000, 1}, {3000, 3000}, {20000, 700}, {700, 20000}
+  };
+  static const unsigned int threads[] = {1, 2, 4};
+  avl_node_arena * arena = avl_new_node_arena (0, NULL, NULL, NULL);
+  unsigned int s, p, operation, rounds = 0;
+
+  CHECK (arena != NULL);
+  srand (1);
+  for (p = 0; p < sizeof (threads) / sizeof (threads[0]); p++) {
+    avl_pool * pool = avl_new_pool (threads[p], 16);
+    CHECK (pool != NULL);
+    for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+      for (operation = UNION; operation <= MERGE; operation++) {
+        long range = 2 * (sizes[s][0] + sizes[s][1]) + 1;
+        avl_tree * a = random_tree (arena, sizes[s][0], range);
+        avl_tree * b = random_tree (arena, sizes[s][1], range);
+        avl_tree * expect_a = copy_tree (arena, a);
+        avl_tree * expect_b = copy_tree (arena, b);
+        long * keys = (long *) malloc ((a->length + b->length + 1) * sizeof (long));
+        long * end = keys;
+        unsigned long expect_freed;
+
+        keys_freed = 0;
+        sequential (operation, expect_a, expect_b);
+        expect_freed = keys_freed;
+        keys_freed = 0;
+        parallel (pool, operation, a, b);
+        CHECK (keys_freed == expect_freed);
+        CHECK (b->length == 0);
+        avl_iterate_inorder (expect_a, append_key, &end);
+        check_keys (a, keys, expect_a->length);
+        free (keys);
+        avl_free_avl_tree (a, free_nothing);
+        avl_free_avl_tree (b, free_nothing);
+        avl_free_avl_tree (expect_a, free_nothing);
+        avl_free_avl_tree (expect_b, free_nothing);
+        rounds = rounds + 1;
+      }
+    }
+    avl_free_pool (pool);
+  }
+  avl_release_node_arena (arena);
+  printf ("test_parallel: %u rounds ok\n", rounds);
+  return 0;
+}
@@ -0,0 +1,135 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * Persistent trees: take snapshots while mutating the current version,
+ * check that every older version still holds what it did when taken,
+ * then release them in random order.  Keys are malloc'd boxes, copied
+ * and freed through the tree's key functions; every box must be freed
+ * in the end (run under ASan to catch the leaks and double frees).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+#include "avl_persistent.h"
+#include "avl_test.h"
+
+#define VERSIONS 8
+
+static
+int
+append_box (void * key, void * iter_arg)
+{
+  return append_key ((void *) *(long *) key, iter_arg);
+}
+
+typedef struct {
+  avl_ptree *   tree;
+  long *        keys;
+  unsigned int  length;
+} version;
+
+static
+void
+check_version (version * v)
+{
+  long * found = (long *) malloc ((v->length + 1) * sizeof (long));
+  long * end = found;
+  unsigned int i;
+  void * key;
+
+  CHECK (avl_ptree_verify (v->tree) == 0);
+  CHECK (v->tree->length == v->length);
+  avl_ptree_iterate_inorder (v->tree, append_box, &end);
+  CHECK (end == found + v->length);
+  for (i = 0; i < v->length; i++) {
+    CHECK (found[i] == v->keys[i]);
+    CHECK (avl_ptree_get_item_by_index (v->tree, i, &key) == 0);
+    CHECK (*(long *) key == v->keys[i]);
+  }
+  free (found);
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, snapshots = 0;
+
+  srand (11);
+  for (round = 0; round < 100; round++) {
+    version versions[VERSIONS + 1];       /* room for <current> at the end */
+    unsigned int count = 0, ops = rand () % 3000, capacity = ops + 1, i, j;
+    long range = 1 + rand () % 500;
+    version current;
+
+    current.tree = avl_new_ptree (compare_boxes, NULL, copy_box, free_box);
+    CHECK (current.tree != NULL);
+    current.keys = (long *) malloc (capacity * sizeof (long));
+    current.length = 0;
+    for (i = 0; i < ops; i++) {
+      long k = rand () % range;
+      unsigned int at = 0, index;
+      void * key;
+      while (at < current.length && current.keys[at] < k) {
+        at++;
+      }
+      if (current.length && rand () % 3 == 0) {
+        long probe = k;
+        int present = (at < current.length && current.keys[at] == k);
+        CHECK (avl_ptree_remove_by_key (current.tree, &probe) == (present ? 0 : -1));
+        if (present) {
+          memmove (current.keys + at, current.keys + at + 1,
+                   (current.length - at - 1) * sizeof (long));
+          current.length = current.length - 1;
+        }
+      } else {
+        CHECK (avl_ptree_insert_by_key (current.tree, new_box (k), &index) == 0);
+        CHECK (avl_ptree_get_item_by_index (current.tree, index, &key) == 0);
+        CHECK (*(long *) key == k);
+        memmove (current.keys + at + 1, current.keys + at,
+                 (current.length - at) * sizeof (long));
+        current.keys[at] = k;
+        current.length = current.length + 1;
+      }
+      if (rand () % 200 == 0) {
+        /* take a snapshot, dropping a random older one if we have too many */
+        if (count == VERSIONS) {
+          j = rand () % count;
+          check_version (&versions[j]);
+          avl_free_ptree (versions[j].tree);
+          free (versions[j].keys);
+          versions[j] = versions[--count];
+        }
+        versions[count].tree = avl_ptree_snapshot (current.tree);
+        CHECK (versions[count].tree != NULL);
+        versions[count].keys = (long *) malloc (capacity * sizeof (long));
+        memcpy (versions[count].keys, current.keys, current.length * sizeof (long));
+        versions[count].length = current.length;
+        count = count + 1;
+        snapshots = snapshots + 1;
+      }
+      if (rand () % 500 == 0) {
+        for (j = 0; j < count; j++) {
+          check_version (&versions[j]);
+        }
+      }
+    }
+    check_version (&current);
+    /* release the versions in random order, checking the survivors */
+    versions[count++] = current;
+    while (count) {
+      j = rand () % count;
+      avl_free_ptree (versions[j].tree);
+      free (versions[j].keys);
+      versions[j] = versions[--count];
+      for (i = 0; i < count; i++) {
+        check_version (&versions[i]);
+      }
+    }
+    CHECK (boxes_live == 0);
+  }
+  printf ("test_persistent: %u rounds, %u snapshots ok\n", round, snapshots);
+  return 0;
+}
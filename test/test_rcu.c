@@ -0,0 +1,147 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * One writer and several readers on an RCU tree.  The readers check
+ * that each version they see is whole and in order, and read every key
+ * in it, so that a version reclaimed too early shows up under ASan.
+ * Once the readers are gone, every retired version must be reclaimed,
+ * and freeing the tree must release every key.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_rcu.h"
+#include "avl_test.h"
+
+#define READERS 4
+#define WRITES  20000
+#define RANGE   500
+
+static int stop;
+
+typedef struct {
+  long          last;
+  unsigned int  count;
+} walk;
+
+static
+int
+walk_key (void * key, void * iter_arg)
+{
+  walk * w = (walk *) iter_arg;
+  long k = *(long *) key;
+
+  CHECK (k >= 0 && k < RANGE);
+  CHECK (w->count == 0 || k > w->last);
+  w->last = k;
+  w->count = w->count + 1;
+  return 0;
+}
+
+static
+void *
+reader (void * arg)
+{
+  avl_rcu_tree * tree = (avl_rcu_tree *) arg;
+  unsigned long sections = 0;
+
+  while (!__atomic_load_n (&stop, __ATOMIC_ACQUIRE)) {
+    walk w = {0, 0};
+    void * first = NULL;
+
+    /*
+     * Each call reads whichever version is published when it starts,
+     * but a key it hands back stays valid to the end of the section.
+     */
+    CHECK (avl_rcu_read_lock (tree) == 0);
+    if (avl_rcu_length (tree)) {
+      avl_rcu_get_item_by_index (tree, 0, &first);
+    }
+    CHECK (avl_rcu_iterate_inorder (tree, walk_key, &w) == 0);
+    CHECK (w.count <= RANGE);
+    CHECK (!first || (*(long *) first >= 0 && *(long *) first < RANGE));
+    avl_rcu_read_unlock (tree);
+    sections = sections + 1;
+  }
+  return (void *) sections;
+}
+
+static
+unsigned int
+count_retired (avl_rcu_tree * tree)
+{
+  avl_rcu_retired * r;
+  unsigned int count = 0;
+
+  for (r = tree->retired; r; r = r->next) {
+    count = count + 1;
+  }
+  return count;
+}
+
+int
+main (int argc, char ** argv)
+{
+  avl_rcu_tree * tree = avl_new_rcu_tree (compare_boxes, NULL, copy_box, free_box);
+  pthread_t threads[READERS];
+  char present[RANGE] = {0};
+  unsigned int i, index, length = 0, most_retired = 0;
+  unsigned long sections = 0;
+  void * key;
+
+  CHECK (tree != NULL);
+
+  /* unlocks without a lock, before and after this thread has a slot */
+  avl_rcu_read_unlock (tree);
+  CHECK (avl_rcu_read_lock (tree) == 0);
+  avl_rcu_read_unlock (tree);
+  avl_rcu_read_unlock (tree);
+  CHECK (avl_rcu_read_lock (tree) == 0);
+  CHECK (tree->readers->epoch != 0);
+  avl_rcu_read_unlock (tree);
+  CHECK (tree->readers->epoch == 0);
+
+  srand (12);
+  for (i = 0; i < READERS; i++) {
+    CHECK (pthread_create (&threads[i], NULL, reader, tree) == 0);
+  }
+  for (i = 0; i < WRITES; i++) {
+    long k = rand () % RANGE;
+    if (present[k]) {
+      long probe = k;
+      CHECK (avl_rcu_remove_by_key (tree, &probe) == 0);
+      length = length - 1;
+    } else {
+      CHECK (avl_rcu_insert_by_key (tree, new_box (k), &index) == 0);
+      length = length + 1;
+    }
+    present[k] = !present[k];
+    if (count_retired (tree) > most_retired) {
+      most_retired = count_retired (tree);
+    }
+  }
+  __atomic_store_n (&stop, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < READERS; i++) {
+    void * result;
+    CHECK (pthread_join (threads[i], &result) == 0);
+    sections = sections + (unsigned long) result;
+  }
+
+  /* reclamation kept up with the writer, and finishes with no readers */
+  CHECK (most_retired < WRITES / 2);
+  avl_rcu_reclaim (tree);
+  CHECK (tree->retired == NULL);
+  CHECK (avl_rcu_length (tree) == length);
+  for (i = 0; i < RANGE; i++) {
+    long probe = i;
+    CHECK ((avl_rcu_get_item_by_key (tree, &probe, &key) == 0) == present[i]);
+  }
+  avl_free_rcu_tree (tree);
+  CHECK (boxes_live == 0);
+  printf ("test_rcu: %u writes, %lu read sections ok, at most %u versions retired\n",
+          WRITES, sections, most_retired);
+  return 0;
+}
@@ -0,0 +1,198 @@
+/* -*- Mode: C; indent-tabs-mode: nil -*- */
+
+/*
+ * The sharded tree against a plain one, with a split threshold small
+ * enough that shards split and merge all the time: every global index
+ * and every span must agree, whatever the shards look like.  Then the
+ * same with writers in several threads, each in a key range of its own,
+ * and a shard that may only split past a run of equal keys.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_sharded.h"
+#include "avl_test.h"
+
+#define WRITERS         4
+#define WRITER_KEYS     2000
+#define WRITER_STRIDE   7919            /* prime, so it visits every key */
+
+static
+void
+check_sharded (avl_sharded_tree * sharded, avl_tree * tree, long range)
+{
+  unsigned int i, low, high, expect_low, expect_high;
+  void * found, * expect;
+  long a, b;
+
+  CHECK (avl_sharded_verify (sharded) == 0);
+  CHECK (avl_sharded_length (sharded) == tree->length);
+  for (i = 0; i < tree->length; i++) {
+    CHECK (avl_sharded_get_item_by_index (sharded, i, &found) == 0);
+    CHECK (avl_get_item_by_index (tree, i, &expect) == 0);
+    CHECK (found == expect);
+  }
+  CHECK (avl_sharded_get_item_by_index (sharded, tree->length, &found) == -1);
+  for (a = -1; a <= range; a++) {
+    CHECK ((avl_sharded_get_item_by_key (sharded, (void *) a, &found) == 0)
+           == (avl_get_item_by_key (tree, (void *) a, &expect) == 0));
+    CHECK (avl_sharded_get_span_by_key (sharded, (void *) a, &low, &high) == 0);
+    avl_get_span_by_key (tree, (void *) a, &expect_low, &expect_high);
+    CHECK (low == expect_low && high == expect_high);
+    b = a + rand () % 40 - 10;
+    CHECK (avl_sharded_get_span_by_two_keys (sharded, (void *) a, (void *) b, &low, &high) == 0);
+    avl_get_span_by_two_keys (tree, (void *) a, (void *) b, &expect_low, &expect_high);
+    CHECK (low == expect_low && high == expect_high);
+  }
+}
+
+/* the <j>th key writer <w> inserts; it removes each with j % 3 == 1 after the next */
+
+static
+long
+writer_key (long w, long j)
+{
+  return w * WRITER_KEYS + (j * WRITER_STRIDE) % WRITER_KEYS;
+}
+
+typedef struct {
+  avl_sharded_tree *    sharded;
+  long                  w;
+} writer_arg;
+
+static
+void *
+writer (void * arg)
+{
+  writer_arg * a = (writer_arg *) arg;
+  unsigned int index;
+  long j;
+
+  for (j = 0; j < WRITER_KEYS; j++) {
+    CHECK (avl_sharded_insert_by_key (a->sharded, (void *) writer_key (a->w, j), &index) == 0);
+    if (j % 3 == 2) {
+      CHECK (avl_sharded_remove_by_key (a->sharded, (void *) writer_key (a->w, j - 1)) == 0);
+    }
+  }
+  return NULL;
+}
+
+static
+void
+check_writers (void)
+{
+  avl_sharded_tree * sharded =
+    avl_new_sharded_tree (compare_longs, NULL, NULL, NULL, 64);
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+  pthread_t threads[WRITERS];
+  writer_arg args[WRITERS];
+  unsigned int i, index;
+  long w, j;
+
+  CHECK (sharded != NULL && tree != NULL);
+  for (i = 0; i < WRITERS; i++) {
+    args[i].sharded = sharded;
+    args[i].w = i;
+    CHECK (pthread_create (&threads[i], NULL, writer, &args[i]) == 0);
+  }
+  for (i = 0; i < WRITERS; i++) {
+    CHECK (pthread_join (threads[i], NULL) == 0);
+  }
+  for (w = 0; w < WRITERS; w++) {
+    for (j = 0; j < WRITER_KEYS; j++) {
+      /* the last has no next */
+      if ((j % 3 != 1) || (j + 1 == WRITER_KEYS)) {
+        CHECK (avl_insert_by_key (tree, (void *) writer_key (w, j), &index) == 0);
+      }
+    }
+  }
+  CHECK (sharded->shard_count > WRITERS);
+  check_sharded (sharded, tree, WRITERS * WRITER_KEYS);
+  avl_free_sharded_tree (sharded);
+  avl_free_avl_tree (tree, free_nothing);
+}
+
+/* a run of equal keys filling the lower half must not stop a split */
+
+static
+void
+check_equal_run (void)
+{
+  avl_sharded_tree * sharded =
+    avl_new_sharded_tree (compare_longs, NULL, NULL, NULL, 8);
+  avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+  unsigned int i, index;
+
+  CHECK (sharded != NULL && tree != NULL);
+  for (i = 0; i < 20; i++) {
+    CHECK (avl_sharded_insert_by_key (sharded, (void *) 5L, &index) == 0);
+    CHECK (avl_insert_by_key (tree, (void *) 5L, &index) == 0);
+  }
+  /* one key throughout: nothing to split at */
+  CHECK (sharded->shard_count == 1);
+  CHECK (avl_sharded_insert_by_key (sharded, (void *) 6L, &index) == 0);
+  CHECK (avl_insert_by_key (tree, (void *) 6L, &index) == 0);
+  CHECK (sharded->shard_count == 2);
+  check_sharded (sharded, tree, 10);
+  avl_free_sharded_tree (sharded);
+  avl_free_avl_tree (tree, free_nothing);
+}
+
+int
+main (int argc, char ** argv)
+{
+  unsigned int round, splits = 0, merges = 0;
+
+  srand (13);
+  for (round = 0; round < 60; round++) {
+    avl_sharded_tree * sharded =
+      avl_new_sharded_tree (compare_longs, NULL, NULL, NULL, 4 + rand () % 32);
+    avl_tree * tree = avl_new_avl_tree (compare_longs, NULL);
+    unsigned int ops = rand () % 4000, i, index, expect_index, shards;
+    long range = 1 + rand () % 600;
+
+    CHECK (sharded != NULL && tree != NULL);
+    shards = sharded->shard_count;
+    for (i = 0; i < ops; i++) {
+      long k = rand () % range;
+      void * found;
+      /* grow for the first half, then mostly shrink, to force merges */
+      if (tree->length && (rand () % 4 < ((i < ops / 2) ? 1 : 3))) {
+        int present = (avl_get_item_by_key (tree, (void *) k, &found) == 0);
+        CHECK ((avl_sharded_remove_by_key (sharded, (void *) k) == 0) == present);
+        if (present) {
+          avl_remove_by_key (tree, (void *) k, free_nothing);
+        }
+      } else {
+        CHECK (avl_sharded_insert_by_key (sharded, (void *) k, &index) == 0);
+        avl_insert_by_key (tree, (void *) k, &expect_index);
+        /* among equal keys the two may differ; the key there may not */
+        CHECK (avl_sharded_get_item_by_index (sharded, index, &found) == 0);
+        CHECK ((long) found == k);
+      }
+      if (sharded->shard_count > shards) {
+        splits = splits + 1;
+      } else if (sharded->shard_count < shards) {
+        merges = merges + 1;
+      }
+      if (sharded->shard_count != shards) {
+        shards = sharded->shard_count;
+        if (rand () % 8 == 0) {
+          check_sharded (sharded, tree, range);
+        }
+      }
+    }
+    check_sharded (sharded, tree, range);
+    avl_free_sharded_tree (sharded);
+    avl_free_avl_tree (tree, free_nothing);
+  }
+  CHECK (splits > 0 && merges > 0);
+  check_equal_run ();
+  check_writers ();
+  printf ("test_sharded: %u rounds ok, %u splits, %u merges, %u writers ok\n",
+          round, splits, merges, WRITERS);
+  return 0;
+}
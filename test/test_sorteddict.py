@@ -0,0 +1,74 @@
+#! /usr/bin/env python
+# -*- coding: utf-8 -*-
+"""tests for the key/value map mode.
+"""
+from __future__ import (
+    division, print_function, absolute_import, unicode_literals)
+
+# Standard libraries.
+import random
+
+# Third party libraries.
+import avl
+import pytest
+
+
+@pytest.fixture
+def pairs():
+    random.seed(6)
+    return [(random.randint(0, 1000), random.random()) for i in range(500)]
+
+
+def test_sorteddict(pairs):
+    d = avl.SortedDict()
+    model = {}
+    for k, v in pairs:
+        d[k] = v
+        model[k] = v
+    assert d.verify()
+    assert len(d) == len(model)
+    assert list(d) == sorted(model)
+    assert list(d.values()) == [model[k] for k in sorted(model)]
+    assert list(d.items()) == sorted(model.items())
+    assert d.key_at(0) == min(model) and d.value_at(-1) == model[max(model)]
+    for k in list(model)[::2]:
+        del d[k]
+        del model[k]
+    assert d.verify()
+    assert list(d.items()) == sorted(model.items())
+    assert all(d[k] == v for k, v in model.items())
+    assert 1001 not in d and d.get(1001, 7) == 7
+    with pytest.raises(KeyError):
+        d[1001]
+    with pytest.raises(KeyError):
+        del d[1001]
+
+
+def test_sorteddict_refcounts():
+    value = object()
+    d = avl.SortedDict({1: value, 2: value}, None)
+    d[1] = "replaced"
+    del d[2]
+    assert d[1] == "replaced"
+    del d
+    import sys
+    assert sys.getrefcount(value) == 2
+
+
+def test_sorteddict_changed_during_iteration():
+    d = avl.SortedDict(dict.fromkeys(range(10)))
+    with pytest.raises(RuntimeError):
+        for k in d:
+            del d[k]
+
+
+def test_sorteddict_overwrite_refcounts():
+    import sys
+    key = (1 << 70)
+    d = avl.SortedDict()
+    d[key] = 1
+    before = sys.getrefcount(key)
+    d[key] = 2
+    d[1 << 70] = 3
+    assert sys.getrefcount(key) == before
+    assert len(d) == 1 and d[key] == 3
@@ -33,6 +33,21 @@ def fill_up(tree, nums):
     t.end()
 
 
+def count_compares(nums):
+    "insert <nums> through a counting compare function"
+    count = [0]
+
+    def compare(a, b):
+        count[0] += 1
+        return (a > b) - (a < b)
+
+    tree = avl.newavl(None, compare)
+    for num in nums:
+        tree.insert(num)
+    print("%.2f compares per insert" % (count[0] / len(nums)))
+    return count[0] / len(nums)
+
+
 def random_indices_tree(length):
     t = avl.newavl()
     # build a 'list' of indices
@@ -98,6 +113,15 @@ def do_test(n):
     empty(tree)
 
 
+def test_insert_compares():
+    # one compare per level on the way down, and none after: with this
+    # seed that is 12.16 per insert, where comparing again during the
+    # fix-up took 15.9
+    random.seed(2)
+    n = 10000
+    assert count_compares(generate_test_numbers(n)) < 13
+
+
 # def test_workout():
 #     # print(sys.argv)
 #     # if len(sys.argv) > 1:
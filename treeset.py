@@ -5,31 +5,36 @@ from __future__ import (absolute_import, division, print_function,
 import avl
 
 
-# set operations on avl trees.
-def intersection(a, b):
-    ta = avl.newavl(a)
-    result = avl.newavl()
-    for x in b:
-        if x in ta:
-            result.insert(x)
-            ta.remove(x)
+def _tree(a, like=None):
+    """<a> itself if it is a tree ordered as <like> is, else a new tree
+    of its items ordered that way"""
+    compare = None if like is None else like.compare_function
+    if isinstance(a, avl.tree) and (
+            like is None or a.compare_function is compare):
+        return a
+    if compare is None:
+        return avl.newavl(list(a))
+    # list() sorts by the default order, so insert one by one
+    result = avl.newavl(None, compare)
+    for x in a:
+        result.insert(x)
     return result
 
 
+# set operations on avl trees, or on any iterables.
+def intersection(a, b):
+    a = _tree(a)
+    return a.intersection(_tree(b, a))
+
+
 def union(a, b):
-    result = avl.newavl(a)
-    for key in b:
-        if key not in a:
-            result.insert(key)
-    return result
+    a = _tree(a)
+    return a.union(_tree(b, a))
 
 
 def difference(a, b):
-    result = avl.newavl(a)
-    for key in b:
-        if key in a:
-            result.remove(key)
-    return result
+    a = _tree(a)
+    return a.difference(_tree(b, a))
 
 
 # an abstract set implementation based on avl trees
@@ -47,9 +52,7 @@ class avl_set:
             self.items = avl.newavl(set)
 
     def add(self, item):
-        if item not in self.items:
-            self.items.insert(item)
-        else:
+        if not self.items.insert_unique(item):
             raise ValueError("item already present in set")
 
     def remove(self, item):